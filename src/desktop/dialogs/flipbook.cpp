@@ -18,6 +18,7 @@ extern "C" {
 #include <QPixmap>
 #include <QRect>
 #include <QScreen>
+#include <QSet>
 #include <QSignalBlocker>
 #include <QTimer>
 
@@ -32,6 +33,9 @@ struct Flipbook::Private {
 	drawdance::ViewModeBuffer vmb;
 	utils::AnimationRenderer *animationRenderer;
 	QHash<int, QPixmap> frames;
+	drawdance::CanvasState renderedCanvasState;
+	QRect renderedCrop;
+	QSize renderedMaxSize;
 	QTimer timer;
 	QRect crop;
 	unsigned int batchId = 0;
@@ -314,12 +318,32 @@ int Flipbook::getTimerInterval() const
 
 void Flipbook::renderFrames()
 {
-	d->frames.clear();
+	// Keep the frames that still look the same as in the canvas state they
+	// were rendered from, so that a stroke on one key frame only re-renders
+	// the frames that show it. Frames still missing from an earlier batch that
+	// got cancelled will get rendered again.
+	QSize maxSize = compat::widgetScreen(*this)->availableSize() * 0.9;
+	QSet<int> unchangedFrames;
+	if(d->renderedCrop == d->crop && d->renderedMaxSize == maxSize) {
+		unchangedFrames = utils::AnimationRenderer::findUnchangedFrames(
+			d->renderedCanvasState, d->canvasState, d->frames.keys());
+	}
+
+	for(QHash<int, QPixmap>::iterator it = d->frames.begin();
+		it != d->frames.end();) {
+		if(unchangedFrames.contains(it.key())) {
+			++it;
+		} else {
+			it = d->frames.erase(it);
+		}
+	}
+
+	d->renderedCanvasState = d->canvasState;
+	d->renderedCrop = d->crop;
+	d->renderedMaxSize = maxSize;
 	d->batchId = d->animationRenderer->render(
-		d->canvasState, d->crop,
-		compat::widgetScreen(*this)->availableSize() * 0.9,
-		d->ui.loopStart->value() - 1, d->ui.loopEnd->value(),
-		d->ui.layerIndex->value() - 1);
+		d->canvasState, d->crop, maxSize, d->ui.loopStart->value() - 1,
+		d->ui.loopEnd->value(), d->ui.layerIndex->value() - 1, unchangedFrames);
 }
 
 void Flipbook::insertRenderedFrames(
@@ -76,6 +76,11 @@ void Input::initTablet(
 	settings.bindInterpolateInputs(interpolate);
 	form->addRow(nullptr, interpolate);
 
+	auto *brushThread =
+		new QCheckBox(tr("Generate brush strokes on a separate thread"));
+	settings.bindBrushThread(brushThread);
+	form->addRow(nullptr, brushThread);
+
 	auto *smoothing = new KisSliderSpinBox;
 	smoothing->setMaximum(libclient::settings::maxSmoothing);
 	smoothing->setPrefix(tr("Smoothing: "));
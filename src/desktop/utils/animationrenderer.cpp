@@ -5,10 +5,12 @@ extern "C" {
 }
 #include "desktop/utils/animationrenderer.h"
 #include "libclient/drawdance/canvasstate.h"
+#include "libclient/drawdance/viewmode.h"
 #include "libshared/util/qtcompat.h"
 #include <QImage>
 #include <QPixmap>
 #include <QRect>
+#include <algorithm>
 
 namespace utils {
 
@@ -58,12 +60,21 @@ AnimationRenderer::~AnimationRenderer()
 unsigned int AnimationRenderer::render(
 	const drawdance::CanvasState &canvasState, const QRect &crop,
 	const QSize &maxSize, int rangeStart, int rangeEndExclusive,
-	int currentRangeIndex)
+	int currentRangeIndex, const QSet<int> &skipFrames)
 {
 	unsigned int batchId = ++m_batchId;
 	QVector<int> indexes = buildFrameOrder(
 		canvasState.frameCount(), rangeStart, rangeEndExclusive,
 		currentRangeIndex);
+	if(!skipFrames.isEmpty()) {
+		indexes.erase(
+			std::remove_if(
+				indexes.begin(), indexes.end(),
+				[&skipFrames](int i) {
+					return skipFrames.contains(i);
+				}),
+			indexes.end());
+	}
 	QVector<int> frameIndexBuffer;
 	while(!indexes.isEmpty()) {
 		gatherFrame(canvasState, indexes, frameIndexBuffer);
@@ -90,6 +101,34 @@ unsigned int AnimationRenderer::render(
 	return batchId;
 }
 
+QSet<int> AnimationRenderer::findUnchangedFrames(
+	const drawdance::CanvasState &prevCanvasState,
+	const drawdance::CanvasState &canvasState, const QList<int> &frameIndexes)
+{
+	QSet<int> unchangedFrames;
+	if(!prevCanvasState.isNull() && !canvasState.isNull()) {
+		DP_CanvasState *prevCs = prevCanvasState.get();
+		DP_CanvasState *cs = canvasState.get();
+		int frameCount = canvasState.frameCount();
+		drawdance::ViewModeBuffer prevVmb;
+		drawdance::ViewModeBuffer vmb;
+		for(int frameIndex : frameIndexes) {
+			if(frameIndex < frameCount) {
+				DP_ViewModeFilter prevVmf =
+					DP_view_mode_filter_make_frame_render(
+						prevVmb.get(), prevCs, frameIndex);
+				DP_ViewModeFilter vmf = DP_view_mode_filter_make_frame_render(
+					vmb.get(), cs, frameIndex);
+				if(DP_view_mode_filter_frame_render_equal(
+					   &prevVmf, prevCs, &vmf, cs)) {
+					unchangedFrames.insert(frameIndex);
+				}
+			}
+		}
+	}
+	return unchangedFrames;
+}
+
 void AnimationRenderer::detachDelete()
 {
 	setParent(nullptr);
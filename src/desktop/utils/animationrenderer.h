@@ -5,7 +5,9 @@ extern "C" {
 #include <dpengine/view_mode.h>
 }
 #include <QAtomicInteger>
+#include <QList>
 #include <QObject>
+#include <QSet>
 #include <QVector>
 
 class QRect;
@@ -29,10 +31,20 @@ public:
 	AnimationRenderer &operator=(const AnimationRenderer &) = delete;
 	AnimationRenderer &operator=(AnimationRenderer &&) = delete;
 
+	// Frames in skipFrames aren't rendered, for when the caller still has
+	// them from a previous render that findUnchangedFrames deemed current.
 	unsigned int render(
 		const drawdance::CanvasState &canvasState, const QRect &crop,
 		const QSize &maxSize, int rangeStart, int rangeEndExclusive,
-		int currentRangeIndex);
+		int currentRangeIndex, const QSet<int> &skipFrames = QSet<int>());
+
+	// Returns which of the given frames render to the same image in both canvas
+	// states, because they show the very same layers. Comparing is cheap, since
+	// it's just looking at which layers the frames consist of.
+	static QSet<int> findUnchangedFrames(
+		const drawdance::CanvasState &prevCanvasState,
+		const drawdance::CanvasState &canvasState,
+		const QList<int> &frameIndexes);
 
 	// Asynchronous destruction without waiting for running jobs. Orphans this,
 	// cancels current batch and enqueues a job that calls deleteLater.
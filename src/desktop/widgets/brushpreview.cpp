@@ -12,6 +12,9 @@ namespace widgets {
 
 BrushPreview::BrushPreview(QWidget *parent, Qt::WindowFlags f)
 	: QFrame(parent,f)
+#ifndef DESIGNER_PLUGIN
+	, m_brushPreview(&BrushPreview::onPreviewRendered, this)
+#endif
 {
 	setAttribute(Qt::WA_NoSystemBackground);
 	setMinimumSize(32,32);
@@ -104,11 +107,16 @@ void BrushPreview::paintEvent(QPaintEvent *event)
 	painter.drawTiledPixmap(rect, m_background);
 #else
 	QRect rect = event->rect();
-	painter.drawPixmap(
-		rect, m_brushPreview.pixmap(),
-		QRect(
-			rect.x() * dpr, rect.y() * dpr, rect.width() * dpr,
-			rect.height() * dpr));
+	if(m_previewPixmap.isNull()) {
+		// Nothing rendered yet, the first preview is still in the works.
+		painter.drawTiledPixmap(rect, m_background);
+	} else {
+		painter.drawPixmap(
+			rect, m_previewPixmap,
+			QRect(
+				rect.x() * dpr, rect.y() * dpr, rect.width() * dpr,
+				rect.height() * dpr));
+	}
 #endif
 	if(!isEnabled()) {
 		QColor color = palette().color(QPalette::Window);
@@ -132,15 +140,44 @@ void BrushPreview::updateBackground()
 void BrushPreview::updatePreview(qreal dpr)
 {
 #ifndef DESIGNER_PLUGIN
+	// Rendering happens in the background, the old preview stays visible
+	// until the new one arrives in showPreview.
 	const QSize size = contentsRect().size() * dpr;
-	m_brushPreview.reset(size);
-	m_brush.renderPreview(m_brushPreview, m_shape);
-	m_brushPreview.paint(m_background);
+	m_previewRequestId = m_brush.requestPreview(m_brushPreview, size, m_shape);
 #endif
 	m_needUpdate = false;
 	m_lastDpr = dpr;
 }
 
+#ifndef DESIGNER_PLUGIN
+void BrushPreview::onPreviewRendered(
+	void *user, unsigned int requestId, const QImage &img)
+{
+	BrushPreview *bp = static_cast<BrushPreview *>(user);
+	QMetaObject::invokeMethod(
+		bp,
+		[bp, requestId, img]() {
+			bp->showPreview(requestId, img);
+		},
+		Qt::QueuedConnection);
+}
+
+void BrushPreview::showPreview(unsigned int requestId, const QImage &img)
+{
+	// Another request may have been made since this one was delivered.
+	if(requestId == m_previewRequestId) {
+		m_previewPixmap = QPixmap::fromImage(img);
+		if(!m_previewPixmap.isNull()) {
+			QPainter painter{&m_previewPixmap};
+			painter.setCompositionMode(
+				QPainter::CompositionMode_DestinationOver);
+			painter.drawTiledPixmap(m_previewPixmap.rect(), m_background);
+		}
+		update();
+	}
+}
+#endif
+
 void BrushPreview::mouseDoubleClickEvent(QMouseEvent*)
 {
 	emit requestColorChange();
@@ -66,11 +66,20 @@ private:
 	void updatePreview(qreal dpr);
 	void updateBackground();
 
+#ifndef DESIGNER_PLUGIN
+	static void
+	onPreviewRendered(void *user, unsigned int requestId, const QImage &img);
+
+	void showPreview(unsigned int requestId, const QImage &img);
+#endif
+
 	QPixmap m_background;
 	brushes::ActiveBrush m_brush;
 
 #ifndef DESIGNER_PLUGIN
 	drawdance::BrushPreview m_brushPreview;
+	QPixmap m_previewPixmap;
+	unsigned int m_previewRequestId = 0;
 #endif
 
 	DP_BrushPreviewShape m_shape = DP_BRUSH_PREVIEW_STROKE;
@@ -366,27 +366,16 @@ jo_gifx_t *jo_gifx_start(jo_gifx_write_fn write_fn, void *user, uint16_t width,
     return gif;
 }
 
-bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
-                   uint32_t *rgba, uint16_t delayCsec)
+void jo_gifx_frame_index(const jo_gifx_t *gif, const uint32_t *rgba,
+                         uint16_t width, uint16_t height,
+                         unsigned char *indexedPixels,
+                         unsigned char *ditheredPixels)
 {
-    uint16_t width = gif->width;
-    uint16_t height = gif->height;
     size_t size = (size_t)width * (size_t)height;
 
-    unsigned char *palette = gif->palette;
-    unsigned char *indexedPixels, *prevIndexedPixels;
-    if (gif->frame % 2 == 0) {
-        indexedPixels = gif->pixels;
-        prevIndexedPixels = gif->pixels + size;
-    }
-    else {
-        indexedPixels = gif->pixels + size;
-        prevIndexedPixels = gif->pixels;
-    }
-
+    const unsigned char *palette = gif->palette;
     int usableColors = gif->numColors - 1; // Last color is transparency.
     {
-        unsigned char *ditheredPixels = gif->pixels + size * 2;
         for (size_t i = 0; i < size; ++i) {
             uint32_t color = rgba[i];
             ditheredPixels[i * 4 + 0] = (color >> 16) & 0xff;
@@ -447,33 +436,131 @@ bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
             }
         }
     }
+}
+
+static unsigned char *jo_gifx_current_pixels(jo_gifx_t *gif, size_t size)
+{
+    return gif->frame % 2 == 0 ? gif->pixels : gif->pixels + size;
+}
+
+static bool jo_gifx_row_changed(const unsigned char *a, const unsigned char *b,
+                                uint16_t width, int y)
+{
+    size_t offset = (size_t)y * (size_t)width;
+    return memcmp(a + offset, b + offset, width) != 0;
+}
+
+// Finds the rectangle of pixels that changed since the previous frame, right
+// and bottom are exclusive. Returns false if nothing changed at all.
+static bool jo_gifx_changed_bounds(const unsigned char *indexedPixels,
+                                   const unsigned char *prevIndexedPixels,
+                                   uint16_t width, uint16_t height,
+                                   int *outLeft, int *outTop, int *outRight,
+                                   int *outBottom)
+{
+    int top = 0;
+    while (top < height
+           && !jo_gifx_row_changed(indexedPixels, prevIndexedPixels, width,
+                                   top)) {
+        ++top;
+    }
+    if (top == height) {
+        return false;
+    }
+
+    int bottom = height;
+    while (!jo_gifx_row_changed(indexedPixels, prevIndexedPixels, width,
+                                bottom - 1)) {
+        --bottom;
+    }
+
+    int left = width;
+    int right = 0;
+    for (int y = top; y < bottom; ++y) {
+        const unsigned char *row = indexedPixels + (size_t)y * (size_t)width;
+        const unsigned char *prevRow =
+            prevIndexedPixels + (size_t)y * (size_t)width;
+        for (int x = 0; x < left; ++x) {
+            if (row[x] != prevRow[x]) {
+                left = x;
+                break;
+            }
+        }
+        for (int x = width - 1; x >= right; --x) {
+            if (row[x] != prevRow[x]) {
+                right = x + 1;
+                break;
+            }
+        }
+    }
 
+    *outLeft = left;
+    *outTop = top;
+    *outRight = right;
+    *outBottom = bottom;
+    return true;
+}
+
+static bool jo_gifx_write_frame(jo_gifx_write_fn write_fn, void *user,
+                                jo_gifx_t *gif, uint16_t delayCsec)
+{
+    uint16_t width = gif->width;
+    uint16_t height = gif->height;
+    size_t size = (size_t)width * (size_t)height;
+
+    unsigned char *indexedPixels, *prevIndexedPixels;
+    if (gif->frame % 2 == 0) {
+        indexedPixels = gif->pixels;
+        prevIndexedPixels = gif->pixels + size;
+    }
+    else {
+        indexedPixels = gif->pixels + size;
+        prevIndexedPixels = gif->pixels;
+    }
+
+    // Frames after the first only cover the area that changed, with pixels
+    // inside of it that stayed the same made transparent. The previous frame
+    // isn't disposed of, so everything else shows through from before. If
+    // nothing changed at all, a single transparent pixel carries the delay.
+    int usableColors = gif->numColors - 1; // Last color is transparency.
+    int left = 0, top = 0, right = width, bottom = height;
     unsigned char *outputPixels;
     if (gif->frame > 0) {
+        if (!jo_gifx_changed_bounds(indexedPixels, prevIndexedPixels, width,
+                                    height, &left, &top, &right, &bottom)) {
+            right = 1;
+            bottom = 1;
+        }
         outputPixels = gif->pixels + size * 2;
-        for (size_t i = 0; i < size; ++i) {
-            outputPixels[i] = indexedPixels[i] == prevIndexedPixels[i]
-                                ? usableColors
-                                : indexedPixels[i];
+        size_t o = 0;
+        for (int y = top; y < bottom; ++y) {
+            for (int x = left; x < right; ++x) {
+                size_t i = (size_t)y * (size_t)width + (size_t)x;
+                outputPixels[o++] = indexedPixels[i] == prevIndexedPixels[i]
+                                      ? usableColors
+                                      : indexedPixels[i];
+            }
         }
     }
     else {
         outputPixels = indexedPixels;
     }
 
+    int frameWidth = right - left;
+    int frameHeight = bottom - top;
     unsigned char imageHeader[] = {
-        // Graphic Control Extension
+        // Graphic Control Extension, don't dispose, with transparency
         0x21, 0xf9, 0x04, 0x05,
         // Delay in centiseconds, 16 bit little-endian
         delayCsec & 0xff, (delayCsec >> 8) & 0xff,
         // Transparent pixel index (last color in palette), end of block
         (unsigned char)usableColors, 0x00,
-        // Image Descriptor header, x, y (always top-left, so zero)
-        0x2c, 0x00, 0x00, 0x00, 0x00,
+        // Image Descriptor header, x and y in 16 bit little-endian
+        0x2c, left & 0xff, (left >> 8) & 0xff, top & 0xff, (top >> 8) & 0xff,
         // Width in 16 bit little-endian
-        width & 0xff, (width >> 8) & 0xff,
+        frameWidth & 0xff, (frameWidth >> 8) & 0xff,
         // Height in 16 bit little-endian
-        height & 0xff, (height >> 8) & 0xff,
+        frameHeight & 0xff, (frameHeight >> 8) & 0xff,
         // Local palette size (zero, because we don't use local palettes)
         0};
     if (!write_fn(user, imageHeader, sizeof(imageHeader))) {
@@ -482,12 +569,53 @@ bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
 
     // Start of image, compressed pixels, block terminator.
     bool ok = write_fn(user, (unsigned char[]){0x08}, 1)
-           && jo_gifx_lzw_encode(write_fn, user, gif, outputPixels, size)
+           && jo_gifx_lzw_encode(write_fn, user, gif, outputPixels,
+                                 frameWidth * frameHeight)
            && write_fn(user, (unsigned char[]){0x00}, 1);
     ++gif->frame;
     return ok;
 }
 
+bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
+                   uint32_t *rgba, uint16_t delayCsec)
+{
+    size_t size = (size_t)gif->width * (size_t)gif->height;
+    jo_gifx_frame_index(gif, rgba, gif->width, gif->height,
+                        jo_gifx_current_pixels(gif, size),
+                        gif->pixels + size * 2);
+    return jo_gifx_write_frame(write_fn, user, gif, delayCsec);
+}
+
+bool jo_gifx_frame_indexed(jo_gifx_write_fn write_fn, void *user,
+                           jo_gifx_t *gif, const unsigned char *indexedPixels,
+                           uint16_t delayCsec)
+{
+    size_t size = (size_t)gif->width * (size_t)gif->height;
+    memcpy(jo_gifx_current_pixels(gif, size), indexedPixels, size);
+    return jo_gifx_write_frame(write_fn, user, gif, delayCsec);
+}
+
+bool jo_gifx_frame_indexed_rect(jo_gifx_write_fn write_fn, void *user,
+                                jo_gifx_t *gif,
+                                const unsigned char *indexedPixels, uint16_t x,
+                                uint16_t y, uint16_t width, uint16_t height,
+                                uint16_t delayCsec)
+{
+    size_t size = (size_t)gif->width * (size_t)gif->height;
+    unsigned char *currentPixels = jo_gifx_current_pixels(gif, size);
+    if (gif->frame > 0) {
+        // Start from the previous frame, the rectangle goes on top of it.
+        unsigned char *prevPixels =
+            currentPixels == gif->pixels ? gif->pixels + size : gif->pixels;
+        memcpy(currentPixels, prevPixels, size);
+    }
+    for (uint16_t i = 0; i < height; ++i) {
+        memcpy(currentPixels + ((size_t)y + i) * gif->width + x,
+               indexedPixels + (size_t)i * width, width);
+    }
+    return jo_gifx_write_frame(write_fn, user, gif, delayCsec);
+}
+
 bool jo_gifx_end(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif)
 {
     free(gif);
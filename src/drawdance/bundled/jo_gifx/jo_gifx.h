@@ -53,6 +53,32 @@ jo_gifx_t *jo_gifx_start(jo_gifx_write_fn write_fn, void *user, uint16_t width,
 bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
                    uint32_t *rgba, uint16_t delayCsec);
 
+// The two halves of jo_gifx_frame, so that frames can be mapped to the palette
+// in parallel and then written in order. jo_gifx_frame_index doesn't modify the
+// handle, so it's safe to call it from multiple threads at once. The given
+// width and height may be smaller than the image's, to only map part of it. It
+// writes width * height palette indices to indexedPixels and needs a scratch
+// buffer of 4 * width * height bytes for dithering.
+void jo_gifx_frame_index(const jo_gifx_t *gif, const uint32_t *rgba,
+                         uint16_t width, uint16_t height,
+                         unsigned char *indexedPixels,
+                         unsigned char *ditheredPixels);
+
+// Appends a frame of palette indices as given by jo_gifx_frame_index. Frames
+// after the first only store the rectangle that changed since the frame before.
+bool jo_gifx_frame_indexed(jo_gifx_write_fn write_fn, void *user,
+                           jo_gifx_t *gif, const unsigned char *indexedPixels,
+                           uint16_t delayCsec);
+
+// Like jo_gifx_frame_indexed, but only the given rectangle of the image is
+// passed in, everything outside of it stays the same as in the previous frame.
+// The first frame must cover the entire image.
+bool jo_gifx_frame_indexed_rect(jo_gifx_write_fn write_fn, void *user,
+                                jo_gifx_t *gif,
+                                const unsigned char *indexedPixels, uint16_t x,
+                                uint16_t y, uint16_t width, uint16_t height,
+                                uint16_t delayCsec);
+
 // Frees the handle, writes trailer and returns if that worked. The handle
 // *always* gets freed, even if writing the trailer failed.
 bool jo_gifx_end(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif);
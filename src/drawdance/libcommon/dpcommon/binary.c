@@ -118,6 +118,19 @@ uint32_t DP_read_bigendian_uint32(const unsigned char *d)
         + (DP_uchar_to_uint(d[2]) << 8u) + DP_uchar_to_uint(d[3]));
 }
 
+uint64_t DP_read_bigendian_uint64(const unsigned char *d)
+{
+    DP_ASSERT(d);
+    return (DP_uchar_to_uint64(d[0]) << (uint64_t)56)
+         + (DP_uchar_to_uint64(d[1]) << (uint64_t)48)
+         + (DP_uchar_to_uint64(d[2]) << (uint64_t)40)
+         + (DP_uchar_to_uint64(d[3]) << (uint64_t)32)
+         + (DP_uchar_to_uint64(d[4]) << (uint64_t)24)
+         + (DP_uchar_to_uint64(d[5]) << (uint64_t)16)
+         + (DP_uchar_to_uint64(d[6]) << (uint64_t)8)
+         + (DP_uchar_to_uint64(d[7]) << (uint64_t)0);
+}
+
 
 size_t DP_write_littleendian_int8(int8_t x, unsigned char *out)
 {
@@ -37,6 +37,7 @@ int32_t DP_read_bigendian_int32(const unsigned char *d);
 uint8_t DP_read_bigendian_uint8(const unsigned char *d);
 uint16_t DP_read_bigendian_uint16(const unsigned char *d);
 uint32_t DP_read_bigendian_uint32(const unsigned char *d);
+uint64_t DP_read_bigendian_uint64(const unsigned char *d);
 
 size_t DP_write_littleendian_int8(int8_t x, unsigned char *out);
 size_t DP_write_littleendian_int16(int16_t x, unsigned char *out);
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: MIT
+#include "mpsc_queue.h"
+#include "atomic.h"
+#include "common.h"
+#include "threading.h"
+
+// This is the intrusive queue by Dmitry Vyukov. Producers swap their node into
+// the tail and then link the previous tail to it, so pushing is one exchange
+// and one store, no matter how many producers there are. The consumer follows
+// the links from the head. A stub node keeps the list from ever becoming
+// empty, so the consumer can hand out the last real node. It gets pushed back
+// in behind that node whenever the queue runs dry.
+//
+// Between the exchange and the link, the list is briefly cut off after the
+// previous tail. The consumer treats that as empty and the producer, having
+// linked its node, wakes it up if it went to sleep in the meantime.
+
+struct DP_MpscQueue {
+    DP_AtomicPtr tail;
+    DP_MpscQueueNode *head; // Only touched by the consumer.
+    DP_MpscQueueNode stub;
+    DP_Atomic consumer_waiting;
+    DP_Semaphore *sem;
+};
+
+
+DP_MpscQueue *DP_mpsc_queue_new(void)
+{
+    DP_Semaphore *sem = DP_semaphore_new(0);
+    if (!sem) {
+        return NULL;
+    }
+
+    DP_MpscQueue *mq = DP_malloc(sizeof(*mq));
+    DP_atomic_ptr_set(&mq->stub.next, NULL);
+    DP_atomic_ptr_set(&mq->tail, &mq->stub);
+    mq->head = &mq->stub;
+    DP_atomic_set(&mq->consumer_waiting, 0);
+    mq->sem = sem;
+    return mq;
+}
+
+void DP_mpsc_queue_free(DP_MpscQueue *mq)
+{
+    if (mq) {
+        DP_semaphore_free(mq->sem);
+        DP_free(mq);
+    }
+}
+
+
+static DP_MpscQueueNode *next_node(DP_MpscQueueNode *node)
+{
+    return DP_atomic_ptr_get(&node->next);
+}
+
+static void link_node(DP_MpscQueue *mq, DP_MpscQueueNode *node)
+{
+    DP_atomic_ptr_set(&node->next, NULL);
+    DP_MpscQueueNode *prev = DP_atomic_ptr_xch(&mq->tail, node);
+    DP_atomic_ptr_set(&prev->next, node);
+}
+
+void DP_mpsc_queue_push(DP_MpscQueue *mq, DP_MpscQueueNode *node)
+{
+    DP_ASSERT(mq);
+    DP_ASSERT(node);
+    link_node(mq, node);
+    // Only one producer gets to see the flag set, so a sleeping consumer gets
+    // posted once, not once for every producer that comes along.
+    if (DP_atomic_xch(&mq->consumer_waiting, 0)) {
+        DP_SEMAPHORE_MUST_POST(mq->sem);
+    }
+}
+
+
+DP_MpscQueueNode *DP_mpsc_queue_shift(DP_MpscQueue *mq)
+{
+    DP_ASSERT(mq);
+    DP_MpscQueueNode *head = mq->head;
+    DP_MpscQueueNode *next = next_node(head);
+
+    if (head == &mq->stub) {
+        if (!next) {
+            return NULL;
+        }
+        mq->head = next;
+        head = next;
+        next = next_node(next);
+    }
+
+    if (next) {
+        mq->head = next;
+        return head;
+    }
+
+    // The head is the last node we can see. If it's not the tail, a producer
+    // is in the middle of linking in the next one, so we'll have to wait.
+    if (DP_atomic_ptr_get(&mq->tail) != head) {
+        return NULL;
+    }
+
+    // Push the stub back in so that the head has something after it.
+    link_node(mq, &mq->stub);
+    next = next_node(head);
+    if (next) {
+        mq->head = next;
+        return head;
+    }
+    else {
+        return NULL;
+    }
+}
+
+static bool can_shift(DP_MpscQueue *mq)
+{
+    DP_MpscQueueNode *head = mq->head;
+    return next_node(head)
+        || (head != &mq->stub && DP_atomic_ptr_get(&mq->tail) == head);
+}
+
+void DP_mpsc_queue_wait(DP_MpscQueue *mq)
+{
+    DP_ASSERT(mq);
+    DP_atomic_set(&mq->consumer_waiting, 1);
+    // Something may have been pushed before the flag was set, in which case
+    // we don't want to go to sleep. But if a producer got to the flag first,
+    // it already posted to the semaphore, so we still have to take that post.
+    if (!can_shift(mq) || !DP_atomic_xch(&mq->consumer_waiting, 0)) {
+        DP_SEMAPHORE_MUST_WAIT(mq->sem);
+    }
+}
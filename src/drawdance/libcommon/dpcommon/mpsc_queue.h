@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: MIT
+#ifndef DPCOMMON_MPSC_QUEUE_H
+#define DPCOMMON_MPSC_QUEUE_H
+#include "atomic.h"
+
+
+// Unbounded, intrusive multi-producer, single-consumer queue. Producers never
+// block, they embed a node in whatever they want to send and push that. The
+// consumer gets the same nodes back in the order they were pushed in, so a
+// producer that packs a batch of things into a single node gets its batches
+// delivered whole and in order, without them interleaving with others.
+typedef struct DP_MpscQueueNode {
+    DP_AtomicPtr next;
+} DP_MpscQueueNode;
+
+typedef struct DP_MpscQueue DP_MpscQueue;
+
+
+// Returns NULL and sets an error if the wakeup semaphore can't be created.
+DP_MpscQueue *DP_mpsc_queue_new(void);
+
+// Must only be called when no other threads are using the queue anymore.
+// Nodes still in the queue are not touched, shift them out beforehand.
+void DP_mpsc_queue_free(DP_MpscQueue *mq);
+
+// Producer function, safe to call from any thread but the consumer's. The
+// queue owns the node until the consumer shifts it out again. Wakes up the
+// consumer if it's waiting, so it's one wakeup per node, not per element.
+void DP_mpsc_queue_push(DP_MpscQueue *mq, DP_MpscQueueNode *node);
+
+// Consumer functions, must only be called from a single thread.
+
+// Removes and returns the oldest node, or NULL if there's nothing to shift. A
+// node that's still in the middle of being pushed counts as nothing, the
+// producer will wake up the consumer when it's done.
+DP_MpscQueueNode *DP_mpsc_queue_shift(DP_MpscQueue *mq);
+
+// Sleeps until there's something to shift. May return early, so check with
+// DP_mpsc_queue_shift and wait again if that comes up empty.
+void DP_mpsc_queue_wait(DP_MpscQueue *mq);
+
+
+#endif
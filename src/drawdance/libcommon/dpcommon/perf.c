@@ -25,7 +25,8 @@
 #include "conversions.h"
 #include "output.h"
 #include "threading.h"
-#include "vector.h"
+#include <stdio.h>
+#include <string.h>
 
 // On Windows, we use QueryPerformanceCounter. On Darwin and old Android libc,
 // we use gettimeofday. On normal systems, we use the standard timespec_get.
@@ -33,134 +34,402 @@
 #    include <windows.h>
 #elif defined(__APPLE__) || (defined(__ANDROID__) && __ANDROID_API__ < 29)
 #    include <errno.h>
-#    include <string.h>
 #    include <sys/time.h>
 #else
 #    include "time.h"
 #endif
 
+#if defined(_MSC_VER)
+#    define THREAD_LOCAL __declspec(thread)
+#else
+#    define THREAD_LOCAL __thread
+#endif
+
 
-#define INITIAL_CAPACITY 64
-#define DETAIL_LENGTH    256
-#define NS_IN_S          1000000000
+#define DETAIL_LENGTH         256
+#define ESCAPED_DETAIL_LENGTH (DETAIL_LENGTH * 6)
+#define NS_IN_S               1000000000
+#define MAX_DEPTH             32
+#define RING_CAPACITY         2048 // Must be a power of two.
+#define RING_MASK             (RING_CAPACITY - 1)
+#define FLUSH_THRESHOLD       (RING_CAPACITY / 16)
 
-typedef struct DP_PerfEntry {
+typedef struct DP_PerfSpan {
+    int generation;
     unsigned long long start;
+    unsigned long long end;
     const char *realm;
     const char *categories;
     char detail[DETAIL_LENGTH];
-} DP_PerfEntry;
+} DP_PerfSpan;
+
+// Each thread that records spans gets one of these. The open spans are only
+// touched by the owning thread. Finished spans go into a single-producer,
+// single-consumer ring buffer: the owning thread writes at head, the flusher
+// thread reads at tail. If the ring is full, spans are dropped rather than
+// making the recording thread wait. The flusher may still be walking one after
+// its thread is gone, so these are never freed. Instead, a thread exiting
+// retires its buffer and the next thread to record a span reuses it once the
+// flusher has drained it, so there's only ever as many as there were threads
+// recording at the same time.
+typedef struct DP_PerfThread {
+    struct DP_PerfThread *next;
+    DP_Atomic retired;
+    DP_ThreadId thread_id;
+    int index;
+    bool named;
+    int depth;
+    DP_PerfSpan open[MAX_DEPTH];
+    DP_Atomic head;
+    DP_Atomic tail;
+    DP_Atomic dropped;
+    DP_PerfSpan ring[RING_CAPACITY];
+} DP_PerfThread;
 
 static DP_Mutex *perf_mutex;
-static DP_Vector perf_entries;
+static DP_Semaphore *perf_flush_sem;
+static DP_Thread *perf_flusher;
+static DP_Atomic perf_flusher_running;
+static DP_Atomic perf_generation;
+static DP_PerfThread *perf_threads;
+static int perf_thread_count;
+static DP_PerfFormat perf_format;
+static unsigned long long perf_start_time;
+static bool perf_first_event;
+static THREAD_LOCAL DP_PerfThread *perf_thread;
 
 DP_Output *DP_perf_output;
 
-static bool init_mutex(void)
+static bool init_perf(void)
 {
     DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(perf_lock);
     if (!perf_mutex) {
         DP_atomic_lock(&perf_lock);
         if (!perf_mutex) {
-            perf_mutex = DP_mutex_new();
+            perf_flush_sem = DP_semaphore_new(0);
+            if (perf_flush_sem) {
+                perf_mutex = DP_mutex_new();
+                if (!perf_mutex) {
+                    DP_semaphore_free(perf_flush_sem);
+                    perf_flush_sem = NULL;
+                }
+            }
         }
         DP_atomic_unlock(&perf_lock);
     }
     return perf_mutex;
 }
 
-static bool close_perf(DP_Output *output)
+static DP_PerfThread *threads_snapshot(void)
 {
-    bool ok = DP_output_free(output);
-    if (!ok) {
-        DP_error_set("Error closing perf output: %s", DP_error());
+    // Threads are only ever prepended and never removed, so the list can be
+    // walked without holding the lock after grabbing its head.
+    DP_MUTEX_MUST_LOCK(perf_mutex);
+    DP_PerfThread *pt = perf_threads;
+    DP_MUTEX_MUST_UNLOCK(perf_mutex);
+    return pt;
+}
+
+// Must be called with the perf mutex held.
+static DP_PerfThread *reuse_retired_perf_thread(void)
+{
+    for (DP_PerfThread *pt = perf_threads; pt; pt = pt->next) {
+        // Spans still in the ring would be attributed to the wrong thread.
+        if (DP_atomic_get(&pt->retired)
+            && DP_atomic_get(&pt->tail) == DP_atomic_get(&pt->head)) {
+            return pt;
+        }
     }
-    DP_vector_dispose(&perf_entries);
-    return ok;
+    return NULL;
+}
+
+static DP_PerfThread *get_perf_thread(void)
+{
+    DP_PerfThread *pt = perf_thread;
+    if (!pt) {
+        DP_MUTEX_MUST_LOCK(perf_mutex);
+        pt = reuse_retired_perf_thread();
+        if (!pt) {
+            pt = DP_malloc(sizeof(*pt));
+            DP_atomic_set(&pt->head, 0);
+            DP_atomic_set(&pt->tail, 0);
+            DP_atomic_set(&pt->dropped, 0);
+            pt->next = perf_threads;
+            perf_threads = pt;
+        }
+        pt->thread_id = DP_thread_current_id();
+        pt->index = ++perf_thread_count;
+        pt->named = false;
+        pt->depth = 0;
+        DP_atomic_set(&pt->retired, 0);
+        DP_MUTEX_MUST_UNLOCK(perf_mutex);
+        perf_thread = pt;
+    }
+    return pt;
+}
+
+void DP_perf_thread_exit(void)
+{
+    DP_PerfThread *pt = perf_thread;
+    if (pt) {
+        perf_thread = NULL;
+        DP_atomic_set(&pt->retired, 1);
+        // Have the flusher drain what's left, the buffer can't be reused until
+        // then. Without a flusher, the ring is emptied on the next open.
+        if (DP_perf_output) {
+            DP_SEMAPHORE_MUST_POST(perf_flush_sem);
+        }
+    }
+}
+
+
+static const char *escape_json(const char *in, char *buffer)
+{
+    char *out = buffer;
+    for (const char *c = in; *c != '\0'; ++c) {
+        switch (*c) {
+        case '"':
+            *out++ = '\\';
+            *out++ = '"';
+            break;
+        case '\\':
+            *out++ = '\\';
+            *out++ = '\\';
+            break;
+        default:
+            if ((unsigned char)*c < 0x20) {
+                unsigned int u = (unsigned char)*c;
+                out += sprintf(out, "\\u%04x", u);
+            }
+            else {
+                *out++ = *c;
+            }
+            break;
+        }
+    }
+    *out = '\0';
+    return buffer;
+}
+
+static bool write_text_span(DP_Output *output, DP_PerfThread *pt,
+                            DP_PerfSpan *span)
+{
+    unsigned long long diff = span->end - span->start;
+    double start_seconds = DP_ullong_to_double(span->start) / NS_IN_S;
+    double end_seconds = DP_ullong_to_double(span->end) / NS_IN_S;
+    const char *detail = span->detail;
+    return DP_output_format(
+        output, "%" DP_THREAD_ID_FMT " %f %f %llu %s:%s%s%s\n", pt->thread_id,
+        start_seconds, end_seconds, diff, span->realm, span->categories,
+        detail[0] == '\0' ? "" : " ", detail);
+}
+
+static bool write_chrome_trace_span(DP_Output *output, DP_PerfThread *pt,
+                                    DP_PerfSpan *span)
+{
+    const char *separator = perf_first_event ? "\n" : ",\n";
+    perf_first_event = false;
+
+    if (!pt->named) {
+        pt->named = true;
+        bool ok = DP_output_format(
+            output,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"Thread %" DP_THREAD_ID_FMT "\"}},\n",
+            separator, pt->index, pt->thread_id);
+        if (!ok) {
+            return false;
+        }
+        separator = "";
+    }
+
+    // Trace event timestamps are in microseconds.
+    double ts = DP_ullong_to_double(span->start - perf_start_time) / 1000.0;
+    double dur = DP_ullong_to_double(span->end - span->start) / 1000.0;
+    bool ok = DP_output_format(
+        output,
+        "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+        "\"ts\":%.3f,\"dur\":%.3f",
+        separator, span->categories, span->realm, pt->index, ts, dur);
+    if (ok && span->detail[0] != '\0') {
+        char buffer[ESCAPED_DETAIL_LENGTH];
+        ok = DP_output_format(output, ",\"args\":{\"detail\":\"%s\"}",
+                              escape_json(span->detail, buffer));
+    }
+    return ok && DP_output_print(output, "}");
+}
+
+static bool write_span(DP_Output *output, DP_PerfThread *pt, DP_PerfSpan *span)
+{
+    switch (perf_format) {
+    case DP_PERF_FORMAT_TEXT:
+        return write_text_span(output, pt, span);
+    case DP_PERF_FORMAT_CHROME_TRACE:
+        return write_chrome_trace_span(output, pt, span);
+    }
+    DP_UNREACHABLE();
+}
+
+static void flush_thread(DP_Output *output, DP_PerfThread *pt, int generation)
+{
+    int tail = DP_atomic_get(&pt->tail);
+    int head = DP_atomic_get(&pt->head);
+    while (tail != head) {
+        DP_PerfSpan *span = &pt->ring[tail];
+        // Spans from a previous recording may still trickle in if a thread
+        // was in the middle of ending one when the output got closed.
+        if (span->generation == generation && !write_span(output, pt, span)) {
+            DP_warn("Error formatting perf output: %s", DP_error());
+        }
+        // Free up the slot right away so the recording thread has room.
+        tail = (tail + 1) & RING_MASK;
+        DP_atomic_set(&pt->tail, tail);
+        if (tail == head) {
+            head = DP_atomic_get(&pt->head);
+        }
+    }
+}
+
+static void flush_threads(DP_Output *output)
+{
+    int generation = DP_atomic_get(&perf_generation);
+    for (DP_PerfThread *pt = threads_snapshot(); pt; pt = pt->next) {
+        flush_thread(output, pt, generation);
+    }
+}
+
+static void run_flusher(void *user)
+{
+    DP_Output *output = user;
+    while (true) {
+        DP_SEMAPHORE_MUST_WAIT(perf_flush_sem);
+        if (DP_atomic_get(&perf_flusher_running)) {
+            flush_threads(output);
+        }
+        else {
+            break;
+        }
+    }
+}
+
+
+static bool write_header(DP_Output *output)
+{
+    switch (perf_format) {
+    case DP_PERF_FORMAT_TEXT:
+        return DP_OUTPUT_PRINT_LITERAL(
+            output,
+            "# Drawdance performance recording v" DP_PERF_VERSION "\n"
+            "# <thread_id> <start_seconds>.<start_nanoseconds> "
+            "<end_seconds>.<end_nanoseconds> <diff_nanoseconds> <category> "
+            "<details...>\n");
+    case DP_PERF_FORMAT_CHROME_TRACE:
+        return DP_OUTPUT_PRINT_LITERAL(output, "{\"traceEvents\":[");
+    }
+    DP_UNREACHABLE();
 }
 
-bool DP_perf_open(DP_Output *output)
+static bool write_footer(DP_Output *output)
+{
+    switch (perf_format) {
+    case DP_PERF_FORMAT_TEXT:
+        return true;
+    case DP_PERF_FORMAT_CHROME_TRACE:
+        return DP_OUTPUT_PRINT_LITERAL(output,
+                                       "\n],\"displayTimeUnit\":\"ms\"}\n");
+    }
+    DP_UNREACHABLE();
+}
+
+bool DP_perf_open(DP_Output *output, DP_PerfFormat format)
 {
     if (!output) {
         DP_error_set("Given output is null");
         return false;
     }
 
-    if (!init_mutex()) {
+    if (!init_perf()) {
         DP_output_free(output);
         return false;
     }
 
-    DP_MUTEX_MUST_LOCK(perf_mutex);
-    DP_Output *prev_output = DP_perf_output;
-    if (prev_output && !close_perf(prev_output)) {
+    if (DP_perf_is_open() && !DP_perf_close()) {
         DP_warn("Reopen perf output: %s", DP_error());
     }
-    DP_perf_output = output;
-    DP_VECTOR_INIT_TYPE(&perf_entries, DP_PerfEntry, INITIAL_CAPACITY);
+
+    DP_MUTEX_MUST_LOCK(perf_mutex);
+    DP_atomic_inc(&perf_generation);
+    perf_format = format;
+    perf_start_time = DP_perf_time();
+    perf_first_event = true;
+    for (DP_PerfThread *pt = perf_threads; pt; pt = pt->next) {
+        pt->named = false;
+        DP_atomic_set(&pt->tail, DP_atomic_get(&pt->head));
+        DP_atomic_set(&pt->dropped, 0);
+    }
     DP_MUTEX_MUST_UNLOCK(perf_mutex);
 
-    return DP_OUTPUT_PRINT_LITERAL(
-        output, "# Drawdance performance recording v" DP_PERF_VERSION "\n"
-                "# <thread_id> <start_seconds>.<start_nanoseconds> "
-                "<end_seconds>.<end_nanoseconds> <diff_nanoseconds> <category> "
-                "<details...>\n");
+    bool ok = write_header(output);
+
+    DP_atomic_set(&perf_flusher_running, 1);
+    perf_flusher = DP_thread_new(run_flusher, output);
+    if (!perf_flusher) {
+        DP_output_free(output);
+        return false;
+    }
+
+    DP_perf_output = output;
+    return ok;
 }
 
 bool DP_perf_close(void)
 {
-    if (!init_mutex()) {
+    if (!init_perf()) {
         return false;
     }
 
-    DP_MUTEX_MUST_LOCK(perf_mutex);
-    bool ok;
     DP_Output *output = DP_perf_output;
-    if (output) {
-        ok = close_perf(output);
-        DP_perf_output = NULL;
-    }
-    else {
-        ok = false;
+    if (!output) {
         DP_error_set("Perf output is not open");
+        return false;
     }
-    DP_MUTEX_MUST_UNLOCK(perf_mutex);
-    return ok;
-}
 
+    // Stop new spans from being recorded, then let the flusher finish up.
+    DP_perf_output = NULL;
+    DP_atomic_set(&perf_flusher_running, 0);
+    DP_SEMAPHORE_MUST_POST(perf_flush_sem);
+    DP_thread_free_join(perf_flusher);
+    perf_flusher = NULL;
 
-bool DP_perf_is_open(void)
-{
-    return perf_mutex && DP_perf_output;
-}
+    flush_threads(output);
 
+    int dropped = 0;
+    for (DP_PerfThread *pt = threads_snapshot(); pt; pt = pt->next) {
+        dropped += DP_atomic_get(&pt->dropped);
+    }
+    if (dropped != 0) {
+        DP_warn("Dropped %d perf spans because buffers were full", dropped);
+    }
 
-static bool is_available_perf_entry(void *entry, DP_UNUSED void *user)
-{
-    DP_PerfEntry *pe = entry;
-    return pe->realm == NULL;
-}
+    bool footer_ok = write_footer(output);
+    if (!footer_ok) {
+        DP_warn("Error writing perf output footer: %s", DP_error());
+    }
 
-static DP_PerfEntry *perf_entry_at(int handle)
-{
-    return DP_vector_at(&perf_entries, sizeof(DP_PerfEntry),
-                        DP_int_to_size(handle));
+    bool ok = DP_output_free(output) && footer_ok;
+    if (!ok) {
+        DP_error_set("Error closing perf output: %s", DP_error());
+    }
+    return ok;
 }
 
-static DP_PerfEntry *search_or_push_perf_entry(int *out_handle)
+
+bool DP_perf_is_open(void)
 {
-    int handle = DP_vector_search_index(&perf_entries, sizeof(DP_PerfEntry),
-                                        is_available_perf_entry, NULL);
-    if (handle == -1) {
-        *out_handle = DP_size_to_int(perf_entries.used);
-        return DP_vector_push(&perf_entries, sizeof(DP_PerfEntry));
-    }
-    else {
-        *out_handle = handle;
-        return perf_entry_at(handle);
-    }
+    return perf_mutex && DP_perf_output;
 }
 
+
 unsigned long long DP_perf_time(void)
 {
 #if defined(_WIN32)
@@ -201,46 +470,70 @@ int DP_perf_begin_internal(const char *realm, const char *categories,
     DP_ASSERT(realm);
     DP_ASSERT(categories);
     DP_ASSERT(perf_mutex);
-    DP_MUTEX_MUST_LOCK(perf_mutex);
-    int handle;
-    DP_PerfEntry *pe = search_or_push_perf_entry(&handle);
-    pe->start = DP_perf_time();
-    pe->realm = realm;
-    pe->categories = categories;
+    DP_PerfThread *pt = get_perf_thread();
+    int handle = pt->depth;
+    if (handle == MAX_DEPTH) {
+        return DP_PERF_INVALID_HANDLE;
+    }
+
+    pt->depth = handle + 1;
+    DP_PerfSpan *span = &pt->open[handle];
+    span->generation = DP_atomic_get(&perf_generation);
+    span->realm = realm;
+    span->categories = categories;
     if (fmt) {
-        vsnprintf(pe->detail, DETAIL_LENGTH, fmt, ap);
+        vsnprintf(span->detail, DETAIL_LENGTH, fmt, ap);
     }
     else {
-        pe->detail[0] = '\0';
+        span->detail[0] = '\0';
     }
-    DP_MUTEX_MUST_UNLOCK(perf_mutex);
+    // Take the time last so that the formatting above isn't counted.
+    span->start = DP_perf_time();
     return handle;
 }
 
-void DP_perf_end_internal(DP_Output *output, int handle)
+static void push_span(DP_PerfThread *pt, DP_PerfSpan *span,
+                      unsigned long long end)
 {
-    DP_ASSERT(output);
-    DP_ASSERT(handle != DP_PERF_INVALID_HANDLE);
-    DP_ASSERT(perf_mutex);
-    unsigned long long end = DP_perf_time();
-
-    DP_MUTEX_MUST_LOCK(perf_mutex);
-    DP_PerfEntry *pe = perf_entry_at(handle);
-    unsigned long long start = pe->start;
-    char *detail = pe->detail;
+    int head = DP_atomic_get(&pt->head);
+    int tail = DP_atomic_get(&pt->tail);
+    int next = (head + 1) & RING_MASK;
+    if (next == tail) {
+        DP_atomic_inc(&pt->dropped);
+        return;
+    }
 
-    unsigned long long diff = end - start;
-    double start_seconds = DP_ullong_to_double(start) / NS_IN_S;
-    double end_seconds = DP_uint64_to_double(end) / NS_IN_S;
+    DP_PerfSpan *slot = &pt->ring[head];
+    slot->generation = span->generation;
+    slot->start = span->start;
+    slot->end = end;
+    slot->realm = span->realm;
+    slot->categories = span->categories;
+    memcpy(slot->detail, span->detail, strlen(span->detail) + 1);
+    DP_atomic_set(&pt->head, next);
 
-    bool ok = DP_output_format(
-        output, "%" DP_THREAD_ID_FMT " %f %f %llu %s:%s%s%s\n",
-        DP_thread_current_id(), start_seconds, end_seconds, diff, pe->realm,
-        pe->categories, detail[0] == '\0' ? "" : " ", detail);
-    if (!ok) {
-        DP_warn("Error formatting perf output: %s", DP_error());
+    // Only wake up the flusher occasionally, it doesn't need every span.
+    if (((next - tail) & RING_MASK) == FLUSH_THRESHOLD) {
+        DP_SEMAPHORE_MUST_POST(perf_flush_sem);
     }
+}
 
-    pe->realm = NULL;
-    DP_MUTEX_MUST_UNLOCK(perf_mutex);
+void DP_perf_end_internal(int handle)
+{
+    DP_ASSERT(handle != DP_PERF_INVALID_HANDLE);
+    unsigned long long end = DP_perf_time();
+
+    DP_PerfThread *pt = perf_thread;
+    DP_ASSERT(pt);
+    DP_ASSERT(handle < pt->depth);
+    if (pt && handle < pt->depth) {
+        // Spans are strictly nested, so this also discards any spans that were
+        // begun inside of this one and never ended.
+        pt->depth = handle;
+        DP_PerfSpan *span = &pt->open[handle];
+        if (DP_perf_output
+            && span->generation == DP_atomic_get(&perf_generation)) {
+            push_span(pt, span, end);
+        }
+    }
 }
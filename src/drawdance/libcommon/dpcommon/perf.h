@@ -49,15 +49,29 @@ typedef struct DP_Output DP_Output;
 #endif
 
 
+typedef enum DP_PerfFormat {
+    // Drawdance's own line-based text format, see DP_PERF_VERSION.
+    DP_PERF_FORMAT_TEXT,
+    // Chrome's JSON trace event format, readable by chrome://tracing and
+    // Perfetto. Each thread that records spans gets its own track.
+    DP_PERF_FORMAT_CHROME_TRACE,
+} DP_PerfFormat;
+
 extern DP_Output *DP_perf_output;
 
-// Takes ownership of the output, it is freed even on error.
-bool DP_perf_open(DP_Output *output);
+// Takes ownership of the output, it is freed even on error. Spans are
+// buffered per thread without locking and written to the output by a
+// background thread, so the output must not be used by anything else.
+bool DP_perf_open(DP_Output *output, DP_PerfFormat format);
 bool DP_perf_close(void);
 bool DP_perf_is_open(void);
 
 unsigned long long DP_perf_time(void);
 
+// Retires the calling thread's span buffer so that another thread can reuse it.
+// Threads started through DP_thread_new call this when they exit.
+void DP_perf_thread_exit(void);
+
 DP_INLINE int DP_perf_begin(const char *realm, const char *categories,
                             const char *fmt_or_null, ...) DP_FORMAT(3, 4);
 
@@ -79,15 +93,14 @@ DP_INLINE int DP_perf_begin(const char *realm, const char *categories,
     }
 }
 
-void DP_perf_end_internal(DP_Output *output, int handle);
+void DP_perf_end_internal(int handle);
 
+// Spans must be ended on the same thread that began them. This is called even
+// if perf output was closed in the meantime to keep the thread's spans nested.
 DP_INLINE void DP_perf_end(int handle)
 {
     if (handle != DP_PERF_INVALID_HANDLE) {
-        DP_Output *output = DP_perf_output;
-        if (output) {
-            DP_perf_end_internal(output, handle);
-        }
+        DP_perf_end_internal(handle);
     }
 }
 
@@ -22,6 +22,7 @@
 #include "atomic.h"
 #include "common.h"
 #include "conversions.h"
+#include "perf.h"
 #include "threading.h"
 #include <errno.h>
 #include <pthread.h>
@@ -253,6 +254,7 @@ static void *run_thread(void *arg)
     void *data = run_args->data;
     DP_free(run_args);
     fn(data);
+    DP_perf_thread_exit();
     return NULL;
 }
 
@@ -21,6 +21,7 @@
  */
 
 #include "common.h"
+#include "perf.h"
 #include "threading.h"
 #include <windows.h>
 
@@ -166,6 +167,7 @@ static DWORD WINAPI run_thread(void *fn_arg)
 
     fn(arg);
 
+    DP_perf_thread_exit();
     free_error_state();
     return 0;
 }
@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/mpsc_queue.h>
+#include <dpcommon/queue.h>
+#include <dpcommon/threading.h>
+#include <dptest.h>
+#include <time.h>
+
+#define PRODUCER_COUNT    4
+#define PUSHES_PER_THREAD 100000
+#define MAX_BATCH_SIZE    64
+#define NODE_COUNT        5
+
+
+typedef struct TestNode {
+    DP_MpscQueueNode node; // Must be first, shifted nodes get cast back.
+    int value;
+} TestNode;
+
+typedef struct Element {
+    int producer;
+    int sequence;
+    bool last_in_batch;
+} Element;
+
+typedef struct Batch {
+    DP_MpscQueueNode node; // Must be first, shifted nodes get cast back.
+    int count;
+    Element elements[];
+} Batch;
+
+// Common interface over the lock-free queue and the mutex-protected DP_Queue
+// the paint engine used before it, so that both get put through the same test.
+typedef struct StressQueue {
+    const char *title;
+    void (*push_batch)(void *queue, int count, const Element *elements);
+    // Blocks until there's an element to shift.
+    void (*shift)(void *queue, Element *out_element);
+    void *queue;
+} StressQueue;
+
+typedef struct ProducerParams {
+    StressQueue *sq;
+    int producer;
+} ProducerParams;
+
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+// Each batch goes into a single node, like the paint engine does it.
+typedef struct MpscStress {
+    DP_MpscQueue *mq;
+    Batch *batch;
+    int index;
+} MpscStress;
+
+static void mpsc_push_batch(void *queue, int count, const Element *elements)
+{
+    MpscStress *ms = queue;
+    Batch *batch = DP_malloc(
+        DP_FLEX_SIZEOF(Batch, elements, DP_int_to_size(count)));
+    batch->count = count;
+    memcpy(batch->elements, elements,
+           sizeof(*elements) * DP_int_to_size(count));
+    DP_mpsc_queue_push(ms->mq, &batch->node);
+}
+
+static void mpsc_shift(void *queue, Element *out_element)
+{
+    MpscStress *ms = queue;
+    while (!ms->batch) {
+        ms->batch = (Batch *)DP_mpsc_queue_shift(ms->mq);
+        if (ms->batch) {
+            ms->index = 0;
+        }
+        else {
+            DP_mpsc_queue_wait(ms->mq);
+        }
+    }
+
+    *out_element = ms->batch->elements[ms->index++];
+    if (ms->index == ms->batch->count) {
+        DP_free(ms->batch);
+        ms->batch = NULL;
+    }
+}
+
+
+// How the paint engine used to do it: a batch gets pushed under the mutex and
+// posts the semaphore once per element, every shift takes the mutex again.
+typedef struct LockedQueue {
+    DP_Mutex *mutex;
+    DP_Semaphore *sem;
+    DP_Queue queue;
+} LockedQueue;
+
+static void locked_push_batch(void *queue, int count, const Element *elements)
+{
+    LockedQueue *lq = queue;
+    DP_MUTEX_MUST_LOCK(lq->mutex);
+    for (int i = 0; i < count; ++i) {
+        *(Element *)DP_queue_push(&lq->queue, sizeof(Element)) = elements[i];
+    }
+    DP_SEMAPHORE_MUST_POST_N(lq->sem, count);
+    DP_MUTEX_MUST_UNLOCK(lq->mutex);
+}
+
+static void locked_shift(void *queue, Element *out_element)
+{
+    LockedQueue *lq = queue;
+    DP_SEMAPHORE_MUST_WAIT(lq->sem);
+    DP_MUTEX_MUST_LOCK(lq->mutex);
+    *out_element = *(Element *)DP_queue_peek(&lq->queue, sizeof(Element));
+    DP_queue_shift(&lq->queue);
+    DP_MUTEX_MUST_UNLOCK(lq->mutex);
+}
+
+
+static void run_producer(void *data)
+{
+    ProducerParams *params = data;
+    StressQueue *sq = params->sq;
+    int producer = params->producer;
+    uint32_t state = 0x9e3779b9u ^ DP_int_to_uint32(producer + 1);
+    Element elements[MAX_BATCH_SIZE];
+    int sequence = 0;
+    while (sequence < PUSHES_PER_THREAD) {
+        int count = DP_min_int(DP_test_random_int(&state, MAX_BATCH_SIZE) + 1,
+                               PUSHES_PER_THREAD - sequence);
+        for (int i = 0; i < count; ++i) {
+            elements[i] = (Element){producer, sequence++, i == count - 1};
+        }
+        sq->push_batch(sq->queue, count, elements);
+    }
+}
+
+// Every producer's elements must arrive exactly once and in the order they
+// were pushed in, and batches must not get interleaved with each other.
+static void stress_queue(TEST_PARAMS, StressQueue *sq)
+{
+    ProducerParams params[PRODUCER_COUNT];
+    DP_Thread *threads[PRODUCER_COUNT];
+    int next_sequences[PRODUCER_COUNT];
+    double start = now_seconds();
+    for (int i = 0; i < PRODUCER_COUNT; ++i) {
+        params[i] = (ProducerParams){sq, i};
+        next_sequences[i] = 0;
+        threads[i] = DP_thread_new(run_producer, &params[i]);
+    }
+
+    int total = PRODUCER_COUNT * PUSHES_PER_THREAD;
+    int batch_producer = -1;
+    int out_of_order = 0;
+    int interleaved = 0;
+    int invalid = 0;
+    for (int received = 0; received < total; ++received) {
+        Element element;
+        sq->shift(sq->queue, &element);
+        int producer = element.producer;
+        if (producer < 0 || producer >= PRODUCER_COUNT) {
+            ++invalid;
+            continue;
+        }
+
+        if (element.sequence != next_sequences[producer]++) {
+            ++out_of_order;
+        }
+
+        if (batch_producer != -1 && batch_producer != producer) {
+            ++interleaved;
+        }
+        batch_producer = element.last_in_batch ? -1 : producer;
+    }
+    double elapsed = now_seconds() - start;
+
+    for (int i = 0; i < PRODUCER_COUNT; ++i) {
+        DP_thread_free_join(threads[i]);
+    }
+
+    INT_EQ_OK(invalid, 0, "%s: no invalid elements", sq->title);
+    INT_EQ_OK(out_of_order, 0, "%s: elements in order", sq->title);
+    INT_EQ_OK(interleaved, 0, "%s: batches not interleaved", sq->title);
+    bool all_received = true;
+    for (int i = 0; i < PRODUCER_COUNT; ++i) {
+        if (next_sequences[i] != PUSHES_PER_THREAD) {
+            all_received = false;
+        }
+    }
+    OK(all_received, "%s: all elements received", sq->title);
+    NOTE("%s: %d elements in %.3f seconds, %.0f per second", sq->title, total,
+         elapsed, elapsed > 0.0 ? (double)total / elapsed : 0.0);
+}
+
+
+static int shift_value(DP_MpscQueue *mq)
+{
+    TestNode *tn = (TestNode *)DP_mpsc_queue_shift(mq);
+    return tn ? tn->value : -1;
+}
+
+static void push_shift(TEST_PARAMS)
+{
+    DP_MpscQueue *mq = DP_mpsc_queue_new();
+    FATAL(NOT_NULL_OK(mq, "queue created"));
+    TestNode nodes[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; ++i) {
+        nodes[i].value = i;
+    }
+
+    INT_EQ_OK(shift_value(mq), -1, "can't shift from empty queue");
+
+    DP_mpsc_queue_push(mq, &nodes[0].node);
+    DP_mpsc_queue_push(mq, &nodes[1].node);
+    DP_mpsc_queue_push(mq, &nodes[2].node);
+    INT_EQ_OK(shift_value(mq), 0, "shift first node");
+    INT_EQ_OK(shift_value(mq), 1, "shift second node");
+    DP_mpsc_queue_push(mq, &nodes[3].node);
+    INT_EQ_OK(shift_value(mq), 2, "shift third node");
+    INT_EQ_OK(shift_value(mq), 3, "shift fourth node");
+    INT_EQ_OK(shift_value(mq), -1, "queue empty again");
+
+    // The queue ran dry with the stub node behind the last one, make sure
+    // that pushing and shifting still works from there, including reusing a
+    // node that was already shifted out.
+    DP_mpsc_queue_push(mq, &nodes[4].node);
+    DP_mpsc_queue_push(mq, &nodes[0].node);
+    INT_EQ_OK(shift_value(mq), 4, "shift node after running dry");
+    INT_EQ_OK(shift_value(mq), 0, "shift reused node");
+    INT_EQ_OK(shift_value(mq), -1, "queue empty at the end");
+
+    DP_mpsc_queue_free(mq);
+}
+
+static void wait_after_push(TEST_PARAMS)
+{
+    DP_MpscQueue *mq = DP_mpsc_queue_new();
+    FATAL(NOT_NULL_OK(mq, "queue created"));
+    TestNode node = {{DP_ATOMIC_PTR_INIT(NULL)}, 1};
+
+    // There's something in the queue, so this must return right away.
+    DP_mpsc_queue_push(mq, &node.node);
+    DP_mpsc_queue_wait(mq);
+    INT_EQ_OK(shift_value(mq), 1, "shift node pushed before waiting");
+
+    DP_mpsc_queue_free(mq);
+}
+
+static void stress_mpsc(TEST_PARAMS)
+{
+    DP_MpscQueue *mq = DP_mpsc_queue_new();
+    FATAL(NOT_NULL_OK(mq, "queue created"));
+    MpscStress ms = {mq, NULL, 0};
+    StressQueue sq = {"lock-free", mpsc_push_batch, mpsc_shift, &ms};
+    stress_queue(TEST_ARGS, &sq);
+    DP_mpsc_queue_free(mq);
+}
+
+static void stress_locked(TEST_PARAMS)
+{
+    LockedQueue lq = {DP_mutex_new(), DP_semaphore_new(0), DP_QUEUE_NULL};
+    DP_queue_init(&lq.queue, MAX_BATCH_SIZE, sizeof(Element));
+    StressQueue sq = {"locked", locked_push_batch, locked_shift, &lq};
+    stress_queue(TEST_ARGS, &sq);
+    DP_queue_dispose(&lq.queue);
+    DP_semaphore_free(lq.sem);
+    DP_mutex_free(lq.mutex);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(push_shift);
+    REGISTER_TEST(wait_after_push);
+    REGISTER_TEST(stress_mpsc);
+    REGISTER_TEST(stress_locked);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -35,6 +35,7 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/threading.h>
 #include <dpcommon/vector.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/message.h>
@@ -346,6 +347,197 @@ DP_Image *DP_brush_preview_to_image(DP_BrushPreview *bp)
 }
 
 
+typedef struct DP_BrushPreviewRequest {
+    unsigned int id;
+    int width, height;
+    DP_BrushPreviewShape shape;
+    bool mypaint;
+    DP_ClassicBrush classic;
+    DP_MyPaintBrush mypaint_brush;
+    DP_MyPaintSettings mypaint_settings;
+} DP_BrushPreviewRequest;
+
+struct DP_BrushPreviewRenderer {
+    DP_BrushPreviewRenderedFn fn;
+    void *user;
+    DP_BrushPreview *bp;
+    DP_DrawContext *dc;
+    DP_Mutex *mutex;
+    DP_Semaphore *sem;
+    DP_Thread *thread;
+    unsigned int last_id;
+    bool have_request;
+    bool running;
+    // MyPaint settings are big, so we swap these around instead of copying.
+    DP_BrushPreviewRequest *pending;
+    DP_BrushPreviewRequest *current;
+};
+
+static bool renderer_take_request(DP_BrushPreviewRenderer *bpr)
+{
+    DP_MUTEX_MUST_LOCK(bpr->mutex);
+    bool running = bpr->running;
+    bool have_request = bpr->have_request;
+    if (running && have_request) {
+        DP_BrushPreviewRequest *tmp = bpr->current;
+        bpr->current = bpr->pending;
+        bpr->pending = tmp;
+        bpr->have_request = false;
+    }
+    DP_MUTEX_MUST_UNLOCK(bpr->mutex);
+    // Requests that got replaced by newer ones still post the semaphore, so
+    // there may be nothing to do here.
+    return running && have_request;
+}
+
+static bool renderer_is_current(DP_BrushPreviewRenderer *bpr, unsigned int id)
+{
+    DP_MUTEX_MUST_LOCK(bpr->mutex);
+    bool current = bpr->running && bpr->last_id == id;
+    DP_MUTEX_MUST_UNLOCK(bpr->mutex);
+    return current;
+}
+
+static void renderer_render(DP_BrushPreviewRenderer *bpr)
+{
+    DP_BrushPreviewRequest *req = bpr->current;
+    if (req->mypaint) {
+        DP_brush_preview_render_mypaint(bpr->bp, bpr->dc, req->width,
+                                        req->height, &req->mypaint_brush,
+                                        &req->mypaint_settings, req->shape);
+    }
+    else {
+        DP_brush_preview_render_classic(bpr->bp, bpr->dc, req->width,
+                                        req->height, &req->classic,
+                                        req->shape);
+    }
+
+    unsigned int id = req->id;
+    if (renderer_is_current(bpr, id)) {
+        DP_Image *img = DP_brush_preview_to_image(bpr->bp);
+        // Flattening takes a moment too, so check again before delivering.
+        if (renderer_is_current(bpr, id)) {
+            bpr->fn(bpr->user, id, img);
+        }
+        else {
+            DP_image_free(img);
+        }
+    }
+}
+
+static void run_renderer(void *data)
+{
+    DP_BrushPreviewRenderer *bpr = data;
+    while (true) {
+        DP_SEMAPHORE_MUST_WAIT(bpr->sem);
+        if (renderer_take_request(bpr)) {
+            renderer_render(bpr);
+        }
+        else {
+            DP_MUTEX_MUST_LOCK(bpr->mutex);
+            bool running = bpr->running;
+            DP_MUTEX_MUST_UNLOCK(bpr->mutex);
+            if (!running) {
+                break;
+            }
+        }
+    }
+}
+
+DP_BrushPreviewRenderer *
+DP_brush_preview_renderer_new(DP_BrushPreviewRenderedFn fn, void *user)
+{
+    DP_ASSERT(fn);
+    DP_BrushPreviewRenderer *bpr = DP_malloc(sizeof(*bpr));
+    *bpr = (DP_BrushPreviewRenderer){
+        fn,
+        user,
+        DP_brush_preview_new(),
+        DP_draw_context_new(),
+        DP_mutex_new(),
+        DP_semaphore_new(0),
+        NULL,
+        0,
+        false,
+        true,
+        DP_malloc(sizeof(*bpr->pending)),
+        DP_malloc(sizeof(*bpr->current)),
+    };
+    bpr->thread = DP_thread_new(run_renderer, bpr);
+    return bpr;
+}
+
+void DP_brush_preview_renderer_free(DP_BrushPreviewRenderer *bpr)
+{
+    if (bpr) {
+        DP_MUTEX_MUST_LOCK(bpr->mutex);
+        bpr->running = false;
+        DP_MUTEX_MUST_UNLOCK(bpr->mutex);
+        DP_SEMAPHORE_MUST_POST(bpr->sem);
+        DP_thread_free_join(bpr->thread);
+        DP_free(bpr->current);
+        DP_free(bpr->pending);
+        DP_semaphore_free(bpr->sem);
+        DP_mutex_free(bpr->mutex);
+        DP_draw_context_free(bpr->dc);
+        DP_brush_preview_free(bpr->bp);
+        DP_free(bpr);
+    }
+}
+
+// Locks the renderer and returns the pending request to be filled in, must be
+// followed by a call to renderer_request_end.
+static DP_BrushPreviewRequest *
+renderer_request_begin(DP_BrushPreviewRenderer *bpr, int width, int height,
+                       DP_BrushPreviewShape shape, bool mypaint)
+{
+    DP_MUTEX_MUST_LOCK(bpr->mutex);
+    DP_BrushPreviewRequest *req = bpr->pending;
+    req->width = width;
+    req->height = height;
+    req->shape = shape;
+    req->mypaint = mypaint;
+    return req;
+}
+
+static unsigned int renderer_request_end(DP_BrushPreviewRenderer *bpr)
+{
+    unsigned int id = ++bpr->last_id;
+    bpr->pending->id = id;
+    bpr->have_request = true;
+    DP_MUTEX_MUST_UNLOCK(bpr->mutex);
+    DP_SEMAPHORE_MUST_POST(bpr->sem);
+    return id;
+}
+
+unsigned int DP_brush_preview_renderer_request_classic(
+    DP_BrushPreviewRenderer *bpr, int width, int height,
+    const DP_ClassicBrush *brush, DP_BrushPreviewShape shape)
+{
+    DP_ASSERT(bpr);
+    DP_ASSERT(brush);
+    DP_BrushPreviewRequest *req =
+        renderer_request_begin(bpr, width, height, shape, false);
+    req->classic = *brush;
+    return renderer_request_end(bpr);
+}
+
+unsigned int DP_brush_preview_renderer_request_mypaint(
+    DP_BrushPreviewRenderer *bpr, int width, int height,
+    const DP_MyPaintBrush *brush, const DP_MyPaintSettings *settings,
+    DP_BrushPreviewShape shape)
+{
+    DP_ASSERT(bpr);
+    DP_ASSERT(brush);
+    DP_ASSERT(settings);
+    DP_BrushPreviewRequest *req =
+        renderer_request_begin(bpr, width, height, shape, true);
+    req->mypaint_brush = *brush;
+    req->mypaint_settings = *settings;
+    return renderer_request_end(bpr);
+}
+
+
 static void set_preview_pixel_dab(DP_UNUSED int count, DP_PixelDab *pds,
                                   void *user)
 {
@@ -40,6 +40,13 @@ typedef enum DP_BrushPreviewShape {
 } DP_BrushPreviewShape;
 
 typedef struct DP_BrushPreview DP_BrushPreview;
+typedef struct DP_BrushPreviewRenderer DP_BrushPreviewRenderer;
+
+// Called on the renderer's thread with the finished preview for the given
+// request. Ownership of the image is transferred, it may be NULL if the
+// requested size was empty.
+typedef void (*DP_BrushPreviewRenderedFn)(void *user, unsigned int request_id,
+                                          DP_Image *img);
 
 DP_BrushPreview *DP_brush_preview_new(void);
 
@@ -58,6 +65,26 @@ void DP_brush_preview_render_mypaint(DP_BrushPreview *bp, DP_DrawContext *dc,
 
 DP_Image *DP_brush_preview_to_image(DP_BrushPreview *bp);
 
+
+// Renders brush previews on a separate thread. Only the most recent request
+// matters: pending requests get replaced by newer ones and a render that gets
+// overtaken by a newer request while it's running is discarded instead of
+// being delivered. Request ids start at 1 and increase with each request.
+DP_BrushPreviewRenderer *
+DP_brush_preview_renderer_new(DP_BrushPreviewRenderedFn fn, void *user);
+
+void DP_brush_preview_renderer_free(DP_BrushPreviewRenderer *bpr);
+
+unsigned int DP_brush_preview_renderer_request_classic(
+    DP_BrushPreviewRenderer *bpr, int width, int height,
+    const DP_ClassicBrush *brush, DP_BrushPreviewShape shape);
+
+unsigned int DP_brush_preview_renderer_request_mypaint(
+    DP_BrushPreviewRenderer *bpr, int width, int height,
+    const DP_MyPaintBrush *brush, const DP_MyPaintSettings *settings,
+    DP_BrushPreviewShape shape);
+
+
 DP_Image *DP_classic_brush_preview_dab(const DP_ClassicBrush *cb,
                                        DP_DrawContext *dc, int width,
                                        int height, uint32_t color);
@@ -106,6 +106,25 @@ void DP_canvas_diff_check(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
     }
 }
 
+void DP_canvas_diff_check_indexes(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
+                                  void *data, int index_count,
+                                  const int *indexes)
+{
+    DP_ASSERT(diff);
+    DP_ASSERT(fn);
+    DP_ASSERT(index_count == 0 || indexes);
+    bool *tile_changes = diff->tile_changes;
+    for (int i = 0; i < index_count; ++i) {
+        int index = indexes[i];
+        DP_ASSERT(index >= 0);
+        DP_ASSERT(index < diff->count);
+        bool *tile_change = &tile_changes[index];
+        if (!*tile_change && fn(data, index)) {
+            *tile_change = true;
+        }
+    }
+}
+
 void DP_canvas_diff_check_all(DP_CanvasDiff *diff)
 {
     DP_ASSERT(diff);
@@ -40,6 +40,12 @@ void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
 void DP_canvas_diff_check(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
                           void *data);
 
+// Like DP_canvas_diff_check, but only checks the given tile indexes. For when
+// the caller knows that all other tiles are unchanged. Duplicates are fine.
+void DP_canvas_diff_check_indexes(DP_CanvasDiff *diff, DP_CanvasDiffCheckFn fn,
+                                  void *data, int index_count,
+                                  const int *indexes);
+
 void DP_canvas_diff_check_all(DP_CanvasDiff *diff);
 
 void DP_canvas_diff_each_index(DP_CanvasDiff *diff, DP_CanvasDiffEachIndexFn fn,
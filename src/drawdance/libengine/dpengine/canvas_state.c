@@ -1361,7 +1361,8 @@ DP_canvas_state_to_flat_layer(DP_CanvasState *cs, unsigned int flags,
         DP_TransientTile *tt = DP_transient_tile_new_blank(0);
         init_flattening_tile(tt, background_tile);
         int i = ti.row * wt + ti.col;
-        DP_canvas_state_flatten_tile_to(cs, i, tt, include_sublayers, &vmf);
+        DP_canvas_state_flatten_tile_to(cs, i, tt, include_sublayers, &vmf,
+                                        NULL);
         DP_transient_layer_content_transient_tile_set_noinc(tlc, tt, i);
     }
 
@@ -1397,11 +1398,41 @@ flatten_onion_skin(int tile_index, DP_TransientTile *tt, DP_LayerListEntry *lle,
     }
 }
 
-DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
-                                                  int tile_index,
-                                                  DP_TransientTile *tt_or_null,
-                                                  bool include_sublayers,
-                                                  const DP_ViewModeFilter *vmf)
+static void flatten_onion_skin_cached(int tile_index, DP_TransientTile *tt,
+                                      DP_LayerListEntry *lle, DP_LayerProps *lp,
+                                      uint16_t parent_opacity,
+                                      bool include_sublayers,
+                                      DP_ViewModeContext *vmc,
+                                      const DP_OnionSkin *os,
+                                      DP_OnionSkinCache *osc)
+{
+    DP_OnionSkinCacheKey key = DP_onion_skin_cache_key_make(
+        vmc, lle, lp, os, parent_opacity, include_sublayers, tile_index);
+    DP_Tile *t;
+    if (!DP_onion_skin_cache_search_inc(osc, &key, &t)) {
+        DP_TransientTile *skin_tt = flatten_onion_skin(
+            tile_index, NULL, lle, lp, parent_opacity, include_sublayers, vmc,
+            os);
+        if (DP_transient_tile_blank(skin_tt)) {
+            DP_transient_tile_decref(skin_tt);
+            t = NULL;
+        }
+        else {
+            t = DP_transient_tile_persist(skin_tt);
+        }
+        DP_onion_skin_cache_insert(osc, &key, t);
+    }
+
+    if (t) {
+        DP_transient_tile_merge(tt, t, DP_BIT15, DP_BLEND_MODE_NORMAL);
+        DP_tile_decref(t);
+    }
+}
+
+DP_TransientTile *DP_canvas_state_flatten_tile_to(
+    DP_CanvasState *cs, int tile_index, DP_TransientTile *tt_or_null,
+    bool include_sublayers, const DP_ViewModeFilter *vmf,
+    DP_OnionSkinCache *osc_or_null)
 {
     DP_ViewModeContextRoot vmcr = DP_view_mode_context_root_init(vmf, cs);
     DP_TransientTile *tt = tt_or_null;
@@ -1413,7 +1444,12 @@ DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
         DP_ViewModeContext vmc = DP_view_mode_context_root_at(
             &vmcr, cs, i, &lle, &lp, &os, &parent_opacity);
         if (!DP_view_mode_context_excludes_everything(&vmc)) {
-            if (os) {
+            if (os && osc_or_null && tt) {
+                flatten_onion_skin_cached(tile_index, tt, lle, lp,
+                                          parent_opacity, include_sublayers,
+                                          &vmc, os, osc_or_null);
+            }
+            else if (os) {
                 tt = flatten_onion_skin(tile_index, tt, lle, lp, parent_opacity,
                                         include_sublayers, &vmc, os);
             }
@@ -1452,7 +1488,8 @@ static void *flatten_canvas(
     while (DP_tile_iterator_next(&ti)) {
         init_flattening_tile(tt, background_tile);
         int i = ti.row * wt + ti.col;
-        DP_canvas_state_flatten_tile_to(cs, i, tt, include_sublayers, &vmf);
+        DP_canvas_state_flatten_tile_to(cs, i, tt, include_sublayers, &vmf,
+                                        NULL);
         to_buffer(buffer, tt, &ti);
     }
     DP_transient_tile_decref(tt);
@@ -1541,7 +1578,7 @@ DP_canvas_state_flatten_tile(DP_CanvasState *cs, int tile_index,
     DP_ViewModeFilter vmf =
         vmf_or_null ? *vmf_or_null : DP_view_mode_filter_make_default();
     return DP_canvas_state_flatten_tile_to(cs, tile_index, tt,
-                                           include_sublayers, &vmf);
+                                           include_sublayers, &vmf, NULL);
 }
 
 DP_TransientTile *
@@ -1723,6 +1760,7 @@ DP_CanvasState *DP_transient_canvas_state_persist(DP_TransientCanvasState *tcs)
     if (DP_layer_props_list_transient(tcs->layer_props)) {
         DP_transient_layer_props_list_persist(tcs->transient_layer_props);
     }
+    DP_layer_routes_persisted(tcs->layer_routes, tcs->layer_props);
     if (DP_annotation_list_transient(tcs->annotations)) {
         DP_transient_annotation_list_persist(tcs->transient_annotations);
     }
@@ -1794,9 +1832,10 @@ void DP_transient_canvas_state_background_tile_set_noinc(
 void DP_transient_canvas_state_layer_routes_reindex(
     DP_TransientCanvasState *tcs, DP_DrawContext *dc)
 {
-    DP_layer_routes_decref_nullable(tcs->layer_routes);
-    DP_LayerRoutes *lr = DP_layer_routes_new_index(tcs->layer_props, dc);
-    tcs->layer_routes = lr;
+    DP_LayerRoutes *prev_lr = tcs->layer_routes;
+    tcs->layer_routes =
+        DP_layer_routes_new_reindex(prev_lr, tcs->layer_props, dc);
+    DP_layer_routes_decref_nullable(prev_lr);
 }
 
 static void timeline_cleanup_make_transient(
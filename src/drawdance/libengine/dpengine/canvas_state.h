@@ -34,6 +34,7 @@ typedef struct DP_LayerList DP_LayerList;
 typedef struct DP_LayerPropsList DP_LayerPropsList;
 typedef struct DP_LayerRoutes DP_LayerRoutes;
 typedef struct DP_Message DP_Message;
+typedef struct DP_OnionSkinCache DP_OnionSkinCache;
 typedef struct DP_Rect DP_Rect;
 typedef struct DP_Tile DP_Tile;
 typedef struct DP_Timeline DP_Timeline;
@@ -140,11 +141,12 @@ bool DP_canvas_state_to_flat_separated_urgba8(
     DP_CanvasState *cs, unsigned int flags, const DP_Rect *area_or_null,
     const DP_ViewModeFilter *vmf_or_null, unsigned char *buffer);
 
-DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
-                                                  int tile_index,
-                                                  DP_TransientTile *tt_or_null,
-                                                  bool include_sublayers,
-                                                  const DP_ViewModeFilter *vmf);
+// Flattens the given tile. If an onion skin cache is given, onion skins are
+// taken from or put into it rather than being flattened every time.
+DP_TransientTile *DP_canvas_state_flatten_tile_to(
+    DP_CanvasState *cs, int tile_index, DP_TransientTile *tt_or_null,
+    bool include_sublayers, const DP_ViewModeFilter *vmf,
+    DP_OnionSkinCache *osc_or_null);
 
 DP_TransientTile *
 DP_canvas_state_flatten_tile(DP_CanvasState *cs, int tile_index,
@@ -37,6 +37,26 @@
 #include <dpmsg/blend_mode.h>
 
 
+// Changes to tiles are tracked relative to some earlier version of the layer
+// content, so that diffing two versions only needs to look at those tiles
+// instead of all of them. The lineage identifies that earlier version, it's
+// shared between all contents derived from it. Contents with a null lineage
+// don't know what changed, so they have to be diffed fully. The bits are a set
+// of the indexes, they only exist while the content is transient.
+#define CHANGES_LIMIT_DIVISOR 16
+
+typedef struct DP_LayerContentLineage {
+    DP_Atomic refcount;
+} DP_LayerContentLineage;
+
+typedef struct DP_LayerContentChanges {
+    DP_LayerContentLineage *lineage;
+    int count;
+    int capacity;
+    int *indexes;
+    unsigned char *bits;
+} DP_LayerContentChanges;
+
 #ifdef DP_NO_STRICT_ALIASING
 
 struct DP_LayerContent {
@@ -47,6 +67,7 @@ struct DP_LayerContent {
         DP_LayerList *contents;
         DP_LayerPropsList *props;
     } sub;
+    DP_LayerContentChanges changes;
     union {
         DP_Tile *const tile;
     } elements[];
@@ -66,6 +87,7 @@ struct DP_TransientLayerContent {
             DP_TransientLayerPropsList *transient_props;
         };
     } sub;
+    DP_LayerContentChanges changes;
     union {
         DP_Tile *tile;
         DP_TransientTile *transient_tile;
@@ -88,6 +110,7 @@ struct DP_LayerContent {
             DP_TransientLayerPropsList *transient_props;
         };
     } sub;
+    DP_LayerContentChanges changes;
     union {
         DP_Tile *tile;
         DP_TransientTile *transient_tile;
@@ -97,6 +120,18 @@ struct DP_LayerContent {
 #endif
 
 
+static void changes_dispose(DP_LayerContentChanges *changes)
+{
+    DP_LayerContentLineage *lineage = changes->lineage;
+    if (lineage && DP_atomic_dec(&lineage->refcount)) {
+        DP_free(lineage);
+    }
+    DP_free(changes->indexes);
+    DP_free(changes->bits);
+    *changes = (DP_LayerContentChanges){NULL, 0, 0, NULL, NULL};
+}
+
+
 DP_LayerContent *DP_layer_content_incref(DP_LayerContent *lc)
 {
     DP_ASSERT(lc);
@@ -121,6 +156,7 @@ void DP_layer_content_decref(DP_LayerContent *lc)
         }
         DP_layer_props_list_decref(lc->sub.props);
         DP_layer_list_decref(lc->sub.contents);
+        changes_dispose(&lc->changes);
         DP_free(lc);
     }
 }
@@ -198,6 +234,29 @@ static bool diff_tile_both_censored(void *data, int tile_index)
     return !a->elements[tile_index].tile != !b->elements[tile_index].tile;
 }
 
+static void layer_content_diff_check(DP_LayerContent *lc,
+                                     DP_LayerContent *prev_lc,
+                                     DP_CanvasDiff *diff,
+                                     DP_CanvasDiffCheckFn fn)
+{
+    if (lc != prev_lc) {
+        DP_LayerContent *data[] = {lc, prev_lc};
+        DP_LayerContentLineage *lineage = lc->changes.lineage;
+        if (lineage && lineage == prev_lc->changes.lineage) {
+            // Both are derived from the same content, so any tile that differs
+            // between them must have changed from that in one of them.
+            DP_canvas_diff_check_indexes(diff, fn, data, lc->changes.count,
+                                         lc->changes.indexes);
+            DP_canvas_diff_check_indexes(diff, fn, data,
+                                         prev_lc->changes.count,
+                                         prev_lc->changes.indexes);
+        }
+        else {
+            DP_canvas_diff_check(diff, fn, data);
+        }
+    }
+}
+
 static void layer_content_diff(DP_LayerContent *lc, bool censored,
                                DP_LayerContent *prev_lc, bool prev_censored,
                                DP_CanvasDiff *diff)
@@ -210,14 +269,13 @@ static void layer_content_diff(DP_LayerContent *lc, bool censored,
     DP_ASSERT(lc->width == prev_lc->width);   // Different sizes could be
     DP_ASSERT(lc->height == prev_lc->height); // supported, but aren't yet.
     if (!censored && !prev_censored) {
-        DP_canvas_diff_check(diff, diff_tile,
-                             (DP_LayerContent *[]){lc, prev_lc});
+        layer_content_diff_check(lc, prev_lc, diff, diff_tile);
         DP_layer_list_diff(lc->sub.contents, lc->sub.props,
                            prev_lc->sub.contents, prev_lc->sub.props, diff);
     }
     else if (censored && prev_censored) {
-        DP_canvas_diff_check(diff, diff_tile_both_censored,
-                             (DP_LayerContent *[]){lc, prev_lc});
+        layer_content_diff_check(lc, prev_lc, diff,
+                                 diff_tile_both_censored);
         DP_layer_list_diff(lc->sub.contents, lc->sub.props,
                            prev_lc->sub.contents, prev_lc->sub.props, diff);
     }
@@ -354,6 +412,10 @@ bool DP_layer_content_pick_at(DP_LayerContent *lc, int x, int y,
     return false;
 }
 
+// Large diameters sample from the tiles' mipmaps instead of every single pixel,
+// which keeps the cost bounded at about what this diameter costs otherwise.
+#define SAMPLE_MIPMAP_MIN_DIAMETER 96
+
 static DP_UPixelFloat sample_dab_color(DP_LayerContent *lc, DP_BrushStamp stamp,
                                        bool opaque)
 {
@@ -404,6 +466,61 @@ static DP_UPixelFloat sample_dab_color(DP_LayerContent *lc, DP_BrushStamp stamp,
     return DP_paint_sample_to_upixel(diameter, weight, red, green, blue, alpha);
 }
 
+static DP_UPixelFloat sample_dab_color_mipmap(DP_LayerContent *lc, int x,
+                                              int y, int diameter, bool opaque)
+{
+    DP_ColorSamplingWeights csw =
+        DP_paint_color_sampling_weights_make(diameter);
+    int radius = diameter / 2;
+    int left = DP_max_int(0, x - radius);
+    int top = DP_max_int(0, y - radius);
+    int right = DP_min_int(x - radius + diameter, lc->width);
+    int bottom = DP_min_int(y - radius + diameter, lc->height);
+    int xtiles = DP_tile_count_round(lc->width);
+
+    // Bounds in mipmap pixels across the whole canvas, inclusive.
+    int scale = DP_TILE_MIPMAP_SCALE;
+    int size = DP_TILE_MIPMAP_SIZE;
+    int mleft = left / scale;
+    int mtop = top / scale;
+    int mright = (right - 1) / scale;
+    int mbottom = (bottom - 1) / scale;
+    // Offset from the corner of a mipmap pixel to its center.
+    float center = DP_int_to_float(scale - 1) / 2.0f;
+
+    uint16_t weights[DP_TILE_MIPMAP_LENGTH];
+    float weight = 0.0;
+    float red = 0.0;
+    float green = 0.0;
+    float blue = 0.0;
+    float alpha = 0.0;
+
+    for (int my = mtop; my <= mbottom; my = (my / size + 1) * size) {
+        int yindex = my / size;
+        int h = DP_min_int(mbottom + 1, (yindex + 1) * size) - my;
+        for (int mx = mleft; mx <= mright; mx = (mx / size + 1) * size) {
+            int xindex = mx / size;
+            int w = DP_min_int(mright + 1, (xindex + 1) * size) - mx;
+
+            for (int j = 0; j < h; ++j) {
+                float dy = DP_int_to_float((my + j) * scale - y) + center;
+                for (int i = 0; i < w; ++i) {
+                    float dx = DP_int_to_float((mx + i) * scale - x) + center;
+                    weights[j * w + i] =
+                        DP_paint_color_sampling_weight_at(&csw, dx, dy);
+                }
+            }
+
+            DP_tile_sample_mipmap(lc->elements[yindex * xtiles + xindex].tile,
+                                  weights, mx - xindex * size,
+                                  my - yindex * size, w, h, 0, opaque, &weight,
+                                  &red, &green, &blue, &alpha);
+        }
+    }
+
+    return DP_paint_sample_to_upixel(diameter, weight, red, green, blue, alpha);
+}
+
 DP_UPixelFloat DP_layer_content_sample_color_at(DP_LayerContent *lc,
                                                 uint16_t *stamp_buffer, int x,
                                                 int y, int diameter,
@@ -415,6 +532,10 @@ DP_UPixelFloat DP_layer_content_sample_color_at(DP_LayerContent *lc,
             DP_Pixel15 pixel = DP_layer_content_pixel_at(lc, x, y);
             return DP_upixel15_to_float(DP_pixel15_unpremultiply(pixel));
         }
+        else if (diameter >= SAMPLE_MIPMAP_MIN_DIAMETER) {
+            // Doesn't touch the stamp buffer, so the last diameter stays.
+            return sample_dab_color_mipmap(lc, x, y, diameter, opaque);
+        }
         else {
             int last_diameter;
             if (in_out_last_diameter) {
@@ -584,6 +705,48 @@ bool DP_layer_content_search_change_bounds(DP_LayerContent *lc,
     return false;
 }
 
+bool DP_layer_content_bounds(DP_LayerContent *lc, bool include_sublayers,
+                             DP_Rect *out_bounds)
+{
+    DP_ASSERT(lc);
+    DP_ASSERT(DP_atomic_get(&lc->refcount) > 0);
+    DP_ASSERT(out_bounds);
+    int left, top, right, bottom;
+    bool found = layer_content_tile_bounds(lc, &left, &top, &right, &bottom);
+
+    if (include_sublayers) {
+        DP_LayerList *ll = lc->sub.contents;
+        int count = DP_layer_list_count(ll);
+        for (int i = 0; i < count; ++i) {
+            DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+            DP_LayerContent *slc = DP_layer_list_entry_content_noinc(lle);
+            int sl, st, sr, sb;
+            if (layer_content_tile_bounds(slc, &sl, &st, &sr, &sb)) {
+                if (found) {
+                    left = DP_min_int(left, sl);
+                    top = DP_min_int(top, st);
+                    right = DP_max_int(right, sr);
+                    bottom = DP_max_int(bottom, sb);
+                }
+                else {
+                    left = sl;
+                    top = st;
+                    right = sr;
+                    bottom = sb;
+                    found = true;
+                }
+            }
+        }
+    }
+
+    if (found) {
+        *out_bounds = DP_rect_make(left * DP_TILE_SIZE, top * DP_TILE_SIZE,
+                                   (right - left + 1) * DP_TILE_SIZE,
+                                   (bottom - top + 1) * DP_TILE_SIZE);
+    }
+    return found;
+}
+
 DP_Image *DP_layer_content_to_image(DP_LayerContent *lc)
 {
     DP_ASSERT(lc);
@@ -888,9 +1051,72 @@ static DP_TransientLayerContent *alloc_layer_content(int width, int height)
     tlc->transient = true;
     tlc->width = width;
     tlc->height = height;
+    tlc->changes = (DP_LayerContentChanges){NULL, 0, 0, NULL, NULL};
     return tlc;
 }
 
+static void changes_track(DP_TransientLayerContent *tlc,
+                          DP_LayerContent *lc_or_null)
+{
+    int count = DP_tile_total_round(tlc->width, tlc->height);
+    DP_LayerContentChanges *changes = &tlc->changes;
+    changes->bits = DP_malloc_zeroed(DP_int_to_size((count + 7) / 8));
+    DP_LayerContentLineage *lineage =
+        lc_or_null ? lc_or_null->changes.lineage : NULL;
+    if (lineage) {
+        DP_atomic_inc(&lineage->refcount);
+        changes->lineage = lineage;
+        int change_count = lc_or_null->changes.count;
+        if (change_count != 0) {
+            size_t size = sizeof(*changes->indexes)
+                        * DP_int_to_size(change_count);
+            changes->indexes = DP_malloc(size);
+            memcpy(changes->indexes, lc_or_null->changes.indexes, size);
+            changes->count = change_count;
+            changes->capacity = change_count;
+            for (int i = 0; i < change_count; ++i) {
+                int index = changes->indexes[i];
+                changes->bits[index / 8] |= (unsigned char)(1 << (index % 8));
+            }
+        }
+    }
+    else {
+        // Start a new lineage, tracking changes relative to the given content.
+        lineage = DP_malloc(sizeof(*lineage));
+        DP_atomic_set(&lineage->refcount, 1);
+        changes->lineage = lineage;
+    }
+}
+
+static void mark_changed(DP_TransientLayerContent *tlc, int i)
+{
+    DP_LayerContentChanges *changes = &tlc->changes;
+    if (changes->lineage) {
+        unsigned char bit = (unsigned char)(1 << (i % 8));
+        if (!(changes->bits[i / 8] & bit)) {
+            int count = changes->count;
+            int limit = DP_tile_total_round(tlc->width, tlc->height)
+                      / CHANGES_LIMIT_DIVISOR;
+            if (count < limit) {
+                changes->bits[i / 8] |= bit;
+                if (count == changes->capacity) {
+                    int capacity = DP_max_int(16, count * 2);
+                    changes->indexes = DP_realloc(
+                        changes->indexes,
+                        sizeof(*changes->indexes) * DP_int_to_size(capacity));
+                    changes->capacity = capacity;
+                }
+                changes->indexes[count] = i;
+                changes->count = count + 1;
+            }
+            else {
+                // Too much changed, checking all tiles is just as fast.
+                changes_dispose(changes);
+            }
+        }
+    }
+}
+
 static DP_TransientTile *get_transient_tile(DP_TransientLayerContent *tlc,
                                             unsigned int context_id, int i)
 {
@@ -908,6 +1134,7 @@ static DP_TransientTile *get_transient_tile(DP_TransientLayerContent *tlc,
         DP_TransientTile *tt = DP_transient_tile_new(t, context_id);
         tlc->elements[i].transient_tile = tt;
         DP_tile_decref(t);
+        mark_changed(tlc, i);
         return tt;
     }
 }
@@ -925,11 +1152,13 @@ get_or_create_transient_tile(DP_TransientLayerContent *tlc,
     if (!tile) {
         tlc->elements[i].transient_tile =
             DP_transient_tile_new_blank(context_id);
+        mark_changed(tlc, i);
     }
     else if (!DP_tile_transient(tile)) {
         tlc->elements[i].transient_tile =
             DP_transient_tile_new(tile, context_id);
         DP_tile_decref(tile);
+        mark_changed(tlc, i);
     }
     return tlc->elements[i].transient_tile;
 }
@@ -1128,6 +1357,7 @@ DP_TransientLayerContent *DP_transient_layer_content_new(DP_LayerContent *lc)
     }
     tlc->sub.contents = DP_layer_list_incref(lc->sub.contents);
     tlc->sub.props = DP_layer_props_list_incref(lc->sub.props);
+    changes_track(tlc, lc);
     return tlc;
 }
 
@@ -1192,6 +1422,8 @@ DP_transient_layer_content_persist(DP_TransientLayerContent *tlc)
     DP_ASSERT(DP_atomic_get(&tlc->refcount) > 0);
     DP_ASSERT(tlc->transient);
     tlc->transient = false;
+    DP_free(tlc->changes.bits);
+    tlc->changes.bits = NULL;
     int count = DP_tile_total_round(tlc->width, tlc->height);
     for (int i = 0; i < count; ++i) {
         DP_Tile *tile = tlc->elements[i].tile;
@@ -1249,6 +1481,7 @@ void DP_transient_layer_content_transient_tile_at_set_noinc(
     int i = y * DP_tile_count_round(tlc->width) + x;
     DP_tile_decref_nullable(tlc->elements[i].tile);
     tlc->elements[i].transient_tile = tt;
+    mark_changed(tlc, i);
 }
 
 
@@ -1305,6 +1538,7 @@ static DP_TransientTile *create_transient_tile(DP_TransientLayerContent *tlc,
     DP_ASSERT(!tlc->elements[i].tile);
     DP_TransientTile *tt = DP_transient_tile_new_blank(context_id);
     tlc->elements[i].transient_tile = tt;
+    mark_changed(tlc, i);
     return tt;
 }
 
@@ -1552,6 +1786,7 @@ static void fill_rect(DP_TransientLayerContent *tlc, unsigned int context_id,
             else if (blend_blank) {
                 tt = DP_transient_tile_new_blank(context_id);
                 tlc->elements[i].transient_tile = tt;
+                mark_changed(tlc, i);
             }
             else {
                 continue; // Nothing to do on a blank tile.
@@ -1576,6 +1811,7 @@ static void fill_entirely(DP_TransientLayerContent *tld,
         for (int i = 0; i < tile_count; ++i) {
             DP_tile_decref_nullable(tld->elements[i].tile);
             tld->elements[i].tile = tile;
+            mark_changed(tld, i);
         }
     }
     else {
@@ -1610,6 +1846,7 @@ void DP_transient_layer_content_tile_set_noinc(DP_TransientLayerContent *tlc,
     DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
     DP_tile_decref_nullable(tlc->elements[i].tile);
     tlc->elements[i].tile = t;
+    mark_changed(tlc, i);
 }
 
 void DP_transient_layer_content_transient_tile_set_noinc(
@@ -1621,6 +1858,7 @@ void DP_transient_layer_content_transient_tile_set_noinc(
     DP_ASSERT(i < DP_tile_total_round(tlc->width, tlc->height));
     DP_tile_decref_nullable(tlc->elements[i].tile);
     tlc->elements[i].transient_tile = tt;
+    mark_changed(tlc, i);
 }
 
 void DP_transient_layer_content_put_tile_inc(DP_TransientLayerContent *tlc,
@@ -1646,6 +1884,7 @@ void DP_transient_layer_content_put_tile_inc(DP_TransientLayerContent *tlc,
     for (int i = start; i < end; ++i) {
         DP_tile_decref_nullable(tlc->elements[i].tile);
         tlc->elements[i].tile = tile;
+        mark_changed(tlc, i);
     }
 }
 
@@ -1876,5 +2115,6 @@ DP_transient_layer_content_render_tile(DP_TransientLayerContent *tlc,
     DP_TransientTile *tt = DP_canvas_state_flatten_tile(
         cs, tile_index, DP_FLAT_IMAGE_RENDER_FLAGS, &vmf);
     tlc->elements[tile_index].transient_tile = tt;
+    mark_changed(tlc, tile_index);
     return tt;
 }
@@ -101,6 +101,11 @@ bool DP_layer_content_search_change_bounds(DP_LayerContent *lc,
                                            int *out_y, int *out_width,
                                            int *out_height);
 
+// Pixel bounds of all non-blank tiles, which may extend past the edges of the
+// layer. Returns false if the whole thing is blank.
+bool DP_layer_content_bounds(DP_LayerContent *lc, bool include_sublayers,
+                             DP_Rect *out_bounds);
+
 DP_Image *DP_layer_content_to_image(DP_LayerContent *lc);
 
 DP_UPixel8 *
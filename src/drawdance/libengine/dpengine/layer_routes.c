@@ -31,31 +31,177 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpmsg/message.h>
-#include <uthash_inc.h>
 
 
+// Routes are kept in a persistent trie keyed by layer id, so that a new set of
+// routes can share everything that didn't change with the one it's derived
+// from. Each node covers NODE_BITS of the id, the root covers the highest bits
+// needed for the ids in it. Nodes at the bottom level hold the entries.
+#define NODE_BITS 4
+#define NODE_SIZE (1 << NODE_BITS)
+#define NODE_MASK (NODE_SIZE - 1)
+
 typedef struct DP_LayerRoutesEntry {
-    UT_hash_handle hh;
+    DP_Atomic refcount;
     bool is_group;
     int layer_id;
     int index_count;
     int indexes[];
 } DP_LayerRoutesEntry;
 
+typedef struct DP_LayerRoutesNode {
+    DP_Atomic refcount;
+    void *children[NODE_SIZE];
+} DP_LayerRoutesNode;
+
 
 struct DP_LayerRoutes {
     DP_Atomic refcount;
-    DP_LayerRoutesEntry *entries;
+    int shift;
+    DP_LayerRoutesNode *root;
+    // The persistent layer props these routes were built from, if any. Used to
+    // figure out what changed when the layers get reindexed. If they were
+    // built from transient layer props, those get filled in when persisted.
+    DP_LayerPropsList *lpl;
+    bool lpl_pending;
 };
 
 
 DP_LayerRoutes *DP_layer_routes_new(void)
 {
     DP_LayerRoutes *lr = DP_malloc(sizeof(*lr));
-    *lr = (DP_LayerRoutes){DP_ATOMIC_INIT(1), NULL};
+    *lr = (DP_LayerRoutes){DP_ATOMIC_INIT(1), 0, NULL, NULL, false};
     return lr;
 }
 
+
+static unsigned int route_key(int layer_id)
+{
+    // Layer ids are positive and fit into 16 bits, but anything else still
+    // works, it just makes for a deeper trie.
+    return (unsigned int)layer_id;
+}
+
+static void entry_decref(DP_LayerRoutesEntry *lre)
+{
+    if (DP_atomic_dec(&lre->refcount)) {
+        DP_free(lre);
+    }
+}
+
+static DP_LayerRoutesNode *node_new(void)
+{
+    DP_LayerRoutesNode *node = DP_malloc(sizeof(*node));
+    DP_atomic_set(&node->refcount, 1);
+    for (int i = 0; i < NODE_SIZE; ++i) {
+        node->children[i] = NULL;
+    }
+    return node;
+}
+
+static void node_decref(DP_LayerRoutesNode *node, int shift)
+{
+    if (DP_atomic_dec(&node->refcount)) {
+        for (int i = 0; i < NODE_SIZE; ++i) {
+            void *child = node->children[i];
+            if (!child) {
+                continue;
+            }
+            else if (shift == 0) {
+                entry_decref(child);
+            }
+            else {
+                node_decref(child, shift - NODE_BITS);
+            }
+        }
+        DP_free(node);
+    }
+}
+
+static DP_LayerRoutesNode *node_copy(DP_LayerRoutesNode *node, int shift)
+{
+    DP_LayerRoutesNode *copy = DP_malloc(sizeof(*copy));
+    DP_atomic_set(&copy->refcount, 1);
+    for (int i = 0; i < NODE_SIZE; ++i) {
+        void *child = node->children[i];
+        if (!child) {
+            copy->children[i] = NULL;
+        }
+        else if (shift == 0) {
+            DP_LayerRoutesEntry *lre = child;
+            DP_atomic_inc(&lre->refcount);
+            copy->children[i] = lre;
+        }
+        else {
+            DP_LayerRoutesNode *child_node = child;
+            DP_atomic_inc(&child_node->refcount);
+            copy->children[i] = child_node;
+        }
+    }
+    return copy;
+}
+
+// Nodes only referenced by the routes being built can be changed in place,
+// shared ones have to be copied first.
+static DP_LayerRoutesNode *node_writable(DP_LayerRoutesNode **slot, int shift)
+{
+    DP_LayerRoutesNode *node = *slot;
+    if (DP_atomic_get(&node->refcount) != 1) {
+        DP_LayerRoutesNode *copy = node_copy(node, shift);
+        node_decref(node, shift);
+        *slot = copy;
+        return copy;
+    }
+    else {
+        return node;
+    }
+}
+
+// Puts the given entry into the routes, replacing whatever was there under the
+// same layer id before. Passing NULL removes the entry.
+static void routes_set(DP_LayerRoutes *lr, int layer_id,
+                       DP_LayerRoutesEntry *lre_or_null)
+{
+    unsigned int key = route_key(layer_id);
+    if (!lr->root) {
+        if (!lre_or_null) {
+            return;
+        }
+        lr->root = node_new();
+        lr->shift = 0;
+    }
+
+    while ((key >> lr->shift) >> NODE_BITS != 0) {
+        if (!lre_or_null) {
+            return; // Not in here, nothing to remove.
+        }
+        DP_LayerRoutesNode *root = node_new();
+        root->children[0] = lr->root;
+        lr->root = root;
+        lr->shift += NODE_BITS;
+    }
+
+    DP_LayerRoutesNode **slot = &lr->root;
+    for (int shift = lr->shift; shift > 0; shift -= NODE_BITS) {
+        DP_LayerRoutesNode *node = node_writable(slot, shift);
+        int i = DP_uint_to_int((key >> shift) & NODE_MASK);
+        slot = (DP_LayerRoutesNode **)&node->children[i];
+        if (!*slot) {
+            if (!lre_or_null) {
+                return;
+            }
+            *slot = node_new();
+        }
+    }
+
+    DP_LayerRoutesNode *leaf = node_writable(slot, 0);
+    void **child = &leaf->children[key & NODE_MASK];
+    if (*child) {
+        entry_decref(*child);
+    }
+    *child = lre_or_null;
+}
+
 static void insert(DP_LayerRoutes *lr, DP_DrawContext *dc, DP_LayerProps *lp,
                    bool is_group)
 {
@@ -64,6 +210,7 @@ static void insert(DP_LayerRoutes *lr, DP_DrawContext *dc, DP_LayerProps *lp,
 
     DP_LayerRoutesEntry *lre = DP_malloc(DP_FLEX_SIZEOF(
         DP_LayerRoutesEntry, indexes, DP_int_to_size(index_count)));
+    DP_atomic_set(&lre->refcount, 1);
     lre->layer_id = DP_layer_props_id(lp);
     lre->is_group = is_group;
     lre->index_count = index_count;
@@ -71,7 +218,18 @@ static void insert(DP_LayerRoutes *lr, DP_DrawContext *dc, DP_LayerProps *lp,
         lre->indexes[i] = indexes[i];
     }
 
-    HASH_ADD_INT(lr->entries, layer_id, lre);
+    routes_set(lr, lre->layer_id, lre);
+}
+
+static void set_indexed_lpl(DP_LayerRoutes *lr, DP_LayerPropsList *lpl)
+{
+    // Transient layer props may still change, so we can't hold onto those.
+    if (DP_layer_props_list_transient(lpl)) {
+        lr->lpl_pending = true;
+    }
+    else {
+        lr->lpl = DP_layer_props_list_incref(lpl);
+    }
 }
 
 static void index_layers(DP_LayerRoutes *lr, DP_DrawContext *dc,
@@ -97,11 +255,142 @@ DP_LayerRoutes *DP_layer_routes_new_index(DP_LayerPropsList *lpl,
     DP_ASSERT(lpl);
     DP_ASSERT(dc);
     DP_LayerRoutes *lr = DP_layer_routes_new();
+    set_indexed_lpl(lr, lpl);
     DP_draw_context_layer_indexes_clear(dc);
     index_layers(lr, dc, lpl);
     return lr;
 }
 
+
+// A layer keeps its route if it has the same id and is still the same kind of
+// layer at the same index. Its children may still have changed though.
+static bool same_route(DP_LayerProps *prev_lp, DP_LayerProps *lp)
+{
+    return DP_layer_props_id(prev_lp) == DP_layer_props_id(lp)
+        && !DP_layer_props_children_noinc(prev_lp)
+               == !DP_layer_props_children_noinc(lp);
+}
+
+// The previous layer props are persistent, so if the new ones are too and it's
+// the same list, nothing in it can have changed.
+static bool same_children(DP_LayerProps *prev_lp, DP_LayerProps *lp)
+{
+    DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+    return !child_lpl
+        || (child_lpl == DP_layer_props_children_noinc(prev_lp)
+            && !DP_layer_props_list_transient(child_lpl));
+}
+
+static void remove_layers(DP_LayerRoutes *lr, DP_LayerPropsList *lpl)
+{
+    int count = DP_layer_props_list_count(lpl);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        routes_set(lr, DP_layer_props_id(lp), NULL);
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        if (child_lpl) {
+            remove_layers(lr, child_lpl);
+        }
+    }
+}
+
+static void remove_changed(DP_LayerRoutes *lr, DP_LayerPropsList *prev_lpl,
+                           DP_LayerPropsList *lpl)
+{
+    int prev_count = DP_layer_props_list_count(prev_lpl);
+    int count = DP_layer_props_list_count(lpl);
+    for (int i = 0; i < prev_count; ++i) {
+        DP_LayerProps *prev_lp = DP_layer_props_list_at_noinc(prev_lpl, i);
+        DP_LayerProps *lp =
+            i < count ? DP_layer_props_list_at_noinc(lpl, i) : NULL;
+        if (lp && same_route(prev_lp, lp)) {
+            if (!same_children(prev_lp, lp)) {
+                remove_changed(lr, DP_layer_props_children_noinc(prev_lp),
+                               DP_layer_props_children_noinc(lp));
+            }
+        }
+        else {
+            routes_set(lr, DP_layer_props_id(prev_lp), NULL);
+            DP_LayerPropsList *child_lpl =
+                DP_layer_props_children_noinc(prev_lp);
+            if (child_lpl) {
+                remove_layers(lr, child_lpl);
+            }
+        }
+    }
+}
+
+static void insert_changed(DP_LayerRoutes *lr, DP_DrawContext *dc,
+                           DP_LayerPropsList *prev_lpl, DP_LayerPropsList *lpl)
+{
+    int prev_count = DP_layer_props_list_count(prev_lpl);
+    int count = DP_layer_props_list_count(lpl);
+    DP_draw_context_layer_indexes_push(dc);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerProps *prev_lp =
+            i < prev_count ? DP_layer_props_list_at_noinc(prev_lpl, i) : NULL;
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        DP_draw_context_layer_indexes_set(dc, i);
+        if (prev_lp && same_route(prev_lp, lp)) {
+            if (!same_children(prev_lp, lp)) {
+                insert_changed(lr, dc, DP_layer_props_children_noinc(prev_lp),
+                               child_lpl);
+            }
+        }
+        else {
+            insert(lr, dc, lp, child_lpl);
+            if (child_lpl) {
+                index_layers(lr, dc, child_lpl);
+            }
+        }
+    }
+    DP_draw_context_layer_indexes_pop(dc);
+}
+
+DP_LayerRoutes *DP_layer_routes_new_reindex(DP_LayerRoutes *prev_lr_or_null,
+                                            DP_LayerPropsList *lpl,
+                                            DP_DrawContext *dc)
+{
+    DP_ASSERT(lpl);
+    DP_ASSERT(dc);
+    DP_LayerPropsList *prev_lpl =
+        prev_lr_or_null ? prev_lr_or_null->lpl : NULL;
+    if (!prev_lpl) {
+        return DP_layer_routes_new_index(lpl, dc);
+    }
+
+    DP_LayerRoutes *lr = DP_layer_routes_new();
+    lr->shift = prev_lr_or_null->shift;
+    if (prev_lr_or_null->root) {
+        lr->root = prev_lr_or_null->root;
+        DP_atomic_inc(&lr->root->refcount);
+    }
+    set_indexed_lpl(lr, lpl);
+
+    // Remove everything that went away or moved first, since a moved layer
+    // would otherwise get its new route clobbered again.
+    remove_changed(lr, prev_lpl, lpl);
+    DP_draw_context_layer_indexes_clear(dc);
+    insert_changed(lr, dc, prev_lpl, lpl);
+    return lr;
+}
+
+void DP_layer_routes_persisted(DP_LayerRoutes *lr, DP_LayerPropsList *lpl)
+{
+    DP_ASSERT(lr);
+    DP_ASSERT(DP_atomic_get(&lr->refcount) > 0);
+    DP_ASSERT(lpl);
+    DP_ASSERT(!DP_layer_props_list_transient(lpl));
+    // If someone else got a hold of these routes in the meantime, leave them
+    // alone. That just means the next reindex has to start from scratch.
+    if (lr->lpl_pending && DP_atomic_get(&lr->refcount) == 1) {
+        DP_ASSERT(!lr->lpl);
+        lr->lpl = DP_layer_props_list_incref(lpl);
+        lr->lpl_pending = false;
+    }
+}
+
 DP_LayerRoutes *DP_layer_routes_incref(DP_LayerRoutes *lr)
 {
     DP_ASSERT(lr);
@@ -120,11 +409,10 @@ void DP_layer_routes_decref(DP_LayerRoutes *lr)
     DP_ASSERT(lr);
     DP_ASSERT(DP_atomic_get(&lr->refcount) > 0);
     if (DP_atomic_dec(&lr->refcount)) {
-        DP_LayerRoutesEntry *lre, *tmp;
-        HASH_ITER(hh, lr->entries, lre, tmp) {
-            HASH_DEL(lr->entries, lre);
-            DP_free(lre);
+        if (lr->root) {
+            node_decref(lr->root, lr->shift);
         }
+        DP_layer_props_list_decref_nullable(lr->lpl);
         DP_free(lr);
     }
 }
@@ -140,9 +428,19 @@ DP_LayerRoutesEntry *DP_layer_routes_search(DP_LayerRoutes *lr, int layer_id)
 {
     DP_ASSERT(lr);
     DP_ASSERT(DP_atomic_get(&lr->refcount) > 0);
-    DP_LayerRoutesEntry *lre;
-    HASH_FIND_INT(lr->entries, &layer_id, lre);
-    return lre;
+    unsigned int key = route_key(layer_id);
+    DP_LayerRoutesNode *node = lr->root;
+    if (!node || (key >> lr->shift) >> NODE_BITS != 0) {
+        return NULL;
+    }
+
+    for (int shift = lr->shift; shift > 0; shift -= NODE_BITS) {
+        node = node->children[(key >> shift) & NODE_MASK];
+        if (!node) {
+            return NULL;
+        }
+    }
+    return node->children[key & NODE_MASK];
 }
 
 
@@ -560,20 +858,17 @@ static void to_transient(DP_TransientLayerList **tllp,
     *tlplp = DP_transient_layer_props_transient_children(tlp, reserve);
 }
 
-void DP_layer_routes_entry_transient_children(
-    DP_LayerRoutesEntry *lre, DP_TransientCanvasState *tcs, int offset,
-    int reserve, DP_TransientLayerList **out_tll,
-    DP_TransientLayerPropsList **out_tlpl)
+void DP_layer_routes_entry_indexes_transient_children(
+    int index_count, int *indexes, DP_TransientCanvasState *tcs, int reserve,
+    DP_TransientLayerList **out_tll, DP_TransientLayerPropsList **out_tlpl)
 {
-    DP_ASSERT(lre);
+    DP_ASSERT(index_count >= 0);
+    DP_ASSERT(index_count == 0 || indexes);
     DP_ASSERT(tcs);
-    DP_ASSERT(offset <= 0);
     DP_ASSERT(reserve >= 0);
     DP_ASSERT(out_tll);
     DP_ASSERT(out_tlpl);
 
-    int index_count = lre->index_count + offset;
-    int *indexes = lre->indexes;
     if (index_count == 0) {
         *out_tll = DP_transient_canvas_state_transient_layers(tcs, reserve);
         *out_tlpl =
@@ -594,3 +889,15 @@ void DP_layer_routes_entry_transient_children(
         *out_tlpl = tlpl;
     }
 }
+
+void DP_layer_routes_entry_transient_children(
+    DP_LayerRoutesEntry *lre, DP_TransientCanvasState *tcs, int offset,
+    int reserve, DP_TransientLayerList **out_tll,
+    DP_TransientLayerPropsList **out_tlpl)
+{
+    DP_ASSERT(lre);
+    DP_ASSERT(offset <= 0);
+    DP_layer_routes_entry_indexes_transient_children(
+        lre->index_count + offset, lre->indexes, tcs, reserve, out_tll,
+        out_tlpl);
+}
@@ -57,6 +57,18 @@ DP_LayerRoutes *DP_layer_routes_new(void);
 DP_LayerRoutes *DP_layer_routes_new_index(DP_LayerPropsList *lpl,
                                           DP_DrawContext *dc);
 
+// Indexes the given layer props, reusing whatever didn't change from the
+// previous routes. Only layers whose index path changed get new entries, the
+// rest is shared with the previous routes. Falls back to indexing everything
+// if the previous routes weren't built from persistent layer props.
+DP_LayerRoutes *DP_layer_routes_new_reindex(DP_LayerRoutes *prev_lr_or_null,
+                                            DP_LayerPropsList *lpl,
+                                            DP_DrawContext *dc);
+
+// Must be called when the transient layer props that the routes were indexed
+// from get persisted, so that the next reindex can compare against them.
+void DP_layer_routes_persisted(DP_LayerRoutes *lr, DP_LayerPropsList *lpl);
+
 DP_LayerRoutes *DP_layer_routes_incref(DP_LayerRoutes *lr);
 
 DP_LayerRoutes *DP_layer_routes_incref_nullable(DP_LayerRoutes *lr_or_null);
@@ -124,6 +136,10 @@ DP_TransientLayerProps *
 DP_layer_routes_entry_transient_props(DP_LayerRoutesEntry *lre,
                                       DP_TransientCanvasState *tcs);
 
+void DP_layer_routes_entry_indexes_transient_children(
+    int index_count, int *indexes, DP_TransientCanvasState *tcs, int reserve,
+    DP_TransientLayerList **out_tll, DP_TransientLayerPropsList **out_tlpl);
+
 void DP_layer_routes_entry_transient_children(
     DP_LayerRoutesEntry *lre, DP_TransientCanvasState *tcs, int offset,
     int reserve, DP_TransientLayerList **out_tll,
@@ -1334,7 +1334,7 @@ static DP_CanvasState *load(DP_DrawContext *dc, const char *path,
     if (guess_psd(buf, read)) {
         assign_type(out_type, DP_SAVE_IMAGE_PSD);
         if (DP_input_rewind_by(input, read)) {
-            return DP_load_psd(dc, input, out_result);
+            return DP_load_psd(dc, input, flags, out_result);
         }
         else {
             assign_load_result(out_result, DP_LOAD_RESULT_READ_ERROR);
@@ -9,8 +9,11 @@ extern "C" {
 #include "layer_props_list.h"
 #include "load.h"
 #include "rust.h"
+#include <dpcommon/binary.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/input.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 }
 #include <Psd.h>
@@ -20,6 +23,7 @@ extern "C" {
 #include <PsdChannel.h>
 #include <PsdChannelType.h>
 #include <PsdColorMode.h>
+#include <PsdCompressionType.h>
 #include <PsdDocument.h>
 #include <PsdFile.h>
 #include <PsdLayer.h>
@@ -29,6 +33,7 @@ extern "C" {
 #include <PsdMemoryUtil.h>
 #include <PsdParseDocument.h>
 #include <PsdParseLayerMaskSection.h>
+#include <Psdminiz.h>
 #include <utility>
 #include <vector>
 
@@ -209,7 +214,222 @@ static void combine8(int size, DP_Pixel8 *pixels, const uint8_t *a,
     }
 }
 
-static void extract_layer_pixels(psd::Document *document, psd::Layer *layer,
+static void apply_prediction8(int width, int height, uint8_t *data)
+{
+    for (int y = 0; y < height; ++y) {
+        uint8_t *row = data + y * width;
+        for (int x = 1; x < width; ++x) {
+            row[x] = uint8_t(row[x] + row[x - 1]);
+        }
+    }
+}
+
+// Decompresses a single PackBits-compressed row. Fails if the input runs out
+// before the row is filled, if a run would go beyond the end of the row or if
+// there's data left over after it.
+static bool decompress_rle_row(const unsigned char *in, size_t in_size,
+                               uint8_t *out, size_t out_size)
+{
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+    while (in_pos < in_size) {
+        int header = static_cast<signed char>(in[in_pos++]);
+        if (header >= 0) {
+            size_t count = DP_int_to_size(header) + 1;
+            if (in_size - in_pos < count || out_size - out_pos < count) {
+                return false;
+            }
+            memcpy(out + out_pos, in + in_pos, count);
+            in_pos += count;
+            out_pos += count;
+        }
+        else if (header != -128) { // -128 is a no-op.
+            size_t count = DP_int_to_size(1 - header);
+            if (in_pos == in_size || out_size - out_pos < count) {
+                return false;
+            }
+            memset(out + out_pos, in[in_pos++], count);
+            out_pos += count;
+        }
+    }
+    return out_pos == out_size;
+}
+
+// Decompresses 8 bit channel data, prefixed by its compression type, into
+// planar data of the given size. Returns false if the channel is broken or if
+// it doesn't actually contain anything, in which case it's treated as missing.
+static bool decompress_channel(const unsigned char *data, size_t size,
+                               int width, int height, uint8_t *out)
+{
+    size_t out_size = DP_int_to_size(width) * DP_int_to_size(height);
+    unsigned int compression = DP_read_bigendian_uint16(data);
+    const unsigned char *in = data + 2;
+    size_t in_size = size - 2;
+    switch (compression) {
+    case psd::compressionType::RAW:
+        if (in_size < out_size) {
+            DP_warn("PSD raw channel has %zu bytes, expected %zu", in_size,
+                    out_size);
+            return false;
+        }
+        memcpy(out, in, out_size);
+        return true;
+    case psd::compressionType::RLE: {
+        // The compressed data is preceded by a byte count for each row.
+        size_t counts_size = DP_int_to_size(height) * 2;
+        if (in_size < counts_size) {
+            DP_warn("PSD RLE channel too short for row byte counts");
+            return false;
+        }
+        size_t rle_size = 0;
+        for (int y = 0; y < height; ++y) {
+            rle_size += DP_read_bigendian_uint16(in + y * 2);
+        }
+        if (rle_size == 0) {
+            return false;
+        }
+        else if (in_size - counts_size < rle_size) {
+            DP_warn("PSD RLE channel has %zu bytes, expected %zu",
+                    in_size - counts_size, rle_size);
+            return false;
+        }
+        // Each row is decompressed on its own, so that a broken one can't
+        // spill over into the next or beyond the end of the channel.
+        const unsigned char *row_in = in + counts_size;
+        size_t row_size = DP_int_to_size(width);
+        for (int y = 0; y < height; ++y) {
+            size_t count = DP_read_bigendian_uint16(in + y * 2);
+            if (!decompress_rle_row(row_in, count,
+                                    out + DP_int_to_size(y) * row_size,
+                                    row_size)) {
+                DP_warn("PSD RLE channel row %d doesn't decompress to %zu "
+                        "bytes",
+                        y, row_size);
+                return false;
+            }
+            row_in += count;
+        }
+        return true;
+    }
+    case psd::compressionType::ZIP:
+    case psd::compressionType::ZIP_WITH_PREDICTION: {
+        size_t status = tinfl_decompress_mem_to_mem(
+            out, out_size, in, in_size, TINFL_FLAG_PARSE_ZLIB_HEADER);
+        if (status == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED) {
+            DP_warn("Error decompressing PSD ZIP channel");
+            return false;
+        }
+        else if (status != out_size) {
+            DP_warn("PSD ZIP channel decompressed to %zu bytes, expected %zu",
+                    status, out_size);
+            return false;
+        }
+        if (compression == psd::compressionType::ZIP_WITH_PREDICTION) {
+            apply_prediction8(width, height, out);
+        }
+        return true;
+    }
+    default:
+        DP_warn("Unsupported PSD channel compression %u", compression);
+        return false;
+    }
+}
+
+struct DP_PsdLayerPixelsParams {
+    DP_TransientLayerContent *tlc;
+    int left, top, width, height;
+    // Compressed alpha, red, green and blue channel data as read from the
+    // file, null for channels that aren't present. Freed by the job.
+    unsigned char *channels[4];
+    size_t sizes[4];
+};
+
+static void load_layer_pixels_job(void *user, DP_UNUSED int thread_index)
+{
+    DP_PsdLayerPixelsParams *params =
+        static_cast<DP_PsdLayerPixelsParams *>(user);
+    int width = params->width;
+    int height = params->height;
+    int size = width * height;
+
+    uint8_t *planes =
+        static_cast<uint8_t *>(DP_malloc(DP_int_to_size(size) * 4));
+    const uint8_t *argb[4];
+    bool have_data = false;
+    for (int i = 0; i < 4; ++i) {
+        unsigned char *data = params->channels[i];
+        uint8_t *plane = planes + DP_int_to_size(size) * DP_int_to_size(i);
+        if (data
+            && decompress_channel(data, params->sizes[i], width, height,
+                                  plane)) {
+            argb[i] = plane;
+            have_data = true;
+        }
+        else {
+            argb[i] = nullptr;
+        }
+        DP_free(data);
+    }
+
+    if (have_data) {
+        DP_Image *img = DP_image_new(width, height);
+        combine8(size, DP_image_pixels(img), argb[0], argb[1], argb[2],
+                 argb[3]);
+        DP_free(planes);
+        DP_transient_layer_content_put_image(params->tlc, 1,
+                                             DP_BLEND_MODE_REPLACE,
+                                             params->left, params->top, img);
+        DP_image_free(img);
+    }
+    else {
+        DP_free(planes);
+    }
+}
+
+static int channel_index(int type)
+{
+    switch (type) {
+    case psd::channelType::TRANSPARENCY_MASK:
+        return 0;
+    case psd::channelType::R:
+        return 1;
+    case psd::channelType::G:
+        return 2;
+    case psd::channelType::B:
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+static unsigned char *read_channel(psd::File *file, psd::Channel *channel,
+                                   size_t *out_size)
+{
+    uint32_t size = channel->size;
+    if (size < 2) {
+        return nullptr;
+    }
+
+    unsigned char *buffer =
+        static_cast<unsigned char *>(DP_malloc(DP_uint32_to_size(size)));
+    psd::File::ReadOperation op =
+        file->Read(buffer, size, channel->fileOffset);
+    if (op && file->WaitForRead(op)) {
+        *out_size = DP_uint32_to_size(size);
+        return buffer;
+    }
+    else {
+        DP_warn("Error reading %u bytes of PSD channel data", size);
+        DP_free(buffer);
+        return nullptr;
+    }
+}
+
+// Only the compressed channel data is read here. Decompressing it and turning
+// it into tiles is the slow part, so that's done in the worker if we have one.
+// Those are joined before the layer content is used for anything.
+static void extract_layer_pixels(psd::File *file, DP_Worker *worker,
+                                 psd::Layer *layer,
                                  DP_TransientLayerContent *tlc)
 {
     int left = layer->left;
@@ -220,63 +440,34 @@ static void extract_layer_pixels(psd::Document *document, psd::Layer *layer,
         return;
     }
 
+    DP_PsdLayerPixelsParams params = {
+        tlc, left, top, right - left, bottom - top, {}, {}};
+    bool have_channels = false;
     unsigned int channel_count = layer->channelCount;
-    void *a = nullptr;
-    void *r = nullptr;
-    void *b = nullptr;
-    void *g = nullptr;
     for (unsigned int i = 0; i < channel_count; ++i) {
         psd::Channel *channel = &layer->channels[i];
-        if (channel->data) {
-            switch (channel->type) {
-            case psd::channelType::TRANSPARENCY_MASK:
-                if (!a) {
-                    a = channel->data;
-                }
-                break;
-            case psd::channelType::R:
-                if (!r) {
-                    r = channel->data;
-                }
-                break;
-            case psd::channelType::G:
-                if (!g) {
-                    g = channel->data;
-                }
-                break;
-            case psd::channelType::B:
-                if (!b) {
-                    b = channel->data;
-                }
-                break;
-            default:
-                break;
-            }
+        int index = channel_index(channel->type);
+        if (index != -1 && !params.channels[index]) {
+            params.channels[index] =
+                read_channel(file, channel, &params.sizes[index]);
+            have_channels = have_channels || params.channels[index];
         }
     }
-    if (a || r || g || b) {
-        int width = right - left;
-        int height = bottom - top;
-        int size = width * height;
-        DP_Image *img = DP_image_new(width, height);
-        DP_Pixel8 *pixels = DP_image_pixels(img);
-        switch (document->bitsPerChannel) {
-        case 8:
-            combine8(size, pixels, static_cast<uint8_t *>(a),
-                     static_cast<uint8_t *>(r), static_cast<uint8_t *>(g),
-                     static_cast<uint8_t *>(b));
-            break;
-        default:
-            DP_UNREACHABLE();
+
+    if (have_channels) {
+        if (worker) {
+            DP_worker_push(worker, &params);
+        }
+        else {
+            load_layer_pixels_job(&params, 0);
         }
-        DP_transient_layer_content_put_image(tlc, 1, DP_BLEND_MODE_REPLACE,
-                                             left, top, img);
-        DP_image_free(img);
     }
 }
 
 static DP_PsdLayerPair extract_layer_content(psd::Document *document,
-                                             int &layer_id, psd::Layer *layer)
+                                             psd::File *file,
+                                             DP_Worker *worker, int &layer_id,
+                                             psd::Layer *layer)
 {
     DP_PsdLayerPair p;
     p.tlp = DP_transient_layer_props_new_init(layer_id++, false);
@@ -284,14 +475,15 @@ static DP_PsdLayerPair extract_layer_content(psd::Document *document,
 
     p.t.lc = DP_transient_layer_content_new_init(
         int(document->width), int(document->height), nullptr);
-    extract_layer_pixels(document, layer, p.t.lc);
+    extract_layer_pixels(file, worker, layer, p.t.lc);
 
     return p;
 }
 
-static std::vector<DP_PsdLayerPair> extract_layers_recursive(
-    psd::Document *document, psd::File *file, psd::Allocator *allocator,
-    psd::LayerMaskSection *section, unsigned int &i, int &layer_id);
+static std::vector<DP_PsdLayerPair>
+extract_layers_recursive(psd::Document *document, psd::File *file,
+                         DP_Worker *worker, psd::LayerMaskSection *section,
+                         unsigned int &i, int &layer_id);
 
 static std::pair<DP_TransientLayerPropsList *, DP_TransientLayerList *>
 build_layer_lists(const std::vector<DP_PsdLayerPair> &layers)
@@ -321,14 +513,13 @@ build_layer_lists(const std::vector<DP_PsdLayerPair> &layers)
 }
 
 static DP_PsdLayerPair extract_layer_group(psd::Document *document,
-                                           psd::File *file,
-                                           psd::Allocator *allocator,
+                                           psd::File *file, DP_Worker *worker,
                                            psd::LayerMaskSection *section,
                                            unsigned int &i, int &layer_id)
 {
     int group_id = layer_id++;
-    std::vector<DP_PsdLayerPair> layers = extract_layers_recursive(
-        document, file, allocator, section, i, layer_id);
+    std::vector<DP_PsdLayerPair> layers =
+        extract_layers_recursive(document, file, worker, section, i, layer_id);
 
     auto [tlpl, tll] = build_layer_lists(layers);
 
@@ -345,9 +536,10 @@ static DP_PsdLayerPair extract_layer_group(psd::Document *document,
     return p;
 }
 
-static std::vector<DP_PsdLayerPair> extract_layers_recursive(
-    psd::Document *document, psd::File *file, psd::Allocator *allocator,
-    psd::LayerMaskSection *section, unsigned int &i, int &layer_id)
+static std::vector<DP_PsdLayerPair>
+extract_layers_recursive(psd::Document *document, psd::File *file,
+                         DP_Worker *worker, psd::LayerMaskSection *section,
+                         unsigned int &i, int &layer_id)
 {
     std::vector<DP_PsdLayerPair> layers;
     while (i < section->layerCount) {
@@ -356,7 +548,7 @@ static std::vector<DP_PsdLayerPair> extract_layers_recursive(
         if (type == psd::layerType::SECTION_DIVIDER) {
             // Start of a new group.
             ++i;
-            layers.push_back(extract_layer_group(document, file, allocator,
+            layers.push_back(extract_layer_group(document, file, worker,
                                                  section, i, layer_id));
         }
         else if (type == psd::layerType::OPEN_FOLDER
@@ -367,8 +559,8 @@ static std::vector<DP_PsdLayerPair> extract_layers_recursive(
         else {
             // Regular layer.
             ++i;
-            psd::ExtractLayer(document, file, allocator, layer);
-            layers.push_back(extract_layer_content(document, layer_id, layer));
+            layers.push_back(
+                extract_layer_content(document, file, worker, layer_id, layer));
         }
     }
     return layers;
@@ -376,7 +568,8 @@ static std::vector<DP_PsdLayerPair> extract_layers_recursive(
 
 static DP_TransientCanvasState *extract_layers(psd::Document *document,
                                                psd::File *file,
-                                               psd::Allocator *allocator)
+                                               psd::Allocator *allocator,
+                                               unsigned int flags)
 {
     psd::LayerMaskSection *section =
         psd::ParseLayerMaskSection(document, file, allocator);
@@ -385,10 +578,20 @@ static DP_TransientCanvasState *extract_layers(psd::Document *document,
         return nullptr;
     }
 
+    DP_Worker *worker = nullptr;
+    if ((flags & DP_LOAD_FLAG_SINGLE_THREAD) == 0) {
+        worker = DP_worker_new(64, sizeof(DP_PsdLayerPixelsParams),
+                               DP_thread_cpu_count(32), load_layer_pixels_job);
+        if (!worker) {
+            DP_warn("Error creating worker: %s", DP_error());
+        }
+    }
+
     unsigned int i = 0;
     int layer_id = 0x100;
-    std::vector<DP_PsdLayerPair> layers = extract_layers_recursive(
-        document, file, allocator, section, i, layer_id);
+    std::vector<DP_PsdLayerPair> layers =
+        extract_layers_recursive(document, file, worker, section, i, layer_id);
+    DP_worker_free_join(worker);
     auto [tlpl, tll] = build_layer_lists(layers);
 
     psd::DestroyLayerMaskSection(section, allocator);
@@ -402,6 +605,7 @@ static DP_TransientCanvasState *extract_layers(psd::Document *document,
 }
 
 extern "C" DP_CanvasState *DP_load_psd(DP_DrawContext *dc, DP_Input *input,
+                                       unsigned int flags,
                                        DP_LoadResult *out_result)
 {
     psd::MallocAllocator allocator;
@@ -451,7 +655,8 @@ extern "C" DP_CanvasState *DP_load_psd(DP_DrawContext *dc, DP_Input *input,
         return nullptr;
     }
 
-    DP_TransientCanvasState *tcs = extract_layers(document, &file, &allocator);
+    DP_TransientCanvasState *tcs =
+        extract_layers(document, &file, &allocator, flags);
     psd::DestroyDocument(document, &allocator);
     file.Close();
     if (tcs) {
@@ -519,9 +519,30 @@ layer_tree_move_delete(DP_TransientCanvasState *tcs,
     return ltml;
 }
 
-void layer_tree_move_insert(DP_TransientCanvasState *tcs,
-                            struct DP_LayerTreeMoveLayer ltml, int parent_id,
-                            int sibling_id)
+// The routes still have the indexes from before the moved layer was deleted.
+// Anything that came after it in the same list has shifted down by one since.
+static int layer_tree_move_index_at(DP_LayerRoutesEntry *layer_lre,
+                                    DP_LayerRoutesEntry *lre, int i)
+{
+    int index = DP_layer_routes_entry_index_at(lre, i);
+    int last = DP_layer_routes_entry_index_count(layer_lre) - 1;
+    if (i != last || index <= DP_layer_routes_entry_index_at(layer_lre, i)) {
+        return index;
+    }
+
+    for (int j = 0; j < last; ++j) {
+        if (DP_layer_routes_entry_index_at(lre, j)
+            != DP_layer_routes_entry_index_at(layer_lre, j)) {
+            return index;
+        }
+    }
+    return index - 1;
+}
+
+static void layer_tree_move_insert(DP_TransientCanvasState *tcs,
+                                   DP_LayerRoutesEntry *layer_lre,
+                                   struct DP_LayerTreeMoveLayer ltml,
+                                   int parent_id, int sibling_id)
 {
     DP_LayerRoutes *lr = DP_transient_canvas_state_layer_routes_noinc(tcs);
 
@@ -533,8 +554,15 @@ void layer_tree_move_insert(DP_TransientCanvasState *tcs,
     }
     else {
         DP_LayerRoutesEntry *parent_lre = DP_layer_routes_search(lr, parent_id);
-        DP_layer_routes_entry_transient_children(parent_lre, tcs, 0, 1, &tll,
-                                                 &tlpl);
+        int index_count = DP_layer_routes_entry_index_count(parent_lre);
+        int *indexes =
+            DP_malloc(sizeof(*indexes) * DP_int_to_size(index_count));
+        for (int i = 0; i < index_count; ++i) {
+            indexes[i] = layer_tree_move_index_at(layer_lre, parent_lre, i);
+        }
+        DP_layer_routes_entry_indexes_transient_children(index_count, indexes,
+                                                         tcs, 1, &tll, &tlpl);
+        DP_free(indexes);
     }
 
     int index;
@@ -545,7 +573,9 @@ void layer_tree_move_insert(DP_TransientCanvasState *tcs,
     else {
         DP_LayerRoutesEntry *sibling_lre =
             DP_layer_routes_search(lr, sibling_id);
-        index = DP_layer_routes_entry_index_last(sibling_lre);
+        index = layer_tree_move_index_at(
+            layer_lre, sibling_lre,
+            DP_layer_routes_entry_index_count(sibling_lre) - 1);
     }
 
     DP_transient_layer_props_list_insert_inc(tlpl, ltml.lp, index);
@@ -569,8 +599,7 @@ DP_CanvasState *DP_ops_layer_tree_move(DP_CanvasState *cs, DP_DrawContext *dc,
 
     DP_TransientCanvasState *tcs = DP_transient_canvas_state_new(cs);
     struct DP_LayerTreeMoveLayer ltml = layer_tree_move_delete(tcs, layer_lre);
-    DP_transient_canvas_state_layer_routes_reindex(tcs, dc);
-    layer_tree_move_insert(tcs, ltml, parent_id, sibling_id);
+    layer_tree_move_insert(tcs, layer_lre, ltml, parent_id, sibling_id);
     DP_transient_canvas_state_layer_routes_reindex(tcs, dc);
     return DP_transient_canvas_state_persist(tcs);
 }
@@ -1092,6 +1092,29 @@ DP_BrushStamp DP_paint_color_sampling_stamp_make(uint16_t *data, int diameter,
     return (DP_BrushStamp){top - radius, left - radius, diameter, data};
 }
 
+DP_ColorSamplingWeights DP_paint_color_sampling_weights_make(int diameter)
+{
+    DP_ASSERT(diameter > 1);
+    int radius = diameter / 2;
+    return (DP_ColorSamplingWeights){
+        get_classic_lut(0.5),
+        DP_double_to_float(
+            DP_square_double((CLASSIC_LUT_RADIUS - 1.0) / radius)),
+    };
+}
+
+uint16_t
+DP_paint_color_sampling_weight_at(const DP_ColorSamplingWeights *csw, float dx,
+                                  float dy)
+{
+    DP_ASSERT(csw);
+    // Same calculation as in DP_paint_color_sampling_stamp_make.
+    float dist = (dx * dx + dy * dy) * csw->lut_scale;
+    return dist < (float)CLASSIC_LUT_SIZE
+             ? DP_float_to_uint16(DP_BIT15 * csw->lut[DP_float_to_int(dist)])
+             : 0;
+}
+
 DP_UPixelFloat DP_paint_sample_to_upixel(int diameter, float weight, float red,
                                          float green, float blue, float alpha)
 {
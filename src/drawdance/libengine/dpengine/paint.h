@@ -82,6 +82,19 @@ DP_BrushStamp DP_paint_color_sampling_stamp_make(uint16_t *data, int diameter,
                                                  int left, int top,
                                                  int last_diameter);
 
+// For when building a whole color sampling stamp isn't worth it, allows
+// getting the stamp's weight at an offset from its center instead.
+typedef struct DP_ColorSamplingWeights {
+    const float *lut;
+    float lut_scale;
+} DP_ColorSamplingWeights;
+
+DP_ColorSamplingWeights DP_paint_color_sampling_weights_make(int diameter);
+
+uint16_t
+DP_paint_color_sampling_weight_at(const DP_ColorSamplingWeights *csw, float dx,
+                                  float dy);
+
 DP_UPixelFloat DP_paint_sample_to_upixel(int diameter, float weight, float red,
                                          float green, float blue, float alpha);
 
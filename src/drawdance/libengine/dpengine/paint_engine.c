@@ -49,6 +49,7 @@
 #include <dpcommon/cpu.h>
 #include <dpcommon/file.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/mpsc_queue.h>
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
 #include <dpcommon/queue.h>
@@ -97,6 +98,17 @@ typedef struct DP_PaintEngineCursorChange {
     };
 } DP_PaintEngineCursorChange;
 
+// Other threads send messages in batches through the lock-free inbox, the
+// paint thread then moves them into its local and remote queues, which only it
+// touches. A batch stays in one piece, so batches from different threads can't
+// get interleaved with each other.
+typedef struct DP_PaintEngineBatch {
+    DP_MpscQueueNode node; // Must be first, the inbox gives back nodes.
+    bool local;
+    int count;
+    DP_Message *msgs[];
+} DP_PaintEngineBatch;
+
 struct DP_PaintEngine {
     DP_AclState *acls;
     DP_CanvasHistory *ch;
@@ -130,9 +142,9 @@ struct DP_PaintEngine {
     DP_AtomicPtr next_previews[DP_PREVIEW_COUNT];
     DP_Atomic preview_rerendered;
     DP_PreviewRenderer *preview_renderer;
+    DP_MpscQueue *inbox;
     DP_Queue local_queue;
     DP_Queue remote_queue;
-    DP_Semaphore *queue_sem;
     DP_Mutex *queue_mutex;
     DP_Atomic running;
     DP_Atomic catchup;
@@ -167,11 +179,50 @@ struct DP_PaintEngine {
 };
 
 
+static DP_PaintEngineBatch *batch_new(bool local, int capacity)
+{
+    DP_PaintEngineBatch *batch = DP_malloc(DP_FLEX_SIZEOF(
+        DP_PaintEngineBatch, msgs, DP_int_to_size(capacity)));
+    batch->local = local;
+    batch->count = 0;
+    return batch;
+}
+
+static void batch_push_noinc(DP_PaintEngineBatch *batch, DP_Message *msg)
+{
+    batch->msgs[batch->count++] = msg;
+}
+
+static void send_batch(DP_PaintEngine *pe, DP_PaintEngineBatch *batch)
+{
+    DP_mpsc_queue_push(pe->inbox, &batch->node);
+}
+
+static void send_message_noinc(DP_PaintEngine *pe, bool local, DP_Message *msg)
+{
+    DP_PaintEngineBatch *batch = batch_new(local, 1);
+    batch_push_noinc(batch, msg);
+    send_batch(pe, batch);
+}
+
+static void drain_inbox(DP_PaintEngine *pe)
+{
+    DP_MpscQueueNode *node;
+    while ((node = DP_mpsc_queue_shift(pe->inbox)) != NULL) {
+        DP_PaintEngineBatch *batch = (DP_PaintEngineBatch *)node;
+        DP_Queue *queue = batch->local ? &pe->local_queue : &pe->remote_queue;
+        for (int i = 0; i < batch->count; ++i) {
+            DP_message_queue_push_noinc(queue, batch->msgs[i]);
+        }
+        DP_free(batch);
+    }
+}
+
 static void push_cleanup_message(void *user, DP_Message *msg)
 {
+    // Called on the paint thread, so this can go right into the queue.
     DP_PaintEngine *pe = user;
     DP_message_queue_push_noinc(&pe->remote_queue, msg);
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
 }
 
 static void free_preview(DP_Preview *pv)
@@ -302,6 +353,7 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
     }
     case DP_MSG_INTERNAL_TYPE_CLEANUP:
         DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        drain_inbox(pe);
         DP_canvas_history_cleanup(pe->ch, dc, push_cleanup_message, pe);
         while (pe->local_queue.used != 0) {
             DP_message_queue_push_noinc(
@@ -484,12 +536,6 @@ static int shift_more_draw_dabs_messages(DP_PaintEngine *pe, bool local,
         }
     }
 
-    if (count > 1) {
-        int n = count - 1;
-        DP_ASSERT(DP_semaphore_value(pe->queue_sem) >= n);
-        DP_SEMAPHORE_MUST_WAIT_N(pe->queue_sem, n);
-    }
-
     return count;
 }
 
@@ -560,37 +606,40 @@ static void handle_multidab(DP_PaintEngine *pe, DP_DrawContext *dc, bool local,
 static void handle_message(DP_PaintEngine *pe, DP_DrawContext *dc,
                            DP_Message **msgs)
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     bool local = shift_first_message(pe, msgs);
     DP_Message *first = msgs[0];
     DP_MessageType type = DP_message_type(first);
     int count = maybe_shift_more_messages(pe, local, type, msgs);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
 
     DP_ASSERT(count > 0);
     DP_ASSERT(count <= MAX_MULTIDAB_MESSAGES);
+    DP_PERF_BEGIN_DETAIL(fn, "paint", "type=%d,count=%d,local=%d", (int)type,
+                         count, local);
     if (count == 1) {
         handle_single_message(pe, dc, local, type, first);
     }
     else {
         handle_multidab(pe, dc, local, count, msgs);
     }
+    DP_PERF_END(fn);
 }
 
 static void run_paint_engine(void *user)
 {
     DP_PaintEngine *pe = user;
     DP_DrawContext *dc = pe->paint_dc;
-    DP_Semaphore *sem = pe->queue_sem;
     // NOLINTNEXTLINE(bugprone-sizeof-expression)
     DP_Message **msgs = DP_malloc(sizeof(*msgs) * MAX_MULTIDAB_MESSAGES);
     while (true) {
-        DP_SEMAPHORE_MUST_WAIT(sem);
-        if (DP_atomic_get(&pe->running)) {
-            handle_message(pe, dc, msgs);
+        drain_inbox(pe);
+        if (!DP_atomic_get(&pe->running)) {
+            break;
+        }
+        else if (pe->local_queue.used == 0 && pe->remote_queue.used == 0) {
+            DP_mpsc_queue_wait(pe->inbox);
         }
         else {
-            break;
+            handle_message(pe, dc, msgs);
         }
     }
     DP_free(msgs);
@@ -635,11 +684,8 @@ static void sync_preview(DP_PaintEngine *pe, DP_PreviewType type,
     // Make the preview go through the paint engine so that there's less jerking
     // as previews are created and cleared. There may still be flickering, but
     // it won't look like transforms undo themselves for a moment.
-    DP_Message *msg = DP_msg_internal_preview_new(0, (int)type, pv);
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-    DP_message_queue_push_noinc(&pe->local_queue, msg);
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+    send_message_noinc(pe, true,
+                       DP_msg_internal_preview_new(0, (int)type, pv));
 }
 
 static void preview_rendered(void *user, DP_Preview *pv)
@@ -707,9 +753,9 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     DP_atomic_set(&pe->preview_rerendered, false);
     pe->preview_renderer = DP_preview_renderer_new(
         preview_dc, preview_rendered, preview_rerendered, preview_clear, pe);
+    pe->inbox = DP_mpsc_queue_new();
     DP_message_queue_init(&pe->local_queue, INITIAL_QUEUE_CAPACITY);
     DP_message_queue_init(&pe->remote_queue, INITIAL_QUEUE_CAPACITY);
-    pe->queue_sem = DP_semaphore_new(0);
     pe->queue_mutex = DP_mutex_new();
     DP_atomic_set(&pe->running, true);
     DP_atomic_set(&pe->catchup, -1);
@@ -746,14 +792,16 @@ void DP_paint_engine_free_join(DP_PaintEngine *pe)
     if (pe) {
         DP_paint_engine_recorder_stop(pe);
         DP_atomic_set(&pe->running, false);
-        DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+        // An empty batch, just to wake up the paint thread.
+        send_batch(pe, batch_new(false, 0));
         DP_thread_free_join(pe->paint_thread);
         DP_player_free(pe->playback.player);
         DP_semaphore_free(pe->record.start_sem);
         DP_vector_dispose(&pe->meta.cursor_changes);
         DP_renderer_free(pe->renderer);
         DP_mutex_free(pe->queue_mutex);
-        DP_semaphore_free(pe->queue_sem);
+        drain_inbox(pe);
+        DP_mpsc_queue_free(pe->inbox);
         DP_message_queue_dispose(&pe->remote_queue);
         DP_Message *msg;
         while ((msg = DP_message_queue_shift(&pe->local_queue)) != NULL) {
@@ -942,15 +990,10 @@ static bool start_recording(DP_PaintEngine *pe, DP_RecorderType type,
         // and then block this thread (which must be the only thread interacting
         // with the paint engine, maybe we should verify that somehow) until the
         // paint thread gets to it.
-        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-        DP_message_queue_push_noinc(&pe->remote_queue,
-                                    DP_msg_internal_recorder_start_new(0));
-        DP_SEMAPHORE_MUST_POST(pe->queue_sem);
-        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+        send_message_noinc(pe, false, DP_msg_internal_recorder_start_new(0));
         // The paint thread will post to this semaphore when it reaches our
         // recorder start message.
         DP_SEMAPHORE_MUST_WAIT(pe->record.start_sem);
-        DP_ASSERT(pe->remote_queue.used == 0);
 
         // Now all queued messages have been handled. We can't just take the
         // current canvas state from the canvas history though, since that would
@@ -1767,7 +1810,7 @@ static int should_push_message_local(DP_UNUSED DP_PaintEngine *pe,
     }
 }
 
-static int push_more_messages(DP_PaintEngine *pe, DP_Queue *queue,
+static int push_more_messages(DP_PaintEngine *pe, DP_PaintEngineBatch *batch,
                               bool override_acls, int count, DP_Message **msgs,
                               int (*should_push)(DP_PaintEngine *, DP_Message *,
                                                  bool))
@@ -1779,48 +1822,44 @@ static int push_more_messages(DP_PaintEngine *pe, DP_Queue *queue,
         case NO_PUSH:
             break;
         case PUSH_MESSAGE:
-            DP_message_queue_push_inc(queue, msg);
+            batch_push_noinc(batch, DP_message_incref(msg));
             ++pushed;
             break;
         case PUSH_CLEAR_LOCAL_FORK:
-            DP_message_queue_push_noinc(
-                queue, DP_msg_internal_local_fork_clear_new(0));
+            batch_push_noinc(batch, DP_msg_internal_local_fork_clear_new(0));
             ++pushed;
             break;
         default:
             DP_UNREACHABLE();
         }
     }
-    DP_SEMAPHORE_MUST_POST_N(pe->queue_sem, pushed);
+    // The whole batch goes in at once, with at most a single wakeup.
+    send_batch(pe, batch);
     return pushed;
 }
 
-static int push_messages(DP_PaintEngine *pe, DP_Queue *queue,
-                         bool override_acls, int count, DP_Message **msgs,
+static int push_messages(DP_PaintEngine *pe, bool local, bool override_acls,
+                         int count, DP_Message **msgs,
                          int (*should_push)(DP_PaintEngine *, DP_Message *,
                                             bool))
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     // First message is the one that triggered the call to this function,
     // push it unconditionally. Then keep checking the rest again.
-    DP_message_queue_push_inc(queue, msgs[0]);
-    int pushed =
-        push_more_messages(pe, queue, override_acls, count, msgs, should_push);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
-    return pushed;
+    DP_PaintEngineBatch *batch = batch_new(local, count);
+    batch_push_noinc(batch, DP_message_incref(msgs[0]));
+    return push_more_messages(pe, batch, override_acls, count, msgs,
+                              should_push);
 }
 
 static int push_clear_local_fork_messages(
-    DP_PaintEngine *pe, DP_Queue *queue, bool override_acls, int count,
+    DP_PaintEngine *pe, bool local, bool override_acls, int count,
     DP_Message **msgs, int (*should_push)(DP_PaintEngine *, DP_Message *, bool))
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     // First message is to instruct the paint engine to clear the local fork.
-    DP_message_queue_push_noinc(queue, DP_msg_internal_local_fork_clear_new(0));
-    int pushed =
-        push_more_messages(pe, queue, override_acls, count, msgs, should_push);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
-    return pushed;
+    DP_PaintEngineBatch *batch = batch_new(local, count);
+    batch_push_noinc(batch, DP_msg_internal_local_fork_clear_new(0));
+    return push_more_messages(pe, batch, override_acls, count, msgs,
+                              should_push);
 }
 
 int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
@@ -1841,7 +1880,7 @@ int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
     DP_Vector *cursor_changes = &pe->meta.cursor_changes;
     cursor_changes->used = 0;
 
-    // Don't lock anything until we actually find a message to push.
+    // Don't allocate a batch until we actually find a message to push.
     int pushed = 0;
     for (int i = 0; i < count; ++i) {
         int push = should_push(pe, msgs[i], override_acls);
@@ -1849,8 +1888,7 @@ int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
             DP_PERF_BEGIN(push, "handle:push");
             pushed = (push == PUSH_MESSAGE ? push_messages
                                            : push_clear_local_fork_messages)(
-                pe, local ? &pe->local_queue : &pe->remote_queue, override_acls,
-                count - i, msgs + i, should_push);
+                pe, local, override_acls, count - i, msgs + i, should_push);
             DP_PERF_END(push);
             break;
         }
@@ -47,6 +47,7 @@
 #include <dpcommon/perf.h>
 #include <dpcommon/vector.h>
 #include <dpmsg/acl.h>
+#include <dpmsg/binary_blocks.h>
 #include <dpmsg/binary_reader.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/rust.h>
@@ -142,8 +143,10 @@ static DP_LoadResult guess_type(DP_Input *input, DP_PlayerType *out_type)
         return DP_LOAD_RESULT_READ_ERROR;
     }
 
-    bool is_binary = read >= DP_DPREC_MAGIC_LENGTH
-                  && memcmp(buffer, DP_DPREC_MAGIC, DP_DPREC_MAGIC_LENGTH) == 0;
+    bool is_binary =
+        (read >= DP_DPREC_MAGIC_LENGTH
+         && memcmp(buffer, DP_DPREC_MAGIC, DP_DPREC_MAGIC_LENGTH) == 0)
+        || DP_binary_block_magic_matches(buffer, read);
     if (is_binary) {
         return finish_guess(input, out_type, DP_PLAYER_TYPE_BINARY);
     }
@@ -13,11 +13,14 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/perf.h>
 #include <dpcommon/queue.h>
 #include <dpcommon/threading.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/message.h>
 
+#define DP_PERF_CONTEXT "preview"
+
 
 #define RENDER_NEEDED 0
 #define RENDER_QUEUED 1
@@ -572,6 +575,7 @@ static bool handle_render_job(DP_Preview *pv, DP_DrawContext *dc,
                               int offset_y)
 {
     if (DP_atomic_compare_exchange(&pv->status, RENDER_QUEUED, RENDER_ACTIVE)) {
+        DP_PERF_BEGIN_DETAIL(fn, "render", "type=%d", (int)pv->type);
         DP_TransientLayerContent *tlc = DP_transient_layer_content_new_init(
             canvas_width, canvas_height, NULL);
         pv->render(pv, dc, pv->initial_offset_x - offset_x,
@@ -580,6 +584,7 @@ static bool handle_render_job(DP_Preview *pv, DP_DrawContext *dc,
         DP_LayerContent *lc = DP_atomic_ptr_xch(
             &pv->render_lc, DP_transient_layer_content_persist(tlc));
         DP_layer_content_decref_nullable(lc);
+        DP_PERF_END(fn);
 
         return DP_atomic_compare_exchange(&pv->status, RENDER_ACTIVE,
                                           RENDER_DONE);
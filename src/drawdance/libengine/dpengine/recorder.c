@@ -25,6 +25,7 @@
 #include <dpcommon/atomic.h>
 #include <dpcommon/common.h>
 #include <dpcommon/output.h>
+#include <dpcommon/perf.h>
 #include <dpcommon/queue.h>
 #include <dpcommon/threading.h>
 #include <dpmsg/acl.h>
@@ -34,6 +35,9 @@
 #include <dpmsg/text_writer.h>
 #include <parson.h>
 
+#define DP_PERF_CONTEXT "recorder"
+
+
 #define MIN_INTERVAL 500
 #define MAX_INTERVAL UINT16_MAX
 
@@ -143,6 +147,7 @@ static bool write_header(DP_Recorder *r)
 
 static bool write_message_dec(DP_Recorder *r, DP_Message *msg)
 {
+    DP_PERF_BEGIN_DETAIL(fn, "write", "type=%d", (int)DP_message_type(msg));
     bool ok;
     switch (r->type) {
     case DP_RECORDER_TYPE_BINARY:
@@ -156,6 +161,7 @@ static bool write_message_dec(DP_Recorder *r, DP_Message *msg)
     }
 
     DP_message_decref(msg);
+    DP_PERF_END(fn);
 
     if (ok) {
         return true;
@@ -205,8 +211,10 @@ static void run_recorder(void *user)
 
     if (write_initial(r)) {
         if (cs_or_null) {
+            DP_PERF_BEGIN(reset_image, "reset_image");
             DP_reset_image_build(cs_or_null, 0, write_reset_image_message, r);
             DP_canvas_state_decref(cs_or_null);
+            DP_PERF_END(reset_image);
         }
         DP_Semaphore *sem = r->sem;
         while (true) {
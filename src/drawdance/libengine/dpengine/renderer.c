@@ -9,10 +9,13 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/perf.h>
 #include <dpcommon/queue.h>
 #include <dpcommon/threading.h>
 #include <dpmsg/blend_mode.h>
 
+#define DP_PERF_CONTEXT "renderer"
+
 #define TILE_QUEUE_INITIAL_CAPACITY 1024
 
 #define TILE_QUEUED_NONE 0
@@ -96,6 +99,7 @@ struct DP_Renderer {
     bool needs_checkers;
     int xtiles;
     DP_RendererLocalState local_state;
+    DP_OnionSkinCache *onion_skin_cache;
     DP_Mutex *queue_mutex;
     DP_Semaphore *queue_sem;
     DP_Semaphore *wait_ready_sem;
@@ -108,6 +112,7 @@ struct DP_Renderer {
 static void handle_tile_job(DP_Renderer *renderer, DP_RenderContext *rc,
                             DP_RendererTileJob *job)
 {
+    DP_PERF_BEGIN_DETAIL(fn, "tile", "x=%d,y=%d", job->tile_x, job->tile_y);
     DP_TransientTile *tt = rc->tt;
     DP_CanvasState *cs = job->cs;
     DP_Tile *background_tile = DP_canvas_state_background_tile_noinc(cs);
@@ -122,7 +127,8 @@ static void handle_tile_job(DP_Renderer *renderer, DP_RenderContext *rc,
         &rc->vmb, renderer->local_state.view_mode, cs,
         renderer->local_state.active, renderer->local_state.oss);
 
-    DP_canvas_state_flatten_tile_to(cs, job->tile_index, tt, true, &vmf);
+    DP_canvas_state_flatten_tile_to(cs, job->tile_index, tt, true, &vmf,
+                                    renderer->onion_skin_cache);
 
     if (job->needs_checkers) {
         DP_transient_tile_merge(tt, renderer->checker, DP_BIT15,
@@ -135,6 +141,7 @@ static void handle_tile_job(DP_Renderer *renderer, DP_RenderContext *rc,
                       pixel_buffer);
 
     DP_canvas_state_decref(cs);
+    DP_PERF_END(fn);
 }
 
 
@@ -159,6 +166,14 @@ static void handle_blocking_job(DP_Renderer *renderer, DP_Mutex *queue_mutex,
         renderer->local_state = job->local_state;
     }
 
+    // Onion skin tints and opacities depend on their distance to the current
+    // frame, so after switching frames or resizing the canvas, the cached ones
+    // are unlikely to be hit again. Let go of them instead of keeping old
+    // layers alive until they're evicted.
+    if (changes & (CHANGE_RESIZE | CHANGE_LOCAL_STATE)) {
+        DP_onion_skin_cache_clear(renderer->onion_skin_cache);
+    }
+
     if (changes & CHANGE_UNLOCK) {
         renderer->fn.unlock(renderer->fn.user);
     }
@@ -322,6 +337,7 @@ DP_Renderer *DP_renderer_new(int thread_count, DP_RendererTileFn tile_fn,
     renderer->fn.resize = resize_fn;
     renderer->fn.user = user;
     renderer->thread_count = thread_count;
+    renderer->onion_skin_cache = NULL;
     renderer->queue_mutex = NULL;
     renderer->queue_sem = NULL;
     renderer->wait_ready_sem = NULL;
@@ -350,7 +366,8 @@ DP_Renderer *DP_renderer_new(int thread_count, DP_RendererTileFn tile_fn,
         renderer->threads[i] = NULL;
     }
 
-    bool ok = (renderer->queue_mutex = DP_mutex_new()) != NULL
+    bool ok = (renderer->onion_skin_cache = DP_onion_skin_cache_new()) != NULL
+           && (renderer->queue_mutex = DP_mutex_new()) != NULL
            && (renderer->queue_sem = DP_semaphore_new(0)) != NULL
            && (renderer->wait_ready_sem = DP_semaphore_new(0)) != NULL
            && (renderer->wait_done_sem = DP_semaphore_new(0)) != NULL;
@@ -402,6 +419,7 @@ void DP_renderer_free(DP_Renderer *renderer)
         DP_semaphore_free(renderer->wait_ready_sem);
         DP_semaphore_free(renderer->queue_sem);
         DP_mutex_free(renderer->queue_mutex);
+        DP_onion_skin_cache_free(renderer->onion_skin_cache);
         DP_onion_skins_free(renderer->local_state.oss);
         DP_canvas_state_decref(renderer->cs);
         DP_tile_decref(renderer->checker);
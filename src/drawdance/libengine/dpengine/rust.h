@@ -28,7 +28,6 @@ DP_load_old_animation(DP_DrawContext *dc, const char *path, int hold_time,
 bool DP_psd_read_utf16be_layer_title(DP_TransientLayerProps *tlp,
                                      const uint16_t *be);
 
-DP_SaveResult DP_save_psd(DP_CanvasState *cs, const char *path,
-                          DP_DrawContext *dc);
+DP_SaveResult DP_save_psd(DP_CanvasState *cs, const char *path);
 
 #endif /* DPENGINE_RUST_H */
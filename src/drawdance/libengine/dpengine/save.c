@@ -113,15 +113,111 @@ typedef struct DP_SaveOraLayer {
     UT_hash_handle hh;
 } DP_SaveOraLayer;
 
+// Encoded layer from a previous save. Layer contents are immutable, so if a
+// layer still has the same content, its PNG can be written out again as-is.
+// The content is kept referenced so that its address can't get reused.
+typedef struct DP_SaveOraCacheEntry {
+    int layer_id;
+    DP_LayerContent *lc;
+    void *buffer;
+    size_t size;
+    int offset_x, offset_y;
+    UT_hash_handle hh;
+} DP_SaveOraCacheEntry;
+
+struct DP_SaveOraCache {
+    DP_SaveOraCacheEntry *entries;
+};
+
 typedef struct DP_SaveOraContext {
     DP_ZipWriter *zw;
     DP_SaveOraLayer *layers;
+    DP_SaveOraCache *cache;
+    DP_SaveOraCacheEntry *cache_entries;
     struct {
         size_t capacity;
         char *buffer;
     } string;
 } DP_SaveOraContext;
 
+static void save_ora_cache_entries_free(DP_SaveOraCacheEntry **entries)
+{
+    DP_SaveOraCacheEntry *soce, *tmp;
+    HASH_ITER(hh, *entries, soce, tmp) {
+        HASH_DEL(*entries, soce);
+        DP_layer_content_decref(soce->lc);
+        DP_free(soce->buffer);
+        DP_free(soce);
+    }
+}
+
+DP_SaveOraCache *DP_save_ora_cache_new(void)
+{
+    DP_SaveOraCache *cache = DP_malloc(sizeof(*cache));
+    cache->entries = NULL;
+    return cache;
+}
+
+void DP_save_ora_cache_free(DP_SaveOraCache *cache)
+{
+    if (cache) {
+        save_ora_cache_entries_free(&cache->entries);
+        DP_free(cache);
+    }
+}
+
+// Takes the cached entry for the given layer if its content is unchanged. It
+// gets moved over into the entries for the current save right away, so that
+// it survives even if the layer shows up again later.
+static DP_SaveOraCacheEntry *save_ora_context_cache_take(DP_SaveOraContext *c,
+                                                         int layer_id,
+                                                         DP_LayerContent *lc)
+{
+    DP_SaveOraCache *cache = c->cache;
+    if (cache) {
+        DP_SaveOraCacheEntry *soce;
+        HASH_FIND_INT(cache->entries, &layer_id, soce);
+        if (soce && soce->lc == lc) {
+            HASH_DEL(cache->entries, soce);
+            HASH_ADD_INT(c->cache_entries, layer_id, soce);
+            return soce;
+        }
+    }
+    return NULL;
+}
+
+static void save_ora_context_cache_put(DP_SaveOraContext *c, int layer_id,
+                                       DP_LayerContent *lc, const void *buffer,
+                                       size_t size, int offset_x, int offset_y)
+{
+    DP_SaveOraCacheEntry *soce;
+    HASH_FIND_INT(c->cache_entries, &layer_id, soce);
+    if (!soce) {
+        soce = DP_malloc(sizeof(*soce));
+        *soce = (DP_SaveOraCacheEntry){layer_id,
+                                       DP_layer_content_incref(lc),
+                                       DP_malloc(size),
+                                       size,
+                                       offset_x,
+                                       offset_y,
+                                       {0}};
+        memcpy(soce->buffer, buffer, size);
+        HASH_ADD_INT(c->cache_entries, layer_id, soce);
+    }
+}
+
+// Replaces the cache contents with the layers encountered in this save,
+// anything left over is for layers that changed or no longer exist.
+static void save_ora_context_cache_finish(DP_SaveOraContext *c)
+{
+    DP_SaveOraCache *cache = c->cache;
+    if (cache) {
+        save_ora_cache_entries_free(&cache->entries);
+        cache->entries = c->cache_entries;
+        c->cache_entries = NULL;
+    }
+}
+
 static DP_SaveOraLayer *save_ora_context_layer_insert(DP_SaveOraContext *c,
                                                       int layer_id, int index)
 {
@@ -188,6 +284,7 @@ static const char *save_ora_context_format(DP_SaveOraContext *c,
 
 static void save_ora_context_dispose(DP_SaveOraContext *c)
 {
+    save_ora_cache_entries_free(&c->cache_entries);
     DP_free(c->string.buffer);
     DP_SaveOraLayer *sol, *tmp;
     HASH_ITER(hh, c->layers, sol, tmp) {
@@ -204,8 +301,14 @@ static bool ora_store_mimetype(DP_ZipWriter *zw)
                                   false, false);
 }
 
-static bool ora_store_png(DP_SaveOraContext *c, const char *name,
-                          bool (*write_png)(void *, DP_Output *), void *user)
+typedef struct DP_SaveOraEntry {
+    char *name;
+    void *buffer;
+    size_t size;
+} DP_SaveOraEntry;
+
+static bool ora_encode_png(DP_SaveOraEntry *entry, const char *name,
+                           bool (*write_png)(void *, DP_Output *), void *user)
 {
     void **buffer_ptr;
     size_t *size_ptr;
@@ -216,7 +319,8 @@ static bool ora_store_png(DP_SaveOraContext *c, const char *name,
     DP_output_free(output);
 
     if (ok) {
-        return DP_zip_writer_add_file(c->zw, name, buffer, size, false, true);
+        *entry = (DP_SaveOraEntry){DP_strdup(name), buffer, size};
+        return true;
     }
     else {
         DP_free(buffer);
@@ -237,14 +341,14 @@ static bool ora_write_png_upixels(void *user, DP_Output *output)
                                               params->height, params->pixels);
 }
 
-static bool ora_store_png_upixels(DP_SaveOraContext *c, DP_UPixel8 *pixels,
-                                  int width, int height, const char *name)
+static bool ora_encode_png_upixels(DP_SaveOraEntry *entry, DP_UPixel8 *pixels,
+                                   int width, int height, const char *name)
 {
     static DP_UPixel8 null_pixels[] = {{0}};
     struct DP_OraWriteUpixelsParams params =
         pixels ? (struct DP_OraWriteUpixelsParams){pixels, width, height}
                : (struct DP_OraWriteUpixelsParams){null_pixels, 1, 1};
-    return ora_store_png(c, name, ora_write_png_upixels, &params);
+    return ora_encode_png(entry, name, ora_write_png_upixels, &params);
 }
 
 static bool ora_write_png_image(void *user, DP_Output *output)
@@ -253,28 +357,196 @@ static bool ora_write_png_image(void *user, DP_Output *output)
     return DP_image_write_png(img, output);
 }
 
-static bool ora_store_png_image(DP_SaveOraContext *c, DP_Image *img,
-                                const char *name)
+static bool ora_encode_png_image(DP_SaveOraEntry *entry, DP_Image *img,
+                                 const char *name)
 {
-    return img ? ora_store_png(c, name, ora_write_png_image, img)
-               : ora_store_png_upixels(c, NULL, 0, 0, name);
+    return img ? ora_encode_png(entry, name, ora_write_png_image, img)
+               : ora_encode_png_upixels(entry, NULL, 0, 0, name);
 }
 
-static bool ora_store_layer(DP_SaveOraContext *c, DP_LayerContent *lc,
-                            DP_SaveOraLayer *sol)
+static bool ora_store_entry(DP_SaveOraContext *c, DP_SaveOraEntry *entry)
 {
+    char *name = entry->name;
+    void *buffer = entry->buffer;
+    size_t size = entry->size;
+    *entry = (DP_SaveOraEntry){NULL, NULL, 0};
+    bool ok = DP_zip_writer_add_file(c->zw, name, buffer, size, false, true);
+    DP_free(name);
+    return ok;
+}
+
+
+// The expensive parts of saving an ORA are cropping and encoding the layers
+// and flattening the merged image. Those get done in parallel as jobs, while
+// the zip entries get written on the calling thread in the original order.
+typedef enum DP_SaveOraJobType {
+    DP_SAVE_ORA_JOB_LAYER,
+    DP_SAVE_ORA_JOB_BACKGROUND,
+    DP_SAVE_ORA_JOB_MERGED,
+} DP_SaveOraJobType;
+
+typedef struct DP_SaveOraJob {
+    DP_SaveOraJobType type;
+    DP_Atomic done;
+    bool ok;
+    char *error;
+    union {
+        struct {
+            DP_LayerContent *lc;
+            DP_SaveOraLayer *sol;
+            DP_SaveOraCacheEntry *cached;
+        } layer;
+        DP_CanvasState *cs;
+    };
+    DP_Image *img;
+    int entry_count;
+    DP_SaveOraEntry entries[2];
+} DP_SaveOraJob;
+
+typedef struct DP_SaveOraJobs {
+    DP_SaveOraJob *jobs;
+    int count, capacity;
+    DP_Semaphore *sem_done;
+    DP_Atomic cancel;
+} DP_SaveOraJobs;
+
+struct DP_SaveOraJobParams {
+    DP_SaveOraJobs *sojs;
+    DP_SaveOraJob *job;
+};
+
+static DP_SaveOraJob *save_ora_job_push(DP_SaveOraJobs *sojs,
+                                        DP_SaveOraJobType type)
+{
+    if (sojs->count == sojs->capacity) {
+        sojs->capacity = sojs->capacity == 0 ? 16 : sojs->capacity * 2;
+        sojs->jobs = DP_realloc(
+            sojs->jobs, sizeof(*sojs->jobs) * DP_int_to_size(sojs->capacity));
+    }
+    DP_SaveOraJob *job = &sojs->jobs[sojs->count++];
+    *job = (DP_SaveOraJob){.type = type, .done = DP_ATOMIC_INIT(0)};
+    return job;
+}
+
+static bool ora_run_layer_job(DP_SaveOraJob *job)
+{
+    DP_SaveOraLayer *sol = job->layer.sol;
+    DP_SaveOraCacheEntry *cached = job->layer.cached;
+    if (cached) {
+        sol->offset_x = cached->offset_x;
+        sol->offset_y = cached->offset_y;
+        void *buffer = DP_malloc(cached->size);
+        memcpy(buffer, cached->buffer, cached->size);
+        job->entries[job->entry_count++] = (DP_SaveOraEntry){
+            DP_format("data/layer-%04x.png", sol->layer_id), buffer,
+            cached->size};
+        return true;
+    }
+
     int width, height;
     DP_UPixel8 *pixels = DP_layer_content_to_upixels8_cropped(
-        lc, false, &sol->offset_x, &sol->offset_y, &width, &height);
-    const char *name =
-        save_ora_context_format(c, "data/layer-%04x.png", sol->layer_id);
-    bool ok = ora_store_png_upixels(c, pixels, width, height, name);
+        job->layer.lc, false, &sol->offset_x, &sol->offset_y, &width, &height);
+    char *name = DP_format("data/layer-%04x.png", sol->layer_id);
+    bool ok = ora_encode_png_upixels(&job->entries[job->entry_count++], pixels,
+                                     width, height, name);
+    DP_free(name);
+    DP_free(pixels);
+    return ok;
+}
+
+static bool ora_run_background_job(DP_SaveOraJob *job)
+{
+    DP_CanvasState *cs = job->cs;
+    DP_Tile *t = DP_canvas_state_background_tile_noinc(cs);
+    DP_UPixel8 *tile_pixels = DP_malloc(sizeof(*tile_pixels) * DP_TILE_LENGTH);
+    DP_pixels15_to_8_unpremultiply(tile_pixels, DP_tile_pixels(t),
+                                   DP_TILE_LENGTH);
+    if (!ora_encode_png_upixels(&job->entries[job->entry_count++], tile_pixels,
+                                DP_TILE_SIZE, DP_TILE_SIZE,
+                                "data/background-tile.png")) {
+        DP_free(tile_pixels);
+        return false;
+    }
+
+    int width = DP_max_int(1, DP_canvas_state_width(cs));
+    int height = DP_max_int(1, DP_canvas_state_height(cs));
+    DP_UPixel8 *pixels = DP_malloc(sizeof(*pixels) * DP_int_to_size(width)
+                                   * DP_int_to_size(height));
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int tx = x % DP_TILE_SIZE;
+            int ty = y % DP_TILE_SIZE;
+            pixels[y * width + x] = tile_pixels[ty * DP_TILE_SIZE + tx];
+        }
+    }
+    DP_free(tile_pixels);
+
+    bool ok = ora_encode_png_upixels(&job->entries[job->entry_count++], pixels,
+                                     width, height, "data/background.png");
     DP_free(pixels);
     return ok;
 }
 
-static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
-                             DP_LayerList *ll, DP_LayerPropsList *lpl)
+static bool ora_run_merged_job(DP_SaveOraJob *job)
+{
+    // The thumbnail needs a draw context, so that gets made on the calling
+    // thread from the flattened image kept here.
+    job->img = DP_canvas_state_to_flat_image(
+        job->cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    return job->img
+        && ora_encode_png_image(&job->entries[job->entry_count++], job->img,
+                                "mergedimage.png");
+}
+
+static void ora_run_job(DP_SaveOraJobs *sojs, DP_SaveOraJob *job)
+{
+    bool ok;
+    if (DP_atomic_get(&sojs->cancel)) {
+        ok = false;
+    }
+    else {
+        switch (job->type) {
+        case DP_SAVE_ORA_JOB_LAYER:
+            ok = ora_run_layer_job(job);
+            break;
+        case DP_SAVE_ORA_JOB_BACKGROUND:
+            ok = ora_run_background_job(job);
+            break;
+        case DP_SAVE_ORA_JOB_MERGED:
+            ok = ora_run_merged_job(job);
+            break;
+        default:
+            DP_UNREACHABLE();
+        }
+        if (!ok) {
+            // The error is thread-local, so stash it for the calling thread.
+            job->error = DP_strdup(DP_error());
+        }
+    }
+    job->ok = ok;
+    DP_atomic_set(&job->done, 1);
+}
+
+static void ora_save_job(void *element, DP_UNUSED int thread_index)
+{
+    struct DP_SaveOraJobParams *params = element;
+    ora_run_job(params->sojs, params->job);
+    DP_SEMAPHORE_MUST_POST(params->sojs->sem_done);
+}
+
+static void ora_wait_job(DP_SaveOraJobs *sojs, DP_SaveOraJob *job)
+{
+    // Every job posts the semaphore once when it's done, so if this job isn't
+    // done yet, its post is still coming and waiting can't deadlock.
+    while (!DP_atomic_get(&job->done)) {
+        DP_SEMAPHORE_MUST_WAIT(sojs->sem_done);
+    }
+}
+
+static void ora_collect_layers(DP_SaveOraContext *c, DP_SaveOraJobs *sojs,
+                               int *next_index, DP_LayerList *ll,
+                               DP_LayerPropsList *lpl)
 {
     int count = DP_layer_list_count(ll);
     DP_ASSERT(DP_layer_props_list_count(lpl) == count);
@@ -288,80 +560,147 @@ static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
             DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
             DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
             DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
-            if (!ora_store_layers(c, next_index, child_ll, child_lpl)) {
-                return false;
-            }
+            ora_collect_layers(c, sojs, next_index, child_ll, child_lpl);
         }
         else {
             DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
-            if (!ora_store_layer(c, lc, sol)) {
-                return false;
-            }
+            DP_SaveOraJob *job =
+                save_ora_job_push(sojs, DP_SAVE_ORA_JOB_LAYER);
+            job->layer.lc = lc;
+            job->layer.sol = sol;
+            job->layer.cached =
+                save_ora_context_cache_take(c, sol->layer_id, lc);
         }
     }
-    return true;
 }
 
-static bool ora_store_background(DP_SaveOraContext *c, DP_CanvasState *cs)
+static void ora_collect_jobs(DP_SaveOraContext *c, DP_SaveOraJobs *sojs,
+                             DP_CanvasState *cs)
 {
+    int next_index = 0;
+    ora_collect_layers(c, sojs, &next_index, DP_canvas_state_layers_noinc(cs),
+                       DP_canvas_state_layer_props_noinc(cs));
+
     DP_Tile *t = DP_canvas_state_background_tile_noinc(cs);
     if (t && !DP_tile_blank(t)) {
-        DP_UPixel8 *tile_pixels =
-            DP_malloc(sizeof(*tile_pixels) * DP_TILE_LENGTH);
-        DP_pixels15_to_8_unpremultiply(tile_pixels, DP_tile_pixels(t),
-                                       DP_TILE_LENGTH);
-        if (!ora_store_png_upixels(c, tile_pixels, DP_TILE_SIZE, DP_TILE_SIZE,
-                                   "data/background-tile.png")) {
-            DP_free(tile_pixels);
-            return false;
-        }
+        save_ora_job_push(sojs, DP_SAVE_ORA_JOB_BACKGROUND)->cs = cs;
+    }
 
-        int width = DP_max_int(1, DP_canvas_state_width(cs));
-        int height = DP_max_int(1, DP_canvas_state_height(cs));
-        DP_UPixel8 *pixels = DP_malloc(sizeof(*pixels) * DP_int_to_size(width)
-                                       * DP_int_to_size(height));
+    save_ora_job_push(sojs, DP_SAVE_ORA_JOB_MERGED)->cs = cs;
+}
 
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                int tx = x % DP_TILE_SIZE;
-                int ty = y % DP_TILE_SIZE;
-                pixels[y * width + x] = tile_pixels[ty * DP_TILE_SIZE + tx];
-            }
+static DP_Worker *ora_start_jobs(DP_SaveOraJobs *sojs)
+{
+    int count = sojs->count;
+    DP_Worker *worker =
+        sojs->sem_done ? DP_worker_new(DP_int_to_size(count),
+                                       sizeof(struct DP_SaveOraJobParams),
+                                       DP_thread_cpu_count(128), ora_save_job)
+                       : NULL;
+    if (worker) {
+        // The merged image is the single most expensive job and it's always
+        // last, so get it started right away.
+        struct DP_SaveOraJobParams merged_params = {sojs,
+                                                    &sojs->jobs[count - 1]};
+        DP_worker_push(worker, &merged_params);
+        for (int i = 0; i < count - 1; ++i) {
+            struct DP_SaveOraJobParams params = {sojs, &sojs->jobs[i]};
+            DP_worker_push(worker, &params);
         }
-        DP_free(tile_pixels);
-
-        bool ok = ora_store_png_upixels(c, pixels, width, height,
-                                        "data/background.png");
-        DP_free(pixels);
-        return ok;
     }
-    return true;
+    else {
+        DP_warn("Saving ORA on a single thread: %s", DP_error());
+    }
+    return worker;
 }
 
-static bool ora_store_merged(DP_SaveOraContext *c, DP_CanvasState *cs,
-                             DP_DrawContext *dc)
+static bool ora_store_thumbnail(DP_SaveOraContext *c, DP_Image *img,
+                                DP_DrawContext *dc)
 {
-    DP_Image *img = DP_canvas_state_to_flat_image(
-        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
-    if (!img) {
+    DP_Image *thumb;
+    if (!DP_image_thumbnail(img, dc, 256, 256, &thumb)) {
         return false;
     }
 
-    if (!ora_store_png_image(c, img, "mergedimage.png")) {
-        DP_image_free(img);
+    DP_SaveOraEntry entry;
+    bool ok = ora_encode_png_image(&entry, thumb ? thumb : img,
+                                   "Thumbnails/thumbnail.png")
+           && ora_store_entry(c, &entry);
+    DP_image_free(thumb);
+    return ok;
+}
+
+static bool ora_store_job(DP_SaveOraContext *c, DP_SaveOraJob *job,
+                          DP_DrawContext *dc)
+{
+    if (!job->ok) {
+        DP_error_set("%s", job->error ? job->error : "Job cancelled");
         return false;
     }
 
-    DP_Image *thumb;
-    if (!DP_image_thumbnail(img, dc, 256, 256, &thumb)) {
-        DP_image_free(img);
-        return false;
+    if (job->type == DP_SAVE_ORA_JOB_LAYER && !job->layer.cached) {
+        DP_SaveOraLayer *sol = job->layer.sol;
+        DP_SaveOraEntry *entry = &job->entries[0];
+        save_ora_context_cache_put(c, sol->layer_id, job->layer.lc,
+                                   entry->buffer, entry->size, sol->offset_x,
+                                   sol->offset_y);
+    }
+
+    for (int i = 0; i < job->entry_count; ++i) {
+        if (!ora_store_entry(c, &job->entries[i])) {
+            return false;
+        }
+    }
+
+    return job->type != DP_SAVE_ORA_JOB_MERGED
+        || ora_store_thumbnail(c, job->img, dc);
+}
+
+static void save_ora_jobs_dispose(DP_SaveOraJobs *sojs)
+{
+    int count = sojs->count;
+    for (int i = 0; i < count; ++i) {
+        DP_SaveOraJob *job = &sojs->jobs[i];
+        for (int j = 0; j < job->entry_count; ++j) {
+            DP_free(job->entries[j].name);
+            DP_free(job->entries[j].buffer);
+        }
+        DP_image_free(job->img);
+        DP_free(job->error);
+    }
+    DP_free(sojs->jobs);
+    DP_semaphore_free(sojs->sem_done);
+}
+
+static bool ora_store_content(DP_SaveOraContext *c, DP_CanvasState *cs,
+                              DP_DrawContext *dc)
+{
+    DP_SaveOraJobs sojs = {NULL, 0, 0, DP_semaphore_new(0), DP_ATOMIC_INIT(0)};
+    ora_collect_jobs(c, &sojs, cs);
+
+    DP_Worker *worker = ora_start_jobs(&sojs);
+    bool ok = true;
+    int count = sojs.count;
+    for (int i = 0; i < count; ++i) {
+        DP_SaveOraJob *job = &sojs.jobs[i];
+        if (worker) {
+            ora_wait_job(&sojs, job);
+        }
+        else {
+            ora_run_job(&sojs, job);
+        }
+
+        if (!ora_store_job(c, job, dc)) {
+            ok = false;
+            break;
+        }
     }
 
-    bool ok =
-        ora_store_png_image(c, thumb ? thumb : img, "Thumbnails/thumbnail.png");
-    DP_free(thumb);
-    DP_free(img);
+    // On failure, any jobs that didn't get to start yet can bail out early.
+    DP_atomic_set(&sojs.cancel, 1);
+    DP_worker_free_join(worker);
+    save_ora_jobs_dispose(&sojs);
+    save_ora_context_cache_finish(c);
     return ok;
 }
 
@@ -655,7 +994,7 @@ static bool ora_store_xml(DP_SaveOraContext *c, DP_CanvasState *cs)
 }
 
 static DP_SaveResult save_ora(DP_CanvasState *cs, const char *path,
-                              DP_DrawContext *dc)
+                              DP_DrawContext *dc, DP_SaveOraCache *cache)
 {
     DP_ZipWriter *zw = DP_zip_writer_new(path);
     if (!zw) {
@@ -670,13 +1009,8 @@ static DP_SaveResult save_ora(DP_CanvasState *cs, const char *path,
         return DP_SAVE_RESULT_WRITE_ERROR;
     }
 
-    DP_SaveOraContext c = {zw, NULL, {0, NULL}};
-    int next_index = 0;
-    bool content_ok =
-        ora_store_layers(&c, &next_index, DP_canvas_state_layers_noinc(cs),
-                         DP_canvas_state_layer_props_noinc(cs))
-        && ora_store_background(&c, cs) && ora_store_merged(&c, cs, dc)
-        && ora_store_xml(&c, cs);
+    DP_SaveOraContext c = {zw, NULL, cache, NULL, {0, NULL}};
+    bool content_ok = ora_store_content(&c, cs, dc) && ora_store_xml(&c, cs);
     save_ora_context_dispose(&c);
     if (!content_ok) {
         DP_warn("Save '%s': %s", path, DP_error());
@@ -792,11 +1126,12 @@ static DP_SaveResult save_flat_image(
 
 static DP_SaveResult save(DP_CanvasState *cs, DP_DrawContext *dc,
                           DP_SaveImageType type, const char *path,
-                          DP_SaveBakeAnnotationFn bake_annotation, void *user)
+                          DP_SaveBakeAnnotationFn bake_annotation, void *user,
+                          DP_SaveOraCache *ora_cache)
 {
     switch (type) {
     case DP_SAVE_IMAGE_ORA:
-        return save_ora(cs, path, dc);
+        return save_ora(cs, path, dc, ora_cache);
     case DP_SAVE_IMAGE_PNG:
         return save_flat_image(cs, dc, NULL, path, save_png,
                                DP_view_mode_filter_make_default(),
@@ -806,7 +1141,7 @@ static DP_SaveResult save(DP_CanvasState *cs, DP_DrawContext *dc,
                                DP_view_mode_filter_make_default(),
                                bake_annotation, user);
     case DP_SAVE_IMAGE_PSD:
-        return DP_save_psd(cs, path, dc);
+        return DP_save_psd(cs, path);
     default:
         DP_error_set("Unknown save format");
         return DP_SAVE_RESULT_UNKNOWN_FORMAT;
@@ -816,10 +1151,19 @@ static DP_SaveResult save(DP_CanvasState *cs, DP_DrawContext *dc,
 DP_SaveResult DP_save(DP_CanvasState *cs, DP_DrawContext *dc,
                       DP_SaveImageType type, const char *path,
                       DP_SaveBakeAnnotationFn bake_annotation, void *user)
+{
+    return DP_save_cached(cs, dc, type, path, bake_annotation, user, NULL);
+}
+
+DP_SaveResult DP_save_cached(DP_CanvasState *cs, DP_DrawContext *dc,
+                             DP_SaveImageType type, const char *path,
+                             DP_SaveBakeAnnotationFn bake_annotation,
+                             void *user, DP_SaveOraCache *ora_cache_or_null)
 {
     if (cs && path) {
         DP_PERF_BEGIN_DETAIL(fn, "image", "path=%s", path);
-        DP_SaveResult result = save(cs, dc, type, path, bake_annotation, user);
+        DP_SaveResult result = save(cs, dc, type, path, bake_annotation, user,
+                                    ora_cache_or_null);
         DP_PERF_END(fn);
         return result;
     }
@@ -1079,7 +1423,8 @@ DP_SaveResult DP_save_animation_frames(DP_CanvasState *cs, const char *path,
 
 
 static bool get_gif_dimensions(DP_CanvasState *cs, DP_Rect *crop,
-                               int *out_width, int *out_height)
+                               DP_Rect *out_area, int *out_width,
+                               int *out_height)
 {
     DP_Rect rect = DP_rect_make(0, 0, DP_canvas_state_width(cs),
                                 DP_canvas_state_height(cs));
@@ -1100,6 +1445,7 @@ static bool get_gif_dimensions(DP_CanvasState *cs, DP_Rect *crop,
         return false;
     }
 
+    *out_area = rect;
     *out_width = width;
     *out_height = height;
     return true;
@@ -1136,13 +1482,277 @@ static bool report_gif_progress(DP_SaveAnimationProgressFn progress_fn,
     return !progress_fn || progress_fn(user, part / total);
 }
 
+typedef struct DP_SaveGifFrame {
+    int frame_index;
+    int instances;
+    DP_Rect rect;
+    unsigned char *indexed;
+    DP_Atomic done;
+    bool ok;
+} DP_SaveGifFrame;
+
+typedef struct DP_SaveGifContext {
+    DP_CanvasState *cs;
+    DP_Rect area;
+    jo_gifx_t *gif;
+    size_t size;
+    DP_ViewModeBuffer *vmbs;
+    unsigned char *dither_buffers;
+    DP_Semaphore *sem_done;
+    DP_Atomic cancel;
+} DP_SaveGifContext;
+
+struct DP_SaveGifJobParams {
+    DP_SaveGifContext *c;
+    DP_SaveGifFrame *frame;
+};
+
+// Figures out which area of each frame needs to be rendered. The first one is
+// rendered in full, the ones after that only where the layers they show differ
+// from the frame before. Frames that don't differ in the visible area at all
+// just extend the previous frame's duration.
+static DP_SaveGifFrame *gif_collect_frames(DP_CanvasState *cs, DP_Rect area,
+                                           int start, int end_inclusive,
+                                           int *out_count)
+{
+    DP_SaveGifFrame *frames =
+        DP_malloc(sizeof(*frames)
+                  * DP_int_to_size(count_frames(start, end_inclusive)));
+    DP_ViewModeBuffer vmbs[2];
+    DP_view_mode_buffer_init(&vmbs[0]);
+    DP_view_mode_buffer_init(&vmbs[1]);
+    DP_ViewModeFilter prev_vmf;
+    int count = 0;
+    for (int i = start; i <= end_inclusive; ++i) {
+        int instances = 1;
+        while (i < end_inclusive && DP_canvas_state_same_frame(cs, i, i + 1)) {
+            ++i;
+            ++instances;
+        }
+
+        DP_ViewModeFilter vmf =
+            DP_view_mode_filter_make_frame_render(&vmbs[count % 2], cs, i);
+        DP_Rect rect = area;
+        if (count != 0) {
+            DP_Rect bounds;
+            rect = DP_view_mode_filter_frame_change_bounds(&prev_vmf, &vmf, cs,
+                                                           &bounds)
+                     ? DP_rect_intersection(area, bounds)
+                     : DP_rect_make(0, 0, 0, 0);
+            if (!DP_rect_valid(rect)) {
+                DP_SaveGifFrame *prev = &frames[count - 1];
+                prev->frame_index = i;
+                prev->instances += instances;
+                continue;
+            }
+        }
+
+        frames[count++] = (DP_SaveGifFrame){i, instances, rect, NULL,
+                                            DP_ATOMIC_INIT(0), false};
+        prev_vmf = vmf;
+    }
+    DP_view_mode_buffer_dispose(&vmbs[0]);
+    DP_view_mode_buffer_dispose(&vmbs[1]);
+    *out_count = count;
+    return frames;
+}
+
+// Flattening a frame and mapping it to the palette is the expensive part and
+// doesn't depend on any other frames, so that happens in the worker. Only the
+// LZW compression and writing of the frames has to happen in order.
+static void gif_index_frame_job(void *element, int thread_index)
+{
+    struct DP_SaveGifJobParams *params = element;
+    DP_SaveGifContext *c = params->c;
+    DP_SaveGifFrame *frame = params->frame;
+    bool ok = false;
+    if (!DP_atomic_get(&c->cancel)) {
+        DP_ViewModeFilter vmf = DP_view_mode_filter_make_frame_render(
+            &c->vmbs[thread_index], c->cs, frame->frame_index);
+        DP_Image *img = DP_canvas_state_to_flat_image(
+            c->cs, DP_FLAT_IMAGE_RENDER_FLAGS, &frame->rect, &vmf);
+        if (img) {
+            jo_gifx_frame_index(
+                c->gif, (uint32_t *)DP_image_pixels(img),
+                DP_int_to_uint16(DP_rect_width(frame->rect)),
+                DP_int_to_uint16(DP_rect_height(frame->rect)), frame->indexed,
+                c->dither_buffers
+                    + c->size * 4 * DP_int_to_size(thread_index));
+            DP_image_free(img);
+            ok = true;
+        }
+    }
+    frame->ok = ok;
+    DP_atomic_set(&frame->done, 1);
+    DP_SEMAPHORE_MUST_POST(c->sem_done);
+}
+
+static void gif_push_frame(DP_Worker *worker, DP_SaveGifContext *c,
+                           DP_SaveGifFrame *frame, unsigned char *indexed)
+{
+    frame->indexed = indexed;
+    struct DP_SaveGifJobParams params = {c, frame};
+    DP_worker_push(worker, &params);
+}
+
+static void gif_wait_frame(DP_SaveGifContext *c, DP_SaveGifFrame *frame)
+{
+    // Every job posts the semaphore once when it's done, so if this frame
+    // isn't done yet, its post is still coming and waiting can't deadlock.
+    while (!DP_atomic_get(&frame->done)) {
+        DP_SEMAPHORE_MUST_WAIT(c->sem_done);
+    }
+}
+
+static DP_SaveResult gif_write_frames(DP_SaveGifContext *c, DP_Worker *worker,
+                                      DP_Output *output,
+                                      DP_SaveGifFrame *frames, int count,
+                                      int slot_count, int start,
+                                      int frame_count, int framerate,
+                                      DP_SaveAnimationProgressFn progress_fn,
+                                      void *user)
+{
+    // Each frame in flight needs a buffer for its palette indices, they get
+    // passed on to the next frame once the frame has been written.
+    unsigned char *slots = DP_malloc(c->size * DP_int_to_size(slot_count));
+    for (int i = 0; i < slot_count; ++i) {
+        gif_push_frame(worker, c, &frames[i],
+                       slots + c->size * DP_int_to_size(i));
+    }
+
+    DP_SaveResult result = DP_SAVE_RESULT_SUCCESS;
+    double centiseconds_per_frame = get_gif_centiseconds_per_frame(framerate);
+    double delay_frac = 0.0;
+    for (int i = 0; i < count; ++i) {
+        DP_SaveGifFrame *frame = &frames[i];
+        gif_wait_frame(c, frame);
+
+        double delay =
+            centiseconds_per_frame * DP_int_to_double(frame->instances);
+        double delay_floored = floor(delay + delay_frac);
+        delay_frac = delay - delay_floored;
+        DP_Rect rect = frame->rect;
+        bool frame_ok =
+            frame->ok
+            && jo_gifx_frame_indexed_rect(
+                write_gif, output, c->gif, frame->indexed,
+                DP_int_to_uint16(DP_rect_x(rect) - DP_rect_x(c->area)),
+                DP_int_to_uint16(DP_rect_y(rect) - DP_rect_y(c->area)),
+                DP_int_to_uint16(DP_rect_width(rect)),
+                DP_int_to_uint16(DP_rect_height(rect)),
+                DP_double_to_uint16(delay_floored));
+        if (!frame_ok) {
+            result = DP_SAVE_RESULT_WRITE_ERROR;
+            break;
+        }
+
+        if (!report_gif_progress(progress_fn, user,
+                                 frame->frame_index - start + 1,
+                                 frame_count)) {
+            result = DP_SAVE_RESULT_CANCEL;
+            break;
+        }
+
+        int next = i + slot_count;
+        if (next < count) {
+            gif_push_frame(worker, c, &frames[next], frame->indexed);
+        }
+    }
+
+    // Make any remaining jobs bail out early if we stopped because of an
+    // error, then wait for them, since they may still be using the buffers.
+    DP_atomic_set(&c->cancel, 1);
+    DP_worker_free_join(worker);
+    DP_free(slots);
+    return result;
+}
+
+// Each indexing thread holds a flattened frame and a dither buffer at 4 bytes
+// per pixel each, plus two in-flight frames' worth of palette indices. Going
+// wide on a machine with lots of cores would eat memory for little gain, since
+// writing the frames is sequential anyway, so the thread count is capped and
+// shrunk further for large canvases to stay within a memory budget.
+#define GIF_MAX_THREADS       8
+#define GIF_THREAD_MEMORY_MAX ((size_t)256 * 1024 * 1024)
+
+static int gif_thread_count(size_t size)
+{
+    size_t per_thread = DP_max_size(1, size * 10);
+    size_t budget_threads = DP_max_size(1, GIF_THREAD_MEMORY_MAX / per_thread);
+    return DP_thread_cpu_count(
+        DP_size_to_int(DP_min_size(budget_threads, GIF_MAX_THREADS)));
+}
+
+static DP_SaveResult save_gif_frames(DP_CanvasState *cs, DP_Rect area,
+                                     jo_gifx_t *gif, DP_Output *output,
+                                     int width, int height, int start,
+                                     int end_inclusive, int framerate,
+                                     DP_SaveAnimationProgressFn progress_fn,
+                                     void *user)
+{
+    int count;
+    DP_SaveGifFrame *frames =
+        gif_collect_frames(cs, area, start, end_inclusive, &count);
+    if (count == 0) {
+        DP_free(frames);
+        return DP_SAVE_RESULT_SUCCESS;
+    }
+
+    DP_SaveGifContext c = {
+        cs,
+        area,
+        gif,
+        DP_int_to_size(width) * DP_int_to_size(height),
+        NULL,
+        NULL,
+        DP_semaphore_new(0),
+        DP_ATOMIC_INIT(0),
+    };
+    DP_Worker *worker =
+        c.sem_done ? DP_worker_new(DP_int_to_size(count),
+                                   sizeof(struct DP_SaveGifJobParams),
+                                   gif_thread_count(c.size),
+                                   gif_index_frame_job)
+                   : NULL;
+    if (!worker) {
+        DP_semaphore_free(c.sem_done);
+        DP_free(frames);
+        return DP_SAVE_RESULT_INTERNAL_ERROR;
+    }
+
+    int thread_count = DP_worker_thread_count(worker);
+    size_t sthread_count = DP_int_to_size(thread_count);
+    c.vmbs = DP_malloc(sizeof(*c.vmbs) * sthread_count);
+    for (int i = 0; i < thread_count; ++i) {
+        DP_view_mode_buffer_init(&c.vmbs[i]);
+    }
+    c.dither_buffers = DP_malloc(c.size * 4 * sthread_count);
+
+    // Keep a couple more frames in flight than there are threads, so that
+    // the workers don't run dry while the frames are being written.
+    int slot_count = DP_min_int(count, thread_count * 2);
+    DP_SaveResult result = gif_write_frames(
+        &c, worker, output, frames, count, slot_count, start,
+        count_frames(start, end_inclusive), framerate, progress_fn, user);
+
+    DP_free(c.dither_buffers);
+    for (int i = 0; i < thread_count; ++i) {
+        DP_view_mode_buffer_dispose(&c.vmbs[i]);
+    }
+    DP_free(c.vmbs);
+    DP_semaphore_free(c.sem_done);
+    DP_free(frames);
+    return result;
+}
+
 static DP_SaveResult save_animation_gif(DP_CanvasState *cs, const char *path,
                                         DP_SaveAnimationProgressFn progress_fn,
                                         void *user, DP_Rect *crop, int start,
                                         int end_inclusive, int framerate)
 {
+    DP_Rect area;
     int width, height;
-    if (!get_gif_dimensions(cs, crop, &width, &height)) {
+    if (!get_gif_dimensions(cs, crop, &area, &width, &height)) {
         return DP_SAVE_RESULT_WRITE_ERROR;
     }
 
@@ -1164,44 +1774,14 @@ static DP_SaveResult save_animation_gif(DP_CanvasState *cs, const char *path,
         return DP_SAVE_RESULT_CANCEL;
     }
 
-    DP_ViewModeBuffer vmb;
-    DP_view_mode_buffer_init(&vmb);
-    double centiseconds_per_frame = get_gif_centiseconds_per_frame(framerate);
-    double delay_frac = 0.0;
-    for (int i = start; i <= end_inclusive; ++i) {
-        int instances = 1;
-        while (i < end_inclusive && DP_canvas_state_same_frame(cs, i, i + 1)) {
-            ++i;
-            ++instances;
-        }
-
-        DP_ViewModeFilter vmf =
-            DP_view_mode_filter_make_frame_render(&vmb, cs, i);
-        DP_Image *img = DP_canvas_state_to_flat_image(
-            cs, DP_FLAT_IMAGE_RENDER_FLAGS, crop, &vmf);
-        double delay = centiseconds_per_frame * DP_int_to_double(instances);
-        double delay_floored = floor(delay + delay_frac);
-        delay_frac = delay - delay_floored;
-        bool frame_ok = jo_gifx_frame(write_gif, output, gif,
-                                      (uint32_t *)DP_image_pixels(img),
-                                      DP_double_to_uint16(delay_floored));
-        DP_image_free(img);
-        if (!frame_ok) {
-            jo_gifx_abort(gif);
-            DP_output_free(output);
-            DP_view_mode_buffer_dispose(&vmb);
-            return DP_SAVE_RESULT_WRITE_ERROR;
-        }
-
-        if (!report_gif_progress(progress_fn, user, i - start + 1,
-                                 frame_count)) {
-            jo_gifx_abort(gif);
-            DP_output_free(output);
-            DP_view_mode_buffer_dispose(&vmb);
-            return DP_SAVE_RESULT_CANCEL;
-        }
+    DP_SaveResult result =
+        save_gif_frames(cs, area, gif, output, width, height, start,
+                        end_inclusive, framerate, progress_fn, user);
+    if (result != DP_SAVE_RESULT_SUCCESS) {
+        jo_gifx_abort(gif);
+        DP_output_free(output);
+        return result;
     }
-    DP_view_mode_buffer_dispose(&vmb);
 
     if (!jo_gifx_end(write_gif, output, gif) || !DP_output_flush(output)) {
         DP_output_free(output);
@@ -67,6 +67,22 @@ DP_SaveResult DP_save(DP_CanvasState *cs, DP_DrawContext *dc,
                       DP_SaveImageType type, const char *path,
                       DP_SaveBakeAnnotationFn bake_annotation, void *user);
 
+// Remembers the encoded layers of an ORA save, so that the next save with the
+// same cache can write out layers that didn't change instead of re-encoding
+// them. Only one save may use a cache at a time.
+typedef struct DP_SaveOraCache DP_SaveOraCache;
+
+DP_SaveOraCache *DP_save_ora_cache_new(void);
+
+void DP_save_ora_cache_free(DP_SaveOraCache *cache);
+
+// Like DP_save, but with a cache for ORA saves. The cache is ignored for
+// other formats.
+DP_SaveResult DP_save_cached(DP_CanvasState *cs, DP_DrawContext *dc,
+                             DP_SaveImageType type, const char *path,
+                             DP_SaveBakeAnnotationFn bake_annotation,
+                             void *user, DP_SaveOraCache *ora_cache_or_null);
+
 
 typedef bool (*DP_SaveAnimationProgressFn)(void *user, double progress);
 
@@ -5,25 +5,26 @@ use drawdance::{
     dp_error_set,
     engine::{
         BaseCanvasState, BaseLayerContent, BaseLayerGroup, BaseLayerList, BaseLayerProps,
-        BaseLayerPropsList, CanvasState, LayerContent, LayerList, LayerProps, LayerPropsList,
+        BaseLayerPropsList, CanvasState, LayerList, LayerProps, LayerPropsList,
         TransientLayerContent,
     },
-    DP_BlendMode, DP_CanvasState, DP_DrawContext, DP_SaveResult, DP_UPixel8,
-    DP_draw_context_pool_require, DP_BLEND_MODE_ADD, DP_BLEND_MODE_BURN, DP_BLEND_MODE_COLOR,
-    DP_BLEND_MODE_DARKEN, DP_BLEND_MODE_DIVIDE, DP_BLEND_MODE_DODGE, DP_BLEND_MODE_HARD_LIGHT,
-    DP_BLEND_MODE_HUE, DP_BLEND_MODE_LIGHTEN, DP_BLEND_MODE_LINEAR_BURN,
-    DP_BLEND_MODE_LINEAR_LIGHT, DP_BLEND_MODE_LUMINOSITY, DP_BLEND_MODE_MULTIPLY,
-    DP_BLEND_MODE_NORMAL, DP_BLEND_MODE_OVERLAY, DP_BLEND_MODE_SATURATION, DP_BLEND_MODE_SCREEN,
-    DP_BLEND_MODE_SOFT_LIGHT, DP_BLEND_MODE_SUBTRACT, DP_SAVE_RESULT_BAD_ARGUMENTS,
-    DP_SAVE_RESULT_INTERNAL_ERROR, DP_SAVE_RESULT_OPEN_ERROR, DP_SAVE_RESULT_SUCCESS,
-    DP_SAVE_RESULT_WRITE_ERROR,
+    DP_BlendMode, DP_CanvasState, DP_LayerContent, DP_SaveResult, DP_UPixel8, DP_BLEND_MODE_ADD,
+    DP_BLEND_MODE_BURN, DP_BLEND_MODE_COLOR, DP_BLEND_MODE_DARKEN, DP_BLEND_MODE_DIVIDE,
+    DP_BLEND_MODE_DODGE, DP_BLEND_MODE_HARD_LIGHT, DP_BLEND_MODE_HUE, DP_BLEND_MODE_LIGHTEN,
+    DP_BLEND_MODE_LINEAR_BURN, DP_BLEND_MODE_LINEAR_LIGHT, DP_BLEND_MODE_LUMINOSITY,
+    DP_BLEND_MODE_MULTIPLY, DP_BLEND_MODE_NORMAL, DP_BLEND_MODE_OVERLAY, DP_BLEND_MODE_SATURATION,
+    DP_BLEND_MODE_SCREEN, DP_BLEND_MODE_SOFT_LIGHT, DP_BLEND_MODE_SUBTRACT,
+    DP_SAVE_RESULT_BAD_ARGUMENTS, DP_SAVE_RESULT_INTERNAL_ERROR, DP_SAVE_RESULT_OPEN_ERROR,
+    DP_SAVE_RESULT_SUCCESS, DP_SAVE_RESULT_WRITE_ERROR,
 };
 use std::{
     collections::HashMap,
     ffi::{c_char, c_int, c_void},
+    num::NonZeroUsize,
     panic::catch_unwind,
     ptr::null_mut,
-    slice::from_raw_parts_mut,
+    sync::atomic::{AtomicUsize, Ordering},
+    thread::{available_parallelism, scope},
 };
 
 #[derive(Debug, Copy, Clone, PartialEq)]
@@ -286,267 +287,363 @@ fn extract_channel(pixels: &[DP_UPixel8], src: &mut [u8], extract: fn(DP_UPixel8
     }
 }
 
-fn clear_buffer(dst: &mut [u8]) {
-    for d in dst {
-        *d = 0;
+const LOW_BITS: u64 = 0x0101_0101_0101_0101;
+const HIGH_BITS: u64 = 0x8080_8080_8080_8080;
+
+fn load_u64(src: &[u8], start: usize) -> u64 {
+    u64::from_le_bytes(src[start..start + 8].try_into().unwrap())
+}
+
+// Counts how many bytes at the start of src are equal to value, up to limit.
+// Compares eight bytes at a time, the first differing byte is the lowest
+// non-zero one in the XOR of a little-endian chunk against the value.
+fn count_run(src: &[u8], value: u8, limit: usize) -> usize {
+    let splat = u64::from_le_bytes([value; 8]);
+    let mut i = 0;
+    while i + 8 <= limit {
+        let diff = load_u64(src, i) ^ splat;
+        if diff != 0 {
+            return i + (diff.trailing_zeros() / 8) as usize;
+        }
+        i += 8;
     }
+    while i < limit && src[i] == value {
+        i += 1;
+    }
+    i
+}
+
+// Finds the first index before limit where three consecutive bytes are equal,
+// or limit if there is none. src must extend at least two bytes past limit.
+// Looks at eight positions at a time by comparing shifted chunks, the lowest
+// zero byte found by the usual bit trick is exact, false positives can only
+// show up above it.
+fn find_triple(src: &[u8], limit: usize) -> usize {
+    debug_assert!(src.len() >= limit + 2);
+    let mut i = 0;
+    while i + 8 <= limit {
+        let a = load_u64(src, i);
+        let diff = (a ^ load_u64(src, i + 1)) | (a ^ load_u64(src, i + 2));
+        let zero = diff.wrapping_sub(LOW_BITS) & !diff & HIGH_BITS;
+        if zero != 0 {
+            return i + (zero.trailing_zeros() / 8) as usize;
+        }
+        i += 8;
+    }
+    while i < limit && !(src[i] == src[i + 1] && src[i] == src[i + 2]) {
+        i += 1;
+    }
+    i
 }
 
 // SPDX-SnippetBegin
 // SPDX-License-Identifier: GPL-2.0-or-later
 // SDPX—SnippetName: PSD RLE compression from Krita, originally from GIMP
-fn rle_compress(src: &[u8], dst: &mut [u8]) -> Result<usize> {
-    let mut remaining = i32::try_from(src.len())?;
-    let mut length = 0;
+fn rle_compress(src: &[u8], dst: &mut Vec<u8>) -> Result<usize> {
+    let mut remaining = src.len();
     let mut start = 0;
-    let mut dst_ptr = 0;
-    clear_buffer(dst);
+    let dst_start = dst.len();
 
     while remaining > 0 {
         // Look for characters matching the first.
-        let mut i = 0;
-        while i < 128 && remaining - i > 0 && src[start] == src[start + i as usize] {
-            i += 1;
-        }
+        let i = count_run(&src[start..], src[start], remaining.min(128));
 
         if i > 1 {
             // Match found.
-            dst[dst_ptr] = -(i - 1) as u8;
-            dst[dst_ptr + 1] = src[start];
-            dst_ptr += 2;
-            start += i as usize;
+            dst.push(-(i as i32 - 1) as u8);
+            dst.push(src[start]);
+            start += i;
             remaining -= i;
-            length += 2;
         } else {
-            // Look for characters different from the previous.
-            i = 0;
-            while (i < 128)
-                && (remaining - (i + 1) > 0)
-                && (src[start + i as usize] != src[start + i as usize + 1]
-                    || remaining - (i + 2) <= 0
-                    || src[start + i as usize] != src[start + i as usize + 2])
-            {
-                i += 1;
-            }
-
-            // If there's only 1 remaining, the previous WHILE stmt doesn't catch it
-            if remaining == 1 {
-                i = 1;
-            }
+            // Look for characters different from the previous. If there's
+            // only 1 remaining, the search doesn't catch it.
+            let i = if remaining == 1 {
+                1
+            } else {
+                let limit = (remaining - 1).min(128);
+                let triple_limit = limit.min(remaining - 2);
+                let found = find_triple(&src[start..], triple_limit);
+                if found < triple_limit {
+                    found
+                } else {
+                    limit
+                }
+            };
 
             if i > 0 {
-                dst[dst_ptr] = (i - 1) as u8;
-                let si = i as usize;
-                for j in 0..si {
-                    dst[dst_ptr + 1 + j] = src[start + j];
-                }
-                dst_ptr += 1 + si;
-                start += si;
+                dst.push((i - 1) as u8);
+                dst.extend_from_slice(&src[start..start + i]);
+                start += i;
                 remaining -= i;
-                length += i + 1;
             }
         }
     }
 
-    Ok(length as usize)
+    Ok(dst.len() - dst_start)
 }
 // SPDX-SnippetEnd
 
-fn write_channel(
-    out: &mut Output,
+// Compression type, row byte counts and run-length encoded rows of a channel.
+fn encode_channel(
     rows: usize,
     stride: usize,
     pixels: &[DP_UPixel8],
-    counts: &mut [u8],
-    src: &mut [u8],
-    dst: &mut [u8],
     extract: fn(DP_UPixel8) -> u8,
-) -> Result<usize> {
-    let start_pos = out.tell()?;
-    out.write_bytes(&[0, 1])?;
-    clear_buffer(counts);
-    out.write_bytes(counts)?;
+) -> Result<Vec<u8>> {
+    let counts_length = rows * 2;
+    let mut buffer = Vec::with_capacity(2 + counts_length + rows * stride / 2);
+    buffer.extend_from_slice(&[0, 1]);
+    buffer.resize(2 + counts_length, 0);
 
+    let mut src = vec![0_u8; stride];
     for i in 0..rows {
         let offset = i * stride;
-        extract_channel(&pixels[offset..offset + stride], src, extract);
+        extract_channel(&pixels[offset..offset + stride], &mut src, extract);
 
-        let length = rle_compress(src, dst)?;
-        out.write_bytes(&dst[0..length])?;
+        let length = rle_compress(&src, &mut buffer)?;
 
         let count_bytes = u16::try_from(length)?.to_be_bytes();
-        counts[i * 2] = count_bytes[0];
-        counts[i * 2 + 1] = count_bytes[1];
+        buffer[2 + i * 2] = count_bytes[0];
+        buffer[2 + i * 2 + 1] = count_bytes[1];
     }
 
-    let end_pos = out.tell()?;
-    out.seek(start_pos + 2)?;
-    out.write_bytes(counts)?;
-    out.seek(end_pos)?;
-    Ok(end_pos - start_pos)
+    Ok(buffer)
 }
 
-fn write_pixel_channels(
-    dc: *mut DP_DrawContext,
-    out: &mut Output,
-    rows: usize,
-    stride: usize,
-    pixels: &[DP_UPixel8],
-) -> Result<(usize, usize, usize, usize)> {
-    let counts_length = rows * 2;
-    let pool_size = counts_length + stride * 3;
-    let pool: &mut [u8] = unsafe {
-        from_raw_parts_mut(
-            DP_draw_context_pool_require(dc, pool_size).cast(),
-            pool_size,
-        )
-    };
-    let (counts, buffers) = pool.split_at_mut(counts_length);
-    let (src, dst) = buffers.split_at_mut(stride);
-    let a = write_channel(out, rows, stride, pixels, counts, src, dst, DP_UPixel8::a)?;
-    let r = write_channel(out, rows, stride, pixels, counts, src, dst, DP_UPixel8::r)?;
-    let g = write_channel(out, rows, stride, pixels, counts, src, dst, DP_UPixel8::g)?;
-    let b = write_channel(out, rows, stride, pixels, counts, src, dst, DP_UPixel8::b)?;
-    Ok((a, r, g, b))
+struct EncodedPixels {
+    offset_x: c_int,
+    offset_y: c_int,
+    width: c_int,
+    height: c_int,
+    // Alpha, red, green and blue, in the order PSD wants them.
+    channels: [Vec<u8>; 4],
 }
 
-fn write_pixel_data(
-    dc: *mut DP_DrawContext,
-    out: &mut Output,
-    offset: usize,
+fn encode_pixels(
     pixels: &[DP_UPixel8],
     offset_x: c_int,
     offset_y: c_int,
     width: c_int,
     height: c_int,
-) -> Result<()> {
+) -> Result<Option<EncodedPixels>> {
     if pixels.is_empty() || width <= 0 || height <= 0 {
-        // Empty layer or group. Just write blank pixel data.
-        out.write_bytes(&[0, 0, 0, 0, 0, 0, 0, 0])?;
+        Ok(None)
     } else {
-        // We got some pixel data, run-length encode it. That's the default in
-        // Photoshop apparently and Krita also always uses this option.
+        // Run-length encode the pixel data. That's the default in Photoshop
+        // apparently and Krita also always uses this option.
         let rows = usize::try_from(height)?;
         let stride = usize::try_from(width)?;
-        let (a, r, g, b) = write_pixel_channels(dc, out, rows, stride, pixels)?;
+        Ok(Some(EncodedPixels {
+            offset_x,
+            offset_y,
+            width,
+            height,
+            channels: [
+                encode_channel(rows, stride, pixels, DP_UPixel8::a)?,
+                encode_channel(rows, stride, pixels, DP_UPixel8::r)?,
+                encode_channel(rows, stride, pixels, DP_UPixel8::g)?,
+                encode_channel(rows, stride, pixels, DP_UPixel8::b)?,
+            ],
+        }))
+    }
+}
+
+fn write_pixel_data(out: &mut Output, offset: usize, encoded: Option<EncodedPixels>) -> Result<()> {
+    if let Some(ep) = encoded {
+        for channel in &ep.channels {
+            out.write_bytes(channel)?;
+        }
         // Go back and fill in the channel size information.
         let pos = out.tell()?;
         out.seek(offset)?;
         // Bounding rectangle.
-        let top = u32::try_from(offset_y)?;
+        let top = u32::try_from(ep.offset_y)?;
         out.write_u32_be(top)?;
-        let left = u32::try_from(offset_x)?;
+        let left = u32::try_from(ep.offset_x)?;
         out.write_u32_be(left)?;
-        let h = u32::try_from(height)?;
+        let h = u32::try_from(ep.height)?;
         out.write_u32_be(top + h)?;
-        let w = u32::try_from(width)?;
+        let w = u32::try_from(ep.width)?;
         out.write_u32_be(left + w)?;
         // Number of channels, always 4 for ARGB.
         out.write_bytes(&[0, 4])?;
         // Channel ids and the sizes of their pixel data.
-        out.write_i16_be(-1)?;
-        out.write_u32_be(u32::try_from(a)?)?;
-        out.write_i16_be(0)?;
-        out.write_u32_be(u32::try_from(r)?)?;
-        out.write_i16_be(1)?;
-        out.write_u32_be(u32::try_from(g)?)?;
-        out.write_i16_be(2)?;
-        out.write_u32_be(u32::try_from(b)?)?;
+        for (id, channel) in [-1_i16, 0, 1, 2].iter().zip(&ep.channels) {
+            out.write_i16_be(*id)?;
+            out.write_u32_be(u32::try_from(channel.len())?)?;
+        }
         out.seek(pos)?;
+    } else {
+        // Empty layer or group. Just write blank pixel data.
+        out.write_bytes(&[0, 0, 0, 0, 0, 0, 0, 0])?;
     }
     Ok(())
 }
 
-fn write_background_pixel_data(
-    cs: &CanvasState,
-    dc: *mut DP_DrawContext,
-    out: &mut Output,
-    layer_offsets: &HashMap<*mut c_void, usize>,
-) -> Result<()> {
-    let width = cs.width();
-    let height = cs.height();
-    let pixels = TransientLayerContent::new_init(width, height, cs.background_tile().as_deref())
-        .to_upixels8(0, 0, width, height);
-    write_pixel_data(
-        dc,
-        out,
-        *layer_offsets.get(&null_mut()).unwrap(),
-        pixels.as_slice(),
-        0,
-        0,
-        width,
-        height,
-    )
+// Persistent layer content doesn't change and the canvas state keeps it alive
+// until saving is done, so it's safe to read it from multiple threads.
+#[derive(Clone, Copy)]
+struct SharedLayerContent(*mut DP_LayerContent);
+
+unsafe impl Send for SharedLayerContent {}
+unsafe impl Sync for SharedLayerContent {}
+
+impl BaseLayerContent for SharedLayerContent {
+    fn persistent_ptr(&self) -> *mut DP_LayerContent {
+        self.0
+    }
 }
 
-fn write_layer_content_pixel_data(
-    lc: &LayerContent,
-    censored: bool,
-    dc: *mut DP_DrawContext,
-    out: &mut Output,
-    offset: usize,
-) -> Result<()> {
-    let (pixels, offset_x, offset_y, width, height) = lc.to_upixels8_cropped(censored);
-    write_pixel_data(
-        dc,
-        out,
-        offset,
-        pixels.as_slice(),
-        offset_x,
-        offset_y,
-        width,
-        height,
-    )
+enum PixelJob {
+    Blank,
+    Background {
+        lc: SharedLayerContent,
+        width: c_int,
+        height: c_int,
+        offset: usize,
+    },
+    Content {
+        lc: SharedLayerContent,
+        censored: bool,
+        offset: usize,
+    },
+}
+
+impl PixelJob {
+    fn offset(&self) -> usize {
+        match self {
+            Self::Blank => 0,
+            Self::Background { offset, .. } | Self::Content { offset, .. } => *offset,
+        }
+    }
+
+    fn encode(&self) -> Result<Option<EncodedPixels>> {
+        match self {
+            Self::Blank => Ok(None),
+            Self::Background {
+                lc, width, height, ..
+            } => {
+                let pixels = lc.to_upixels8(0, 0, *width, *height);
+                encode_pixels(pixels.as_slice(), 0, 0, *width, *height)
+            }
+            Self::Content { lc, censored, .. } => {
+                let (pixels, offset_x, offset_y, width, height) = lc.to_upixels8_cropped(*censored);
+                encode_pixels(pixels.as_slice(), offset_x, offset_y, width, height)
+            }
+        }
+    }
+}
+
+fn thread_count() -> usize {
+    available_parallelism().map_or(1, NonZeroUsize::get)
+}
+
+// Runs the given function over all jobs on up to thread_count threads and
+// returns the results in the order of the jobs.
+fn run_jobs<J, R, F>(jobs: &[J], thread_count: usize, run: F) -> Vec<R>
+where
+    J: Sync,
+    R: Send,
+    F: Fn(&J) -> R + Sync,
+{
+    let worker_count = thread_count.min(jobs.len());
+    if worker_count <= 1 {
+        return jobs.iter().map(run).collect();
+    }
+
+    let next = AtomicUsize::new(0);
+    let run = &run;
+    let mut results: Vec<(usize, R)> = scope(|s| {
+        let handles: Vec<_> = (0..worker_count)
+            .map(|_| {
+                s.spawn(|| {
+                    let mut worker_results = Vec::new();
+                    loop {
+                        let i = next.fetch_add(1, Ordering::Relaxed);
+                        match jobs.get(i) {
+                            Some(job) => worker_results.push((i, run(job))),
+                            None => return worker_results,
+                        }
+                    }
+                })
+            })
+            .collect();
+        handles
+            .into_iter()
+            .flat_map(|handle| handle.join().unwrap())
+            .collect()
+    });
+    results.sort_unstable_by_key(|(i, _)| *i);
+    results.into_iter().map(|(_, result)| result).collect()
 }
 
-fn write_layer_pixel_data_recursive(
+fn collect_pixel_jobs_recursive(
     ll: &LayerList,
     lpl: &LayerPropsList,
-    dc: *mut DP_DrawContext,
-    out: &mut Output,
     layer_offsets: &HashMap<*mut c_void, usize>,
     parent_censored: bool,
-) -> Result<()> {
+    jobs: &mut Vec<PixelJob>,
+) {
     let count = lpl.count();
     for i in 0..count {
         let lp = lpl.at(i);
         if let Some(child_lpl) = lp.children() {
-            write_pixel_data(dc, out, 0, &[], 0, 0, 0, 0)?;
+            jobs.push(PixelJob::Blank);
             let lg = ll.group_at(i);
-            write_layer_pixel_data_recursive(
+            collect_pixel_jobs_recursive(
                 &lg.children(),
                 &child_lpl,
-                dc,
-                out,
                 layer_offsets,
                 lp.censored(),
-            )?;
-            write_pixel_data(dc, out, 0, &[], 0, 0, 0, 0)?;
+                jobs,
+            );
+            jobs.push(PixelJob::Blank);
         } else {
             let lc = ll.content_at(i);
-            let offset = *layer_offsets.get(&lp.persistent_ptr().cast()).unwrap();
-            write_layer_content_pixel_data(&lc, parent_censored || lp.censored(), dc, out, offset)?;
+            jobs.push(PixelJob::Content {
+                lc: SharedLayerContent(lc.persistent_ptr()),
+                censored: parent_censored || lp.censored(),
+                offset: *layer_offsets.get(&lp.persistent_ptr().cast()).unwrap(),
+            });
         }
     }
-    Ok(())
 }
 
+// Layers are encoded on a pool of threads, in batches so that only a limited
+// number of uncompressed layers are around at once. The resulting buffers are
+// written out in order and their sizes spliced into the layer info.
 fn write_layer_pixel_data_section(
     cs: &CanvasState,
-    dc: *mut DP_DrawContext,
     out: &mut Output,
     layer_offsets: &HashMap<*mut c_void, usize>,
 ) -> Result<()> {
-    write_background_pixel_data(cs, dc, out, layer_offsets)?;
+    let width = cs.width();
+    let height = cs.height();
+    let background =
+        TransientLayerContent::new_init(width, height, cs.background_tile().as_deref());
+
+    let mut jobs = vec![PixelJob::Background {
+        lc: SharedLayerContent(background.persistent_ptr()),
+        width,
+        height,
+        offset: *layer_offsets.get(&null_mut()).unwrap(),
+    }];
     let ll = cs.layers();
     let lpl = cs.layer_props();
-    write_layer_pixel_data_recursive(&ll, &lpl, dc, out, layer_offsets, false)?;
+    collect_pixel_jobs_recursive(&ll, &lpl, layer_offsets, false, &mut jobs);
+
+    let thread_count = thread_count();
+    for batch in jobs.chunks(thread_count * 2) {
+        let results = run_jobs(batch, thread_count, PixelJob::encode);
+        for (job, result) in batch.iter().zip(results) {
+            write_pixel_data(out, job.offset(), result?)?;
+        }
+    }
     Ok(())
 }
 
 fn write_layer_info_section(
     cs: &CanvasState,
-    dc: *mut DP_DrawContext,
     out: &mut Output,
     layer_offsets: &mut HashMap<*mut c_void, usize>,
 ) -> Result<()> {
@@ -573,87 +670,60 @@ fn write_layer_info_section(
     write_layer_infos_recursive(&lpl, out, layer_offsets)?;
 
     // Channel pixel data.
-    write_layer_pixel_data_section(cs, dc, out, layer_offsets)?;
+    write_layer_pixel_data_section(cs, out, layer_offsets)?;
 
     write_size_prefix(out, section_start, 2)?;
     Ok(())
 }
 
-fn write_layer_sections(cs: &CanvasState, dc: *mut DP_DrawContext, out: &mut Output) -> Result<()> {
+fn write_layer_sections(cs: &CanvasState, out: &mut Output) -> Result<()> {
     let section_start = write_preliminary_size_prefix(out)?;
     let mut layer_offsets = HashMap::new();
-    write_layer_info_section(cs, dc, out, &mut layer_offsets)?;
+    write_layer_info_section(cs, out, &mut layer_offsets)?;
     out.write_bytes(&[0, 0, 0, 0])?; // Global layer mask info (none).
     write_size_prefix(out, section_start, 0)?;
     Ok(())
 }
 
-fn write_merged_channel(
-    out: &mut Output,
-    rows: usize,
-    stride: usize,
-    counts: &mut [u8],
-    src: &[u8],
-    dst: &mut [u8],
-) -> Result<()> {
+// Row byte counts and run-length encoded rows of a merged image channel.
+fn encode_merged_channel(rows: usize, stride: usize, src: &[u8]) -> Result<(Vec<u8>, Vec<u8>)> {
+    let mut counts = Vec::with_capacity(rows * 2);
+    let mut data = Vec::with_capacity(rows * stride / 2);
     for i in 0..rows {
         let src_start = i * stride;
         let src_end = src_start + stride;
-        let length = rle_compress(&src[src_start..src_end], dst)?;
-        out.write_bytes(&dst[0..length])?;
-
-        let count_bytes = u16::try_from(length)?.to_be_bytes();
-        counts[i * 2] = count_bytes[0];
-        counts[i * 2 + 1] = count_bytes[1];
+        let length = rle_compress(&src[src_start..src_end], &mut data)?;
+        counts.extend_from_slice(&u16::try_from(length)?.to_be_bytes());
     }
-    Ok(())
+    Ok((counts, data))
 }
 
-fn write_merged_image(cs: &CanvasState, dc: *mut DP_DrawContext, mut out: Output) -> Result<()> {
+fn write_merged_image(cs: &CanvasState, mut out: Output) -> Result<()> {
     out.write_bytes(&[0, 1])?; // Compression type: run-length encoding.
 
     let rows = usize::try_from(cs.height())?;
     let stride = usize::try_from(cs.width())?;
-    let counts_stride = rows * 2;
-    let counts_length = counts_stride * 4;
-    let pool_size = counts_length + stride * 2;
-    let pool: &mut [u8] = unsafe {
-        from_raw_parts_mut(
-            DP_draw_context_pool_require(dc, pool_size).cast(),
-            pool_size,
-        )
-    };
-
-    let (counts, dst) = pool.split_at_mut(counts_length);
-    let counts_pos = out.tell()?;
-    clear_buffer(counts);
-    out.write_bytes(counts)?;
-
     let size = rows * stride;
     let buffer = cs.to_flat_separated_urgba8()?;
-    for i in 0..4 {
-        let counts_start = i * counts_stride;
-        let counts_end = counts_start + counts_stride;
-        let buffer_start = i * size;
-        let buffer_end = buffer_start + size;
-        write_merged_channel(
-            &mut out,
-            rows,
-            stride,
-            &mut counts[counts_start..counts_end],
-            &buffer[buffer_start..buffer_end],
-            dst,
-        )?;
+    let planes: Vec<&[u8]> = buffer.chunks(size).take(4).collect();
+    let results = run_jobs(&planes, thread_count(), |plane| {
+        encode_merged_channel(rows, stride, plane)
+    });
+
+    // All the row byte counts come first, then all the data.
+    let channels = results.into_iter().collect::<Result<Vec<_>>>()?;
+    for (counts, _) in &channels {
+        out.write_bytes(counts)?;
+    }
+    for (_, data) in &channels {
+        out.write_bytes(data)?;
     }
-
-    out.seek(counts_pos)?;
-    out.write_bytes(counts)?;
 
     out.close()?;
     Ok(())
 }
 
-fn write_psd(cs: &CanvasState, dc: *mut DP_DrawContext, mut out: Output) -> Result<()> {
+fn write_psd(cs: &CanvasState, mut out: Output) -> Result<()> {
     // Magic "8BPS", 2 bytes for the version (0, 1), 6 reserved zero bytes.
     out.write_bytes(&[
         56, 66, 80, 83, // "8BPS" magic number.
@@ -671,22 +741,18 @@ fn write_psd(cs: &CanvasState, dc: *mut DP_DrawContext, mut out: Output) -> Resu
         0, 0, 0, 0, // Color mode section length, always zero for RGB.
         0, 0, 0, 0, // Image resources section length, we don't have any.
     ])?;
-    write_layer_sections(cs, dc, &mut out)?;
-    write_merged_image(cs, dc, out)?;
+    write_layer_sections(cs, &mut out)?;
+    write_merged_image(cs, out)?;
     Ok(())
 }
 
-fn save_psd(
-    cs: *mut DP_CanvasState,
-    path: *const c_char,
-    dc: *mut DP_DrawContext,
-) -> DP_SaveResult {
+fn save_psd(cs: *mut DP_CanvasState, path: *const c_char) -> DP_SaveResult {
     if let Some(acs) = unsafe { cs.as_mut() }.map(CanvasState::new_attached) {
         let out = match Output::new_from_path(path) {
             Ok(o) => o,
             Err(_) => return DP_SAVE_RESULT_OPEN_ERROR,
         };
-        match write_psd(&acs, dc, out) {
+        match write_psd(&acs, out) {
             Ok(()) => DP_SAVE_RESULT_SUCCESS,
             Err(_) => DP_SAVE_RESULT_WRITE_ERROR,
         }
@@ -696,12 +762,8 @@ fn save_psd(
 }
 
 #[no_mangle]
-pub extern "C" fn DP_save_psd(
-    cs: *mut DP_CanvasState,
-    path: *const c_char,
-    dc: *mut DP_DrawContext,
-) -> DP_SaveResult {
-    if let Ok(save_result) = catch_unwind(|| save_psd(cs, path, dc)) {
+pub extern "C" fn DP_save_psd(cs: *mut DP_CanvasState, path: *const c_char) -> DP_SaveResult {
+    if let Ok(save_result) = catch_unwind(|| save_psd(cs, path)) {
         save_result
     } else {
         dp_error_set("Panic while saving PSD");
@@ -48,6 +48,8 @@ struct DP_Tile {
     const bool transient;
     const bool maybe_blank;
     const unsigned int context_id;
+    DP_Atomic mipmap_state;
+    DP_Pixel15 mipmap[DP_TILE_MIPMAP_LENGTH];
 };
 
 struct DP_TransientTile {
@@ -56,6 +58,8 @@ struct DP_TransientTile {
     bool transient;
     bool maybe_blank;
     unsigned int context_id;
+    DP_Atomic mipmap_state;
+    DP_Pixel15 mipmap[DP_TILE_MIPMAP_LENGTH];
 };
 
 #else
@@ -66,10 +70,18 @@ struct DP_Tile {
     bool transient;
     bool maybe_blank;
     unsigned int context_id;
+    DP_Atomic mipmap_state;
+    DP_Pixel15 mipmap[DP_TILE_MIPMAP_LENGTH];
 };
 
 #endif
 
+// States for a tile's mipmap. Only one thread gets to fill in the cached
+// mipmap, anyone else that needs it in the meantime calculates it themselves.
+#define TILE_MIPMAP_NONE    0
+#define TILE_MIPMAP_PENDING 1
+#define TILE_MIPMAP_READY   2
+
 
 // We want to initialize a static buffer with the same value 4096 times, so this
 // is a goofy way to achieve that at compile time without spelling it all out.
@@ -110,6 +122,7 @@ static void *alloc_tile(bool transient, bool maybe_blank,
     tt->transient = transient;
     tt->maybe_blank = maybe_blank;
     tt->context_id = context_id;
+    DP_atomic_set(&tt->mipmap_state, TILE_MIPMAP_NONE);
 
     return tt;
 }
@@ -457,48 +470,191 @@ void DP_tile_copy_to_upixels8(DP_Tile *tile_or_null, DP_UPixel8 *pixels, int x,
 }
 
 
+// The sum of values from a single tile fit into a 32 bit integer, so we use
+// those and only convert to a float once at the end.
+typedef struct DP_TileSampleSums {
+    uint_fast32_t weight;
+    uint_fast32_t red;
+    uint_fast32_t green;
+    uint_fast32_t blue;
+    uint_fast32_t alpha;
+} DP_TileSampleSums;
+
 // Based on libmypaint, see license above.
-static void sample_tile(DP_Pixel15 *src, const uint16_t *mask, int w, int h,
-                        int mask_skip, int base_skip, bool opaque,
-                        float *in_out_weight, float *in_out_red,
-                        float *in_out_green, float *in_out_blue,
-                        float *in_out_alpha)
-{
-    // The sum of values from a single tile fit into a 32 bit integer,
-    // so we use those and only convert to a float once at the end.
+static void sample_pixels(const DP_Pixel15 *src, const uint16_t *mask,
+                          int count, bool opaque, DP_TileSampleSums *sums)
+{
     uint_fast32_t weight = 0;
     uint_fast32_t red = 0;
     uint_fast32_t green = 0;
     uint_fast32_t blue = 0;
     uint_fast32_t alpha = 0;
 
-    for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x, ++mask, ++src) {
-            uint_fast32_t m = *mask;
-            DP_Pixel15 p = *src;
-            // When working in opaque mode, disregard low alpha values because
-            // the resulting unpremultiplied colors are just too inacurrate.
-            if (!opaque || (m > 512 && p.a > 512)) {
-                weight += m;
-                red += m * p.r / (uint_fast32_t)DP_BIT15;
-                green += m * p.g / (uint_fast32_t)DP_BIT15;
-                blue += m * p.b / (uint_fast32_t)DP_BIT15;
-                alpha += m * p.a / (uint_fast32_t)DP_BIT15;
-            }
+    for (int i = 0; i < count; ++i) {
+        uint_fast32_t m = mask[i];
+        DP_Pixel15 p = src[i];
+        // When working in opaque mode, disregard low alpha values because
+        // the resulting unpremultiplied colors are just too inacurrate.
+        if (!opaque || (m > 512 && p.a > 512)) {
+            weight += m;
+            red += m * p.r / (uint_fast32_t)DP_BIT15;
+            green += m * p.g / (uint_fast32_t)DP_BIT15;
+            blue += m * p.b / (uint_fast32_t)DP_BIT15;
+            alpha += m * p.a / (uint_fast32_t)DP_BIT15;
         }
-        src += base_skip;
-        mask += mask_skip;
     }
 
-    *in_out_weight += (float)weight;
-    *in_out_red += (float)red;
-    *in_out_green += (float)green;
-    *in_out_blue += (float)blue;
-    *in_out_alpha += (float)alpha;
+    sums->weight += weight;
+    sums->red += red;
+    sums->green += green;
+    sums->blue += blue;
+    sums->alpha += alpha;
+}
+
+#ifdef DP_CPU_X64
+DP_TARGET_BEGIN("sse4.2")
+static void sample_pixels_sse42(const DP_Pixel15 *src, const uint16_t *mask,
+                                int count, bool opaque,
+                                DP_TileSampleSums *sums)
+{
+    DP_ASSERT(count % 2 == 0);
+
+    // Refer to sample_pixels for what's being calculated. Each pixel is spread
+    // out to four 32 bit lanes, one per channel, with the mask value broadcast
+    // to all of them. Since the division is by 2^15, it's just a shift.
+    __m128i threshold = _mm_set1_epi32(512);
+    __m128i weight = _mm_setzero_si128();
+    __m128i color = _mm_setzero_si128();
+
+    for (int i = 0; i < count; i += 2) {
+        __m128i source = _mm_loadu_si128((const void *)&src[i]);
+        __m128i p1 = _mm_cvtepu16_epi32(source);
+        __m128i p2 = _mm_cvtepu16_epi32(_mm_srli_si128(source, 8));
+        __m128i m1 = _mm_set1_epi32(mask[i]);
+        __m128i m2 = _mm_set1_epi32(mask[i + 1]);
+
+        if (opaque) {
+            __m128i a1 = _mm_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i a2 = _mm_shuffle_epi32(p2, _MM_SHUFFLE(3, 3, 3, 3));
+            m1 = _mm_and_si128(
+                m1, _mm_and_si128(_mm_cmpgt_epi32(m1, threshold),
+                                  _mm_cmpgt_epi32(a1, threshold)));
+            m2 = _mm_and_si128(
+                m2, _mm_and_si128(_mm_cmpgt_epi32(m2, threshold),
+                                  _mm_cmpgt_epi32(a2, threshold)));
+        }
+
+        weight = _mm_add_epi32(weight, _mm_add_epi32(m1, m2));
+        color = _mm_add_epi32(color,
+                              _mm_srli_epi32(_mm_mullo_epi32(m1, p1), 15));
+        color = _mm_add_epi32(color,
+                              _mm_srli_epi32(_mm_mullo_epi32(m2, p2), 15));
+    }
+
+    DP_ALIGNAS_SIMD uint32_t c[4];
+    _mm_store_si128((void *)c, color);
+    sums->weight += DP_int_to_uint32(_mm_cvtsi128_si32(weight));
+    sums->blue += c[0];
+    sums->green += c[1];
+    sums->red += c[2];
+    sums->alpha += c[3];
+}
+DP_TARGET_END
+
+DP_TARGET_BEGIN("avx2")
+static void sample_pixels_avx2(const DP_Pixel15 *src, const uint16_t *mask,
+                               int count, bool opaque, DP_TileSampleSums *sums)
+{
+    DP_ASSERT(count % 4 == 0);
+
+    // Same as the SSE version, just two pixels per register.
+    __m256i threshold = _mm256_set1_epi32(512);
+    __m256i spread1 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    __m256i spread2 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+    __m256i weight = _mm256_setzero_si256();
+    __m256i color = _mm256_setzero_si256();
+
+    for (int i = 0; i < count; i += 4) {
+        __m256i source = _mm256_loadu_si256((const void *)&src[i]);
+        __m256i p1 = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(source));
+        __m256i p2 = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(source, 1));
+        __m256i masks = _mm256_castsi128_si256(
+            _mm_cvtepu16_epi32(_mm_loadl_epi64((const void *)&mask[i])));
+        __m256i m1 = _mm256_permutevar8x32_epi32(masks, spread1);
+        __m256i m2 = _mm256_permutevar8x32_epi32(masks, spread2);
+
+        if (opaque) {
+            __m256i a1 = _mm256_shuffle_epi32(p1, _MM_SHUFFLE(3, 3, 3, 3));
+            __m256i a2 = _mm256_shuffle_epi32(p2, _MM_SHUFFLE(3, 3, 3, 3));
+            m1 = _mm256_and_si256(
+                m1, _mm256_and_si256(_mm256_cmpgt_epi32(m1, threshold),
+                                     _mm256_cmpgt_epi32(a1, threshold)));
+            m2 = _mm256_and_si256(
+                m2, _mm256_and_si256(_mm256_cmpgt_epi32(m2, threshold),
+                                     _mm256_cmpgt_epi32(a2, threshold)));
+        }
+
+        weight = _mm256_add_epi32(weight, _mm256_add_epi32(m1, m2));
+        color = _mm256_add_epi32(
+            color, _mm256_srli_epi32(_mm256_mullo_epi32(m1, p1), 15));
+        color = _mm256_add_epi32(
+            color, _mm256_srli_epi32(_mm256_mullo_epi32(m2, p2), 15));
+    }
+
+    __m128i w = _mm_add_epi32(_mm256_castsi256_si128(weight),
+                              _mm256_extracti128_si256(weight, 1));
+    DP_ALIGNAS_SIMD uint32_t c[4];
+    _mm_store_si128((void *)c,
+                    _mm_add_epi32(_mm256_castsi256_si128(color),
+                                  _mm256_extracti128_si256(color, 1)));
+    sums->weight += DP_int_to_uint32(_mm_cvtsi128_si32(w));
+    sums->blue += c[0];
+    sums->green += c[1];
+    sums->red += c[2];
+    sums->alpha += c[3];
+
+    _mm256_zeroupper();
+}
+DP_TARGET_END
+#endif
+
+static void sample_row(const DP_Pixel15 *src, const uint16_t *mask, int count,
+                       bool opaque, DP_TileSampleSums *sums)
+{
+#ifdef DP_CPU_X64
+    if (DP_cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        int avx_width = count - count % 4;
+        sample_pixels_avx2(src, mask, avx_width, opaque, sums);
+        count -= avx_width;
+        src += avx_width;
+        mask += avx_width;
+    }
+
+    if (DP_cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        int sse_width = count - count % 2;
+        sample_pixels_sse42(src, mask, sse_width, opaque, sums);
+        count -= sse_width;
+        src += sse_width;
+        mask += sse_width;
+    }
+#endif
+
+    sample_pixels(src, mask, count, opaque, sums);
+}
+
+static void sample_tile(const DP_Pixel15 *src, const uint16_t *mask, int w,
+                        int h, int mask_skip, int base_skip, bool opaque,
+                        DP_TileSampleSums *sums)
+{
+    for (int y = 0; y < h; ++y) {
+        sample_row(src, mask, w, opaque, sums);
+        src += w + base_skip;
+        mask += w + mask_skip;
+    }
 }
 
 static void sample_blank(const uint16_t *mask, int w, int h, int mask_skip,
-                         float *in_out_weight)
+                         DP_TileSampleSums *sums)
 {
     uint_fast32_t weight = 0;
     for (int y = 0; y < h; ++y) {
@@ -507,7 +663,19 @@ static void sample_blank(const uint16_t *mask, int w, int h, int mask_skip,
         }
         mask += mask_skip;
     }
-    *in_out_weight += (float)weight;
+    sums->weight += weight;
+}
+
+static void add_sample_sums(const DP_TileSampleSums *sums, float scale,
+                            float *in_out_weight, float *in_out_red,
+                            float *in_out_green, float *in_out_blue,
+                            float *in_out_alpha)
+{
+    *in_out_weight += (float)sums->weight * scale;
+    *in_out_red += (float)sums->red * scale;
+    *in_out_green += (float)sums->green * scale;
+    *in_out_blue += (float)sums->blue * scale;
+    *in_out_alpha += (float)sums->alpha * scale;
 }
 
 void DP_tile_sample(DP_Tile *tile_or_null, const uint16_t *mask, int x, int y,
@@ -516,15 +684,94 @@ void DP_tile_sample(DP_Tile *tile_or_null, const uint16_t *mask, int x, int y,
                     float *in_out_green, float *in_out_blue,
                     float *in_out_alpha)
 {
+    DP_TileSampleSums sums = {0, 0, 0, 0, 0};
     if (tile_or_null) {
         DP_Pixel15 *src = tile_or_null->pixels + y * DP_TILE_SIZE + x;
         sample_tile(src, mask, width, height, skip, DP_TILE_SIZE - width,
-                    opaque, in_out_weight, in_out_red, in_out_green,
+                    opaque, &sums);
+    }
+    else if (!opaque) {
+        sample_blank(mask, width, height, skip, &sums);
+    }
+    add_sample_sums(&sums, 1.0f, in_out_weight, in_out_red, in_out_green,
                     in_out_blue, in_out_alpha);
+}
+
+static void calculate_mipmap(const DP_Pixel15 *pixels, DP_Pixel15 *mipmap)
+{
+    uint_fast32_t count = DP_TILE_MIPMAP_SCALE * DP_TILE_MIPMAP_SCALE;
+    for (int my = 0; my < DP_TILE_MIPMAP_SIZE; ++my) {
+        for (int mx = 0; mx < DP_TILE_MIPMAP_SIZE; ++mx) {
+            const DP_Pixel15 *block = pixels
+                                    + my * DP_TILE_MIPMAP_SCALE * DP_TILE_SIZE
+                                    + mx * DP_TILE_MIPMAP_SCALE;
+            uint_fast32_t b = 0;
+            uint_fast32_t g = 0;
+            uint_fast32_t r = 0;
+            uint_fast32_t a = 0;
+            for (int y = 0; y < DP_TILE_MIPMAP_SCALE; ++y) {
+                for (int x = 0; x < DP_TILE_MIPMAP_SCALE; ++x) {
+                    DP_Pixel15 p = block[y * DP_TILE_SIZE + x];
+                    b += p.b;
+                    g += p.g;
+                    r += p.r;
+                    a += p.a;
+                }
+            }
+            mipmap[my * DP_TILE_MIPMAP_SIZE + mx] = (DP_Pixel15){
+                (uint16_t)((b + count / 2) / count),
+                (uint16_t)((g + count / 2) / count),
+                (uint16_t)((r + count / 2) / count),
+                (uint16_t)((a + count / 2) / count),
+            };
+        }
+    }
+}
+
+static const DP_Pixel15 *get_mipmap(DP_Tile *tile, DP_Pixel15 *buffer)
+{
+    // Transient tiles may still change, so their mipmap can't be cached.
+    if (!tile->transient) {
+        int state = DP_atomic_get(&tile->mipmap_state);
+        if (state == TILE_MIPMAP_READY) {
+            return tile->mipmap;
+        }
+        else if (state == TILE_MIPMAP_NONE
+                 && DP_atomic_compare_exchange(&tile->mipmap_state,
+                                               TILE_MIPMAP_NONE,
+                                               TILE_MIPMAP_PENDING)) {
+            calculate_mipmap(tile->pixels, tile->mipmap);
+            DP_atomic_set(&tile->mipmap_state, TILE_MIPMAP_READY);
+            return tile->mipmap;
+        }
+    }
+    calculate_mipmap(tile->pixels, buffer);
+    return buffer;
+}
+
+void DP_tile_sample_mipmap(DP_Tile *tile_or_null, const uint16_t *mask, int x,
+                           int y, int width, int height, int skip, bool opaque,
+                           float *in_out_weight, float *in_out_red,
+                           float *in_out_green, float *in_out_blue,
+                           float *in_out_alpha)
+{
+    DP_ASSERT(x >= 0);
+    DP_ASSERT(y >= 0);
+    DP_ASSERT(x + width <= DP_TILE_MIPMAP_SIZE);
+    DP_ASSERT(y + height <= DP_TILE_MIPMAP_SIZE);
+    DP_TileSampleSums sums = {0, 0, 0, 0, 0};
+    if (tile_or_null) {
+        DP_Pixel15 buffer[DP_TILE_MIPMAP_LENGTH];
+        const DP_Pixel15 *mipmap = get_mipmap(tile_or_null, buffer);
+        sample_tile(mipmap + y * DP_TILE_MIPMAP_SIZE + x, mask, width, height,
+                    skip, DP_TILE_MIPMAP_SIZE - width, opaque, &sums);
     }
     else if (!opaque) {
-        sample_blank(mask, width, height, skip, in_out_weight);
+        sample_blank(mask, width, height, skip, &sums);
     }
+    float scale = (float)(DP_TILE_MIPMAP_SCALE * DP_TILE_MIPMAP_SCALE);
+    add_sample_sums(&sums, scale, in_out_weight, in_out_red, in_out_green,
+                    in_out_blue, in_out_alpha);
 }
 
 
@@ -31,6 +31,12 @@ typedef struct DP_Image DP_Image;
 #define DP_TILE_BYTES            (DP_TILE_LENGTH * sizeof(DP_Pixel15))
 #define DP_TILE_COMPRESSED_BYTES (DP_TILE_LENGTH * sizeof(DP_Pixel8))
 
+// Tiles carry a reduced-resolution copy of themselves for sampling large
+// areas, where each pixel is the average of a block of tile pixels.
+#define DP_TILE_MIPMAP_SCALE  8
+#define DP_TILE_MIPMAP_SIZE   (DP_TILE_SIZE / DP_TILE_MIPMAP_SCALE)
+#define DP_TILE_MIPMAP_LENGTH (DP_TILE_MIPMAP_SIZE * DP_TILE_MIPMAP_SIZE)
+
 typedef struct DP_TileCounts {
     int x, y;
 } DP_TileCounts;
@@ -157,6 +163,16 @@ void DP_tile_sample(DP_Tile *tile_or_null, const uint16_t *mask, int x, int y,
                     float *in_out_green, float *in_out_blue,
                     float *in_out_alpha);
 
+// Like DP_tile_sample, but samples the tile's mipmap. Coordinates and the mask
+// are in mipmap pixels, the sums are scaled up to match full resolution ones.
+// The mipmap is calculated the first time it's needed and then cached, which
+// is fine because tiles don't change after being persisted.
+void DP_tile_sample_mipmap(DP_Tile *tile_or_null, const uint16_t *mask, int x,
+                           int y, int width, int height, int skip, bool opaque,
+                           float *in_out_weight, float *in_out_red,
+                           float *in_out_green, float *in_out_blue,
+                           float *in_out_alpha);
+
 
 DP_TransientTile *DP_transient_tile_new(DP_Tile *tile, unsigned int context_id);
 
@@ -29,10 +29,13 @@
 #include "layer_props_list.h"
 #include "layer_routes.h"
 #include "local_state.h"
+#include "tile.h"
 #include "timeline.h"
 #include "track.h"
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <dpcommon/geom.h>
+#include <dpcommon/threading.h>
 #include <dpcommon/vector.h>
 #include <dpmsg/blend_mode.h>
 
@@ -43,11 +46,15 @@
 #define TYPE_FRAME_MANUAL 3
 #define TYPE_FRAME_RENDER 4
 
+// Must be a power of two.
+#define ONION_SKIN_CACHE_CAPACITY 4096
+
 
 typedef struct DP_ViewModeTrack {
     int layer_id;
     DP_Vector hidden_layer_ids;
     const DP_OnionSkin *onion_skin;
+    DP_KeyFrame *key_frame;
 } DP_ViewModeTrack;
 
 struct DP_OnionSkins {
@@ -57,6 +64,16 @@ struct DP_OnionSkins {
     DP_OnionSkin skins[];
 };
 
+typedef struct DP_OnionSkinCacheEntry {
+    DP_OnionSkinCacheKey key;
+    DP_Tile *tile;
+} DP_OnionSkinCacheEntry;
+
+struct DP_OnionSkinCache {
+    DP_Mutex *mutex;
+    DP_OnionSkinCacheEntry entries[ONION_SKIN_CACHE_CAPACITY];
+};
+
 
 void DP_view_mode_buffer_init(DP_ViewModeBuffer *vmb)
 {
@@ -84,7 +101,7 @@ static DP_ViewModeTrack *view_mode_buffer_push(DP_ViewModeBuffer *vmb)
             vmb->tracks, sizeof(*vmb->tracks) * DP_int_to_size(new_capacity));
         vmb->capacity = new_capacity;
         for (int i = capacity; i < new_capacity; ++i) {
-            vmb->tracks[i] = (DP_ViewModeTrack){0, DP_VECTOR_NULL, NULL};
+            vmb->tracks[i] = (DP_ViewModeTrack){0, DP_VECTOR_NULL, NULL, NULL};
         }
     }
     vmb->count = index + 1;
@@ -188,6 +205,7 @@ static bool build_view_frame(DP_ViewModeTrack *vmt, const DP_OnionSkin *os,
 {
     vmt->layer_id = DP_layer_props_id(lp);
     vmt->onion_skin = os;
+    vmt->key_frame = kf;
 
     int count;
     const DP_KeyFrameLayer *kfls = DP_key_frame_layers(kf, &count);
@@ -338,6 +356,174 @@ bool DP_view_mode_filter_excludes_everything(const DP_ViewModeFilter *vmf)
 }
 
 
+static bool same_track(DP_ViewModeTrack *a, DP_ViewModeTrack *b)
+{
+    size_t used = a->hidden_layer_ids.used;
+    return a->layer_id == b->layer_id && a->onion_skin == b->onion_skin
+        && used == b->hidden_layer_ids.used
+        && (used == 0
+            || memcmp(a->hidden_layer_ids.elements,
+                      b->hidden_layer_ids.elements, sizeof(int) * used)
+                   == 0);
+}
+
+static void add_bounds(DP_Rect bounds, bool *in_out_found,
+                       DP_Rect *in_out_bounds)
+{
+    if (*in_out_found) {
+        *in_out_bounds = DP_rect_union(*in_out_bounds, bounds);
+    }
+    else {
+        *in_out_bounds = bounds;
+        *in_out_found = true;
+    }
+}
+
+static void add_entry_bounds(DP_LayerListEntry *lle, bool *in_out_found,
+                             DP_Rect *in_out_bounds)
+{
+    if (DP_layer_list_entry_is_group(lle)) {
+        DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
+        DP_LayerList *ll = DP_layer_group_children_noinc(lg);
+        int count = DP_layer_list_count(ll);
+        for (int i = 0; i < count; ++i) {
+            add_entry_bounds(DP_layer_list_at_noinc(ll, i), in_out_found,
+                             in_out_bounds);
+        }
+    }
+    else {
+        DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
+        DP_Rect bounds;
+        if (DP_layer_content_bounds(lc, true, &bounds)) {
+            add_bounds(bounds, in_out_found, in_out_bounds);
+        }
+    }
+}
+
+static void add_track_bounds(DP_ViewModeTrack *vmt, DP_CanvasState *cs,
+                             bool *in_out_found, DP_Rect *in_out_bounds)
+{
+    DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
+    DP_LayerRoutesEntry *lre = DP_layer_routes_search(lr, vmt->layer_id);
+    if (lre) {
+        add_entry_bounds(DP_layer_routes_entry_layer(lre, cs), in_out_found,
+                         in_out_bounds);
+    }
+}
+
+bool DP_view_mode_filter_frame_change_bounds(const DP_ViewModeFilter *a,
+                                             const DP_ViewModeFilter *b,
+                                             DP_CanvasState *cs,
+                                             DP_Rect *out_bounds)
+{
+    DP_ASSERT(a);
+    DP_ASSERT(b);
+    DP_ASSERT(cs);
+    DP_ASSERT(out_bounds);
+    DP_ASSERT(a->internal_type == TYPE_FRAME_RENDER);
+    DP_ASSERT(b->internal_type == TYPE_FRAME_RENDER);
+    DP_ViewModeTrack *tracks_a = a->vmb->tracks;
+    DP_ViewModeTrack *tracks_b = b->vmb->tracks;
+    int count_a = a->vmb->count;
+    int count_b = b->vmb->count;
+
+    // Compositing happens per pixel, so where none of the differing tracks
+    // have any pixels, the same tracks get composited in the same order.
+    int prefix = 0;
+    while (prefix < count_a && prefix < count_b
+           && same_track(&tracks_a[prefix], &tracks_b[prefix])) {
+        ++prefix;
+    }
+
+    int suffix = 0;
+    while (suffix < count_a - prefix && suffix < count_b - prefix
+           && same_track(&tracks_a[count_a - suffix - 1],
+                         &tracks_b[count_b - suffix - 1])) {
+        ++suffix;
+    }
+
+    bool found = false;
+    for (int i = prefix; i < count_a - suffix; ++i) {
+        add_track_bounds(&tracks_a[i], cs, &found, out_bounds);
+    }
+    for (int i = prefix; i < count_b - suffix; ++i) {
+        add_track_bounds(&tracks_b[i], cs, &found, out_bounds);
+    }
+    return found;
+}
+
+
+static bool same_track_layer(DP_ViewModeTrack *vmt, DP_CanvasState *cs_a,
+                             DP_CanvasState *cs_b)
+{
+    int layer_id = vmt->layer_id;
+    DP_LayerRoutesEntry *lre_a = DP_layer_routes_search(
+        DP_canvas_state_layer_routes_noinc(cs_a), layer_id);
+    DP_LayerRoutesEntry *lre_b = DP_layer_routes_search(
+        DP_canvas_state_layer_routes_noinc(cs_b), layer_id);
+    if (!lre_a || !lre_b) {
+        return !lre_a && !lre_b;
+    }
+
+    DP_LayerListEntry *lle_a = DP_layer_routes_entry_layer(lre_a, cs_a);
+    DP_LayerListEntry *lle_b = DP_layer_routes_entry_layer(lre_b, cs_b);
+    bool is_group = DP_layer_list_entry_is_group(lle_a);
+    if (is_group != DP_layer_list_entry_is_group(lle_b)) {
+        return false;
+    }
+    else if (is_group) {
+        if (DP_layer_list_entry_group_noinc(lle_a)
+            != DP_layer_list_entry_group_noinc(lle_b)) {
+            return false;
+        }
+    }
+    else if (DP_layer_list_entry_content_noinc(lle_a)
+             != DP_layer_list_entry_content_noinc(lle_b)) {
+        return false;
+    }
+
+    return DP_layer_routes_entry_props(lre_a, cs_a)
+            == DP_layer_routes_entry_props(lre_b, cs_b)
+        && DP_layer_routes_entry_parent_opacity(lre_a, cs_a)
+               == DP_layer_routes_entry_parent_opacity(lre_b, cs_b);
+}
+
+bool DP_view_mode_filter_frame_render_equal(const DP_ViewModeFilter *a,
+                                            DP_CanvasState *cs_a,
+                                            const DP_ViewModeFilter *b,
+                                            DP_CanvasState *cs_b)
+{
+    DP_ASSERT(a);
+    DP_ASSERT(cs_a);
+    DP_ASSERT(b);
+    DP_ASSERT(cs_b);
+    DP_ASSERT(a->internal_type == TYPE_FRAME_RENDER);
+    DP_ASSERT(b->internal_type == TYPE_FRAME_RENDER);
+    if (DP_canvas_state_width(cs_a) != DP_canvas_state_width(cs_b)
+        || DP_canvas_state_height(cs_a) != DP_canvas_state_height(cs_b)
+        || DP_canvas_state_background_tile_noinc(cs_a)
+               != DP_canvas_state_background_tile_noinc(cs_b)) {
+        return false;
+    }
+
+    int count = a->vmb->count;
+    if (count != b->vmb->count) {
+        return false;
+    }
+
+    // Layers, props and groups are immutable, so if the tracks refer to the
+    // very same ones in both states, they composite into the same image.
+    for (int i = 0; i < count; ++i) {
+        DP_ViewModeTrack *vmt = &a->vmb->tracks[i];
+        if (!same_track(vmt, &b->vmb->tracks[i])
+            || !same_track_layer(vmt, cs_a, cs_b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 static DP_ViewModeResult make_result(bool hidden_by_view_mode,
                                      DP_ViewModeContext child_vmc)
 {
@@ -835,3 +1021,166 @@ void DP_onion_skins_skin_above_at_set(DP_OnionSkins *oss, int index,
     DP_ASSERT(tint.a <= DP_BIT15);
     oss->skins[oss->count_below + index] = (DP_OnionSkin){opacity, tint};
 }
+
+
+DP_OnionSkinCache *DP_onion_skin_cache_new(void)
+{
+    DP_Mutex *mutex = DP_mutex_new();
+    if (!mutex) {
+        return NULL;
+    }
+    DP_OnionSkinCache *osc = DP_malloc(sizeof(*osc));
+    osc->mutex = mutex;
+    for (int i = 0; i < ONION_SKIN_CACHE_CAPACITY; ++i) {
+        osc->entries[i] = (DP_OnionSkinCacheEntry){{0}, NULL};
+    }
+    return osc;
+}
+
+static void onion_skin_cache_key_incref(const DP_OnionSkinCacheKey *key)
+{
+    if (key->is_group) {
+        DP_layer_group_incref(key->layer);
+    }
+    else {
+        DP_layer_content_incref(key->layer);
+    }
+    DP_layer_props_incref(key->lp);
+    DP_key_frame_incref(key->kf);
+}
+
+static void onion_skin_cache_entry_dispose(DP_OnionSkinCacheEntry *entry)
+{
+    DP_OnionSkinCacheKey *key = &entry->key;
+    if (key->layer) {
+        if (key->is_group) {
+            DP_layer_group_decref(key->layer);
+        }
+        else {
+            DP_layer_content_decref(key->layer);
+        }
+        DP_layer_props_decref(key->lp);
+        DP_key_frame_decref(key->kf);
+        DP_tile_decref_nullable(entry->tile);
+    }
+}
+
+void DP_onion_skin_cache_free(DP_OnionSkinCache *osc_or_null)
+{
+    if (osc_or_null) {
+        for (int i = 0; i < ONION_SKIN_CACHE_CAPACITY; ++i) {
+            onion_skin_cache_entry_dispose(&osc_or_null->entries[i]);
+        }
+        DP_mutex_free(osc_or_null->mutex);
+        DP_free(osc_or_null);
+    }
+}
+
+void DP_onion_skin_cache_clear(DP_OnionSkinCache *osc)
+{
+    DP_ASSERT(osc);
+    DP_MUTEX_MUST_LOCK(osc->mutex);
+    for (int i = 0; i < ONION_SKIN_CACHE_CAPACITY; ++i) {
+        onion_skin_cache_entry_dispose(&osc->entries[i]);
+        osc->entries[i] = (DP_OnionSkinCacheEntry){{0}, NULL};
+    }
+    DP_MUTEX_MUST_UNLOCK(osc->mutex);
+}
+
+DP_OnionSkinCacheKey DP_onion_skin_cache_key_make(const DP_ViewModeContext *vmc,
+                                                  DP_LayerListEntry *lle,
+                                                  DP_LayerProps *lp,
+                                                  const DP_OnionSkin *os,
+                                                  uint16_t parent_opacity,
+                                                  bool include_sublayers,
+                                                  int tile_index)
+{
+    DP_ASSERT(vmc);
+    DP_ASSERT(is_frame_type(vmc->internal_type));
+    DP_ASSERT(lle);
+    DP_ASSERT(lp);
+    DP_ASSERT(os);
+    DP_ViewModeTrack *vmt = &vmc->frame.vmb->tracks[vmc->frame.track_index];
+    // The track's hidden layers are derived from the props and key frame, so
+    // together with the layer itself, they determine what the onion skin is.
+    bool is_group = DP_layer_list_entry_is_group(lle);
+    void *layer = is_group ? (void *)DP_layer_list_entry_group_noinc(lle)
+                           : (void *)DP_layer_list_entry_content_noinc(lle);
+    return (DP_OnionSkinCacheKey){layer,
+                                  lp,
+                                  vmt->key_frame,
+                                  vmc->internal_type,
+                                  tile_index,
+                                  DP_fix15_mul(parent_opacity, os->opacity),
+                                  os->tint,
+                                  is_group,
+                                  include_sublayers};
+}
+
+static size_t onion_skin_cache_index(const DP_OnionSkinCacheKey *key)
+{
+    uint64_t h = (uint64_t)(uintptr_t)key->layer;
+    h = h * 31u + (uint64_t)(uintptr_t)key->lp;
+    h = h * 31u + (uint64_t)(uintptr_t)key->kf;
+    h = h * 31u + DP_int_to_uint64(key->tile_index);
+    h = h * 31u + key->opacity;
+    DP_UPixel15 tint = key->tint;
+    h = h * 31u
+      + (((uint64_t)tint.b << 48u) | ((uint64_t)tint.g << 32u)
+         | ((uint64_t)tint.r << 16u) | (uint64_t)tint.a);
+    // Finalizer from MurmurHash3 to spread the bits around.
+    h ^= h >> 33u;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33u;
+    return DP_uint64_to_size(h & (ONION_SKIN_CACHE_CAPACITY - 1u));
+}
+
+static bool onion_skin_cache_key_equal(const DP_OnionSkinCacheKey *a,
+                                       const DP_OnionSkinCacheKey *b)
+{
+    return a->layer == b->layer && a->lp == b->lp && a->kf == b->kf
+        && a->internal_type == b->internal_type
+        && a->tile_index == b->tile_index && a->opacity == b->opacity
+        && a->tint.b == b->tint.b && a->tint.g == b->tint.g
+        && a->tint.r == b->tint.r && a->tint.a == b->tint.a
+        && a->is_group == b->is_group
+        && a->include_sublayers == b->include_sublayers;
+}
+
+bool DP_onion_skin_cache_search_inc(DP_OnionSkinCache *osc,
+                                    const DP_OnionSkinCacheKey *key,
+                                    DP_Tile **out_tile_or_null)
+{
+    DP_ASSERT(osc);
+    DP_ASSERT(key);
+    DP_ASSERT(key->layer);
+    DP_ASSERT(out_tile_or_null);
+    DP_OnionSkinCacheEntry *entry = &osc->entries[onion_skin_cache_index(key)];
+    DP_MUTEX_MUST_LOCK(osc->mutex);
+    bool found = onion_skin_cache_key_equal(&entry->key, key);
+    if (found) {
+        *out_tile_or_null = DP_tile_incref_nullable(entry->tile);
+    }
+    DP_MUTEX_MUST_UNLOCK(osc->mutex);
+    return found;
+}
+
+void DP_onion_skin_cache_insert(DP_OnionSkinCache *osc,
+                                const DP_OnionSkinCacheKey *key,
+                                DP_Tile *tile_or_null)
+{
+    DP_ASSERT(osc);
+    DP_ASSERT(key);
+    DP_ASSERT(key->layer);
+    onion_skin_cache_key_incref(key);
+    DP_OnionSkinCacheEntry new_entry = {*key,
+                                        DP_tile_incref_nullable(tile_or_null)};
+    DP_OnionSkinCacheEntry *entry = &osc->entries[onion_skin_cache_index(key)];
+    DP_MUTEX_MUST_LOCK(osc->mutex);
+    DP_OnionSkinCacheEntry old_entry = *entry;
+    *entry = new_entry;
+    DP_MUTEX_MUST_UNLOCK(osc->mutex);
+    // Evicted entries may be the last reference to an entire layer, so let go
+    // of them outside of the lock.
+    onion_skin_cache_entry_dispose(&old_entry);
+}
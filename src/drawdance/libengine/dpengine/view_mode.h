@@ -25,11 +25,14 @@
 #include <dpcommon/common.h>
 
 typedef struct DP_CanvasState DP_CanvasState;
+typedef struct DP_KeyFrame DP_KeyFrame;
 typedef struct DP_LayerList DP_LayerList;
 typedef struct DP_LayerListEntry DP_LayerListEntry;
 typedef struct DP_LayerProps DP_LayerProps;
 typedef struct DP_LayerPropsList DP_LayerPropsList;
 typedef struct DP_LocalState DP_LocalState;
+typedef struct DP_Rect DP_Rect;
+typedef struct DP_Tile DP_Tile;
 
 
 typedef enum DP_ViewMode {
@@ -87,6 +90,20 @@ typedef struct DP_OnionSkin {
 
 typedef struct DP_OnionSkins DP_OnionSkins;
 
+typedef struct DP_OnionSkinCache DP_OnionSkinCache;
+
+typedef struct DP_OnionSkinCacheKey {
+    void *layer;
+    DP_LayerProps *lp;
+    DP_KeyFrame *kf;
+    int internal_type;
+    int tile_index;
+    uint16_t opacity;
+    DP_UPixel15 tint;
+    bool is_group;
+    bool include_sublayers;
+} DP_OnionSkinCacheKey;
+
 typedef void (*DP_AddVisibleLayerFn)(void *user, int layer_id, bool visible);
 
 
@@ -113,6 +130,25 @@ DP_view_mode_filter_make_from_active(DP_ViewModeBuffer *vmb, DP_ViewMode vm,
 
 bool DP_view_mode_filter_excludes_everything(const DP_ViewModeFilter *vmf);
 
+// Compares two frame render filters on the same canvas state and gives the
+// canvas area in which their rendered images can differ. That's judged only by
+// which layers they include, tracks showing the same layer the same way at the
+// bottom and top of both frames are skipped, everything in between contributes
+// the bounds of its non-blank tiles. The bounds may extend past the canvas.
+// Returns false if the frames render the same.
+bool DP_view_mode_filter_frame_change_bounds(const DP_ViewModeFilter *a,
+                                             const DP_ViewModeFilter *b,
+                                             DP_CanvasState *cs,
+                                             DP_Rect *out_bounds);
+
+// Compares two frame render filters made on different canvas states. Returns
+// true if they're guaranteed to render the same image, because they show the
+// very same layers in the same way. False if they might differ.
+bool DP_view_mode_filter_frame_render_equal(const DP_ViewModeFilter *a,
+                                            DP_CanvasState *cs_a,
+                                            const DP_ViewModeFilter *b,
+                                            DP_CanvasState *cs_b);
+
 
 DP_ViewModeContextRoot
 DP_view_mode_context_root_init(const DP_ViewModeFilter *vmf,
@@ -178,4 +214,34 @@ void DP_onion_skins_skin_above_at_set(DP_OnionSkins *oss, int index,
                                       uint16_t opacity, DP_UPixel15 tint);
 
 
+// Cache of flattened and tinted onion skin tiles, shared between threads. The
+// entries hold references to the layer, props and key frame they were made
+// from, so a cache hit is always for the exact same onion skin content. Blank
+// results are cached too, without taking up a tile.
+DP_OnionSkinCache *DP_onion_skin_cache_new(void);
+
+void DP_onion_skin_cache_free(DP_OnionSkinCache *osc_or_null);
+
+void DP_onion_skin_cache_clear(DP_OnionSkinCache *osc);
+
+// Makes a key for the onion skin that DP_view_mode_context_root_at gave back.
+DP_OnionSkinCacheKey DP_onion_skin_cache_key_make(const DP_ViewModeContext *vmc,
+                                                  DP_LayerListEntry *lle,
+                                                  DP_LayerProps *lp,
+                                                  const DP_OnionSkin *os,
+                                                  uint16_t parent_opacity,
+                                                  bool include_sublayers,
+                                                  int tile_index);
+
+// Returns true on a hit and sets out_tile_or_null to a new reference to the
+// cached tile, or to NULL if the onion skin is blank on that tile.
+bool DP_onion_skin_cache_search_inc(DP_OnionSkinCache *osc,
+                                    const DP_OnionSkinCacheKey *key,
+                                    DP_Tile **out_tile_or_null);
+
+void DP_onion_skin_cache_insert(DP_OnionSkinCache *osc,
+                                const DP_OnionSkinCacheKey *key,
+                                DP_Tile *tile_or_null);
+
+
 #endif
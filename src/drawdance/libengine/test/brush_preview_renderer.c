@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/threading.h>
+#include <dpengine/brush.h>
+#include <dpengine/brush_preview.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dptest_engine.h>
+
+
+#define WIDTH         200
+#define HEIGHT        80
+#define REQUEST_COUNT 100
+
+
+typedef struct RenderedPreviews {
+    DP_Mutex *mutex;
+    DP_Semaphore *sem;
+    int count;
+    bool in_order;
+    unsigned int last_id;
+    DP_Image *last_img;
+} RenderedPreviews;
+
+static void on_rendered(void *user, unsigned int request_id, DP_Image *img)
+{
+    RenderedPreviews *rp = user;
+    DP_MUTEX_MUST_LOCK(rp->mutex);
+    ++rp->count;
+    if (request_id <= rp->last_id) {
+        rp->in_order = false;
+    }
+    rp->last_id = request_id;
+    DP_image_free(rp->last_img);
+    rp->last_img = img;
+    DP_MUTEX_MUST_UNLOCK(rp->mutex);
+    DP_SEMAPHORE_MUST_POST(rp->sem);
+}
+
+static void wait_for_request(RenderedPreviews *rp, unsigned int request_id)
+{
+    while (true) {
+        DP_SEMAPHORE_MUST_WAIT(rp->sem);
+        DP_MUTEX_MUST_LOCK(rp->mutex);
+        bool done = rp->last_id == request_id;
+        DP_MUTEX_MUST_UNLOCK(rp->mutex);
+        if (done) {
+            break;
+        }
+    }
+}
+
+static void init_range(DP_ClassicBrushRange *range, float value)
+{
+    range->min = value;
+    range->max = value;
+    for (int i = 0; i < DP_CLASSIC_BRUSH_CURVE_VALUE_COUNT; ++i) {
+        range->curve.values[i] =
+            DP_int_to_float(i)
+            / DP_int_to_float(DP_CLASSIC_BRUSH_CURVE_VALUE_COUNT - 1);
+    }
+}
+
+// Roughly what dragging a size slider around does to the brush.
+static DP_ClassicBrush make_brush(int i)
+{
+    DP_ClassicBrush cb = {0};
+    init_range(&cb.size, DP_int_to_float(i % 40 + 1));
+    init_range(&cb.hardness, 0.8f);
+    init_range(&cb.opacity, 1.0f);
+    init_range(&cb.smudge, 0.0f);
+    cb.spacing = 0.1f;
+    cb.color = (DP_UPixelFloat){0.2f, 0.4f, 0.6f, 1.0f};
+    cb.shape = i % 2 == 0 ? DP_BRUSH_SHAPE_CLASSIC_SOFT_ROUND
+                          : DP_BRUSH_SHAPE_CLASSIC_PIXEL_ROUND;
+    cb.brush_mode = DP_BLEND_MODE_NORMAL;
+    cb.erase_mode = DP_BLEND_MODE_ERASE;
+    return cb;
+}
+
+static DP_Image *render_sync(const DP_ClassicBrush *cb, int width, int height,
+                             DP_BrushPreviewShape shape)
+{
+    DP_BrushPreview *bp = DP_brush_preview_new();
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_brush_preview_render_classic(bp, dc, width, height, cb, shape);
+    DP_Image *img = DP_brush_preview_to_image(bp);
+    DP_draw_context_free(dc);
+    DP_brush_preview_free(bp);
+    return img;
+}
+
+
+static void request_storm(TEST_PARAMS)
+{
+    RenderedPreviews rp = {DP_mutex_new(), DP_semaphore_new(0), 0, true, 0,
+                           NULL};
+    DP_BrushPreviewRenderer *bpr =
+        DP_brush_preview_renderer_new(on_rendered, &rp);
+
+    unsigned int request_id = 0;
+    for (int i = 0; i < REQUEST_COUNT; ++i) {
+        DP_ClassicBrush cb = make_brush(i);
+        unsigned int prev_request_id = request_id;
+        request_id = DP_brush_preview_renderer_request_classic(
+            bpr, WIDTH + i % 7, HEIGHT, &cb, DP_BRUSH_PREVIEW_STROKE);
+        if (request_id <= prev_request_id) {
+            FAIL("request id %u not greater than previous %u", request_id,
+                 prev_request_id);
+        }
+    }
+    wait_for_request(&rp, request_id);
+
+    DP_ClassicBrush final_cb = make_brush(REQUEST_COUNT - 1);
+    DP_Image *expected = render_sync(&final_cb, WIDTH + (REQUEST_COUNT - 1) % 7,
+                                     HEIGHT, DP_BRUSH_PREVIEW_STROKE);
+
+    DP_MUTEX_MUST_LOCK(rp.mutex);
+    NOTE("%d of %d previews delivered", rp.count, REQUEST_COUNT);
+    OK(rp.in_order, "previews delivered in request order");
+    OK(rp.count <= REQUEST_COUNT, "no more previews than requests");
+    UINT_EQ_OK(rp.last_id, request_id, "last preview is the final request");
+    IMAGE_EQ_OK(rp.last_img, expected, "last preview matches final settings");
+    DP_MUTEX_MUST_UNLOCK(rp.mutex);
+
+    // A storm that's still in flight when the renderer goes away.
+    for (int i = 0; i < REQUEST_COUNT; ++i) {
+        DP_ClassicBrush cb = make_brush(i);
+        DP_brush_preview_renderer_request_classic(
+            bpr, WIDTH, HEIGHT, &cb, DP_BRUSH_PREVIEW_ELLIPSE);
+    }
+    DP_brush_preview_renderer_free(bpr);
+    PASS("renderer freed with requests in flight");
+
+    DP_image_free(expected);
+    DP_image_free(rp.last_img);
+    DP_semaphore_free(rp.sem);
+    DP_mutex_free(rp.mutex);
+}
+
+static void request_empty(TEST_PARAMS)
+{
+    RenderedPreviews rp = {DP_mutex_new(), DP_semaphore_new(0), 0, true, 0,
+                           NULL};
+    DP_BrushPreviewRenderer *bpr =
+        DP_brush_preview_renderer_new(on_rendered, &rp);
+
+    DP_ClassicBrush cb = make_brush(0);
+    unsigned int request_id = DP_brush_preview_renderer_request_classic(
+        bpr, 0, HEIGHT, &cb, DP_BRUSH_PREVIEW_LINE);
+    wait_for_request(&rp, request_id);
+    DP_brush_preview_renderer_free(bpr);
+
+    INT_EQ_OK(rp.count, 1, "one preview delivered");
+    NULL_OK(rp.last_img, "empty preview has no image");
+
+    DP_semaphore_free(rp.sem);
+    DP_mutex_free(rp.mutex);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(request_storm);
+    REGISTER_TEST(request_empty);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/canvas_diff.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dptest_engine.h>
+
+
+#define WIDTH         700
+#define HEIGHT        500
+#define VERSION_COUNT 200
+#define CHECK_COUNT   1000
+
+// Makes a new version of the given content with a few random pixels changed,
+// some of them to transparent, which turns tiles blank. Sometimes replaces
+// lots of tiles at once, which exceeds what the change tracking keeps.
+static DP_LayerContent *random_version(uint32_t *state, DP_LayerContent *lc)
+{
+    DP_TransientLayerContent *tlc = DP_transient_layer_content_new(lc);
+    int changes = DP_test_random_int(state, 4);
+    for (int i = 0; i < changes; ++i) {
+        uint16_t a =
+            DP_test_random_int(state, 4) == 0
+                ? 0
+                : DP_int_to_uint16(DP_test_random_int(state, DP_BIT15) + 1);
+        DP_Pixel15 pixel = {a, a, a, a};
+        DP_transient_layer_content_pixel_at_set(
+            tlc, 0, DP_test_random_int(state, WIDTH),
+            DP_test_random_int(state, HEIGHT), pixel);
+    }
+    if (DP_test_random_int(state, 20) == 0) {
+        DP_Tile *t = DP_tile_new_from_pixel15(0, (DP_Pixel15){1, 1, 1, 1});
+        DP_transient_layer_content_put_tile_inc(tlc, t, 0, 0,
+                                                DP_test_random_int(state, 40));
+        DP_tile_decref(t);
+    }
+    return DP_transient_layer_content_persist(tlc);
+}
+
+static void mark_changed(void *data, int tile_index)
+{
+    bool *actual = data;
+    actual[tile_index] = true;
+}
+
+// The diff must come out the same as just comparing every tile.
+static void check_diff(TEST_PARAMS, DP_CanvasDiff *diff, DP_LayerProps *lp,
+                       DP_LayerContent *lc, DP_LayerContent *prev_lc,
+                       bool *actual, int a, int b)
+{
+    DP_canvas_diff_begin(diff, WIDTH, HEIGHT, WIDTH, HEIGHT, false);
+    DP_layer_content_diff(lc, lp, prev_lc, lp, diff);
+    int count = DP_tile_total_round(WIDTH, HEIGHT);
+    for (int i = 0; i < count; ++i) {
+        actual[i] = false;
+    }
+    DP_canvas_diff_each_index_reset(diff, mark_changed, actual);
+
+    DP_TileCounts tile_counts = DP_tile_counts_round(WIDTH, HEIGHT);
+    int mismatches = 0;
+    for (int y = 0; y < tile_counts.y; ++y) {
+        for (int x = 0; x < tile_counts.x; ++x) {
+            bool expected = DP_layer_content_tile_at_noinc(lc, x, y)
+                         != DP_layer_content_tile_at_noinc(prev_lc, x, y);
+            if (actual[y * tile_counts.x + x] != expected) {
+                ++mismatches;
+            }
+        }
+    }
+    INT_EQ_OK(mismatches, 0, "diff of versions %d and %d matches", a, b);
+}
+
+
+static void diff_versions(TEST_PARAMS)
+{
+    uint32_t state = 0xc0ffee11u;
+    DP_LayerContent *versions[VERSION_COUNT];
+    versions[0] = DP_transient_layer_content_persist(
+        DP_transient_layer_content_new_init(WIDTH, HEIGHT, NULL));
+    // Branch off of random earlier versions, like undo does.
+    for (int i = 1; i < VERSION_COUNT; ++i) {
+        int parent = DP_test_random_int(&state, 8) == 0
+                       ? DP_test_random_int(&state, i)
+                       : i - 1;
+        versions[i] = random_version(&state, versions[parent]);
+    }
+
+    DP_LayerProps *lp = DP_transient_layer_props_persist(
+        DP_transient_layer_props_new_init(1, false));
+    DP_CanvasDiff *diff = DP_canvas_diff_new();
+    size_t tile_count = DP_int_to_size(DP_tile_total_round(WIDTH, HEIGHT));
+    bool *actual = DP_malloc(sizeof(*actual) * tile_count);
+    // Start with everything marked as changed, then clear it out.
+    DP_canvas_diff_begin(diff, 0, 0, WIDTH, HEIGHT, false);
+    DP_canvas_diff_each_index_reset(diff, mark_changed, actual);
+
+    for (int i = 1; i < VERSION_COUNT; ++i) {
+        check_diff(TEST_ARGS, diff, lp, versions[i], versions[i - 1], actual,
+                   i, i - 1);
+    }
+    for (int i = 0; i < CHECK_COUNT; ++i) {
+        int a = DP_test_random_int(&state, VERSION_COUNT);
+        int b = DP_test_random_int(&state, VERSION_COUNT);
+        check_diff(TEST_ARGS, diff, lp, versions[a], versions[b], actual, a,
+                   b);
+    }
+
+    DP_free(actual);
+    DP_canvas_diff_free(diff);
+    DP_layer_props_decref(lp);
+    for (int i = 0; i < VERSION_COUNT; ++i) {
+        DP_layer_content_decref(versions[i]);
+    }
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(diff_versions);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
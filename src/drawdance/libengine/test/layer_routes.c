@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include <dpcommon/common.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/layer_props_list.h>
+#include <dpengine/layer_routes.h>
+#include <dpengine/ops.h>
+#include <dptest_engine.h>
+
+
+#define MIN_LAYER_ID 0x100
+#define MAX_LAYER_ID 0x1ff
+#define STEP_COUNT   3000
+
+typedef struct LayerIds {
+    int count;
+    int group_count;
+    int ids[MAX_LAYER_ID - MIN_LAYER_ID + 1];
+    int parent_ids[MAX_LAYER_ID - MIN_LAYER_ID + 1];
+    int group_ids[MAX_LAYER_ID - MIN_LAYER_ID + 1];
+} LayerIds;
+
+static void collect_layer_ids(LayerIds *li, DP_LayerPropsList *lpl,
+                              int parent_id)
+{
+    int count = DP_layer_props_list_count(lpl);
+    for (int i = 0; i < count; ++i) {
+        DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+        int layer_id = DP_layer_props_id(lp);
+        li->parent_ids[li->count] = parent_id;
+        li->ids[li->count++] = layer_id;
+        DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
+        if (child_lpl) {
+            li->group_ids[li->group_count++] = layer_id;
+            collect_layer_ids(li, child_lpl, layer_id);
+        }
+    }
+}
+
+static int random_id(uint32_t *state, int count, const int *ids)
+{
+    return count == 0 ? 0 : ids[DP_test_random_int(state, count)];
+}
+
+// Picks a random layer directly inside of the given parent, or 0 for none.
+static int random_child_id(uint32_t *state, const LayerIds *li, int parent_id,
+                           int exclude_id)
+{
+    int count = 0;
+    int child_ids[MAX_LAYER_ID - MIN_LAYER_ID + 1];
+    for (int i = 0; i < li->count; ++i) {
+        if (li->parent_ids[i] == parent_id && li->ids[i] != exclude_id) {
+            child_ids[count++] = li->ids[i];
+        }
+    }
+    return random_id(state, count, child_ids);
+}
+
+static int random_new_id(uint32_t *state, DP_CanvasState *cs)
+{
+    DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
+    int range = MAX_LAYER_ID - MIN_LAYER_ID + 1;
+    int offset = DP_test_random_int(state, range);
+    for (int i = 0; i < range; ++i) {
+        int layer_id = MIN_LAYER_ID + (offset + i) % range;
+        if (!DP_layer_routes_search(lr, layer_id)) {
+            return layer_id;
+        }
+    }
+    return 0;
+}
+
+static DP_CanvasState *random_op(uint32_t *state, DP_CanvasState *cs,
+                                 DP_DrawContext *dc, const LayerIds *li)
+{
+    int any_id = random_id(state, li->count, li->ids);
+    int group_id = random_id(state, li->group_count, li->group_ids);
+    switch (li->count < 8 ? 0 : DP_test_random_int(state, 4)) {
+    case 0: {
+        // Create a layer or group, on top, above a random layer or into a
+        // random group. Sometimes duplicates an existing one, including
+        // all the children of a group.
+        int layer_id = random_new_id(state, cs);
+        if (layer_id == 0) {
+            return NULL;
+        }
+        bool into = group_id != 0 && DP_test_random_int(state, 2) == 0;
+        int target_id = into ? group_id
+                      : DP_test_random_int(state, 4) == 0 ? 0
+                                                         : any_id;
+        int source_id = DP_test_random_int(state, 8) == 0 ? any_id : 0;
+        bool group = DP_test_random_int(state, 3) == 0;
+        return DP_ops_layer_tree_create(cs, dc, layer_id, source_id, target_id,
+                                        NULL, into, group, "", 0);
+    }
+    case 1:
+        // Delete a layer or a group with all its children, sometimes merging
+        // it into another layer.
+        return DP_ops_layer_tree_delete(
+            cs, dc, 1, any_id,
+            DP_test_random_int(state, 4) == 0
+                ? random_id(state, li->count, li->ids)
+                : 0);
+    default: {
+        // Move a layer or group to the root or into a group, either at the
+        // bottom or above some layer. Moves that make no sense, like moving
+        // a group into itself or next to a layer in a different group, fail
+        // and just get skipped.
+        int parent_id = DP_test_random_int(state, 3) == 0 ? 0 : group_id;
+        int sibling_id = DP_test_random_int(state, 4) == 0
+                           ? 0
+                           : random_child_id(state, li, parent_id, any_id);
+        if (any_id == parent_id || any_id == sibling_id
+            || (parent_id == sibling_id && parent_id != 0)) {
+            return NULL;
+        }
+        return DP_ops_layer_tree_move(cs, dc, any_id, parent_id, sibling_id);
+    }
+    }
+}
+
+static bool routes_entries_equal(DP_LayerRoutesEntry *a,
+                                 DP_LayerRoutesEntry *b)
+{
+    if (!a || !b) {
+        return !a && !b;
+    }
+
+    int index_count = DP_layer_routes_entry_index_count(a);
+    bool same = DP_layer_routes_entry_layer_id(a)
+                    == DP_layer_routes_entry_layer_id(b)
+             && DP_layer_routes_entry_is_group(a)
+                    == DP_layer_routes_entry_is_group(b)
+             && index_count == DP_layer_routes_entry_index_count(b);
+    if (!same) {
+        return false;
+    }
+
+    for (int i = 0; i < index_count; ++i) {
+        if (DP_layer_routes_entry_index_at(a, i)
+            != DP_layer_routes_entry_index_at(b, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every layer id, including ones that don't exist (anymore), must have the
+// same entry in the incrementally updated routes as in freshly built ones.
+static bool check_routes(TEST_PARAMS, DP_CanvasState *cs, DP_DrawContext *dc,
+                         int step)
+{
+    DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
+    DP_LayerRoutes *expected_lr =
+        DP_layer_routes_new_index(DP_canvas_state_layer_props_noinc(cs), dc);
+    int mismatched_id = 0;
+    for (int layer_id = MIN_LAYER_ID; layer_id <= MAX_LAYER_ID; ++layer_id) {
+        if (!routes_entries_equal(
+                DP_layer_routes_search(lr, layer_id),
+                DP_layer_routes_search(expected_lr, layer_id))) {
+            mismatched_id = layer_id;
+            break;
+        }
+    }
+    DP_layer_routes_decref(expected_lr);
+
+    if (mismatched_id == 0) {
+        return true;
+    }
+    else {
+        FAIL("routes for layer %d after step %d match a fresh index",
+             mismatched_id, step);
+        return false;
+    }
+}
+
+
+static void layer_routes_random_ops(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs = DP_canvas_state_new();
+    uint32_t state = 0x5eed1234u;
+    int applied = 0;
+    bool ok = true;
+    for (int step = 0; ok && step < STEP_COUNT; ++step) {
+        LayerIds li = {0, 0, {0}, {0}, {0}};
+        collect_layer_ids(&li, DP_canvas_state_layer_props_noinc(cs), 0);
+        DP_CanvasState *next = random_op(&state, cs, dc, &li);
+        if (next) {
+            DP_canvas_state_decref(cs);
+            cs = next;
+            ++applied;
+            ok = check_routes(TEST_ARGS, cs, dc, step);
+        }
+    }
+
+    if (ok) {
+        PASS("routes match a fresh index after all %d applied steps",
+             applied);
+        OK(applied > STEP_COUNT / 4, "applied at least a quarter of the steps");
+    }
+
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(layer_routes_random_ops);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include <dpcommon/binary.h>
+#include <dpcommon/input.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/load.h>
+#include <dpengine/pixels.h>
+#include <dptest_engine.h>
+
+
+#define WIDTH  4
+#define HEIGHT 2
+
+// PackBits-compressed rows of a channel. The byte count given for each row is
+// exactly the size of its data here, so broken rows can't borrow any bytes
+// from their neighbors.
+typedef struct RleRows {
+    const unsigned char *rows[HEIGHT];
+    size_t sizes[HEIGHT];
+} RleRows;
+
+typedef struct PsdBuffer {
+    unsigned char data[1024];
+    size_t length;
+} PsdBuffer;
+
+static void put_bytes(PsdBuffer *buf, const void *bytes, size_t size)
+{
+    DP_ASSERT(buf->length + size <= sizeof(buf->data));
+    memcpy(buf->data + buf->length, bytes, size);
+    buf->length += size;
+}
+
+static void put_u8(PsdBuffer *buf, uint8_t x)
+{
+    put_bytes(buf, &x, 1);
+}
+
+static void put_u16(PsdBuffer *buf, uint16_t x)
+{
+    unsigned char bytes[2];
+    put_bytes(buf, bytes, DP_write_bigendian_uint16(x, bytes));
+}
+
+static void put_u32(PsdBuffer *buf, uint32_t x)
+{
+    unsigned char bytes[4];
+    put_bytes(buf, bytes, DP_write_bigendian_uint32(x, bytes));
+}
+
+static void put_rle_channel(PsdBuffer *buf, const RleRows *rr)
+{
+    put_u16(buf, 1); // RLE compression.
+    for (int y = 0; y < HEIGHT; ++y) {
+        put_u16(buf, (uint16_t)rr->sizes[y]);
+    }
+    for (int y = 0; y < HEIGHT; ++y) {
+        put_bytes(buf, rr->rows[y], rr->sizes[y]);
+    }
+}
+
+static size_t rle_channel_size(const RleRows *rr)
+{
+    size_t size = 2 + HEIGHT * 2;
+    for (int y = 0; y < HEIGHT; ++y) {
+        size += rr->sizes[y];
+    }
+    return size;
+}
+
+// Writes an RGB document with a single layer covering all of it. Alpha, green
+// and blue are solid, the given rows go into the red channel.
+static void write_psd(PsdBuffer *buf, const RleRows *red)
+{
+    static const unsigned char alpha_row[] = {0xfd, 0xff};
+    static const unsigned char green_row[] = {0xfd, 0x80};
+    static const unsigned char blue_row[] = {0xfd, 0x40};
+    RleRows alpha = {{alpha_row, alpha_row}, {2, 2}};
+    RleRows green = {{green_row, green_row}, {2, 2}};
+    RleRows blue = {{blue_row, blue_row}, {2, 2}};
+    struct {
+        int16_t id;
+        const RleRows *rr;
+    } channels[] = {{-1, &alpha}, {0, red}, {1, &green}, {2, &blue}};
+
+    buf->length = 0;
+    put_bytes(buf, "8BPS", 4);
+    put_u16(buf, 1);
+    put_bytes(buf, "\0\0\0\0\0\0", 6);
+    put_u16(buf, 3);
+    put_u32(buf, HEIGHT);
+    put_u32(buf, WIDTH);
+    put_u16(buf, 8);
+    put_u16(buf, 3); // RGB color mode.
+    put_u32(buf, 0); // No color mode data.
+    put_u32(buf, 0); // No image resources.
+
+    size_t section_offset = buf->length;
+    put_u32(buf, 0); // Layer and mask section length, filled in below.
+    size_t layer_info_offset = buf->length;
+    put_u32(buf, 0); // Layer info length, filled in below.
+    put_u16(buf, 1);
+    put_u32(buf, 0);
+    put_u32(buf, 0);
+    put_u32(buf, HEIGHT);
+    put_u32(buf, WIDTH);
+    put_u16(buf, DP_ARRAY_LENGTH(channels));
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(channels); ++i) {
+        put_u16(buf, (uint16_t)channels[i].id);
+        put_u32(buf, (uint32_t)rle_channel_size(channels[i].rr));
+    }
+    put_bytes(buf, "8BIMnorm", 8);
+    // Not fully opaque, otherwise a uniform layer gets turned into the canvas
+    // background on load. Layer opacity doesn't affect the pixels.
+    put_u8(buf, 128);
+    put_u8(buf, 0);   // Clipping.
+    put_u8(buf, 0);   // Flags.
+    put_u8(buf, 0);   // Filler.
+    put_u32(buf, 12); // Extra data length.
+    put_u32(buf, 0);  // No layer mask.
+    put_u32(buf, 0);  // No blending ranges.
+    put_bytes(buf, "\1L\0\0", 4);
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(channels); ++i) {
+        put_rle_channel(buf, channels[i].rr);
+    }
+    DP_write_bigendian_uint32(
+        (uint32_t)(buf->length - layer_info_offset - 4),
+        buf->data + layer_info_offset);
+    put_u32(buf, 0); // No global layer mask info.
+    DP_write_bigendian_uint32((uint32_t)(buf->length - section_offset - 4),
+                              buf->data + section_offset);
+
+    put_u16(buf, 0); // Raw merged image data, which isn't looked at.
+}
+
+static void check_rle_red(TEST_PARAMS, const RleRows *red,
+                          const uint8_t *expected_red)
+{
+    PsdBuffer buf;
+    write_psd(&buf, red);
+
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_LoadResult result;
+    DP_CanvasState *cs = DP_load_psd(
+        dc, DP_mem_input_new_keep_on_close(buf.data, buf.length),
+        DP_LOAD_FLAG_SINGLE_THREAD, &result);
+    DP_draw_context_free(dc);
+    FATAL(NOT_NULL_OK(cs, "loaded PSD"));
+    INT_EQ_OK(result, DP_LOAD_RESULT_SUCCESS, "load result is success");
+
+    DP_LayerList *ll = DP_canvas_state_layers_noinc(cs);
+    if (INT_EQ_OK(DP_layer_list_count(ll), 1, "PSD has one layer")) {
+        DP_LayerContent *lc = DP_layer_list_content_at_noinc(ll, 0);
+        for (int y = 0; y < HEIGHT; ++y) {
+            for (int x = 0; x < WIDTH; ++x) {
+                DP_Pixel15 pixel = DP_layer_content_pixel_at(lc, x, y);
+                INT_EQ_OK(DP_channel15_to_8(pixel.r),
+                          expected_red[y * WIDTH + x], "red at %d, %d", x, y);
+                INT_EQ_OK(DP_channel15_to_8(pixel.g), 0x80,
+                          "green at %d, %d", x, y);
+                INT_EQ_OK(DP_channel15_to_8(pixel.a), 0xff,
+                          "alpha at %d, %d", x, y);
+            }
+        }
+    }
+
+    DP_canvas_state_decref(cs);
+}
+
+
+static void load_psd_rle(TEST_PARAMS)
+{
+    static const unsigned char literal_row[] = {0x03, 10, 20, 30, 40};
+    static const unsigned char run_row[] = {0xfd, 50};
+    RleRows red = {{literal_row, run_row}, {5, 2}};
+    static const uint8_t expected_red[] = {10, 20, 30, 40, 50, 50, 50, 50};
+    check_rle_red(TEST_ARGS, &red, expected_red);
+}
+
+// A broken row makes its whole channel get dropped, so red ends up empty.
+static const uint8_t no_red[WIDTH * HEIGHT];
+
+static void load_psd_rle_short_row(TEST_PARAMS)
+{
+    static const unsigned char literal_row[] = {0x03, 10, 20, 30, 40};
+    static const unsigned char short_row[] = {0xff, 50};
+    RleRows red = {{literal_row, short_row}, {5, 2}};
+    check_rle_red(TEST_ARGS, &red, no_red);
+}
+
+static void load_psd_rle_truncated_row(TEST_PARAMS)
+{
+    // The literal wants four bytes, but the row's byte count cuts it short.
+    static const unsigned char truncated_row[] = {0x03, 10, 20};
+    static const unsigned char run_row[] = {0xfd, 50};
+    RleRows red = {{truncated_row, run_row}, {3, 2}};
+    check_rle_red(TEST_ARGS, &red, no_red);
+}
+
+static void load_psd_rle_overlong_row(TEST_PARAMS)
+{
+    static const unsigned char literal_row[] = {0x03, 10, 20, 30, 40};
+    static const unsigned char overlong_row[] = {0x81, 50};
+    RleRows red = {{literal_row, overlong_row}, {5, 2}};
+    check_rle_red(TEST_ARGS, &red, no_red);
+}
+
+static void load_psd_rle_leftover_data(TEST_PARAMS)
+{
+    static const unsigned char long_row[] = {0x03, 10, 20, 30, 40, 0xfd, 60};
+    static const unsigned char run_row[] = {0xfd, 50};
+    RleRows red = {{long_row, run_row}, {7, 2}};
+    check_rle_red(TEST_ARGS, &red, no_red);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(load_psd_rle);
+    REGISTER_TEST(load_psd_rle_short_row);
+    REGISTER_TEST(load_psd_rle_truncated_row);
+    REGISTER_TEST(load_psd_rle_overlong_row);
+    REGISTER_TEST(load_psd_rle_leftover_data);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/tile.h>
+#include <dpengine/timeline.h>
+#include <dpengine/track.h>
+#include <dpengine/view_mode.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dptest_engine.h>
+#include <string.h>
+
+
+#define WIDTH  300
+#define HEIGHT 200
+
+
+static DP_CanvasState *handle(TEST_PARAMS, DP_CanvasState *cs,
+                              DP_DrawContext *dc, DP_Message *msg)
+{
+    DP_CanvasState *next = DP_canvas_state_handle(cs, dc, NULL, msg);
+    bool ok = NOT_NULL_OK(next, "handle %s",
+                          DP_message_type_enum_name(DP_message_type(msg)));
+    DP_message_decref(msg);
+    if (ok) {
+        DP_canvas_state_decref(cs);
+        return next;
+    }
+    else {
+        return cs;
+    }
+}
+
+static DP_CanvasState *create_layer(TEST_PARAMS, DP_CanvasState *cs,
+                                    DP_DrawContext *dc, uint16_t id,
+                                    bool group, uint16_t parent_id)
+{
+    uint8_t flags =
+        DP_int_to_uint8(group ? DP_MSG_LAYER_TREE_CREATE_FLAGS_GROUP : 0)
+        | DP_int_to_uint8(parent_id == 0 ? 0
+                                         : DP_MSG_LAYER_TREE_CREATE_FLAGS_INTO);
+    return handle(TEST_ARGS, cs, dc,
+                  DP_msg_layer_tree_create_new(1, id, 0, parent_id, 0, flags,
+                                               "", 0));
+}
+
+static DP_CanvasState *fill_rect(TEST_PARAMS, DP_CanvasState *cs,
+                                 DP_DrawContext *dc, uint16_t layer_id,
+                                 uint32_t x, uint32_t y, uint32_t w,
+                                 uint32_t h, uint32_t color)
+{
+    return handle(TEST_ARGS, cs, dc,
+                  DP_msg_fill_rect_new(1, layer_id, DP_BLEND_MODE_NORMAL, x, y,
+                                       w, h, color));
+}
+
+static DP_CanvasState *set_key_frame(TEST_PARAMS, DP_CanvasState *cs,
+                                     DP_DrawContext *dc, uint16_t frame_index,
+                                     uint16_t layer_id)
+{
+    return handle(TEST_ARGS, cs, dc,
+                  DP_msg_key_frame_set_new(1, 300, frame_index, layer_id, 0,
+                                           DP_MSG_KEY_FRAME_SET_SOURCE_LAYER));
+}
+
+// Onion skins are part of the local view, the paint engine usually sets this.
+static DP_CanvasState *enable_onion_skins(DP_CanvasState *cs)
+{
+    DP_TransientCanvasState *tcs = DP_transient_canvas_state_new(cs);
+    DP_canvas_state_decref(cs);
+    DP_TransientTimeline *ttl =
+        DP_transient_canvas_state_transient_timeline(tcs, 0);
+    DP_TransientTrack *tt = DP_transient_timeline_transient_at_noinc(ttl, 0, 0);
+    DP_transient_track_onion_skin_set(tt, true);
+    return DP_transient_canvas_state_persist(tcs);
+}
+
+// Frames 0 and 3 show the same layer, frame 1 a group and frame 2 a layer.
+static DP_CanvasState *make_canvas(TEST_PARAMS, DP_DrawContext *dc)
+{
+    DP_CanvasState *cs = DP_canvas_state_new();
+    cs = handle(TEST_ARGS, cs, dc,
+                DP_msg_canvas_resize_new(1, 0, WIDTH, HEIGHT, 0));
+    cs = create_layer(TEST_ARGS, cs, dc, 257, false, 0);
+    cs = create_layer(TEST_ARGS, cs, dc, 258, true, 0);
+    cs = create_layer(TEST_ARGS, cs, dc, 259, false, 258);
+    cs = create_layer(TEST_ARGS, cs, dc, 260, false, 0);
+    cs = fill_rect(TEST_ARGS, cs, dc, 257, 10, 10, 100, 80, 0xffff0000u);
+    cs = fill_rect(TEST_ARGS, cs, dc, 259, 50, 40, 200, 100, 0x8000ff00u);
+    cs = fill_rect(TEST_ARGS, cs, dc, 260, 150, 100, 140, 90, 0xff0000ffu);
+    cs = handle(TEST_ARGS, cs, dc,
+                DP_msg_set_metadata_int_new(
+                    1, DP_MSG_SET_METADATA_INT_FIELD_FRAME_COUNT, 4));
+    cs = handle(TEST_ARGS, cs, dc, DP_msg_track_create_new(1, 300, 0, 0, "", 0));
+    cs = set_key_frame(TEST_ARGS, cs, dc, 0, 257);
+    cs = set_key_frame(TEST_ARGS, cs, dc, 1, 258);
+    cs = set_key_frame(TEST_ARGS, cs, dc, 2, 260);
+    cs = set_key_frame(TEST_ARGS, cs, dc, 3, 257);
+    return enable_onion_skins(cs);
+}
+
+static DP_OnionSkins *make_onion_skins(void)
+{
+    DP_OnionSkins *oss = DP_onion_skins_new(false, 2, 1);
+    DP_onion_skins_skin_below_at_set(oss, 0, DP_BIT15 / 2,
+                                     (DP_UPixel15){0, 0, DP_BIT15, DP_BIT15 / 2});
+    DP_onion_skins_skin_below_at_set(oss, 1, DP_BIT15 / 4,
+                                     (DP_UPixel15){0, 0, 0, 0});
+    DP_onion_skins_skin_above_at_set(oss, 0, DP_BIT15 / 3,
+                                     (DP_UPixel15){DP_BIT15, 0, 0, DP_BIT15});
+    return oss;
+}
+
+// Flattening with the cache must give the same result as without it.
+static void check_frame(TEST_PARAMS, DP_CanvasState *cs,
+                        DP_OnionSkinCache *osc, DP_OnionSkins *oss,
+                        int frame_index, const char *title)
+{
+    DP_ViewModeBuffer vmb;
+    DP_view_mode_buffer_init(&vmb);
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make(
+        &vmb, DP_VIEW_MODE_FRAME, cs, 0, frame_index, oss);
+
+    DP_TransientTile *expected = DP_transient_tile_new_blank(0);
+    DP_TransientTile *actual = DP_transient_tile_new_blank(0);
+    int tile_count = DP_tile_total_round(WIDTH, HEIGHT);
+    int mismatches = 0;
+    int blank = 0;
+    for (int i = 0; i < tile_count; ++i) {
+        DP_transient_tile_clear(expected);
+        DP_transient_tile_clear(actual);
+        DP_canvas_state_flatten_tile_to(cs, i, expected, false, &vmf, NULL);
+        DP_canvas_state_flatten_tile_to(cs, i, actual, false, &vmf, osc);
+        if (memcmp(DP_transient_tile_pixels(expected),
+                   DP_transient_tile_pixels(actual),
+                   sizeof(DP_Pixel15) * DP_TILE_LENGTH)
+            != 0) {
+            ++mismatches;
+        }
+        if (DP_transient_tile_blank(expected)) {
+            ++blank;
+        }
+    }
+    INT_EQ_OK(mismatches, 0, "%s: cached frame %d matches", title, frame_index);
+    OK(blank < tile_count, "%s: frame %d isn't blank", title, frame_index);
+
+    DP_transient_tile_decref(actual);
+    DP_transient_tile_decref(expected);
+    DP_view_mode_buffer_dispose(&vmb);
+}
+
+
+static void cached_matches_uncached(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_OnionSkins *oss = make_onion_skins();
+    DP_OnionSkinCache *osc = DP_onion_skin_cache_new();
+    DP_CanvasState *cs = make_canvas(TEST_ARGS, dc);
+
+    // Frame 2 shows the same layer as onion skins below and above it, tinted
+    // differently, so those must not be mixed up.
+    check_frame(TEST_ARGS, cs, osc, oss, 2, "empty cache");
+    check_frame(TEST_ARGS, cs, osc, oss, 2, "filled cache");
+    check_frame(TEST_ARGS, cs, osc, oss, 3, "other frame");
+
+    // Drawing on a layer that's shown as an onion skin must not hit stale
+    // entries, neither for plain layers nor groups.
+    cs = fill_rect(TEST_ARGS, cs, dc, 257, 0, 0, 64, 64, 0xff00ffffu);
+    cs = fill_rect(TEST_ARGS, cs, dc, 259, 100, 20, 30, 30, 0xffffff00u);
+    check_frame(TEST_ARGS, cs, osc, oss, 2, "changed layers");
+
+    DP_onion_skin_cache_clear(osc);
+    check_frame(TEST_ARGS, cs, osc, oss, 2, "cleared cache");
+
+    DP_canvas_state_decref(cs);
+    DP_onion_skin_cache_free(osc);
+    DP_onion_skins_free(oss);
+    DP_draw_context_free(dc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(cached_matches_uncached);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dptest_engine.h>
+
+
+// Straightforward version of the sampling to compare against, since the
+// actual one uses vector instructions if available. Set the DP_CPU_SUPPORT
+// environment variable to switch which one to use.
+static void sample_oracle(const DP_Pixel15 *pixels, const uint16_t *mask,
+                          int x, int y, int width, int height, bool opaque,
+                          float *out_sums)
+{
+    uint32_t sums[5] = {0, 0, 0, 0, 0};
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+            uint32_t m = mask[i * width + j];
+            DP_Pixel15 p = pixels[(y + i) * DP_TILE_SIZE + x + j];
+            if (!opaque || (m > 512 && p.a > 512)) {
+                sums[0] += m;
+                sums[1] += m * p.r / DP_BIT15;
+                sums[2] += m * p.g / DP_BIT15;
+                sums[3] += m * p.b / DP_BIT15;
+                sums[4] += m * p.a / DP_BIT15;
+            }
+        }
+    }
+    for (int i = 0; i < 5; ++i) {
+        out_sums[i] = (float)sums[i];
+    }
+}
+
+static uint16_t random_channel(uint32_t *state, uint16_t max)
+{
+    return DP_uint32_to_uint16(DP_test_random_next(state) % (max + 1u));
+}
+
+
+static void sample_tile(TEST_PARAMS)
+{
+    uint32_t state = 0x12345678u;
+    DP_Pixel15 pixels[DP_TILE_LENGTH];
+    DP_TransientTile *tt = DP_transient_tile_new_blank(0);
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        uint16_t a = random_channel(&state, DP_BIT15);
+        DP_Pixel15 p = {random_channel(&state, a), random_channel(&state, a),
+                        random_channel(&state, a), a};
+        pixels[i] = p;
+        DP_transient_tile_pixel_at_set(tt, i % DP_TILE_SIZE, i / DP_TILE_SIZE,
+                                       p);
+    }
+    DP_Tile *t = DP_transient_tile_persist(tt);
+
+    uint16_t mask[DP_TILE_LENGTH];
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        mask[i] = random_channel(&state, DP_BIT15);
+    }
+
+    // Odd sizes and offsets, to hit the remainders of the vector versions.
+    int rects[][4] = {
+        {0, 0, 64, 64}, {1, 3, 63, 61}, {7, 2, 5, 9}, {60, 60, 4, 4},
+        {0, 10, 1, 1},  {13, 0, 3, 64}, {2, 5, 37, 20},
+    };
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(rects); ++i) {
+        int x = rects[i][0];
+        int y = rects[i][1];
+        int w = rects[i][2];
+        int h = rects[i][3];
+        for (int opaque = 0; opaque < 2; ++opaque) {
+            float expected[5];
+            sample_oracle(pixels, mask, x, y, w, h, opaque, expected);
+            float actual[5] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+            DP_tile_sample(t, mask, x, y, w, h, 0, opaque, &actual[0],
+                           &actual[1], &actual[2], &actual[3], &actual[4]);
+            for (int j = 0; j < 5; ++j) {
+                OK(actual[j] == expected[j],
+                   "sum %d of %d,%d,%d,%d (opaque %d) is %f, expected %f", j,
+                   x, y, w, h, opaque, (double)actual[j], (double)expected[j]);
+            }
+        }
+    }
+
+    DP_tile_decref(t);
+}
+
+
+static void sample_mipmap(TEST_PARAMS)
+{
+    // For a tile of a single color, the mipmap has the same color throughout,
+    // so sampling it should give the same result as the full tile.
+    DP_Pixel15 pixel = {1000, 2000, 3000, 20000};
+    DP_Tile *t = DP_tile_new_from_pixel15(0, pixel);
+
+    uint16_t mask[DP_TILE_LENGTH];
+    for (int i = 0; i < DP_TILE_LENGTH; ++i) {
+        mask[i] = DP_BIT15;
+    }
+
+    float expected[5] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    DP_tile_sample(t, mask, 0, 0, DP_TILE_SIZE, DP_TILE_SIZE, 0, false,
+                   &expected[0], &expected[1], &expected[2], &expected[3],
+                   &expected[4]);
+
+    // Twice, the first time calculates the mipmap, the second one is cached.
+    for (int i = 0; i < 2; ++i) {
+        float actual[5] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        DP_tile_sample_mipmap(t, mask, 0, 0, DP_TILE_MIPMAP_SIZE,
+                              DP_TILE_MIPMAP_SIZE, 0, false, &actual[0],
+                              &actual[1], &actual[2], &actual[3], &actual[4]);
+        for (int j = 0; j < 5; ++j) {
+            OK(actual[j] == expected[j], "mipmap sum %d (pass %d) is %f, "
+               "expected %f", j, i, (double)actual[j], (double)expected[j]);
+        }
+    }
+
+    DP_tile_decref(t);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(sample_tile);
+    REGISTER_TEST(sample_mipmap);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,707 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "binary_blocks.h"
+#include "binary_reader.h"
+#include "message.h"
+#include <dpcommon/binary.h>
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
+#include <zlib.h>
+
+// Layout of a block container, all numbers are big-endian:
+//
+// header:  magic (6 bytes) | version (u8) | reserved (u8)
+// block:   compressed size (u32) | size (u32) | data
+// table:   one entry per block:
+//          offset (u64) | compressed size (u32) | size (u32)
+// footer:  table offset (u64) | block count (u32) | end magic (8 bytes)
+//
+// The header of the recording itself goes into the first block. Blocks never
+// split a message, so each one can be decompressed and parsed on its own.
+
+#define HEADER_LENGTH       (DP_DPRECB_MAGIC_LENGTH + 2)
+#define BLOCK_HEADER_LENGTH 8
+#define TABLE_ENTRY_LENGTH  16
+#define END_MAGIC           "DPRECEND"
+#define END_MAGIC_LENGTH    8
+#define FOOTER_LENGTH       (12 + END_MAGIC_LENGTH)
+
+#define BLOCK_SIZE           (1024 * 1024)
+#define COMPRESSION_LEVEL    6
+#define MAX_READAHEAD_BLOCKS 8
+
+// A block is cut once it reaches BLOCK_SIZE, so it can overshoot that by at
+// most one message. The compressed bound is zlib's compressBound formula,
+// which isn't usable in a constant expression. Anything larger than these
+// didn't come from our writer and mustn't get to size our allocations.
+#define MAX_BLOCK_SIZE \
+    (BLOCK_SIZE + DP_MESSAGE_HEADER_LENGTH + DP_MESSAGE_MAX_PAYLOAD_LENGTH)
+#define MAX_COMPRESSED_BLOCK_SIZE                                   \
+    (MAX_BLOCK_SIZE + (MAX_BLOCK_SIZE >> 12) + (MAX_BLOCK_SIZE >> 14) \
+     + (MAX_BLOCK_SIZE >> 25) + 13)
+
+typedef struct DP_BinaryBlock {
+    size_t offset;
+    size_t start;
+    uint32_t compressed_size;
+    uint32_t size;
+} DP_BinaryBlock;
+
+
+bool DP_binary_block_magic_matches(const void *buffer, size_t size)
+{
+    return buffer && size >= DP_DPRECB_MAGIC_LENGTH
+        && memcmp(buffer, DP_DPRECB_MAGIC, DP_DPRECB_MAGIC_LENGTH) == 0;
+}
+
+
+typedef struct DP_BinaryBlockOutputState {
+    DP_Output *inner;
+    size_t offset;
+    unsigned char *buffer;
+    size_t capacity, used, parsed;
+    bool header_parsed;
+    unsigned char *compressed;
+    size_t compressed_capacity;
+    DP_BinaryBlock *blocks;
+    size_t block_count, block_capacity;
+} DP_BinaryBlockOutputState;
+
+static bool block_output_write_block(DP_BinaryBlockOutputState *state,
+                                     size_t size)
+{
+    uLong bound = compressBound(DP_size_to_ulong(size));
+    if (state->compressed_capacity < bound) {
+        state->compressed_capacity = bound;
+        state->compressed = DP_realloc(state->compressed, bound);
+    }
+
+    uLongf compressed_size = bound;
+    int ret = compress2(state->compressed, &compressed_size, state->buffer,
+                        DP_size_to_ulong(size), COMPRESSION_LEVEL);
+    if (ret != Z_OK) {
+        DP_error_set("Error compressing recording block: %s", zError(ret));
+        return false;
+    }
+
+    DP_BinaryBlock block = {state->offset, 0,
+                            DP_ulong_to_uint32(compressed_size),
+                            DP_size_to_uint32(size)};
+    unsigned char header[BLOCK_HEADER_LENGTH];
+    DP_write_bigendian_uint32(block.compressed_size, header);
+    DP_write_bigendian_uint32(block.size, header + 4);
+    if (!DP_output_write(state->inner, header, BLOCK_HEADER_LENGTH)
+        || !DP_output_write(state->inner, state->compressed,
+                            compressed_size)) {
+        return false;
+    }
+    state->offset += BLOCK_HEADER_LENGTH + compressed_size;
+
+    if (state->block_count == state->block_capacity) {
+        state->block_capacity =
+            state->block_capacity == 0 ? 64 : state->block_capacity * 2;
+        state->blocks = DP_realloc(
+            state->blocks, sizeof(*state->blocks) * state->block_capacity);
+    }
+    state->blocks[state->block_count++] = block;
+
+    size_t remaining = state->used - size;
+    memmove(state->buffer, state->buffer + size, remaining);
+    state->used = remaining;
+    state->parsed -= size;
+    return true;
+}
+
+// Returns the length of the header or message at the parse position, or 0 if
+// it hasn't been written in its entirety yet.
+static size_t block_output_record_length(DP_BinaryBlockOutputState *state)
+{
+    size_t available = state->used - state->parsed;
+    const unsigned char *record = state->buffer + state->parsed;
+    size_t length;
+    if (state->header_parsed) {
+        if (available < DP_MESSAGE_HEADER_LENGTH) {
+            return 0;
+        }
+        length = DP_MESSAGE_HEADER_LENGTH + DP_read_bigendian_uint16(record);
+    }
+    else {
+        if (available < DP_DPREC_MAGIC_LENGTH + 2) {
+            return 0;
+        }
+        length = DP_DPREC_MAGIC_LENGTH + 2
+               + DP_read_bigendian_uint16(record + DP_DPREC_MAGIC_LENGTH);
+    }
+    return length <= available ? length : 0;
+}
+
+static size_t block_output_write(void *internal, const void *buffer,
+                                 size_t size)
+{
+    DP_BinaryBlockOutputState *state = internal;
+    if (state->capacity - state->used < size) {
+        do {
+            state->capacity *= 2;
+        } while (state->capacity - state->used < size);
+        state->buffer = DP_realloc(state->buffer, state->capacity);
+    }
+    memcpy(state->buffer + state->used, buffer, size);
+    state->used += size;
+
+    size_t length;
+    while ((length = block_output_record_length(state)) != 0) {
+        state->parsed += length;
+        state->header_parsed = true;
+
+        if (state->parsed >= BLOCK_SIZE
+            && !block_output_write_block(state, state->parsed)) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+static bool block_output_flush(void *internal)
+{
+    DP_BinaryBlockOutputState *state = internal;
+    return DP_output_flush(state->inner);
+}
+
+static bool block_output_finish(DP_BinaryBlockOutputState *state)
+{
+    // Anything left over goes into a final block, including an incomplete
+    // message, which the reader will treat like a truncated recording.
+    if (state->used != 0 && !block_output_write_block(state, state->used)) {
+        return false;
+    }
+
+    size_t table_offset = state->offset;
+    size_t block_count = state->block_count;
+    for (size_t i = 0; i < block_count; ++i) {
+        DP_BinaryBlock *block = &state->blocks[i];
+        unsigned char entry[TABLE_ENTRY_LENGTH];
+        DP_write_bigendian_uint64(DP_size_to_uint64(block->offset), entry);
+        DP_write_bigendian_uint32(block->compressed_size, entry + 8);
+        DP_write_bigendian_uint32(block->size, entry + 12);
+        if (!DP_output_write(state->inner, entry, TABLE_ENTRY_LENGTH)) {
+            return false;
+        }
+    }
+
+    unsigned char footer[FOOTER_LENGTH];
+    DP_write_bigendian_uint64(DP_size_to_uint64(table_offset), footer);
+    DP_write_bigendian_uint32(DP_size_to_uint32(block_count), footer + 8);
+    memcpy(footer + 12, END_MAGIC, END_MAGIC_LENGTH);
+    return DP_output_write(state->inner, footer, FOOTER_LENGTH)
+        && DP_output_flush(state->inner);
+}
+
+static bool block_output_dispose(void *internal)
+{
+    DP_BinaryBlockOutputState *state = internal;
+    bool ok = block_output_finish(state);
+    DP_free(state->blocks);
+    DP_free(state->compressed);
+    DP_free(state->buffer);
+    return DP_output_free(state->inner) && ok;
+}
+
+static const DP_OutputMethods block_output_methods = {
+    block_output_write, NULL, block_output_flush, NULL, NULL,
+    block_output_dispose,
+};
+
+static const DP_OutputMethods *block_output_init(void *internal, void *arg)
+{
+    *((DP_BinaryBlockOutputState *)internal) =
+        *((DP_BinaryBlockOutputState *)arg);
+    return &block_output_methods;
+}
+
+DP_Output *DP_binary_block_output_new(DP_Output *inner)
+{
+    DP_ASSERT(inner);
+    unsigned char header[HEADER_LENGTH] = {0};
+    memcpy(header, DP_DPRECB_MAGIC, DP_DPRECB_MAGIC_LENGTH);
+    header[DP_DPRECB_MAGIC_LENGTH] = DP_DPRECB_VERSION;
+    if (!DP_output_write(inner, header, HEADER_LENGTH)) {
+        DP_output_free(inner);
+        return NULL;
+    }
+
+    size_t capacity = MAX_BLOCK_SIZE;
+    DP_BinaryBlockOutputState state = {
+        inner, HEADER_LENGTH, DP_malloc(capacity), capacity, 0, 0, false, NULL,
+        0,     NULL,          0,                   0};
+    return DP_output_new(block_output_init, &state, sizeof(state));
+}
+
+
+typedef struct DP_BinaryBlockSlot {
+    int block_index;
+    bool pending;
+    bool error;
+    DP_Semaphore *sem_done;
+    unsigned char *compressed;
+    size_t compressed_capacity;
+    uint32_t compressed_size;
+    unsigned char *data;
+    size_t data_capacity;
+    uint32_t size;
+} DP_BinaryBlockSlot;
+
+typedef struct DP_BinaryBlockInputState {
+    DP_Input *inner;
+    DP_BinaryBlock *blocks;
+    int block_count;
+    size_t length;
+    size_t pos;
+    DP_Worker *worker;
+    int readahead;
+    DP_BinaryBlockSlot *slots;
+} DP_BinaryBlockInputState;
+
+static bool read_exactly(DP_Input *input, void *buffer, size_t size,
+                         const char *what)
+{
+    bool error;
+    size_t read = DP_input_read(input, buffer, size, &error);
+    if (error) {
+        return false;
+    }
+    else if (read != size) {
+        DP_error_set("Expected %zu bytes of %s, but got %zu", size, what,
+                     read);
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+static void assign_block_starts(DP_BinaryBlock *blocks, int count,
+                                size_t *out_length)
+{
+    size_t start = 0;
+    for (int i = 0; i < count; ++i) {
+        blocks[i].start = start;
+        start += blocks[i].size;
+    }
+    *out_length = start;
+}
+
+static bool block_sizes_valid(uint32_t compressed_size, uint32_t size)
+{
+    return compressed_size != 0 && compressed_size <= MAX_COMPRESSED_BLOCK_SIZE
+        && size != 0 && size <= MAX_BLOCK_SIZE;
+}
+
+static DP_BinaryBlock *read_block_table(DP_Input *inner, size_t length,
+                                        int *out_count)
+{
+    unsigned char footer[FOOTER_LENGTH];
+    if (length < HEADER_LENGTH + FOOTER_LENGTH
+        || !DP_input_seek(inner, length - FOOTER_LENGTH)
+        || !read_exactly(inner, footer, FOOTER_LENGTH, "block footer")
+        || memcmp(footer + 12, END_MAGIC, END_MAGIC_LENGTH) != 0) {
+        return NULL;
+    }
+
+    uint64_t table_offset = DP_read_bigendian_uint64(footer);
+    uint32_t count = DP_read_bigendian_uint32(footer + 8);
+    size_t table_end = length - FOOTER_LENGTH;
+    if (count > INT_MAX || table_offset < HEADER_LENGTH
+        || table_offset > table_end
+        || (table_end - table_offset) / TABLE_ENTRY_LENGTH != count
+        || (table_end - table_offset) % TABLE_ENTRY_LENGTH != 0) {
+        return NULL;
+    }
+
+    size_t table_length = table_end - DP_uint64_to_size(table_offset);
+    unsigned char *table = DP_malloc(table_length);
+    if (!DP_input_seek(inner, DP_uint64_to_size(table_offset))
+        || !read_exactly(inner, table, table_length, "block table")) {
+        DP_free(table);
+        return NULL;
+    }
+
+    DP_BinaryBlock *blocks =
+        DP_malloc(sizeof(*blocks) * DP_max_size(1, DP_uint32_to_size(count)));
+    for (uint32_t i = 0; i < count; ++i) {
+        const unsigned char *entry = table + i * TABLE_ENTRY_LENGTH;
+        uint64_t offset = DP_read_bigendian_uint64(entry);
+        uint32_t compressed_size = DP_read_bigendian_uint32(entry + 8);
+        uint32_t size = DP_read_bigendian_uint32(entry + 12);
+        if (offset < HEADER_LENGTH || !block_sizes_valid(compressed_size, size)
+            || offset + BLOCK_HEADER_LENGTH + compressed_size > table_offset) {
+            DP_free(blocks);
+            DP_free(table);
+            return NULL;
+        }
+        blocks[i] = (DP_BinaryBlock){
+            DP_uint64_to_size(offset) + BLOCK_HEADER_LENGTH, 0, compressed_size,
+            size};
+    }
+
+    DP_free(table);
+    *out_count = DP_uint32_to_int(count);
+    return blocks;
+}
+
+static DP_BinaryBlock *scan_blocks(DP_Input *inner, size_t length,
+                                   int *out_count)
+{
+    int count = 0;
+    int capacity = 64;
+    DP_BinaryBlock *blocks = DP_malloc(sizeof(*blocks) * (size_t)capacity);
+    size_t offset = HEADER_LENGTH;
+    while (length - offset >= BLOCK_HEADER_LENGTH && count < INT_MAX) {
+        unsigned char header[BLOCK_HEADER_LENGTH];
+        if (!DP_input_seek(inner, offset)
+            || !read_exactly(inner, header, BLOCK_HEADER_LENGTH,
+                             "block header")) {
+            DP_free(blocks);
+            return NULL;
+        }
+
+        uint32_t compressed_size = DP_read_bigendian_uint32(header);
+        uint32_t size = DP_read_bigendian_uint32(header + 4);
+        size_t data_offset = offset + BLOCK_HEADER_LENGTH;
+        if (!block_sizes_valid(compressed_size, size)
+            || length - data_offset < compressed_size) {
+            break; // Truncated or garbage, treat it as the end.
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            blocks = DP_realloc(blocks, sizeof(*blocks) * (size_t)capacity);
+        }
+        blocks[count++] =
+            (DP_BinaryBlock){data_offset, 0, compressed_size, size};
+        offset = data_offset + compressed_size;
+    }
+    *out_count = count;
+    return blocks;
+}
+
+
+static bool decompress_slot(DP_BinaryBlockSlot *slot)
+{
+    uLongf size = slot->size;
+    int ret = uncompress(slot->data, &size, slot->compressed,
+                         slot->compressed_size);
+    return ret == Z_OK && size == slot->size;
+}
+
+static void decompress_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_BinaryBlockSlot *slot = *(DP_BinaryBlockSlot **)element;
+    slot->error = !decompress_slot(slot);
+    DP_SEMAPHORE_MUST_POST(slot->sem_done);
+}
+
+static void wait_slot(DP_BinaryBlockSlot *slot)
+{
+    if (slot->pending) {
+        DP_SEMAPHORE_MUST_WAIT(slot->sem_done);
+        slot->pending = false;
+    }
+}
+
+static DP_BinaryBlockSlot *find_slot(DP_BinaryBlockInputState *state,
+                                     int block_index)
+{
+    int slot_count = state->readahead + 1;
+    for (int i = 0; i < slot_count; ++i) {
+        DP_BinaryBlockSlot *slot = &state->slots[i];
+        if (slot->block_index == block_index) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Grabs a slot that isn't holding one of the blocks in the given range. There
+// are enough slots for the current block and all of its read-ahead blocks, so
+// this never comes up empty.
+static DP_BinaryBlockSlot *evict_slot(DP_BinaryBlockInputState *state,
+                                      int first, int last)
+{
+    int slot_count = state->readahead + 1;
+    for (int i = 0; i < slot_count; ++i) {
+        DP_BinaryBlockSlot *slot = &state->slots[i];
+        int block_index = slot->block_index;
+        if (block_index < first || block_index > last) {
+            wait_slot(slot);
+            slot->block_index = -1;
+            return slot;
+        }
+    }
+    DP_UNREACHABLE();
+}
+
+// Reads the compressed data of a block into the given slot. The inner input
+// isn't thread-safe, so this always happens on the reading thread, only the
+// decompression gets farmed out.
+static bool load_slot(DP_BinaryBlockInputState *state, DP_BinaryBlockSlot *slot,
+                      int block_index)
+{
+    DP_BinaryBlock *block = &state->blocks[block_index];
+    if (slot->compressed_capacity < block->compressed_size) {
+        slot->compressed_capacity = block->compressed_size;
+        slot->compressed = DP_realloc(slot->compressed, block->compressed_size);
+    }
+    if (slot->data_capacity < block->size) {
+        slot->data_capacity = block->size;
+        slot->data = DP_realloc(slot->data, block->size);
+    }
+
+    if (DP_input_seek(state->inner, block->offset)
+        && read_exactly(state->inner, slot->compressed, block->compressed_size,
+                        "compressed block")) {
+        slot->block_index = block_index;
+        slot->error = false;
+        slot->compressed_size = block->compressed_size;
+        slot->size = block->size;
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+static void read_ahead(DP_BinaryBlockInputState *state, int block_index)
+{
+    int last = DP_min_int(block_index + state->readahead,
+                          state->block_count - 1);
+    for (int i = block_index + 1; i <= last; ++i) {
+        if (!find_slot(state, i)) {
+            DP_BinaryBlockSlot *slot = evict_slot(state, block_index, last);
+            if (!load_slot(state, slot, i)) {
+                // Let the reading proper deal with this when it gets here.
+                return;
+            }
+            slot->pending = true;
+            DP_worker_push(state->worker, &slot);
+        }
+    }
+}
+
+static DP_BinaryBlockSlot *get_block(DP_BinaryBlockInputState *state,
+                                     int block_index)
+{
+    DP_BinaryBlockSlot *slot = find_slot(state, block_index);
+    if (slot) {
+        wait_slot(slot);
+    }
+    else {
+        slot = evict_slot(state, block_index, block_index + state->readahead);
+        if (!load_slot(state, slot, block_index)) {
+            return NULL;
+        }
+        slot->error = !decompress_slot(slot);
+    }
+
+    if (slot->error) {
+        DP_error_set("Error decompressing recording block %d", block_index);
+        slot->block_index = -1;
+        return NULL;
+    }
+
+    if (state->worker) {
+        read_ahead(state, block_index);
+    }
+    return slot;
+}
+
+static int search_block(DP_BinaryBlockInputState *state, size_t pos)
+{
+    DP_ASSERT(pos < state->length);
+    int low = 0;
+    int high = state->block_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (state->blocks[mid].start <= pos) {
+            low = mid;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+static size_t block_input_read(void *internal, void *buffer, size_t size,
+                               bool *out_error)
+{
+    DP_BinaryBlockInputState *state = internal;
+    size_t total = 0;
+    while (total < size && state->pos < state->length) {
+        int block_index = search_block(state, state->pos);
+        DP_BinaryBlockSlot *slot = get_block(state, block_index);
+        if (!slot) {
+            *out_error = true;
+            break;
+        }
+        size_t offset = state->pos - state->blocks[block_index].start;
+        size_t count = DP_min_size(slot->size - offset, size - total);
+        memcpy((unsigned char *)buffer + total, slot->data + offset, count);
+        total += count;
+        state->pos += count;
+    }
+    return total;
+}
+
+static size_t block_input_length(void *internal, DP_UNUSED bool *out_error)
+{
+    DP_BinaryBlockInputState *state = internal;
+    return state->length;
+}
+
+static bool block_input_rewind(void *internal)
+{
+    DP_BinaryBlockInputState *state = internal;
+    state->pos = 0;
+    return true;
+}
+
+static bool block_input_rewind_by(void *internal, size_t size)
+{
+    DP_BinaryBlockInputState *state = internal;
+    if (state->pos >= size) {
+        state->pos -= size;
+        return true;
+    }
+    else {
+        DP_error_set("Block input at position %zu can't be rewound by %zu",
+                     state->pos, size);
+        return false;
+    }
+}
+
+static bool block_input_seek(void *internal, size_t offset)
+{
+    DP_BinaryBlockInputState *state = internal;
+    if (offset <= state->length) {
+        state->pos = offset;
+        return true;
+    }
+    else {
+        DP_error_set("Block input can't seek to %zu beyond end at %zu", offset,
+                     state->length);
+        return false;
+    }
+}
+
+static bool block_input_seek_by(void *internal, size_t size)
+{
+    DP_BinaryBlockInputState *state = internal;
+    return block_input_seek(internal, state->pos + size);
+}
+
+static void block_input_dispose(void *internal)
+{
+    DP_BinaryBlockInputState *state = internal;
+    int slot_count = state->readahead + 1;
+    for (int i = 0; i < slot_count; ++i) {
+        wait_slot(&state->slots[i]);
+    }
+    DP_worker_free_join(state->worker);
+    for (int i = 0; i < slot_count; ++i) {
+        DP_BinaryBlockSlot *slot = &state->slots[i];
+        DP_free(slot->data);
+        DP_free(slot->compressed);
+        DP_semaphore_free(slot->sem_done);
+    }
+    DP_free(state->slots);
+    DP_free(state->blocks);
+    DP_input_free(state->inner);
+}
+
+static const DP_InputMethods block_input_methods = {
+    block_input_read,      block_input_length, block_input_rewind,
+    block_input_rewind_by, block_input_seek,   block_input_seek_by,
+    block_input_dispose,
+};
+
+static const DP_InputMethods *block_input_init(void *internal, void *arg)
+{
+    *((DP_BinaryBlockInputState *)internal) =
+        *((DP_BinaryBlockInputState *)arg);
+    return &block_input_methods;
+}
+
+static bool read_container_header(DP_Input *inner)
+{
+    unsigned char header[HEADER_LENGTH];
+    if (!DP_input_seek(inner, 0)
+        || !read_exactly(inner, header, HEADER_LENGTH, "block header")) {
+        return false;
+    }
+    else if (!DP_binary_block_magic_matches(header, HEADER_LENGTH)) {
+        DP_error_set("Invalid block container header prefix value");
+        return false;
+    }
+    else if (header[DP_DPRECB_MAGIC_LENGTH] != DP_DPRECB_VERSION) {
+        DP_error_set("Unknown block container version %d",
+                     (int)header[DP_DPRECB_MAGIC_LENGTH]);
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+DP_Input *DP_binary_block_input_new(DP_Input *inner)
+{
+    DP_ASSERT(inner);
+    bool error = false;
+    size_t inner_length = DP_input_length(inner, &error);
+    if (error || !read_container_header(inner)) {
+        DP_input_free(inner);
+        return NULL;
+    }
+
+    int block_count;
+    DP_BinaryBlock *blocks =
+        read_block_table(inner, inner_length, &block_count);
+    if (!blocks) {
+        blocks = scan_blocks(inner, inner_length, &block_count);
+        if (!blocks) {
+            DP_input_free(inner);
+            return NULL;
+        }
+    }
+
+    size_t length;
+    assign_block_starts(blocks, block_count, &length);
+
+    // Decompressing blocks ahead of time is only worth it if there's more
+    // than one of them to go through.
+    int thread_count = block_count > 1 ? DP_min_int(DP_thread_cpu_count(
+                                                        MAX_READAHEAD_BLOCKS),
+                                                    block_count - 1)
+                                       : 0;
+    DP_Worker *worker =
+        thread_count > 1
+            ? DP_worker_new(MAX_READAHEAD_BLOCKS, sizeof(DP_BinaryBlockSlot *),
+                            thread_count, decompress_job)
+            : NULL;
+    int readahead = worker ? thread_count : 0;
+
+    int slot_count = readahead + 1;
+    DP_BinaryBlockSlot *slots =
+        DP_malloc(sizeof(*slots) * DP_int_to_size(slot_count));
+    for (int i = 0; i < slot_count; ++i) {
+        slots[i] = (DP_BinaryBlockSlot){
+            -1, false, false, worker ? DP_semaphore_new(0) : NULL,
+            NULL, 0, 0, NULL, 0, 0};
+    }
+
+    DP_BinaryBlockInputState state = {
+        inner, blocks, block_count, length, 0, worker, readahead, slots};
+    return DP_input_new(block_input_init, &state, sizeof(state));
+}
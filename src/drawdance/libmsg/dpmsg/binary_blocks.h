@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPMSG_BINARY_BLOCKS_H
+#define DPMSG_BINARY_BLOCKS_H
+#include <dpcommon/common.h>
+
+typedef struct DP_Input DP_Input;
+typedef struct DP_Output DP_Output;
+
+// Block container for binary recordings. Instead of one long stream, the
+// recording is split into blocks of around a megabyte along message
+// boundaries, each compressed on its own. A table at the end of the file lists
+// the offsets and sizes of the blocks, so that a reader can seek around in
+// the recording and decompress blocks in parallel. Compare against
+// DP_DPRECB_MAGIC_LENGTH bytes, there's no terminating zero. DP_DPREC_MAGIC
+// does include its terminating zero, so readers that only know about plain
+// binary recordings reject these, which includes Drawpile 2.2.0 and earlier.
+#define DP_DPRECB_MAGIC        "DPRECB"
+#define DP_DPRECB_MAGIC_LENGTH 6
+#define DP_DPRECB_VERSION      1
+
+
+bool DP_binary_block_magic_matches(const void *buffer, size_t size);
+
+// Takes a regular binary recording stream, as written by DP_BinaryWriter, and
+// writes it to the inner output as a block container. The block table is
+// written when the output is freed, check the return value of DP_output_free
+// to see if that worked. Flushing doesn't write out the block in progress, so
+// don't use this for recordings that have to survive a crash, pack them once
+// they're done instead. Takes ownership of the inner output, even on failure.
+DP_Output *DP_binary_block_output_new(DP_Output *inner);
+
+// Reads a block container as a regular binary recording stream, with seeking
+// and a known length. The inner input must support seeking and have a known
+// length. If the block table is missing, because the writer didn't get to
+// finish, the blocks are found by walking through them instead. Takes
+// ownership of the inner input, even on failure.
+DP_Input *DP_binary_block_input_new(DP_Input *inner);
+
+
+#endif
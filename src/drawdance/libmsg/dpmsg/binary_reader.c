@@ -20,6 +20,7 @@
  * License, version 3. See 3rdparty/licenses/drawpile/COPYING for details.
  */
 #include "binary_reader.h"
+#include "binary_blocks.h"
 #include "message.h"
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
@@ -43,28 +44,41 @@ struct DP_BinaryReader {
 };
 
 
-static bool read_magic(DP_Input *input, size_t *input_offset)
+typedef enum DP_BinaryReaderMagic {
+    MAGIC_INVALID,
+    MAGIC_RECORDING,
+    MAGIC_BLOCK_CONTAINER,
+} DP_BinaryReaderMagic;
+
+static DP_BinaryReaderMagic read_magic(DP_Input *input, size_t *input_offset,
+                                       bool allow_container)
 {
     DP_ASSERT(strlen(DP_DPREC_MAGIC) + 1 == DP_DPREC_MAGIC_LENGTH);
+    static_assert(DP_DPREC_MAGIC_LENGTH == DP_DPRECB_MAGIC_LENGTH,
+                  "Recording and block container magic have the same length");
 
     char buffer[DP_DPREC_MAGIC_LENGTH];
     bool error;
     size_t read = DP_input_read(input, buffer, DP_DPREC_MAGIC_LENGTH, &error);
     *input_offset += read;
     if (error) {
-        return false;
+        return MAGIC_INVALID;
     }
     else if (read != DP_DPREC_MAGIC_LENGTH) {
         DP_error_set("Invalid recording header prefix size: %zu != %d", read,
                      DP_DPREC_MAGIC_LENGTH);
-        return false;
+        return MAGIC_INVALID;
     }
-    else if (memcmp(buffer, DP_DPREC_MAGIC, DP_DPREC_MAGIC_LENGTH) != 0) {
-        DP_error_set("Invalid recording header prefix value");
-        return false;
+    else if (memcmp(buffer, DP_DPREC_MAGIC, DP_DPREC_MAGIC_LENGTH) == 0) {
+        return MAGIC_RECORDING;
+    }
+    else if (allow_container
+             && DP_binary_block_magic_matches(buffer, DP_DPREC_MAGIC_LENGTH)) {
+        return MAGIC_BLOCK_CONTAINER;
     }
     else {
-        return true;
+        DP_error_set("Invalid recording header prefix value");
+        return MAGIC_INVALID;
     }
 }
 
@@ -130,10 +144,6 @@ static JSON_Value *parse_metadata(const char *buffer)
 
 static JSON_Value *read_header(DP_Input *input, size_t *input_offset)
 {
-    if (!read_magic(input, input_offset)) {
-        return NULL;
-    }
-
     size_t length = read_metadata_length(input, input_offset);
     if (length == 0) {
         return NULL;
@@ -150,12 +160,51 @@ static JSON_Value *read_header(DP_Input *input, size_t *input_offset)
 }
 
 
+// Checks the magic at the start of the recording. If it's a block container,
+// the input gets replaced with one that reads the recording within it.
+static DP_Input *open_input(DP_Input *input, size_t *input_offset,
+                            bool *out_container)
+{
+    switch (read_magic(input, input_offset, true)) {
+    case MAGIC_RECORDING:
+        *out_container = false;
+        return input;
+    case MAGIC_BLOCK_CONTAINER: {
+        DP_Input *block_input = DP_binary_block_input_new(input);
+        if (!block_input) {
+            return NULL;
+        }
+        *input_offset = 0;
+        if (read_magic(block_input, input_offset, false) != MAGIC_RECORDING) {
+            DP_input_free(block_input);
+            return NULL;
+        }
+        *out_container = true;
+        return block_input;
+    }
+    default:
+        DP_input_free(input);
+        return NULL;
+    }
+}
+
 DP_BinaryReader *DP_binary_reader_new(DP_Input *input, unsigned int flags)
 {
     DP_ASSERT(input);
 
+    size_t input_offset = 0;
+    bool container = false;
+    if (!(flags & DP_BINARY_READER_FLAG_NO_HEADER)) {
+        input = open_input(input, &input_offset, &container);
+        if (!input) {
+            return NULL;
+        }
+    }
+
+    // Block containers always know their length, since they have to read it
+    // from the block table anyway.
     size_t input_length;
-    if (flags & DP_BINARY_READER_FLAG_NO_LENGTH) {
+    if ((flags & DP_BINARY_READER_FLAG_NO_LENGTH) && !container) {
         input_length = 0;
     }
     else {
@@ -167,7 +216,6 @@ DP_BinaryReader *DP_binary_reader_new(DP_Input *input, unsigned int flags)
         }
     }
 
-    size_t input_offset = 0;
     JSON_Value *header;
     if (flags & DP_BINARY_READER_FLAG_NO_HEADER) {
         header = NULL;
@@ -36,6 +36,7 @@ bool DP_message_type_control(DP_MessageType type)
     case DP_MSG_DISCONNECT:
     case DP_MSG_PING:
     case DP_MSG_KEEP_ALIVE:
+    case DP_MSG_COMPRESSED:
     case DP_MSG_INTERNAL:
         return true;
     default:
@@ -140,6 +141,8 @@ const char *DP_message_type_name(DP_MessageType type)
         return "ping";
     case DP_MSG_KEEP_ALIVE:
         return "keepalive";
+    case DP_MSG_COMPRESSED:
+        return "compressed";
     case DP_MSG_INTERNAL:
         return "internal";
     case DP_MSG_JOIN:
@@ -276,6 +279,8 @@ const char *DP_message_type_enum_name(DP_MessageType type)
         return "DP_MSG_PING";
     case DP_MSG_KEEP_ALIVE:
         return "DP_MSG_KEEP_ALIVE";
+    case DP_MSG_COMPRESSED:
+        return "DP_MSG_COMPRESSED";
     case DP_MSG_INTERNAL:
         return "DP_MSG_INTERNAL";
     case DP_MSG_JOIN:
@@ -622,6 +627,10 @@ DP_Message *DP_message_deserialize_body(int type, unsigned int context_id,
             return DP_msg_ping_deserialize(context_id, buf, length);
         case DP_MSG_KEEP_ALIVE:
             return DP_msg_keep_alive_deserialize(context_id, buf, length);
+        case DP_MSG_COMPRESSED:
+            DP_error_set(
+                "Can't deserialize reserved message type 4 DP_MSG_COMPRESSED");
+            return NULL;
         case DP_MSG_INTERNAL:
             DP_error_set(
                 "Can't deserialize reserved message type 31 DP_MSG_INTERNAL");
@@ -785,6 +794,9 @@ DP_Message *DP_message_parse_body(DP_MessageType type, unsigned int context_id,
         return DP_msg_ping_parse(context_id, reader);
     case DP_MSG_KEEP_ALIVE:
         return DP_msg_keep_alive_parse(context_id, reader);
+    case DP_MSG_COMPRESSED:
+        DP_error_set("Can't parse reserved message type 4 DP_MSG_COMPRESSED");
+        return NULL;
     case DP_MSG_INTERNAL:
         DP_error_set("Can't parse reserved message type 31 DP_MSG_INTERNAL");
         return NULL;
@@ -46,6 +46,7 @@ typedef enum DP_MessageType {
     DP_MSG_DISCONNECT = 1,
     DP_MSG_PING = 2,
     DP_MSG_KEEP_ALIVE = 3,
+    DP_MSG_COMPRESSED = 4,
     DP_MSG_INTERNAL = 31,
     DP_MSG_JOIN = 32,
     DP_MSG_LEAVE = 33,
@@ -275,6 +276,15 @@ DP_Message *DP_msg_keep_alive_parse(unsigned int context_id,
                                     DP_TextReader *reader);
 
 
+/*
+ * DP_MSG_COMPRESSED
+ *
+ * A chunk of a deflate stream containing serialized messages. This
+ * is handled by the message queue and only used if both sides
+ * indicated support for it during login.
+ */
+
+
 /*
  * DP_MSG_INTERNAL
  *
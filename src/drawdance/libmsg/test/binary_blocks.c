@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include <dpcommon/binary.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/file.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpmsg/binary_blocks.h>
+#include <dpmsg/binary_reader.h>
+#include <dpmsg/message.h>
+#include <dptest.h>
+
+
+#define MESSAGE_COUNT 20000
+
+static const char METADATA[] = "{\"version\":\"dp:4.24.0\"}";
+
+// Makes a raw binary recording with messages of random sizes and contents.
+// The contents don't parse as any actual messages, but the reader is only
+// asked to skip over them. Partially random data so that it compresses some.
+static unsigned char *generate_recording(size_t *out_length)
+{
+    size_t metadata_length = sizeof(METADATA) - 1;
+    size_t capacity = DP_DPREC_MAGIC_LENGTH + 2 + metadata_length
+                    + MESSAGE_COUNT * (DP_MESSAGE_HEADER_LENGTH + 1024);
+    unsigned char *buffer = DP_malloc(capacity);
+
+    size_t length = 0;
+    memcpy(buffer, DP_DPREC_MAGIC, DP_DPREC_MAGIC_LENGTH);
+    length += DP_DPREC_MAGIC_LENGTH;
+    length += DP_write_bigendian_uint16((uint16_t)metadata_length,
+                                        buffer + length);
+    memcpy(buffer + length, METADATA, metadata_length);
+    length += metadata_length;
+
+    uint32_t state = 0xdeadbeefu;
+    for (int i = 0; i < MESSAGE_COUNT; ++i) {
+        uint16_t body_length = (uint16_t)(DP_test_random_next(&state) % 1024u);
+        length += DP_write_bigendian_uint16(body_length, buffer + length);
+        buffer[length++] = (unsigned char)(128 + i % 64);
+        buffer[length++] = (unsigned char)(i % 256);
+        for (uint16_t j = 0; j < body_length; ++j) {
+            buffer[length++] = j % 4 == 0
+                                 ? (unsigned char)DP_test_random_next(&state)
+                                 : (unsigned char)j;
+        }
+    }
+
+    *out_length = length;
+    return buffer;
+}
+
+static void *write_container(TEST_PARAMS, const unsigned char *recording,
+                             size_t recording_length, size_t *out_length)
+{
+    const char *path = "test/tmp/binary_blocks.dprec";
+    DP_Output *file_output = DP_file_output_new_from_path(path);
+    FATAL(NOT_NULL_OK(file_output, "got file output for %s", path));
+    DP_Output *output = DP_binary_block_output_new(file_output);
+    FATAL(NOT_NULL_OK(output, "got block output"));
+
+    // Write in odd chunk sizes, so messages get split across writes.
+    size_t offset = 0;
+    bool written = true;
+    while (written && offset < recording_length) {
+        size_t size = DP_min_size(recording_length - offset, 777);
+        written = DP_output_write(output, recording + offset, size);
+        offset += size;
+    }
+    OK(written, "wrote recording to block output");
+    OK(DP_output_free(output), "finished block output");
+
+    void *container = DP_file_slurp(path, out_length);
+    FATAL(NOT_NULL_OK(container, "read back %s", path));
+    return container;
+}
+
+static void check_input(TEST_PARAMS, DP_Input *input,
+                        const unsigned char *recording,
+                        size_t recording_length, const char *title)
+{
+    bool error = false;
+    UINT_EQ_OK(DP_input_length(input, &error), recording_length,
+               "%s length matches", title);
+
+    unsigned char *buffer = DP_malloc(recording_length);
+    size_t read = DP_input_read(input, buffer, recording_length, &error);
+    OK(!error, "%s read without error", title);
+    UINT_EQ_OK(read, recording_length, "%s read everything", title);
+    OK(memcmp(buffer, recording, recording_length) == 0,
+       "%s contents match", title);
+
+    // Jump around, crossing block boundaries backwards and forwards.
+    uint32_t state = 0x1234u;
+    bool seeks_match = true;
+    for (int i = 0; i < 100; ++i) {
+        size_t offset = DP_test_random_next(&state) % recording_length;
+        size_t size = DP_min_size(recording_length - offset, 100000);
+        if (!DP_input_seek(input, offset)
+            || DP_input_read(input, buffer, size, &error) != size
+            || memcmp(buffer, recording + offset, size) != 0) {
+            seeks_match = false;
+        }
+    }
+    OK(seeks_match, "%s seeking reads the right data", title);
+
+    DP_free(buffer);
+}
+
+static void block_roundtrip(TEST_PARAMS)
+{
+    size_t recording_length;
+    unsigned char *recording = generate_recording(&recording_length);
+    size_t container_length;
+    unsigned char *container = write_container(
+        TEST_ARGS, recording, recording_length, &container_length);
+
+    OK(DP_binary_block_magic_matches(container, container_length),
+       "container has block magic");
+    OK(container_length < recording_length, "container is smaller");
+
+    DP_Input *input = DP_binary_block_input_new(
+        DP_mem_input_new_keep_on_close(container, container_length));
+    if (NOT_NULL_OK(input, "got block input")) {
+        check_input(TEST_ARGS, input, recording, recording_length,
+                    "block input");
+        DP_input_free(input);
+    }
+
+    // Lop off the table and the end of the last block, the blocks before that
+    // should still be found by walking them.
+    size_t truncated_length = container_length - 1000;
+    DP_Input *truncated_input = DP_binary_block_input_new(
+        DP_mem_input_new_keep_on_close(container, truncated_length));
+    if (NOT_NULL_OK(truncated_input, "got truncated block input")) {
+        bool error = false;
+        size_t length = DP_input_length(truncated_input, &error);
+        OK(length > 0 && length < recording_length,
+           "truncated input has partial length %zu", length);
+        check_input(TEST_ARGS, truncated_input, recording, length,
+                    "truncated block input");
+        DP_input_free(truncated_input);
+    }
+
+    // A block table entry claiming an absurd size must not be trusted, the
+    // blocks should be found by walking them instead.
+    unsigned char *corrupted = DP_malloc(container_length);
+    memcpy(corrupted, container, container_length);
+    size_t table_offset = DP_uint64_to_size(
+        DP_read_bigendian_uint64(corrupted + container_length - 20));
+    DP_write_bigendian_uint32(UINT32_MAX, corrupted + table_offset + 12);
+    DP_Input *corrupted_input = DP_binary_block_input_new(
+        DP_mem_input_new_keep_on_close(corrupted, container_length));
+    if (NOT_NULL_OK(corrupted_input, "got corrupted block input")) {
+        check_input(TEST_ARGS, corrupted_input, recording, recording_length,
+                    "corrupted block input");
+        DP_input_free(corrupted_input);
+    }
+    DP_free(corrupted);
+
+    // The binary reader should open the container transparently.
+    DP_BinaryReader *br = DP_binary_reader_new(
+        DP_mem_input_new_keep_on_close(container, container_length), 0);
+    if (NOT_NULL_OK(br, "got binary reader for container")) {
+        int count = 0;
+        while (DP_binary_reader_skip_message(br, NULL, NULL) > 0) {
+            ++count;
+        }
+        INT_EQ_OK(count, MESSAGE_COUNT, "read all messages from container");
+        DP_binary_reader_free(br);
+    }
+
+    DP_free(container);
+    DP_free(recording);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(block_roundtrip);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -596,3 +596,22 @@ bool DP_test_file_eq_ok(DP_TestContext *T, const char *file, int line,
     va_end(ap);
     return true;
 }
+
+
+uint32_t DP_test_random_next(uint32_t *state)
+{
+    DP_ASSERT(*state != 0);
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+int DP_test_random_int(uint32_t *state, int max)
+{
+    DP_ASSERT(max > 0);
+    return DP_uint32_to_int(DP_test_random_next(state)
+                            % DP_int_to_uint32(max));
+}
@@ -116,6 +116,14 @@ bool DP_test_file_eq_ok(DP_TestContext *T, const char *file, int line,
                         const char *b, const char *fmt, ...) DP_FORMAT(8, 9);
 
 
+// Pseudo-random numbers for generating test data, using xorshift32, so the
+// same non-zero seed always produces the same sequence.
+uint32_t DP_test_random_next(uint32_t *state);
+
+// Pseudo-random number from 0 up to, but not including, the given maximum.
+int DP_test_random_int(uint32_t *state, int max);
+
+
 #define REGISTER_PARAMS DP_TestRegistry *R
 #define TEST_PARAMS     DP_TestContext *T
 #define REGISTER_ARGS   R
@@ -5854,6 +5854,7 @@ extern "C" {
     pub fn DP_load_psd(
         dc: *mut DP_DrawContext,
         input: *mut DP_Input,
+        flags: ::std::os::raw::c_uint,
         out_result: *mut DP_LoadResult,
     ) -> *mut DP_CanvasState;
 }
@@ -7987,6 +7988,7 @@ pub const DP_MSG_SERVER_COMMAND: DP_MessageType = 0;
 pub const DP_MSG_DISCONNECT: DP_MessageType = 1;
 pub const DP_MSG_PING: DP_MessageType = 2;
 pub const DP_MSG_KEEP_ALIVE: DP_MessageType = 3;
+pub const DP_MSG_COMPRESSED: DP_MessageType = 4;
 pub const DP_MSG_INTERNAL: DP_MessageType = 31;
 pub const DP_MSG_JOIN: DP_MessageType = 32;
 pub const DP_MSG_LEAVE: DP_MessageType = 33;
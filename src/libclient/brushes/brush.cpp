@@ -972,14 +972,15 @@ void ActiveBrush::setInBrushEngine(
 	}
 }
 
-void ActiveBrush::renderPreview(
-	drawdance::BrushPreview &bp, DP_BrushPreviewShape shape) const
+unsigned int ActiveBrush::requestPreview(
+	drawdance::BrushPreview &bp, const QSize &size,
+	DP_BrushPreviewShape shape) const
 {
 	if(m_activeType == CLASSIC) {
-		bp.renderClassic(m_classic, shape);
+		return bp.requestClassic(size, m_classic, shape);
 	} else {
-		bp.renderMyPaint(
-			m_myPaint.constBrush(), m_myPaint.constSettings(), shape);
+		return bp.requestMyPaint(
+			size, m_myPaint.constBrush(), m_myPaint.constSettings(), shape);
 	}
 }
 
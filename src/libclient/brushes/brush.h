@@ -310,8 +310,9 @@ public:
 	void setInBrushEngine(
 		drawdance::BrushEngine &be, const DP_StrokeParams &stroke) const;
 
-	void renderPreview(
-		drawdance::BrushPreview &bp, DP_BrushPreviewShape shape) const;
+	unsigned int requestPreview(
+		drawdance::BrushPreview &bp, const QSize &size,
+		DP_BrushPreviewShape shape) const;
 
 private:
 	ActiveType m_activeType;
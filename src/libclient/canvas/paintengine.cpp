@@ -15,10 +15,13 @@ extern "C" {
 #include "libclient/drawdance/perf.h"
 #include "libclient/drawdance/viewmode.h"
 #include "libclient/net/message.h"
+#include <QMutexLocker>
 #include <QPainter>
 #include <QSet>
 #include <QTimer>
 #include <QtEndian>
+#include <algorithm>
+#include <cstring>
 #ifdef DP_HAVE_BUILTIN_SERVER
 #	include "libclient/server/builtinserver.h"
 #	define ON_SOFT_RESET_FN PaintEngine::onSoftReset
@@ -45,13 +48,11 @@ PaintEngine::PaintEngine(
 	, m_timerId{0}
 	, m_cache{}
 	, m_painter{}
-	, m_cacheMutex{nullptr}
 	, m_viewSem{nullptr}
 	, m_sampleColorLastDiameter(-1)
 	, m_undoDepthLimit{DP_UNDO_DEPTH_DEFAULT}
 	, m_updateLayersVisibleInFrame{false}
 {
-	m_cacheMutex = DP_mutex_new();
 	m_viewSem = DP_semaphore_new(0);
 	start();
 }
@@ -59,7 +60,6 @@ PaintEngine::PaintEngine(
 PaintEngine::~PaintEngine()
 {
 	DP_semaphore_free(m_viewSem);
-	DP_mutex_free(m_cacheMutex);
 }
 
 void PaintEngine::setFps(int fps)
@@ -103,9 +103,8 @@ void PaintEngine::reset(
 		PaintEngine::onRenderUnlock, PaintEngine::onRenderResize, this,
 		ON_SOFT_RESET_FN, this, PaintEngine::onPlayback,
 		PaintEngine::onDumpPlayback, this, canvasState, player);
-	DP_mutex_lock(m_cacheMutex);
+	discardPendingTiles();
 	m_cache = QPixmap{};
-	DP_mutex_unlock(m_cacheMutex);
 	m_undoDepthLimit = DP_UNDO_DEPTH_DEFAULT;
 	start();
 	emit aclsChanged(m_acls, DP_ACL_STATE_CHANGE_MASK, true);
@@ -117,6 +116,7 @@ void PaintEngine::reset(
 void PaintEngine::timerEvent(QTimerEvent *)
 {
 	DP_PERF_SCOPE("tick");
+	flushPendingTiles();
 	DP_Rect tileBounds = {
 		m_canvasViewTileArea.left(), m_canvasViewTileArea.top(),
 		m_canvasViewTileArea.right(), m_canvasViewTileArea.bottom()};
@@ -418,11 +418,9 @@ QColor PaintEngine::sampleColor(int x, int y, int layerId, int diameter)
 			rect = QRect{left, top, diameter, diameter};
 		}
 
-		DP_mutex_lock(m_cacheMutex);
 		QImage img = rect.intersects(m_cache.rect())
 						 ? m_cache.copy(rect).toImage()
 						 : QImage{};
-		DP_mutex_unlock(m_cacheMutex);
 
 		if(img.isNull()) {
 			return Qt::transparent;
@@ -634,19 +632,15 @@ void PaintEngine::clearDabsPreview()
 
 void PaintEngine::withPixmap(std::function<void(const QPixmap &)> fn) const
 {
-	DP_mutex_lock(m_cacheMutex);
 	fn(m_cache);
-	DP_mutex_unlock(m_cacheMutex);
 }
 
 QImage PaintEngine::renderPixmap()
 {
 	DP_paint_engine_render_everything(m_paintEngine.get());
 	DP_SEMAPHORE_MUST_WAIT(m_viewSem);
-	DP_mutex_lock(m_cacheMutex);
-	QImage img = m_cache.toImage();
-	DP_mutex_unlock(m_cacheMutex);
-	return img;
+	flushPendingTiles();
+	return m_cache.toImage();
 }
 
 void PaintEngine::setCanvasViewArea(const QRect &area)
@@ -819,19 +813,19 @@ void PaintEngine::onCursorMoved(
 void PaintEngine::onRenderTile(
 	void *user, int tileX, int tileY, DP_Pixel8 *pixels)
 {
+	// Called concurrently from all the renderer threads. The tile just gets
+	// stashed away here, the GUI thread draws it onto the pixmap on its next
+	// tick. If the same tile gets rendered again until then, it's replaced.
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
-	QRect area{
-		tileX * DP_TILE_SIZE, tileY * DP_TILE_SIZE, DP_TILE_SIZE, DP_TILE_SIZE};
-	QImage image{
-		reinterpret_cast<unsigned char *>(pixels), DP_TILE_SIZE, DP_TILE_SIZE,
-		QImage::Format_RGB32};
-	DP_mutex_lock(pe->m_cacheMutex);
-	QPainter &painter = pe->m_painter;
-	painter.begin(&pe->m_cache);
-	painter.drawImage(area.x(), area.y(), image);
-	painter.end();
-	DP_mutex_unlock(pe->m_cacheMutex);
-	emit pe->areaChanged(area);
+	quint32 x = quint32(tileX);
+	quint32 y = quint32(tileY);
+	TileShard &shard = pe->m_tileShards[(x * 31u + y) % TILE_SHARD_COUNT];
+	QMutexLocker locker{&shard.mutex};
+	QImage &image = shard.tiles[(x << 16u) | y];
+	if(image.isNull()) {
+		image = QImage{DP_TILE_SIZE, DP_TILE_SIZE, QImage::Format_RGB32};
+	}
+	std::memcpy(image.bits(), pixels, DP_TILE_LENGTH * sizeof(*pixels));
 }
 
 void PaintEngine::onRenderUnlock(void *user)
@@ -844,23 +838,134 @@ void PaintEngine::onRenderResize(
 	void *user, int width, int height, int prevWidth, int prevHeight,
 	int offsetX, int offsetY)
 {
+	// The renderer calls this while none of its threads are rendering tiles,
+	// so everything in the shards right now belongs to the old canvas size.
 	PaintEngine *pe = static_cast<PaintEngine *>(user);
-	QSize size{width, height};
-	DP_mutex_lock(pe->m_cacheMutex);
-	QSize cacheSize = pe->m_cache.size();
+	QMutexLocker locker{&pe->m_resizeMutex};
+	PendingResize pr{{}, width, height, prevWidth, prevHeight, offsetX, offsetY};
+	pe->takeShardTiles(pr.tilesBefore);
+	pe->m_pendingResizes.append(pr);
+}
+
+void PaintEngine::takeShardTiles(QVector<TileHash> &outTiles)
+{
+	for(TileShard &shard : m_tileShards) {
+		QMutexLocker locker{&shard.mutex};
+		if(!shard.tiles.isEmpty()) {
+			outTiles.append(TileHash{});
+			outTiles.last().swap(shard.tiles);
+		}
+	}
+}
+
+void PaintEngine::discardPendingTiles()
+{
+	QVector<TileHash> tiles;
+	QMutexLocker locker{&m_resizeMutex};
+	m_pendingResizes.clear();
+	takeShardTiles(tiles);
+}
+
+void PaintEngine::flushPendingTiles()
+{
+	DP_PERF_SCOPE("flush_tiles");
+	QVector<PendingResize> resizes;
+	QVector<TileHash> tiles;
+	{
+		// Holding the resize lock means no resize can happen in between, so
+		// the tiles we take from the shards all belong to the current size.
+		QMutexLocker locker{&m_resizeMutex};
+		resizes.swap(m_pendingResizes);
+		takeShardTiles(tiles);
+	}
+
+	// Coalesce everything that changed into a few updates per tick, rather
+	// than flooding the views with one signal per tile.
+	QRegion dirty;
+	for(const PendingResize &pr : resizes) {
+		drawTiles(pr.tilesBefore, dirty);
+		emitAreaChanged(dirty);
+		dirty = QRegion{};
+		applyResize(pr);
+	}
+
+	drawTiles(tiles, dirty);
+	emitAreaChanged(dirty);
+}
+
+void PaintEngine::drawTiles(const QVector<TileHash> &tiles, QRegion &outDirty)
+{
+	if(tiles.isEmpty() || m_cache.isNull()) {
+		return;
+	}
+
+	// Tile positions, keyed by row first so that sorting them puts tiles that
+	// are next to each other in the same row next to each other in the list.
+	QVector<quint32> dirtyKeys;
+	QPainter &painter = m_painter;
+	painter.begin(&m_cache);
+	for(const TileHash &th : tiles) {
+		for(TileHash::const_iterator it = th.constBegin(), end = th.constEnd();
+			it != end; ++it) {
+			quint32 tileX = it.key() >> 16u;
+			quint32 tileY = it.key() & 0xffffu;
+			painter.drawImage(
+				int(tileX) * DP_TILE_SIZE, int(tileY) * DP_TILE_SIZE,
+				it.value());
+			dirtyKeys.append((tileY << 16u) | tileX);
+		}
+	}
+	painter.end();
+
+	// Unite runs of adjacent tiles in each row, rather than every single tile,
+	// and let the region merge the runs of consecutive rows.
+	std::sort(dirtyKeys.begin(), dirtyKeys.end());
+	int count = dirtyKeys.size();
+	int i = 0;
+	while(i < count) {
+		quint32 first = dirtyKeys[i];
+		int j = i + 1;
+		while(j < count && dirtyKeys[j] == first + quint32(j - i) &&
+			  (dirtyKeys[j] >> 16u) == (first >> 16u)) {
+			++j;
+		}
+		outDirty += QRect{
+			int(first & 0xffffu) * DP_TILE_SIZE,
+			int(first >> 16u) * DP_TILE_SIZE, (j - i) * DP_TILE_SIZE,
+			DP_TILE_SIZE};
+		i = j;
+	}
+}
+
+void PaintEngine::emitAreaChanged(const QRegion &dirty)
+{
+	// Lots of small rectangles cost the views more than repainting their
+	// bounds would, so past a certain point just fall back to that.
+	if(dirty.rectCount() <= MAX_DIRTY_RECTS) {
+		for(const QRect &rect : dirty) {
+			emit areaChanged(rect);
+		}
+	} else {
+		emit areaChanged(dirty.boundingRect());
+	}
+}
+
+void PaintEngine::applyResize(const PendingResize &pr)
+{
+	QSize size{pr.width, pr.height};
+	QSize cacheSize = m_cache.size();
 	if(cacheSize != size) {
 		QPixmap pixmap{size};
 		pixmap.fill(QColor(100, 100, 100));
-		QPainter &painter = pe->m_painter;
+		QPainter &painter = m_painter;
 		painter.begin(&pixmap);
 		painter.drawPixmap(
-			QRect{QPoint{offsetX, offsetY}, cacheSize}, pe->m_cache,
+			QRect{QPoint{pr.offsetX, pr.offsetY}, cacheSize}, m_cache,
 			QRect{QPoint{0, 0}, cacheSize});
 		painter.end();
-		pe->m_cache = std::move(pixmap);
+		m_cache = std::move(pixmap);
 	}
-	DP_mutex_unlock(pe->m_cacheMutex);
-	emit pe->resized(offsetX, offsetY, QSize{prevWidth, prevHeight});
+	emit resized(pr.offsetX, pr.offsetY, QSize{pr.prevWidth, pr.prevHeight});
 }
 
 }
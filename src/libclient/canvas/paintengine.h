@@ -9,13 +9,18 @@ extern "C" {
 #include "libclient/drawdance/canvasstate.h"
 #include "libclient/drawdance/paintengine.h"
 #include "libclient/drawdance/snapshotqueue.h"
+#include <QHash>
+#include <QImage>
+#include <QMutex>
 #include <QObject>
 #include <QPainter>
 #include <QPixmap>
+#include <QRegion>
 #include <QSet>
+#include <QVector>
+#include <array>
 #include <functional>
 
-struct DP_Mutex;
 struct DP_Semaphore;
 
 namespace drawdance {
@@ -52,7 +57,8 @@ public:
 
 	// Do something with the currently rendered canvas pixmap. This is what the
 	// user currently sees, but may have "unfinished" parts. If you need the
-	// full, proper canvas at the current time, use renderPixmap instead.
+	// full, proper canvas at the current time, use renderPixmap instead. Must
+	// only be called from the GUI thread.
 	void withPixmap(std::function<void(const QPixmap &)> fn) const;
 
 	// Renders the whole canvas and returns it as an image. A slow operation!
@@ -261,6 +267,30 @@ private slots:
 #endif
 
 private:
+	// Rendered tiles waiting to be drawn onto the cache pixmap, by position.
+	using TileHash = QHash<quint32, QImage>;
+
+	// Renderer threads put their tiles into one of these, picked by the tile
+	// position, so that they don't all contend on a single lock.
+	struct TileShard {
+		QMutex mutex;
+		TileHash tiles;
+	};
+
+	// A canvas resize, along with the tiles rendered before it happened.
+	struct PendingResize {
+		QVector<TileHash> tilesBefore;
+		int width;
+		int height;
+		int prevWidth;
+		int prevHeight;
+		int offsetX;
+		int offsetY;
+	};
+
+	static constexpr int TILE_SHARD_COUNT = 64;
+	static constexpr int MAX_DIRTY_RECTS = 32;
+
 #ifdef DP_HAVE_BUILTIN_SERVER
 	static void
 	onSoftReset(void *user, unsigned int contextId, DP_CanvasState *cs);
@@ -299,6 +329,19 @@ private:
 
 	void updateLayersVisibleInFrame();
 
+	void takeShardTiles(QVector<TileHash> &outTiles);
+	void discardPendingTiles();
+	void flushPendingTiles();
+	void drawTiles(const QVector<TileHash> &tiles, QRegion &outDirty);
+	void emitAreaChanged(const QRegion &dirty);
+	void applyResize(const PendingResize &pr);
+
+	// These are written to by the renderer threads, so they must outlive the
+	// paint engine and need to be declared before it.
+	std::array<TileShard, TILE_SHARD_COUNT> m_tileShards;
+	QMutex m_resizeMutex;
+	QVector<PendingResize> m_pendingResizes;
+
 	drawdance::AclState m_acls;
 	drawdance::SnapshotQueue m_snapshotQueue;
 	drawdance::PaintEngine m_paintEngine;
@@ -307,7 +350,6 @@ private:
 	QSet<int> m_revealedLayers;
 	QPixmap m_cache;
 	QPainter m_painter;
-	DP_Mutex *m_cacheMutex;
 	DP_Semaphore *m_viewSem;
 	QRect m_canvasViewTileArea;
 	bool m_renderOutsideView = false;
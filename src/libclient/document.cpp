@@ -38,6 +38,7 @@ Document::Document(libclient::settings::Settings &settings, QObject *parent)
 	, m_autosave(false)
 	, m_canAutosave(false)
 	, m_saveInProgress(false)
+	, m_saveOraCache(DP_save_ora_cache_new(), DP_save_ora_cache_free)
 	, m_wantCanvasHistoryDump(false)
 	, m_sessionPersistent(false)
 	, m_sessionClosed(false)
@@ -66,6 +67,8 @@ Document::Document(libclient::settings::Settings &settings, QObject *parent)
 		m_toolctrl, &tools::ToolController::setGlobalSmoothing);
 	m_settings.bindInterpolateInputs(
 		m_toolctrl, &tools::ToolController::setInterpolateInputs);
+	m_settings.bindBrushThread(
+		m_toolctrl, &tools::ToolController::setThreadedBrushEngine);
 	m_banlist = new net::BanlistModel(this);
 	m_authList = new net::AuthListModel(this);
 	m_announcementlist =
@@ -112,6 +115,8 @@ Document::Document(libclient::settings::Settings &settings, QObject *parent)
 void Document::initCanvas()
 {
 	delete m_canvas;
+	// Layers from the previous canvas won't be saved again.
+	m_saveOraCache.reset(DP_save_ora_cache_new(), DP_save_ora_cache_free);
 
 	m_canvas = new canvas::CanvasModel{
 		m_settings,
@@ -688,7 +693,7 @@ void Document::saveCanvasState(
 	m_saveInProgress = true;
 
 	CanvasSaverRunnable *saver =
-		new CanvasSaverRunnable(canvasState, type, path);
+		new CanvasSaverRunnable(canvasState, type, path, m_saveOraCache);
 	if(isCurrentState) {
 		unmarkDirty();
 	}
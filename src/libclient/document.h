@@ -15,6 +15,7 @@ extern "C" {
 #include "libshared/util/qtcompat.h"
 #include <QObject>
 #include <QStringListModel>
+#include <memory>
 #ifdef Q_OS_ANDROID
 #	include <QMimeData>
 #endif
@@ -338,6 +339,7 @@ private:
 	bool m_autosave;
 	bool m_canAutosave;
 	bool m_saveInProgress;
+	std::shared_ptr<DP_SaveOraCache> m_saveOraCache;
 	bool m_wantCanvasHistoryDump;
 	QTimer *m_autosaveTimer;
 
@@ -9,54 +9,41 @@ extern "C" {
 #include "libclient/drawdance/brushpreview.h"
 #include "libclient/drawdance/global.h"
 #include "libclient/drawdance/image.h"
-#include <QPainter>
 
 namespace drawdance {
 
-BrushPreview::BrushPreview()
-    : m_data{DP_brush_preview_new()}
-    , m_pixmap{}
+BrushPreview::BrushPreview(RenderedFn fn, void *user)
+    : m_fn{fn}
+    , m_user{user}
+    , m_renderer{DP_brush_preview_renderer_new(&BrushPreview::onRendered, this)}
 {
 }
 
 BrushPreview::~BrushPreview()
 {
-    DP_brush_preview_free(m_data);
+    DP_brush_preview_renderer_free(m_renderer);
 }
 
-void BrushPreview::reset(QSize size)
+unsigned int BrushPreview::requestClassic(
+    const QSize &size, const DP_ClassicBrush &brush, DP_BrushPreviewShape shape)
 {
-    if (size != m_pixmap.size()) {
-        m_pixmap = QPixmap{size};
-    }
+    return DP_brush_preview_renderer_request_classic(
+        m_renderer, size.width(), size.height(), &brush, shape);
 }
 
-void BrushPreview::renderClassic(const DP_ClassicBrush &brush, DP_BrushPreviewShape shape)
+unsigned int BrushPreview::requestMyPaint(
+    const QSize &size, const DP_MyPaintBrush &brush,
+    const DP_MyPaintSettings &settings, DP_BrushPreviewShape shape)
 {
-    QSize size = m_pixmap.size();
-    DrawContext dc = DrawContextPool::acquire();
-    DP_brush_preview_render_classic(
-        m_data, dc.get(), size.width(), size.height(), &brush, shape);
-}
-
-void BrushPreview::renderMyPaint(
-    const DP_MyPaintBrush &brush, const DP_MyPaintSettings &settings,
-    DP_BrushPreviewShape shape)
-{
-    QSize size = m_pixmap.size();
-    DrawContext dc = DrawContextPool::acquire();
-    DP_brush_preview_render_mypaint(
-        m_data, dc.get(), size.width(), size.height(), &brush, &settings, shape);
+    return DP_brush_preview_renderer_request_mypaint(
+        m_renderer, size.width(), size.height(), &brush, &settings, shape);
 }
 
-void BrushPreview::paint(const QPixmap &background)
+void BrushPreview::onRendered(
+    void *user, unsigned int requestId, DP_Image *img)
 {
-    QImage img = wrapImage(DP_brush_preview_to_image(m_data));
-    m_pixmap.convertFromImage(img);
-
-    QPainter painter{&m_pixmap};
-    painter.setCompositionMode(QPainter::CompositionMode_DestinationOver);
-    painter.drawTiledPixmap(m_pixmap.rect(), background);
+    BrushPreview *bp = static_cast<BrushPreview *>(user);
+    bp->m_fn(bp->m_user, requestId, wrapImage(img));
 }
 
 QPixmap BrushPreview::classicBrushPreviewDab(
@@ -7,14 +7,21 @@ extern "C" {
 #include <dpengine/brush_preview.h>
 }
 
+#include <QImage>
 #include <QPixmap>
 #include <QSize>
 
 namespace drawdance {
 
+// Renders brush previews on a background thread. Only the most recent request
+// gets delivered, stale ones are dropped. The rendered function is called on
+// the render thread, so it must pass the image along to wherever it's needed.
 class BrushPreview final {
 public:
-    BrushPreview();
+    using RenderedFn =
+        void (*)(void *user, unsigned int requestId, const QImage &img);
+
+    BrushPreview(RenderedFn fn, void *user);
     ~BrushPreview();
 
     BrushPreview(const BrushPreview &) = delete;
@@ -22,24 +29,23 @@ public:
     BrushPreview &operator=(const BrushPreview &) = delete;
     BrushPreview &operator=(BrushPreview &&) = delete;
 
-    const QPixmap &pixmap() const { return m_pixmap; }
-
-    void reset(QSize size);
-
-    void renderClassic(const DP_ClassicBrush &brush, DP_BrushPreviewShape shape);
-
-    void renderMyPaint(
-        const DP_MyPaintBrush &brush, const DP_MyPaintSettings &settings,
+    unsigned int requestClassic(
+        const QSize &size, const DP_ClassicBrush &brush,
         DP_BrushPreviewShape shape);
 
-    void paint(const QPixmap &background);
+    unsigned int requestMyPaint(
+        const QSize &size, const DP_MyPaintBrush &brush,
+        const DP_MyPaintSettings &settings, DP_BrushPreviewShape shape);
 
     static QPixmap classicBrushPreviewDab(
         const DP_ClassicBrush &cb, int width, int height, const QColor &color);
 
 private:
-    DP_BrushPreview *m_data;
-    QPixmap m_pixmap;
+    static void onRendered(void *user, unsigned int requestId, DP_Image *img);
+
+    RenderedFn m_fn;
+    void *m_user;
+    DP_BrushPreviewRenderer *m_renderer;
 };
 
 }
@@ -9,8 +9,17 @@ namespace drawdance {
 
 bool Perf::open(const QString &path)
 {
-    DP_Output *output = DP_gzip_output_new_from_path(path.toUtf8().constData());
-    return output ? DP_perf_open(output) : false;
+    // Chrome trace files are plain JSON so that they can be loaded directly
+    // into chrome://tracing or Perfetto, our own format gets compressed.
+    QByteArray pathBytes = path.toUtf8();
+    if(path.endsWith(QStringLiteral(".json"), Qt::CaseInsensitive)) {
+        DP_Output *output = DP_file_output_new_from_path(pathBytes.constData());
+        return output ? DP_perf_open(output, DP_PERF_FORMAT_CHROME_TRACE)
+                      : false;
+    } else {
+        DP_Output *output = DP_gzip_output_new_from_path(pathBytes.constData());
+        return output ? DP_perf_open(output, DP_PERF_FORMAT_TEXT) : false;
+    }
 }
 
 bool Perf::close()
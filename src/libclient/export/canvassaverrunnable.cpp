@@ -7,11 +7,13 @@
 
 CanvasSaverRunnable::CanvasSaverRunnable(
 	const drawdance::CanvasState &canvasState, DP_SaveImageType type,
-	const QString &path, QObject *parent)
+	const QString &path, const std::shared_ptr<DP_SaveOraCache> &oraCache,
+	QObject *parent)
 	: QObject(parent)
 	, m_canvasState(canvasState)
 	, m_type(type)
 	, m_path(path.toUtf8())
+	, m_oraCache(oraCache)
 {
 }
 
@@ -20,8 +22,9 @@ void CanvasSaverRunnable::run()
 	const char *path = m_path.constData();
 	qDebug("Saving to '%s'", path);
 	drawdance::DrawContext dc = drawdance::DrawContextPool::acquire();
-	DP_SaveResult result = DP_save(
-		m_canvasState.get(), dc.get(), m_type, path, bakeAnnotation, this);
+	DP_SaveResult result = DP_save_cached(
+		m_canvasState.get(), dc.get(), m_type, path, bakeAnnotation, this,
+		m_oraCache.get());
 	emit saveComplete(saveResultToErrorString(result));
 }
 
@@ -8,6 +8,7 @@ extern "C" {
 #include <QByteArray>
 #include <QObject>
 #include <QRunnable>
+#include <memory>
 
 /**
  * @brief A runnable for saving a canvas in a background thread
@@ -17,7 +18,9 @@ class CanvasSaverRunnable final : public QObject, public QRunnable {
 public:
 	CanvasSaverRunnable(
 		const drawdance::CanvasState &canvasState, DP_SaveImageType type,
-		const QString &path, QObject *parent = nullptr);
+		const QString &path,
+		const std::shared_ptr<DP_SaveOraCache> &oraCache = {},
+		QObject *parent = nullptr);
 
 	void run() override;
 
@@ -37,6 +40,7 @@ private:
 	drawdance::CanvasState m_canvasState;
 	DP_SaveImageType m_type;
 	QByteArray m_path;
+	std::shared_ptr<DP_SaveOraCache> m_oraCache;
 };
 
 #endif
@@ -60,6 +60,7 @@ LoginHandler::LoginHandler(Mode mode, const QUrl &url, QObject *parent)
 	, m_supportsCryptBanImpEx(false)
 	, m_supportsModBanImpEx(false)
 	, m_supportsLookup(false)
+	, m_supportsCompression(false)
 	, m_supportsExtAuthAvatars(false)
 	, m_compatibilityMode(false)
 	, m_isGuest(true)
@@ -195,6 +196,8 @@ void LoginHandler::expectHello(const ServerReply &msg)
 			m_supportsModBanImpEx = true;
 		} else if(flag == "LOOKUP") {
 			m_supportsLookup = true;
+		} else if(flag == "DEFLATE") {
+			m_supportsCompression = true;
 		} else {
 			qCWarning(lcDpLogin) << "Unknown server capability:" << flag;
 		}
@@ -617,6 +620,7 @@ void LoginHandler::sendHostCommand()
 		m_joinPassword = m_sessionPassword;
 	}
 
+	prepareDecompression();
 	send("host", {}, kwargs);
 	m_state = EXPECT_LOGIN_OK;
 }
@@ -852,6 +856,7 @@ void LoginHandler::sendJoinCommand()
 		kwargs["password"] = m_joinPassword;
 	}
 
+	prepareDecompression();
 	send("join", {m_selectedId}, kwargs);
 	m_state = EXPECT_LOGIN_OK;
 }
@@ -1211,11 +1216,22 @@ QJsonObject LoginHandler::makeClientInfoKwargs()
 		{"s", getSid()},
 		{"m", QString::fromUtf8(QSysInfo::machineUniqueId().toBase64())},
 		// Comma-separated list of client capabilities. KEEPALIVE indicates
-		// support for DP_MSG_KEEP_ALIVE messages from the server.
-		{"capabilities", QStringLiteral("KEEPALIVE")},
+		// support for DP_MSG_KEEP_ALIVE messages from the server, DEFLATE
+		// for compressed messages after the login is done.
+		{"capabilities", QStringLiteral("KEEPALIVE,DEFLATE")},
 	};
 }
 
+void LoginHandler::prepareDecompression()
+{
+	// The server starts compressing right after it accepts the login, which
+	// may arrive in the same read as the reply. So we have to be ready for it
+	// before sending the command that includes our capabilities.
+	if(m_supportsCompression) {
+		m_server->messageQueue()->setDecompressionEnabled(true);
+	}
+}
+
 QString LoginHandler::getSid()
 {
 	static QString key1{"5dd7038779f243b68001dab548ae59ab"};
@@ -170,6 +170,7 @@ public:
 
 	bool supportsCryptBanImEx() const { return m_supportsCryptBanImpEx; }
 	bool supportsModBanImEx() const { return m_supportsModBanImpEx; }
+	bool supportsCompression() const { return m_supportsCompression; }
 
 	/**
 	 * @brief Can the server receive abuse reports?
@@ -454,6 +455,7 @@ private:
 	void handleError(const QString &code, const QString &message);
 
 	QString takeAvatar();
+	void prepareDecompression();
 
 	static LoginMethod parseLoginMethod(const QString &method);
 	static QString loginMethodToString(LoginMethod method);
@@ -507,6 +509,7 @@ private:
 	bool m_supportsCryptBanImpEx;
 	bool m_supportsModBanImpEx;
 	bool m_supportsLookup;
+	bool m_supportsCompression;
 	bool m_supportsExtAuthAvatars;
 	bool m_compatibilityMode;
 	bool m_needSessionPassword;
@@ -6,17 +6,32 @@ extern "C" {
 }
 #include "libclient/canvas/blendmodes.h"
 #include "libclient/drawdance/global.h"
+#include "libclient/drawdance/perf.h"
 #include "libclient/drawdance/tile.h"
 #include "libclient/net/message.h"
 #include "libshared/util/qtcompat.h"
+#include <QAtomicInt>
 #include <QByteArray>
 #include <QImage>
 #include <QJsonDocument>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QString>
+#include <QThread>
+#include <QThreadPool>
 #include <QtEndian>
+#include <functional>
+
+#define DP_PERF_CONTEXT "message"
 
 namespace net {
 
+// Maximum compressed size of a put image message's image data.
+static constexpr int PUT_IMAGE_MAX_PAYLOAD = 0xffff - 19;
+// What chunks of tiles are allowed to add up to when going by the estimated
+// compressed size, with some headroom since the estimate is only a guess.
+static constexpr int PUT_IMAGE_CHUNK_BUDGET = PUT_IMAGE_MAX_PAYLOAD * 3 / 4;
+
 Message makeAnnotationCreateMessage(
 	unsigned int contextId, uint16_t id, int32_t x, int32_t y, uint16_t w,
 	uint16_t h)
@@ -367,7 +382,7 @@ static void makePutImagesRecursive(
 	int w = bounds.width();
 	int h = bounds.height();
 	if(w > 0 && h > 0) {
-		int maxSize = 0xffff - 19;
+		int maxSize = PUT_IMAGE_MAX_PAYLOAD;
 		int compressedSize;
 		// If our estimated size looks good, try compressing. Otherwise assume
 		// that the image is too big to fit into a message and split it up.
@@ -410,6 +425,195 @@ static void makePutImagesRecursive(
 	}
 }
 
+namespace {
+
+struct PutImageTileInfo {
+	bool blank;
+	int estimatedSize;
+};
+
+}
+
+// Guesses how big a region of the image will be after compression, without
+// actually compressing it. Counts runs of identical pixels, since that's what
+// deflate gets most of its mileage out of for this kind of data. Also checks
+// if the region is entirely transparent, so that it can be skipped.
+static PutImageTileInfo
+scanPutImageTile(const QImage &image, int left, int top, int w, int h)
+{
+	bool blank = true;
+	int runs = 0;
+	for(int y = top; y < top + h; ++y) {
+		const uint32_t *line =
+			reinterpret_cast<const uint32_t *>(image.constScanLine(y)) + left;
+		uint32_t prev = line[0];
+		blank = blank && prev == 0;
+		++runs;
+		for(int x = 1; x < w; ++x) {
+			uint32_t pixel = line[x];
+			if(pixel != prev) {
+				blank = false;
+				++runs;
+				prev = pixel;
+			}
+		}
+	}
+	// A literal pixel costs about 4 bytes, long runs still cost a few bytes
+	// for every maximum-length match. This overestimates, which is the safe
+	// direction to be wrong in.
+	return {blank, runs * 4 + w * h / 16};
+}
+
+static void makePutImageChunk(
+	MessageList &msgs, uint8_t contextId, uint16_t layer, uint8_t mode, int x,
+	int y, const QImage &image, const QRect &bounds)
+{
+	QImage subImage = bounds == image.rect() ? image : image.copy(bounds);
+	QByteArray compressed =
+		qCompress(subImage.constBits(), subImage.sizeInBytes());
+	int compressedSize = compressed.size();
+	if(compressedSize <= PUT_IMAGE_MAX_PAYLOAD) {
+		msgs.append(makePutImageMessage(
+			contextId, layer, mode, x + bounds.x(), y + bounds.y(),
+			bounds.width(), bounds.height(), compressed));
+	} else {
+		// The estimate was off, fall back to slicing the chunk up.
+		makePutImagesRecursive(
+			msgs, contextId, layer, mode, x + bounds.x(), y + bounds.y(), image,
+			bounds, compressedSize);
+	}
+}
+
+// Encodes one row of tiles, merging horizontally adjacent tiles into a single
+// message as long as their estimated compressed size fits. Tile boundaries
+// are relative to the canvas, not the image, so that the paint engine doesn't
+// have to split up every incoming tile again.
+static void makePutImagesForTileRow(
+	MessageList &msgs, uint8_t contextId, uint16_t layer, uint8_t mode, int x,
+	int y, const QImage &image, int top, int h, bool skipBlank)
+{
+	int imageWidth = image.width();
+	int chunkLeft = 0;
+	int chunkRight = 0;
+	int chunkSize = 0;
+	int left = 0;
+	while(left < imageWidth) {
+		int right =
+			qMin(imageWidth, left + DP_TILE_SIZE - (x + left) % DP_TILE_SIZE);
+		PutImageTileInfo info =
+			scanPutImageTile(image, left, top, right - left, h);
+		bool skip = skipBlank && info.blank;
+		bool full = chunkSize + info.estimatedSize > PUT_IMAGE_CHUNK_BUDGET;
+		if(chunkSize != 0 && (skip || full)) {
+			makePutImageChunk(
+				msgs, contextId, layer, mode, x, y, image,
+				QRect(chunkLeft, top, chunkRight - chunkLeft, h));
+			chunkSize = 0;
+		}
+		if(!skip) {
+			if(chunkSize == 0) {
+				chunkLeft = left;
+			}
+			chunkSize += info.estimatedSize;
+			chunkRight = right;
+		}
+		left = right;
+	}
+	if(chunkSize != 0) {
+		makePutImageChunk(
+			msgs, contextId, layer, mode, x, y, image,
+			QRect(chunkLeft, top, chunkRight - chunkLeft, h));
+	}
+}
+
+namespace {
+
+class PutImageJob final : public QRunnable {
+public:
+	PutImageJob(
+		QAtomicInt &next, int count, const std::function<void(int)> &fn,
+		QSemaphore *done)
+		: m_next{next}
+		, m_count{count}
+		, m_fn{fn}
+		, m_done{done}
+	{
+	}
+
+	void run() override
+	{
+		int i;
+		while((i = m_next.fetchAndAddOrdered(1)) < m_count) {
+			m_fn(i);
+		}
+		if(m_done) {
+			m_done->release();
+		}
+	}
+
+private:
+	QAtomicInt &m_next;
+	int m_count;
+	const std::function<void(int)> &m_fn;
+	QSemaphore *m_done;
+};
+
+}
+
+// Calls fn for every index in [0, count), spread across the global thread
+// pool. The calling thread works through the indexes too and helpers are only
+// started if the pool has a thread free for them, so a busy pool can't stall
+// this waiting on unrelated tasks.
+static void runPutImageJobs(int count, const std::function<void(int)> &fn)
+{
+	QAtomicInt next{0};
+	QSemaphore done;
+	int started = 0;
+	int helpers = qMin(QThread::idealThreadCount(), count) - 1;
+	QThreadPool *pool = QThreadPool::globalInstance();
+	for(int i = 0; i < helpers; ++i) {
+		PutImageJob *job = new PutImageJob{next, count, fn, &done};
+		if(pool->tryStart(job)) {
+			++started;
+		} else {
+			delete job;
+			break;
+		}
+	}
+	PutImageJob{next, count, fn, nullptr}.run();
+	done.acquire(started);
+}
+
+static void makePutImagesTiled(
+	MessageList &msgs, uint8_t contextId, uint16_t layer, uint8_t mode, int x,
+	int y, const QImage &image)
+{
+	DP_PERF_SCOPE("put_images");
+	// Blank regions do nothing, except in replace mode, where they clear.
+	bool skipBlank = mode != DP_BLEND_MODE_REPLACE;
+
+	QVector<int> rowTops;
+	int imageHeight = image.height();
+	for(int top = 0; top < imageHeight;
+		top += DP_TILE_SIZE - (y + top) % DP_TILE_SIZE) {
+		rowTops.append(top);
+	}
+
+	int rowCount = rowTops.size();
+	QVector<MessageList> rowMsgs(rowCount);
+	runPutImageJobs(rowCount, [&](int i) {
+		int top = rowTops[i];
+		int bottom = i + 1 < rowCount ? rowTops[i + 1] : imageHeight;
+		makePutImagesForTileRow(
+			rowMsgs[i], contextId, layer, mode, x, y, image, top, bottom - top,
+			skipBlank);
+	});
+
+	for(const MessageList &rm : rowMsgs) {
+		msgs.append(rm);
+	}
+}
+
 void makePutImageMessages(
 	MessageList &msgs, uint8_t contextId, uint16_t layer, uint8_t mode, int x,
 	int y, const QImage &image)
@@ -425,13 +629,11 @@ void makePutImageMessages(
 			QImage cropped = converted.copy(
 				xoffset, yoffset, image.width() - xoffset,
 				image.height() - yoffset);
-			makePutImagesRecursive(
-				msgs, contextId, layer, mode, x + xoffset, y + yoffset, cropped,
-				cropped.rect(), 0);
+			makePutImagesTiled(
+				msgs, contextId, layer, mode, x + xoffset, y + yoffset,
+				cropped);
 		} else {
-			makePutImagesRecursive(
-				msgs, contextId, layer, mode, x, y, converted, converted.rect(),
-				0);
+			makePutImagesTiled(msgs, contextId, layer, mode, x, y, converted);
 		}
 	}
 }
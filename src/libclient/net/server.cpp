@@ -192,6 +192,9 @@ void Server::loginSuccess()
 	m_supportsModBanImpEx = m_loginstate->supportsModBanImEx();
 	m_supportsAbuseReports = m_loginstate->supportsAbuseReports();
 	messageQueue()->setContextId(m_loginstate->userId());
+	if(m_loginstate->supportsCompression()) {
+		messageQueue()->setCompressionEnabled(true);
+	}
 
 	emit loggedIn(
 		m_loginstate->url(), m_loginstate->userId(),
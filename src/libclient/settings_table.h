@@ -10,6 +10,7 @@
 
 SETTING(autoSaveInterval            , AutoSaveInterval            , "settings/autosave"                     , 5000)
 SETTING(interpolateInputs           , InterpolateInputs           , "settings/input/interpolate"            , true)
+SETTING(brushThread                 , BrushThread                 , "settings/input/brushthread"            , false)
 SETTING(messageQueueDrainRate       , MessageQueueDrainRate       , "settings/messagequeuedrainrate"        , net::MessageQueue::DEFAULT_SMOOTH_DRAIN_RATE)
 SETTING(parentalControlsAutoTag     , ParentalControlsAutoTag     , "pc/autotag"                            , true)
 SETTING(parentalControlsForceCensor , ParentalControlsForceCensor , "pc/noUncensoring"                      , false)
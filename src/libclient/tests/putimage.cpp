@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+extern "C" {
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/messages.h>
+}
+#include "libclient/net/message.h"
+#include "libshared/util/qtcompat.h"
+
+#include <QImage>
+#include <QRandomGenerator>
+#include <QtTest/QtTest>
+
+class TestPutImage final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testBlankSkipped()
+	{
+		QImage image(300, 200, QImage::Format_ARGB32_Premultiplied);
+		image.fill(0);
+		net::MessageList msgs;
+		net::makePutImageMessages(
+			msgs, 1, 0x0101, DP_BLEND_MODE_NORMAL, 10, 20, image);
+		QVERIFY(msgs.isEmpty());
+	}
+
+	void testBlankReplaced()
+	{
+		QImage image(300, 200, QImage::Format_ARGB32_Premultiplied);
+		image.fill(0);
+		net::MessageList msgs;
+		net::makePutImageMessages(
+			msgs, 1, 0x0101, DP_BLEND_MODE_REPLACE, 10, 20, image);
+		checkMessages(msgs, image, 10, 20, true);
+	}
+
+	void testNoise_data()
+	{
+		QTest::addColumn<int>("x");
+		QTest::addColumn<int>("y");
+
+		QTest::newRow("aligned") << 0 << 0;
+		QTest::newRow("unaligned") << 10 << 100;
+		QTest::newRow("cropped") << -70 << -5;
+	}
+
+	void testNoise()
+	{
+		QFETCH(int, x);
+		QFETCH(int, y);
+
+		// Random pixels don't compress, so this needs a lot of messages.
+		QImage image(500, 300, QImage::Format_ARGB32_Premultiplied);
+		QRandomGenerator rng(1234);
+		for(int iy = 0; iy < image.height(); ++iy) {
+			QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(iy));
+			for(int ix = 0; ix < image.width(); ++ix) {
+				int a = rng.bounded(256);
+				line[ix] = qPremultiply(qRgba(
+					rng.bounded(256), rng.bounded(256), rng.bounded(256), a));
+			}
+		}
+		// Punch a tile-sized hole in it, that should be skipped.
+		for(int iy = 128; iy < 256; ++iy) {
+			QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(iy));
+			for(int ix = 128; ix < 320; ++ix) {
+				line[ix] = 0;
+			}
+		}
+
+		net::MessageList msgs;
+		net::makePutImageMessages(
+			msgs, 1, 0x0101, DP_BLEND_MODE_NORMAL, x, y, image);
+		QVERIFY(msgs.size() > 1);
+		checkMessages(msgs, image, x, y, false);
+	}
+
+	void testFlat()
+	{
+		// A flat color compresses well, so it should be merged into few
+		// messages, one per row of tiles.
+		QImage image(1000, 130, QImage::Format_ARGB32_Premultiplied);
+		image.fill(qRgba(255, 0, 0, 255));
+		net::MessageList msgs;
+		net::makePutImageMessages(
+			msgs, 1, 0x0101, DP_BLEND_MODE_NORMAL, 0, 0, image);
+		QCOMPARE(msgs.size(), 3);
+		checkMessages(msgs, image, 0, 0, true);
+	}
+
+private:
+	static void checkMessages(
+		const net::MessageList &msgs, const QImage &image, int x, int y,
+		bool expectFullCoverage)
+	{
+		QRect canvasRect(x, y, image.width(), image.height());
+		QRect visibleRect = canvasRect.intersected(
+			QRect(0, 0, canvasRect.right() + 1, canvasRect.bottom() + 1));
+		QVector<int> coverage(image.width() * image.height(), 0);
+
+		for(const net::Message &msg : msgs) {
+			QCOMPARE(msg.type(), DP_MSG_PUT_IMAGE);
+			DP_MsgPutImage *mpi = msg.toPutImage();
+			QRect rect(
+				DP_msg_put_image_x(mpi), DP_msg_put_image_y(mpi),
+				DP_msg_put_image_w(mpi), DP_msg_put_image_h(mpi));
+			QVERIFY(visibleRect.contains(rect));
+
+			size_t size;
+			const unsigned char *data = DP_msg_put_image_image(mpi, &size);
+			QVERIFY(size <= 0xffff - 19);
+			QByteArray pixels = qUncompress(data, compat::castSize(size));
+			QCOMPARE(pixels.size(), rect.width() * rect.height() * 4);
+
+			const QRgb *actual =
+				reinterpret_cast<const QRgb *>(pixels.constData());
+			for(int iy = 0; iy < rect.height(); ++iy) {
+				int sy = rect.y() + iy - y;
+				const QRgb *expected =
+					reinterpret_cast<const QRgb *>(image.constScanLine(sy));
+				for(int ix = 0; ix < rect.width(); ++ix) {
+					int sx = rect.x() + ix - x;
+					QCOMPARE(actual[iy * rect.width() + ix], expected[sx]);
+					++coverage[sy * image.width() + sx];
+				}
+			}
+		}
+
+		for(int iy = visibleRect.top(); iy <= visibleRect.bottom(); ++iy) {
+			int sy = iy - y;
+			const QRgb *line =
+				reinterpret_cast<const QRgb *>(image.constScanLine(sy));
+			for(int ix = visibleRect.left(); ix <= visibleRect.right(); ++ix) {
+				int sx = ix - x;
+				int count = coverage[sy * image.width() + sx];
+				if(expectFullCoverage || line[sx] != 0) {
+					QCOMPARE(count, 1);
+				} else {
+					QVERIFY(count <= 1);
+				}
+			}
+		}
+	}
+};
+
+QTEST_MAIN(TestPutImage)
+#include "putimage.moc"
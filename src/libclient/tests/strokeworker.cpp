@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+extern "C" {
+#include <dpengine/brush_engine.h>
+#include <dpmsg/messages.h>
+}
+#include "libclient/brushes/brush.h"
+#include "libclient/canvas/point.h"
+#include "libclient/drawdance/canvasstate.h"
+#include "libclient/net/client.h"
+#include "libclient/net/message.h"
+#include "libclient/tools/strokeworker.h"
+
+#include <QVector>
+#include <QtTest/QtTest>
+
+class TestStrokeWorker final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testStrokeBeforeUndo_data()
+	{
+		QTest::addColumn<int>("points");
+		QTest::newRow("short") << 2;
+		QTest::newRow("long") << 500;
+	}
+
+	void testStrokeBeforeUndo()
+	{
+		QFETCH(int, points);
+
+		net::Client client;
+		QVector<DP_MessageType> types;
+		connect(
+			&client, &net::Client::drawingCommandsLocal,
+			[&types](int count, const net::Message *msgs) {
+				for(int i = 0; i < count; ++i) {
+					types.append(msgs[i].type());
+				}
+			});
+
+		DP_StrokeParams stroke = {};
+		stroke.layer_id = 0x0101;
+		drawdance::CanvasState cs = drawdance::CanvasState::null();
+
+		tools::StrokeWorker worker(&client);
+		worker.beginStroke(brushes::ActiveBrush(), stroke, 1, 1.0f);
+		for(int i = 0; i < points; ++i) {
+			worker.strokeTo(canvas::Point(i, i * 2.0, i, 1.0), cs);
+		}
+		worker.endStroke(points, cs);
+		// The caller may send anything right after the stroke ends, it must
+		// not be able to overtake any part of it.
+		client.sendMessage(net::makeUndoMessage(1, 0, false));
+
+		// Give stray queued sends a chance to show up in the wrong spot.
+		QTest::qWait(100);
+
+		QVERIFY(types.size() >= 2);
+		QCOMPARE(types.last(), DP_MSG_UNDO);
+		QCOMPARE(types[types.size() - 2], DP_MSG_PEN_UP);
+		QCOMPARE(types.count(DP_MSG_UNDO), 1);
+		QCOMPARE(types.count(DP_MSG_PEN_UP), 1);
+	}
+};
+
+QTEST_MAIN(TestStrokeWorker)
+#include "strokeworker.moc"
@@ -3,6 +3,7 @@
 #include "libclient/canvas/canvasmodel.h"
 #include "libclient/canvas/paintengine.h"
 #include "libclient/net/client.h"
+#include "libclient/tools/strokeworker.h"
 #include "libclient/tools/toolcontroller.h"
 #include <QDateTime>
 
@@ -16,6 +17,7 @@ Freehand::Freehand(ToolController &owner, bool isEraser)
 		  false)
 	, m_pollTimer{}
 	, m_brushEngine{std::bind(&Freehand::pollControl, this, _1)}
+	, m_threaded(false)
 	, m_drawing(false)
 {
 	m_pollTimer.setSingleShot(false);
@@ -38,7 +40,16 @@ void Freehand::begin(const canvas::Point &point, bool right, float zoom)
 	m_drawing = true;
 	m_firstPoint = true;
 
-	m_owner.setBrushEngineBrush(m_brushEngine, true);
+	// The mode is picked per stroke, switching it in the middle of one
+	// would lose the brush engine's state.
+	m_threaded = m_owner.threadedBrushEngine();
+	if(m_threaded) {
+		if(!m_strokeWorker) {
+			m_strokeWorker.reset(new StrokeWorker{m_owner.client()});
+		}
+	} else {
+		m_owner.setBrushEngineBrush(m_brushEngine, true);
+	}
 
 	// The pressure value of the first point is unreliable
 	// because it is (or was?) possible to get a synthetic MousePress event
@@ -59,13 +70,15 @@ void Freehand::motion(const canvas::Point &point, bool constrain, bool center)
 
 	if(m_firstPoint) {
 		m_firstPoint = false;
-		m_brushEngine.beginStroke(m_owner.client()->myId(), true, m_zoom);
+		beginStroke();
 		m_start.setPressure(qMin(m_start.pressure(), point.pressure()));
-		m_brushEngine.strokeTo(m_start, canvasState);
+		strokeTo(m_start, canvasState);
 	}
 
-	m_brushEngine.strokeTo(point, canvasState);
-	m_brushEngine.sendMessagesTo(m_owner.client());
+	strokeTo(point, canvasState);
+	if(!m_threaded) {
+		m_brushEngine.sendMessagesTo(m_owner.client());
+	}
 }
 
 void Freehand::end()
@@ -77,20 +90,28 @@ void Freehand::end()
 
 		if(m_firstPoint) {
 			m_firstPoint = false;
-			m_brushEngine.beginStroke(m_owner.client()->myId(), true, m_zoom);
-			m_brushEngine.strokeTo(m_start, canvasState);
+			beginStroke();
+			strokeTo(m_start, canvasState);
 		}
 
-		m_brushEngine.endStroke(
-			QDateTime::currentMSecsSinceEpoch(), canvasState, true);
-		m_brushEngine.sendMessagesTo(m_owner.client());
+		long long timeMsec = QDateTime::currentMSecsSinceEpoch();
+		if(m_threaded) {
+			m_strokeWorker->endStroke(timeMsec, canvasState);
+		} else {
+			m_brushEngine.endStroke(timeMsec, canvasState, true);
+			m_brushEngine.sendMessagesTo(m_owner.client());
+		}
 	}
 }
 
 void Freehand::offsetActiveTool(int x, int y)
 {
 	if(m_drawing) {
-		m_brushEngine.addOffset(x, y);
+		if(m_threaded) {
+			m_strokeWorker->addOffset(x, y);
+		} else {
+			m_brushEngine.addOffset(x, y);
+		}
 	}
 }
 
@@ -103,6 +124,28 @@ void Freehand::pollControl(bool enable)
 	}
 }
 
+void Freehand::beginStroke()
+{
+	unsigned int contextId = m_owner.client()->myId();
+	if(m_threaded) {
+		m_strokeWorker->beginStroke(
+			m_owner.activeBrush(), m_owner.brushEngineStrokeParams(true),
+			contextId, m_zoom);
+	} else {
+		m_brushEngine.beginStroke(contextId, true, m_zoom);
+	}
+}
+
+void Freehand::strokeTo(
+	const canvas::Point &point, const drawdance::CanvasState &cs)
+{
+	if(m_threaded) {
+		m_strokeWorker->strokeTo(point, cs);
+	} else {
+		m_brushEngine.strokeTo(point, cs);
+	}
+}
+
 void Freehand::poll()
 {
 	drawdance::CanvasState canvasState =
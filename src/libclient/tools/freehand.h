@@ -4,9 +4,12 @@
 #include "libclient/drawdance/brushengine.h"
 #include "libclient/tools/tool.h"
 #include <QTimer>
+#include <memory>
 
 namespace tools {
 
+class StrokeWorker;
+
 //! Freehand brush tool
 class Freehand final : public Tool {
 public:
@@ -28,8 +31,13 @@ private:
 	void pollControl(bool enable);
 	void poll();
 
+	void beginStroke();
+	void strokeTo(const canvas::Point &point, const drawdance::CanvasState &cs);
+
 	QTimer m_pollTimer;
 	drawdance::BrushEngine m_brushEngine;
+	std::unique_ptr<StrokeWorker> m_strokeWorker;
+	bool m_threaded;
 	bool m_drawing;
 	bool m_firstPoint;
 	canvas::Point m_start;
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libclient/tools/strokeworker.h"
+#include "libclient/drawdance/brushengine.h"
+#include "libclient/drawdance/perf.h"
+#include "libclient/net/client.h"
+#include <QDateTime>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QThread>
+#include <QTimer>
+
+#define DP_PERF_CONTEXT "stroke_worker"
+
+namespace tools {
+
+// Lives on the worker thread, everything in here runs on it.
+class StrokeWorkerEngine final : public QObject {
+public:
+	explicit StrokeWorkerEngine(StrokeWorker *worker)
+		: m_worker{worker}
+		, m_pollTimer{nullptr}
+		, m_brushEngine{[this](bool enable) {
+			pollControl(enable);
+		}}
+	{
+	}
+
+	void processCommands()
+	{
+		DP_PERF_SCOPE("process");
+		for(StrokeWorker::Command &command : m_worker->takeCommands()) {
+			switch(command.type) {
+			case StrokeWorker::Command::Begin: {
+				const StrokeWorker::BeginParams &bp = *command.begin;
+				bp.brush.setInBrushEngine(m_brushEngine, bp.stroke);
+				m_brushEngine.beginStroke(bp.contextId, true, bp.zoom);
+				break;
+			}
+			case StrokeWorker::Command::StrokeTo:
+				m_canvasState = command.canvasState;
+				m_brushEngine.strokeTo(command.point, m_canvasState);
+				break;
+			case StrokeWorker::Command::End:
+				m_canvasState = command.canvasState;
+				m_brushEngine.endStroke(command.timeMsec, m_canvasState, true);
+				// Don't hold onto the canvas longer than necessary.
+				m_canvasState = drawdance::CanvasState::null();
+				break;
+			case StrokeWorker::Command::Offset:
+				m_brushEngine.addOffset(command.offsetX, command.offsetY);
+				break;
+			}
+		}
+		flushMessages();
+	}
+
+private:
+	void pollControl(bool enable)
+	{
+		if(!m_pollTimer) {
+			m_pollTimer = new QTimer{this};
+			m_pollTimer->setSingleShot(false);
+			m_pollTimer->setTimerType(Qt::PreciseTimer);
+			m_pollTimer->setInterval(15);
+			connect(
+				m_pollTimer, &QTimer::timeout, this, &StrokeWorkerEngine::poll);
+		}
+
+		if(enable) {
+			m_pollTimer->start();
+		} else {
+			m_pollTimer->stop();
+		}
+	}
+
+	void poll()
+	{
+		DP_PERF_SCOPE("poll");
+		m_brushEngine.poll(QDateTime::currentMSecsSinceEpoch(), m_canvasState);
+		flushMessages();
+	}
+
+	void flushMessages()
+	{
+		m_brushEngine.flushDabs();
+		const net::MessageList &msgs = m_brushEngine.messages();
+		if(!msgs.isEmpty()) {
+			m_worker->pushMessages(msgs);
+			m_brushEngine.clearMessages();
+		}
+	}
+
+	StrokeWorker *m_worker;
+	QTimer *m_pollTimer;
+	drawdance::BrushEngine m_brushEngine;
+	drawdance::CanvasState m_canvasState;
+};
+
+StrokeWorker::StrokeWorker(net::Client *client, QObject *parent)
+	: QObject(parent)
+	, m_client{client}
+	, m_thread{new QThread{this}}
+	, m_engine{new StrokeWorkerEngine{this}}
+{
+	m_thread->setObjectName(QStringLiteral("StrokeWorker"));
+	m_engine->moveToThread(m_thread);
+	connect(
+		m_thread, &QThread::finished, m_engine, &StrokeWorkerEngine::deleteLater);
+	m_thread->start(QThread::HighPriority);
+}
+
+StrokeWorker::~StrokeWorker()
+{
+	m_thread->quit();
+	m_thread->wait();
+}
+
+void StrokeWorker::beginStroke(
+	const brushes::ActiveBrush &brush, const DP_StrokeParams &stroke,
+	unsigned int contextId, float zoom)
+{
+	Command command;
+	command.type = Command::Begin;
+	command.begin.reset(new BeginParams{brush, stroke, contextId, zoom});
+	pushCommand(std::move(command));
+}
+
+void StrokeWorker::strokeTo(
+	const canvas::Point &point, const drawdance::CanvasState &cs)
+{
+	Command command;
+	command.type = Command::StrokeTo;
+	command.point = point;
+	command.canvasState = cs;
+	pushCommand(std::move(command));
+}
+
+void StrokeWorker::endStroke(
+	long long timeMsec, const drawdance::CanvasState &cs)
+{
+	Command command;
+	command.type = Command::End;
+	command.timeMsec = timeMsec;
+	command.canvasState = cs;
+	pushCommand(std::move(command));
+	finishPending();
+}
+
+void StrokeWorker::addOffset(float x, float y)
+{
+	Command command;
+	command.type = Command::Offset;
+	command.offsetX = x;
+	command.offsetY = y;
+	pushCommand(std::move(command));
+}
+
+void StrokeWorker::finishPending()
+{
+	// Whatever gets sent after the stroke, like an undo, must not overtake it.
+	// So wait for the worker to chew through the remaining commands and send
+	// the result right away instead of waiting for the queued send. The worker
+	// never blocks on this thread, so this can't deadlock.
+	StrokeWorkerEngine *engine = m_engine;
+	QMetaObject::invokeMethod(
+		engine,
+		[engine]() {
+			engine->processCommands();
+		},
+		Qt::BlockingQueuedConnection);
+	sendMessages();
+}
+
+void StrokeWorker::sendMessages()
+{
+	net::MessageList msgs;
+	{
+		QMutexLocker locker{&m_messagesMutex};
+		msgs.swap(m_messages);
+	}
+	if(!msgs.isEmpty()) {
+		m_client->sendMessages(msgs.count(), msgs.constData());
+	}
+}
+
+void StrokeWorker::pushCommand(Command &&command)
+{
+	bool wasEmpty;
+	{
+		QMutexLocker locker{&m_commandsMutex};
+		wasEmpty = m_commands.isEmpty();
+		m_commands.append(std::move(command));
+	}
+	// Only wake up the worker if it doesn't already have stuff to chew on,
+	// it'll pick up the rest of the queue in one go.
+	if(wasEmpty) {
+		StrokeWorkerEngine *engine = m_engine;
+		QMetaObject::invokeMethod(
+			engine,
+			[engine]() {
+				engine->processCommands();
+			},
+			Qt::QueuedConnection);
+	}
+}
+
+QVector<StrokeWorker::Command> StrokeWorker::takeCommands()
+{
+	QVector<Command> commands;
+	QMutexLocker locker{&m_commandsMutex};
+	commands.swap(m_commands);
+	return commands;
+}
+
+void StrokeWorker::pushMessages(const net::MessageList &msgs)
+{
+	bool wasEmpty;
+	{
+		QMutexLocker locker{&m_messagesMutex};
+		wasEmpty = m_messages.isEmpty();
+		m_messages.append(msgs);
+	}
+	if(wasEmpty) {
+		QMetaObject::invokeMethod(
+			this,
+			[this]() {
+				sendMessages();
+			},
+			Qt::QueuedConnection);
+	}
+}
+
+}
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TOOLS_STROKEWORKER_H
+#define TOOLS_STROKEWORKER_H
+extern "C" {
+#include <dpengine/brush_engine.h>
+}
+#include "libclient/brushes/brush.h"
+#include "libclient/canvas/point.h"
+#include "libclient/drawdance/canvasstate.h"
+#include "libclient/net/message.h"
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QVector>
+
+class QThread;
+
+namespace net {
+class Client;
+}
+
+namespace tools {
+
+class StrokeWorkerEngine;
+
+/**
+ * @brief Runs the brush engine for freehand strokes on a separate thread
+ *
+ * Stroke points are queued up with their timestamps and handed to a brush
+ * engine running on its own thread, which does the stabilization, smoothing
+ * and dab generation. The resulting messages get sent to the client back on
+ * the GUI thread. This way a busy GUI thread doesn't hold up the stroke.
+ *
+ * All public methods must be called from the GUI thread.
+ */
+class StrokeWorker final : public QObject {
+	Q_OBJECT
+public:
+	explicit StrokeWorker(net::Client *client, QObject *parent = nullptr);
+	~StrokeWorker() override;
+
+	void beginStroke(
+		const brushes::ActiveBrush &brush, const DP_StrokeParams &stroke,
+		unsigned int contextId, float zoom);
+
+	void
+	strokeTo(const canvas::Point &point, const drawdance::CanvasState &cs);
+
+	//! Blocks until the worker is done and the whole stroke has been sent.
+	void endStroke(long long timeMsec, const drawdance::CanvasState &cs);
+
+	void addOffset(float x, float y);
+
+private:
+	friend class StrokeWorkerEngine;
+
+	struct BeginParams {
+		brushes::ActiveBrush brush;
+		DP_StrokeParams stroke;
+		unsigned int contextId;
+		float zoom;
+	};
+
+	struct Command {
+		enum Type { Begin, StrokeTo, End, Offset };
+		Type type = Begin;
+		QSharedPointer<BeginParams> begin;
+		canvas::Point point;
+		drawdance::CanvasState canvasState;
+		long long timeMsec = 0LL;
+		float offsetX = 0.0f;
+		float offsetY = 0.0f;
+	};
+
+	void finishPending();
+	void sendMessages();
+	void pushCommand(Command &&command);
+	QVector<Command> takeCommands();
+	void pushMessages(const net::MessageList &msgs);
+
+	net::Client *m_client;
+	QThread *m_thread;
+	StrokeWorkerEngine *m_engine;
+	QMutex m_commandsMutex;
+	QVector<Command> m_commands;
+	QMutex m_messagesMutex;
+	net::MessageList m_messages;
+};
+
+}
+
+#endif
@@ -29,6 +29,7 @@ ToolController::ToolController(net::Client *client, QObject *parent)
 	, m_activeTool(nullptr)
 	, m_globalSmoothing(0)
 	, m_interpolateInputs(false)
+	, m_threadedBrushEngine(false)
 	, m_stabilizationMode(brushes::Stabilizer)
 	, m_stabilizerSampleCount(0)
 	, m_smoothing(0)
@@ -172,6 +173,11 @@ void ToolController::setInterpolateInputs(bool interpolateInputs)
 	m_interpolateInputs = interpolateInputs;
 }
 
+void ToolController::setThreadedBrushEngine(bool threadedBrushEngine)
+{
+	m_threadedBrushEngine = threadedBrushEngine;
+}
+
 void ToolController::setStabilizationMode(brushes::StabilizationMode stabilizationMode)
 {
 	m_stabilizationMode = stabilizationMode;
@@ -420,6 +426,11 @@ void ToolController::offsetActiveTool(int xOffset, int yOffset)
 
 void ToolController::setBrushEngineBrush(
 	drawdance::BrushEngine &be, bool freehand)
+{
+	activeBrush().setInBrushEngine(be, brushEngineStrokeParams(freehand));
+}
+
+DP_StrokeParams ToolController::brushEngineStrokeParams(bool freehand) const
 {
 	const brushes::ActiveBrush &brush = activeBrush();
 	DP_StrokeParams stroke = {
@@ -441,7 +452,7 @@ void ToolController::setBrushEngineBrush(
 			stroke.stabilizer_sample_count = m_stabilizerSampleCount;
 		}
 	}
-	brush.setInBrushEngine(be, stroke);
+	return stroke;
 }
 
 void ToolController::executeAsync(Task *task)
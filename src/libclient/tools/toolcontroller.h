@@ -65,6 +65,10 @@ public:
 
 	void setInterpolateInputs(bool interpolateInputs);
 
+	//! Generate freehand strokes on a separate thread instead of the GUI thread
+	void setThreadedBrushEngine(bool threadedBrushEngine);
+	bool threadedBrushEngine() const { return m_threadedBrushEngine; }
+
 	void setStabilizerUseBrushSampleCount(bool stabilizerUseBrushSampleCount);
 	bool stabilizerUseBrushSampleCount() { return m_stabilizerUseBrushSampleCount; }
 
@@ -113,6 +117,9 @@ public:
 	 */
 	void setBrushEngineBrush(drawdance::BrushEngine &be, bool freehand);
 
+	//! Get the stroke parameters that setBrushEngineBrush would use
+	DP_StrokeParams brushEngineStrokeParams(bool freehand) const;
+
 	/**
 	 * Runs the given task in the background. Takes over the task using
 	 * setParent(), calls run() on it to execute it on a background thread and
@@ -195,6 +202,7 @@ private:
 
 	int m_globalSmoothing;
 	bool m_interpolateInputs;
+	bool m_threadedBrushEngine;
 	brushes::StabilizationMode m_stabilizationMode;
 	int m_stabilizerSampleCount;
 	int m_smoothing;
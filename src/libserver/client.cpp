@@ -632,6 +632,11 @@ void Client::setKeepAliveTimeout(int timeout)
 	d->msgqueue->setKeepAliveTimeout(timeout);
 }
 
+void Client::setCompressionEnabled(bool compressionEnabled)
+{
+	d->msgqueue->setCompressionEnabled(compressionEnabled);
+}
+
 qint64 Client::lastActive() const
 {
 	return d->lastActive;
@@ -642,6 +647,21 @@ qint64 Client::lastActiveDrawing() const
 	return d->lastActiveDrawing;
 }
 
+int Client::uploadQueueBytes() const
+{
+	return d->msgqueue->uploadQueueBytes();
+}
+
+TrafficMetrics Client::trafficMetrics() const
+{
+	TrafficMetrics metrics;
+	metrics.messagesReceived = d->msgqueue->totalMessagesReceived();
+	metrics.messagesSent = d->msgqueue->totalMessagesSent();
+	metrics.bytesReceived = d->msgqueue->totalBytesReceived();
+	metrics.bytesSent = d->msgqueue->totalBytesSent();
+	return metrics;
+}
+
 QHostAddress Client::peerAddress() const
 {
 	return d->socket->peerAddress();
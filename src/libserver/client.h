@@ -2,6 +2,7 @@
 #ifndef DP_SERVER_CLIENT_H
 #define DP_SERVER_CLIENT_H
 #include "libserver/jsonapi.h"
+#include "libserver/metrics.h"
 #include "libshared/net/message.h"
 #include <QAbstractSocket>
 #include <QObject>
@@ -163,6 +164,7 @@ public:
 	 */
 	void setConnectionTimeout(int timeout);
 	void setKeepAliveTimeout(int timeout);
+	void setCompressionEnabled(bool compressionEnabled);
 
 	/**
 	 * Get the timestamp of this client's last activity (i.e. non-keepalive
@@ -177,6 +179,12 @@ public:
 	 */
 	qint64 lastActiveDrawing() const;
 
+	//! Get the number of bytes waiting to be sent to this client
+	int uploadQueueBytes() const;
+
+	//! Get the totals of what was sent to and received from this client
+	TrafficMetrics trafficMetrics() const;
+
 	enum class DisconnectionReason {
 		Kick,	  // kicked by an operator
 		Error,	  // kicked due to some server or protocol error
@@ -4,6 +4,7 @@ extern "C" {
 #include <dpcommon/input_qt.h>
 #include <dpcommon/output.h>
 #include <dpcommon/output_qt.h>
+#include <dpmsg/binary_blocks.h>
 #include <dpmsg/binary_reader.h>
 #include <dpmsg/binary_writer.h>
 }
@@ -12,8 +13,10 @@ extern "C" {
 #include "libshared/util/passwordhash.h"
 #include <QDebug>
 #include <QFile>
+#include <QRunnable>
 #include <QScopedPointer>
 #include <QSet>
+#include <QThreadPool>
 #include <QTimerEvent>
 #include <QVarLengthArray>
 
@@ -22,6 +25,64 @@ namespace server {
 // A block is closed when its size goes above this limit
 static const qint64 MAX_BLOCK_SIZE = 0xffff * 10;
 
+// Archived recordings are only ever read back for playback, so they get packed
+// into a block container, which is smaller and can still be seeked around in.
+// Recompressing a whole recording takes a while, so this runs on the thread
+// pool rather than holding up the server while the session gets torn down.
+// It only deals in file paths, the history may be long gone by the time it's
+// done. If packing fails, the recording is archived as-is.
+namespace {
+
+class RecordingArchiveJob final : public QRunnable {
+public:
+	explicit RecordingArchiveJob(const QString &recordingPath)
+		: m_recordingPath(recordingPath)
+	{
+	}
+
+	void run() override
+	{
+		const QString archivedPath = m_recordingPath + ".archived";
+		if(!pack(archivedPath)) {
+			QFile::rename(m_recordingPath, archivedPath);
+		}
+	}
+
+private:
+	bool pack(const QString &path)
+	{
+		QFile recording(m_recordingPath);
+		if(!recording.open(QFile::ReadOnly)) {
+			qWarning() << m_recordingPath << recording.errorString();
+			return false;
+		}
+
+		DP_Output *output = DP_file_output_new_from_path(qUtf8Printable(path));
+		output = output ? DP_binary_block_output_new(output) : nullptr;
+		bool ok = output != nullptr;
+		QByteArray buffer(1024 * 1024, Qt::Uninitialized);
+		while(ok && !recording.atEnd()) {
+			qint64 read = recording.read(buffer.data(), buffer.size());
+			ok = read >= 0 &&
+				 DP_output_write(output, buffer.constData(), size_t(read));
+		}
+		ok = DP_output_free(output) && ok;
+		recording.close();
+
+		if(ok) {
+			recording.remove();
+		} else {
+			qWarning() << path << "packing failed:" << DP_error();
+			QFile::remove(path);
+		}
+		return ok;
+	}
+
+	QString m_recordingPath;
+};
+
+}
+
 FiledHistory::FiledHistory(
 	const QDir &dir, QFile *journal, const QString &id, const QString &alias,
 	const protocol::ProtocolVersion &version, const QString &founder,
@@ -187,6 +248,55 @@ bool FiledHistory::initRecording()
 	return true;
 }
 
+// New messages get appended to the recording, which isn't possible with a
+// block container. So if a session was restored from a packed recording, it
+// gets unpacked into a fresh one that the session continues with.
+bool FiledHistory::unpackRecording()
+{
+	DP_Input *input = DP_binary_block_input_new(
+		DP_qfile_input_new(m_recording, false, DP_input_new));
+	if(!input) {
+		qWarning() << m_recording->fileName() << DP_error();
+		return false;
+	}
+
+	const QString filename =
+		uniqueRecordingFilename(m_dir, id(), ++m_fileCount);
+	QFile *recording = new QFile(m_dir.absoluteFilePath(filename), this);
+	bool ok = recording->open(QFile::ReadWrite);
+	QByteArray buffer(1024 * 1024, Qt::Uninitialized);
+	while(ok) {
+		bool error = false;
+		size_t read = DP_input_read(
+			input, buffer.data(), size_t(buffer.size()), &error);
+		if(error) {
+			qWarning() << m_recording->fileName() << DP_error();
+			ok = false;
+		} else if(read == 0) {
+			break;
+		} else {
+			ok = recording->write(buffer.constData(), qint64(read)) ==
+				 qint64(read);
+		}
+	}
+	DP_input_free(input);
+
+	if(!ok || !recording->seek(0)) {
+		qWarning() << filename << recording->errorString();
+		recording->remove();
+		delete recording;
+		return false;
+	}
+
+	m_journal->write(QString("FILE %1\n").arg(filename).toUtf8());
+	m_journal->flush();
+
+	m_recording->remove();
+	delete m_recording;
+	m_recording = recording;
+	return true;
+}
+
 bool FiledHistory::load()
 {
 	QByteArray line;
@@ -376,6 +486,13 @@ bool FiledHistory::load()
 		return false;
 	}
 
+	QByteArray magic = m_recording->peek(DP_DPRECB_MAGIC_LENGTH);
+	if(DP_binary_block_magic_matches(magic.constData(), size_t(magic.size())) &&
+	   !unpackRecording()) {
+		qWarning() << recordingFile << "could not be unpacked";
+		return false;
+	}
+
 	m_reader = DP_binary_reader_new(
 		DP_qfile_input_new(m_recording, false, DP_input_new),
 		DP_BINARY_READER_FLAG_NO_LENGTH);
@@ -495,7 +612,8 @@ void FiledHistory::terminate()
 
 	if(m_archive) {
 		m_journal->rename(m_journal->fileName() + ".archived");
-		m_recording->rename(m_recording->fileName() + ".archived");
+		QThreadPool::globalInstance()->start(
+			new RecordingArchiveJob(m_recording->fileName()));
 	} else {
 		m_recording->remove();
 		m_journal->remove();
@@ -718,6 +836,17 @@ void FiledHistory::cleanupBatches(int before)
 	}
 }
 
+int FiledHistory::residentBlockCount() const
+{
+	int count = 0;
+	for(const Block &b : m_blocks) {
+		if(!b.messages.isEmpty()) {
+			++count;
+		}
+	}
+	return count;
+}
+
 void FiledHistory::historyAddBan(
 	int id, const QString &username, const QHostAddress &ip,
 	const QString &extAuthId, const QString &sid, const QString &bannedBy)
@@ -81,6 +81,7 @@ public:
 
 	void terminate() override;
 	void cleanupBatches(int before) override;
+	int residentBlockCount() const override;
 	std::tuple<net::MessageList, int> getBatch(int after) const override;
 
 	void addAnnouncement(const QString &) override;
@@ -127,6 +128,7 @@ private:
 	bool load();
 	bool scanBlocks();
 	bool initRecording();
+	bool unpackRecording();
 
 	QDir m_dir;
 	QFile *m_journal;
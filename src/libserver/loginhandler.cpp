@@ -76,6 +76,9 @@ void LoginHandler::startLoginProcess()
 	if(m_config->getConfigBool(config::AllowCustomAvatars)) {
 		flags << "AVATAR";
 	}
+	if(m_config->getConfigBool(config::EnableCompression)) {
+		flags << "DEFLATE";
+	}
 #ifdef HAVE_LIBSODIUM
 	if(!m_config->internalConfig().cryptKey.isEmpty()) {
 		flags << "CBANIMPEX";
@@ -1034,6 +1037,12 @@ void LoginHandler::checkClientCapabilities(const net::ServerCommand &cmd)
 	if(capabilities.contains(QStringLiteral("KEEPALIVE"))) {
 		m_client->setKeepAliveTimeout(30 * 1000);
 	}
+	// Only start compressing after the login is done, to not mix passwords
+	// into the compression state. The client will do the same.
+	if(capabilities.contains(QStringLiteral("DEFLATE")) &&
+	   m_config->getConfigBool(config::EnableCompression)) {
+		m_client->setCompressionEnabled(true);
+	}
 }
 
 QJsonObject LoginHandler::extractClientInfo(const net::ServerCommand &cmd)
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libserver/metrics.h"
+#include <QString>
+
+namespace server {
+
+const qint64 DurationHistogram::BUCKET_BOUNDS_MS[BUCKET_COUNT] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 120000, 300000,
+};
+
+void DurationHistogram::observe(qint64 msecs)
+{
+	for(int i = 0; i < BUCKET_COUNT; ++i) {
+		if(msecs <= BUCKET_BOUNDS_MS[i]) {
+			++m_counts[i];
+			break;
+		}
+	}
+	++m_count;
+	m_sumMs += msecs;
+}
+
+qint64 DurationHistogram::cumulativeCount(int bucket) const
+{
+	qint64 total = 0;
+	for(int i = 0; i <= bucket && i < BUCKET_COUNT; ++i) {
+		total += m_counts[i];
+	}
+	return total;
+}
+
+void MetricsWriter::family(const char *name, Type type, const char *help)
+{
+	const char *typeName = "untyped";
+	switch(type) {
+	case Type::Counter:
+		typeName = "counter";
+		break;
+	case Type::Gauge:
+		typeName = "gauge";
+		break;
+	case Type::Histogram:
+		typeName = "histogram";
+		break;
+	}
+	m_text.append("# HELP ").append(name).append(' ').append(help);
+	m_text.append("\n# TYPE ").append(name).append(' ').append(typeName);
+	m_text.append('\n');
+}
+
+void MetricsWriter::sample(
+	const char *name, const Labels &labels, qint64 value)
+{
+	appendName(name, labels);
+	m_text.append(' ').append(QByteArray::number(value)).append('\n');
+}
+
+void MetricsWriter::sample(
+	const char *name, const Labels &labels, double value)
+{
+	appendName(name, labels);
+	m_text.append(' ').append(QByteArray::number(value, 'g', 10));
+	m_text.append('\n');
+}
+
+void MetricsWriter::histogram(
+	const char *name, const Labels &labels, const DurationHistogram &histogram)
+{
+	QByteArray bucketName = QByteArray(name) + "_bucket";
+	Labels bucketLabels = labels;
+	bucketLabels.append({QByteArrayLiteral("le"), QString()});
+	for(int i = 0; i < DurationHistogram::BUCKET_COUNT; ++i) {
+		bucketLabels.last().second = QString::number(
+			DurationHistogram::BUCKET_BOUNDS_MS[i] / 1000.0, 'g', 10);
+		sample(
+			bucketName.constData(), bucketLabels,
+			histogram.cumulativeCount(i));
+	}
+	bucketLabels.last().second = QStringLiteral("+Inf");
+	sample(bucketName.constData(), bucketLabels, histogram.count());
+
+	sample(
+		(QByteArray(name) + "_sum").constData(), labels,
+		histogram.sumMs() / 1000.0);
+	sample(
+		(QByteArray(name) + "_count").constData(), labels, histogram.count());
+}
+
+void MetricsWriter::appendName(const char *name, const Labels &labels)
+{
+	m_text.append(name);
+	if(!labels.isEmpty()) {
+		m_text.append('{');
+		bool first = true;
+		for(const QPair<QByteArray, QString> &label : labels) {
+			if(first) {
+				first = false;
+			} else {
+				m_text.append(',');
+			}
+			m_text.append(label.first).append("=\"");
+			m_text.append(escapeLabelValue(label.second)).append('"');
+		}
+		m_text.append('}');
+	}
+}
+
+QByteArray MetricsWriter::escapeLabelValue(const QString &value)
+{
+	QByteArray utf8 = value.toUtf8();
+	QByteArray escaped;
+	escaped.reserve(utf8.size());
+	for(char c : utf8) {
+		switch(c) {
+		case '\\':
+			escaped.append("\\\\");
+			break;
+		case '"':
+			escaped.append("\\\"");
+			break;
+		case '\n':
+			escaped.append("\\n");
+			break;
+		default:
+			escaped.append(c);
+			break;
+		}
+	}
+	return escaped;
+}
+
+}
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSERVER_METRICS_H
+#define LIBSERVER_METRICS_H
+#include <QByteArray>
+#include <QPair>
+#include <QVector>
+
+namespace server {
+
+//! Totals of messages and bytes that went over one or more connections.
+struct TrafficMetrics {
+	qint64 messagesReceived = 0;
+	qint64 messagesSent = 0;
+	qint64 bytesReceived = 0;
+	qint64 bytesSent = 0;
+
+	TrafficMetrics &operator+=(const TrafficMetrics &other)
+	{
+		messagesReceived += other.messagesReceived;
+		messagesSent += other.messagesSent;
+		bytesReceived += other.bytesReceived;
+		bytesSent += other.bytesSent;
+		return *this;
+	}
+};
+
+/**
+ * @brief A histogram of durations with fixed bucket bounds
+ *
+ * The buckets are tuned for things that take between a fraction of a second
+ * and several minutes, like catching up to a session.
+ */
+class DurationHistogram {
+public:
+	static constexpr int BUCKET_COUNT = 11;
+	static const qint64 BUCKET_BOUNDS_MS[BUCKET_COUNT];
+
+	void observe(qint64 msecs);
+
+	//! Number of observations that fall into the given bucket (or below it.)
+	qint64 cumulativeCount(int bucket) const;
+	qint64 count() const { return m_count; }
+	qint64 sumMs() const { return m_sumMs; }
+
+private:
+	qint64 m_counts[BUCKET_COUNT] = {};
+	qint64 m_count = 0;
+	qint64 m_sumMs = 0;
+};
+
+/**
+ * @brief Writer for metrics in the Prometheus text exposition format
+ *
+ * All samples of a metric must be grouped together, so call family() once
+ * and then write all samples for it before moving on to the next one.
+ */
+class MetricsWriter {
+public:
+	using Labels = QVector<QPair<QByteArray, QString>>;
+
+	enum class Type { Counter, Gauge, Histogram };
+
+	void family(const char *name, Type type, const char *help);
+
+	void sample(const char *name, const Labels &labels, qint64 value);
+	void sample(const char *name, const Labels &labels, double value);
+
+	void histogram(
+		const char *name, const Labels &labels,
+		const DurationHistogram &histogram);
+
+	const QByteArray &text() const { return m_text; }
+
+private:
+	void appendName(const char *name, const Labels &labels);
+	static QByteArray escapeLabelValue(const QString &value);
+
+	QByteArray m_text;
+};
+
+}
+
+#endif
@@ -39,6 +39,8 @@ QString Log::toString(bool abridged) const
 QJsonObject Log::toJson(JsonOptions options) const
 {
 	QJsonObject o;
+	if(options.testFlag(WithId) && m_id > 0)
+		o["id"] = m_id;
 	o["timestamp"] = m_timestamp.toString(Qt::ISODate);
 	o["level"] = QMetaEnum::fromType<Log::Level>().valueToKey(int(m_level));
 	o["topic"] = QMetaEnum::fromType<Log::Topic>().valueToKey(int(m_topic));
@@ -82,12 +84,13 @@ void InMemoryLog::setHistoryLimit(int limit)
 
 void InMemoryLog::storeMessage(const Log &entry)
 {
-	m_history.prepend(entry);
+	Log e = entry;
+	m_history.prepend(e.id(++m_lastId));
 	if(m_limit>0 && m_history.size() >= m_limit)
 		m_history.pop_back();
 }
 
-QList<Log> InMemoryLog::getLogEntries(const QString &session, const QDateTime &after, Log::Level atleast, bool omitSensitive, int offset, int limit) const
+QList<Log> InMemoryLog::getLogEntries(const QString &session, const QDateTime &after, qint64 before, Log::Level atleast, bool omitSensitive, int offset, int limit) const
 {
 	QList<Log> filtered;
 
@@ -95,6 +98,10 @@ QList<Log> InMemoryLog::getLogEntries(const QString &session, const QDateTime &a
 		if(after.isValid() && after.msecsTo(l.timestamp()) < 1000)
 			break;
 
+		// History is newest first, so ids are descending.
+		if(before > 0 && l.id() >= before)
+			continue;
+
 		if(!session.isEmpty() && session != l.session())
 			continue;
 
@@ -50,11 +50,14 @@ public:
 	};
 	Q_ENUM(Topic)
 
-	Log() : m_timestamp(QDateTime::currentDateTimeUtc()), m_level(Level::Warn), m_topic(Topic::Status) { }
+	Log() : m_id(0), m_timestamp(QDateTime::currentDateTimeUtc()), m_level(Level::Warn), m_topic(Topic::Status) { }
 	Log(const QDateTime &ts, const QString &sessionId, const QString &user, Level level, Topic topic, const QString message)
-		: m_timestamp(ts), m_session(sessionId), m_user(user), m_level(level), m_topic(topic), m_message(message)
+		: m_id(0), m_timestamp(ts), m_session(sessionId), m_user(user), m_level(level), m_topic(topic), m_message(message)
 		{ }
 
+	//! Get the entry's id in the log it's stored in (0 if not stored yet)
+	qint64 id() const { return m_id; }
+
 	//! Get the entry timestamp
 	QDateTime timestamp() const { return m_timestamp; }
 
@@ -79,6 +82,7 @@ public:
 	Log &user(uint8_t id, const QHostAddress &ip, const QString &name) { m_user = QStringLiteral("%1;%2;%3").arg(int(id)).arg(ip.toString()).arg(name); return *this; }
 	Log &session(const QString &id) { m_session=id; return *this; }
 	Log &message(const QString &msg) { m_message=msg; return *this; }
+	Log &id(qint64 id) { m_id=id; return *this; }
 
 	inline void to(ServerLog *logger);
 
@@ -91,7 +95,8 @@ public:
 	enum JsonOption {
 		NoOptions = 0,
 		NoPrivateData = 0x01,
-		NoSession = 0x02
+		NoSession = 0x02,
+		WithId = 0x04
 	};
 	Q_DECLARE_FLAGS(JsonOptions, JsonOption)
 
@@ -106,6 +111,7 @@ public:
 	QJsonObject toJson(JsonOptions options=NoOptions) const;
 
 private:
+	qint64 m_id;
 	QDateTime m_timestamp;
 	QString m_session;
 	QString m_user;
@@ -123,15 +129,17 @@ class ServerLog;
  */
 class ServerLogQuery {
 public:
-	ServerLogQuery(const ServerLog &log) : m_log(log), m_offset(0), m_limit(0), m_atleast(Log::Level::Debug), m_omitSensitive(true) { }
+	ServerLogQuery(const ServerLog &log) : m_log(log), m_offset(0), m_limit(0), m_atleast(Log::Level::Debug), m_before(0), m_omitSensitive(true) { }
 
 	ServerLogQuery &session(const QString &id) { m_session = id; return *this; }
 	ServerLogQuery &page(int page, int entriesPerPage) { m_offset = page*entriesPerPage; m_limit=entriesPerPage; return *this; }
 	ServerLogQuery &after(const QDateTime &ts) { m_after = ts; return *this; }
+	//! Only get entries older than the one with the given id, for paging by cursor
+	ServerLogQuery &before(qint64 id) { m_before = id; return *this; }
 	ServerLogQuery &atleast(Log::Level level) { m_atleast = level; return *this; }
 	ServerLogQuery &omitSensitive(bool omitSensitive) { m_omitSensitive = omitSensitive; return *this; }
 
-	bool isFiltered() const { return !m_session.isNull() || m_offset>0 || m_limit>0; }
+	bool isFiltered() const { return !m_session.isNull() || m_offset>0 || m_limit>0 || m_before>0; }
 	QList<Log> get() const;
 
 private:
@@ -141,6 +149,7 @@ private:
 	int m_limit;
 	Log::Level m_atleast;
 	QDateTime m_after;
+	qint64 m_before;
 	bool m_omitSensitive;
 };
 
@@ -168,12 +177,13 @@ public:
 	 *
 	 * @param session get only log entries for this session
 	 * @param after get messages whose timestamp is greater than this
+	 * @param before get messages older than the one with this id (if > 0)
 	 * @param atleast minimum log level
 	 * @param offset ignore first *offset* messages
 	 * @param limit return at most this many messages
 	 * @param omitSensitive leave out messages with sensitive data, like IPs
 	 */
-	virtual QList<Log> getLogEntries(const QString &session, const QDateTime &after, Log::Level atleast, bool omitSensitive, int offset, int limit) const = 0;
+	virtual QList<Log> getLogEntries(const QString &session, const QDateTime &after, qint64 before, Log::Level atleast, bool omitSensitive, int offset, int limit) const = 0;
 
 	/**
 	 * @brief Return a query builder
@@ -189,7 +199,7 @@ private:
 };
 
 inline QList<Log> ServerLogQuery::get() const {
-	return m_log.getLogEntries(m_session, m_after, m_atleast, m_omitSensitive, m_offset, m_limit);
+	return m_log.getLogEntries(m_session, m_after, m_before, m_atleast, m_omitSensitive, m_offset, m_limit);
 }
 
 void Log::to(ServerLog *logger)
@@ -206,10 +216,10 @@ void Log::to(ServerLog *logger)
 class InMemoryLog : public ServerLog
 {
 public:
-	InMemoryLog() : m_limit(1000) { }
+	InMemoryLog() : m_limit(1000), m_lastId(0) { }
 	void setHistoryLimit(int limit);
 
-	QList<Log> getLogEntries(const QString &session, const QDateTime &after, Log::Level atleast, bool omitSensitive, int offset, int limit) const override;
+	QList<Log> getLogEntries(const QString &session, const QDateTime &after, qint64 before, Log::Level atleast, bool omitSensitive, int offset, int limit) const override;
 
 protected:
 	void storeMessage(const Log &entry) override;
@@ -217,6 +227,7 @@ protected:
 private:
 	QList<Log> m_history;
 	int m_limit;
+	qint64 m_lastId;
 };
 
 }
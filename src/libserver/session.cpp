@@ -268,6 +268,7 @@ void Session::removeUser(Client *user)
 	m_pastClients.insert(
 		user->id(), {user->id(), user->authId(), user->username(),
 					 user->peerAddress(), user->sid(), !user->isModerator()});
+	m_pastClientTraffic += user->trafficMetrics();
 
 	Q_ASSERT(user->session() == this);
 	bool isGhost = user->isGhost();
@@ -398,6 +399,15 @@ int Session::activeDrawingUserCount(qint64 ms) const
 	return count;
 }
 
+TrafficMetrics Session::trafficMetrics() const
+{
+	TrafficMetrics metrics = m_pastClientTraffic;
+	for(const Client *c : m_clients) {
+		metrics += c->trafficMetrics();
+	}
+	return metrics;
+}
+
 bool Session::isClosed() const
 {
 	return m_closed || userCount() >= m_history->maxUsers() ||
@@ -3,6 +3,7 @@
 #define LIBSHARED_SERVER_SESSION_H
 #include "libserver/announcable.h"
 #include "libserver/jsonapi.h"
+#include "libserver/metrics.h"
 #include "libserver/sessionhistory.h"
 #include "libshared/net/message.h"
 #include "libshared/net/protover.h"
@@ -177,6 +178,23 @@ public:
 	//! Get the of clients currently in this session
 	const QVector<Client *> &clients() const { return m_clients; }
 
+	/**
+	 * @brief Get the traffic totals of this session
+	 *
+	 * This includes clients that have since left the session, so that the
+	 * numbers only ever go up.
+	 */
+	TrafficMetrics trafficMetrics() const;
+
+	//! Get the distribution of how long it took clients to catch up
+	const DurationHistogram &catchupDurations() const
+	{
+		return m_catchupDurations;
+	}
+
+	//! A client just finished receiving the history on join
+	void addCatchupDuration(qint64 msecs) { m_catchupDurations.observe(msecs); }
+
 	/**
 	 * @brief Get the ID of the user uploading initialization or reset data
 	 * @return user ID or -1 if init not in progress
@@ -470,6 +488,8 @@ private:
 
 	QVector<Client *> m_clients;
 	QHash<int, PastClient> m_pastClients;
+	TrafficMetrics m_pastClientTraffic;
+	DurationHistogram m_catchupDurations;
 
 	net::MessageList m_resetstream;
 	uint m_resetstreamsize = 0;
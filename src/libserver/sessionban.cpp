@@ -2,11 +2,14 @@
 #include "libserver/sessionban.h"
 #include <QJsonArray>
 #include <QJsonObject>
+#include <algorithm>
+#include <limits>
 
 namespace server {
 
 SessionBanList::SessionBanList()
 	: m_idautoinc(0)
+	, m_banseq(0)
 {
 }
 
@@ -61,6 +64,7 @@ int SessionBanList::addBan(
 	}
 
 	m_banlist.append(ban);
+	indexBan(ban);
 	return ban.id;
 }
 
@@ -71,6 +75,7 @@ QString SessionBanList::removeBan(int id)
 		SessionBan entry = i.next();
 		if(entry.id == id) {
 			i.remove();
+			unindexBan(entry);
 			return entry.username;
 		}
 	}
@@ -86,18 +91,22 @@ int SessionBanList::isBanned(
 	bool haveSid = !sid.isEmpty();
 	bool haveAddress = !address.isNull();
 	if(haveUsername || haveAuthId || haveSid || haveAddress) {
-		QHostAddress ip = haveAddress ? toIpv6(address) : QHostAddress();
-		for(const SessionBan &b : m_banlist) {
-			bool isBanned =
-				(haveUsername && !b.username.isEmpty() &&
-				 username.compare(b.username, Qt::CaseInsensitive) == 0) ||
-				(haveAuthId && !b.authId.isEmpty() && authId == b.authId) ||
-				(haveSid && !b.sid.isEmpty() && sid == b.sid) ||
-				(haveAddress && !b.ip.isNull() && ip == b.ip);
-			if(isBanned) {
-				// Zero ids shouldn't happen, but guard against it anyway.
-				return b.id == 0 ? INT_MAX : b.id;
-			}
+		BanRef found = {std::numeric_limits<quint64>::max(), 0};
+		if(haveUsername) {
+			findInIndex(m_usernames, username.toCaseFolded(), found);
+		}
+		if(haveAuthId) {
+			findInIndex(m_authIds, authId, found);
+		}
+		if(haveSid) {
+			findInIndex(m_sids, sid, found);
+		}
+		if(haveAddress) {
+			findInIndex(m_ips, toIpv6(address), found);
+		}
+		if(found.seq != std::numeric_limits<quint64>::max()) {
+			// Zero ids shouldn't happen, but guard against it anyway.
+			return found.id == 0 ? INT_MAX : found.id;
 		}
 	} else {
 		qWarning("isBanned() called without a valid parameters");
@@ -215,6 +224,80 @@ bool SessionBanList::canAddBan(const SessionBan &ban)
 	return true;
 }
 
+void SessionBanList::indexBan(const SessionBan &ban)
+{
+	BanRef ref = {m_banseq++, ban.id};
+	if(!ban.username.isEmpty()) {
+		addToIndex(m_usernames, ban.username.toCaseFolded(), ref);
+	}
+	if(!ban.authId.isEmpty()) {
+		addToIndex(m_authIds, ban.authId, ref);
+	}
+	if(!ban.sid.isEmpty()) {
+		addToIndex(m_sids, ban.sid, ref);
+	}
+	if(!ban.ip.isNull()) {
+		addToIndex(m_ips, ban.ip, ref);
+	}
+}
+
+void SessionBanList::unindexBan(const SessionBan &ban)
+{
+	if(!ban.username.isEmpty()) {
+		removeFromIndex(m_usernames, ban.username.toCaseFolded(), ban.id);
+	}
+	if(!ban.authId.isEmpty()) {
+		removeFromIndex(m_authIds, ban.authId, ban.id);
+	}
+	if(!ban.sid.isEmpty()) {
+		removeFromIndex(m_sids, ban.sid, ban.id);
+	}
+	if(!ban.ip.isNull()) {
+		removeFromIndex(m_ips, ban.ip, ban.id);
+	}
+}
+
+template <typename Key>
+void SessionBanList::addToIndex(
+	BanIndex<Key> &index, const Key &key, BanRef ref)
+{
+	// Sequence numbers only go up, so each entry stays sorted by them.
+	index[key].append(ref);
+}
+
+template <typename Key>
+void SessionBanList::removeFromIndex(
+	BanIndex<Key> &index, const Key &key, int id)
+{
+	typename BanIndex<Key>::iterator it = index.find(key);
+	if(it != index.end()) {
+		QVector<BanRef> &refs = it.value();
+		refs.erase(
+			std::remove_if(
+				refs.begin(), refs.end(),
+				[id](const BanRef &ref) {
+					return ref.id == id;
+				}),
+			refs.end());
+		if(refs.isEmpty()) {
+			index.erase(it);
+		}
+	}
+}
+
+template <typename Key>
+void SessionBanList::findInIndex(
+	const BanIndex<Key> &index, const Key &key, BanRef &found)
+{
+	typename BanIndex<Key>::const_iterator it = index.constFind(key);
+	if(it != index.constEnd()) {
+		const BanRef &first = it.value().first();
+		if(first.seq < found.seq) {
+			found = first;
+		}
+	}
+}
+
 QHostAddress SessionBanList::toIpv6(const QHostAddress &address)
 {
 	return address.protocol() == QAbstractSocket::IPv4Protocol
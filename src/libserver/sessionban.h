@@ -1,9 +1,11 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #ifndef DP_SERVER_SESSIONBAN_H
 #define DP_SERVER_SESSIONBAN_H
+#include <QHash>
 #include <QHostAddress>
 #include <QList>
 #include <QString>
+#include <QVector>
 #include <functional>
 
 class QJsonArray;
@@ -92,12 +94,39 @@ public:
 		const QJsonObject &data, std::function<void(const SessionBan &)> fn);
 
 private:
+	// Bans indexed by each of their keys, so that lookups don't have to walk
+	// the whole list. The sequence number preserves the list order, so that
+	// the first matching ban wins when several of them match.
+	struct BanRef {
+		quint64 seq;
+		int id;
+	};
+	template <typename Key> using BanIndex = QHash<Key, QVector<BanRef>>;
+
 	bool canAddBan(const SessionBan &ban);
 
+	void indexBan(const SessionBan &ban);
+	void unindexBan(const SessionBan &ban);
+
+	template <typename Key>
+	static void addToIndex(BanIndex<Key> &index, const Key &key, BanRef ref);
+
+	template <typename Key>
+	static void removeFromIndex(BanIndex<Key> &index, const Key &key, int id);
+
+	template <typename Key>
+	static void
+	findInIndex(const BanIndex<Key> &index, const Key &key, BanRef &found);
+
 	static QHostAddress toIpv6(const QHostAddress &address);
 
 	QList<SessionBan> m_banlist;
 	int m_idautoinc;
+	quint64 m_banseq;
+	BanIndex<QString> m_usernames;
+	BanIndex<QString> m_authIds;
+	BanIndex<QString> m_sids;
+	BanIndex<QHostAddress> m_ips;
 };
 
 }
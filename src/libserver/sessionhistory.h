@@ -173,6 +173,14 @@ public:
 	 */
 	virtual void cleanupBatches(int before) = 0;
 
+	/**
+	 * @brief Get the number of history blocks currently cached in memory
+	 *
+	 * Only relevant to storage backends that cache parts of the history and
+	 * release them through cleanupBatches, others return zero.
+	 */
+	virtual int residentBlockCount() const { return 0; }
+
 	/**
 	 * @brief End this session and delete any associated files (if any)
 	 */
@@ -104,6 +104,9 @@ public:
 	 */
 	int sessionCount() const { return m_sessions.size(); }
 
+	//! Get the currently active sessions
+	const QList<Session *> &sessions() const { return m_sessions; }
+
 	/**
 	 * @brief Stop all running sessions
 	 */
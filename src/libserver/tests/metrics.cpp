@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "libserver/metrics.h"
+
+#include <QtTest/QtTest>
+
+using server::DurationHistogram;
+using server::MetricsWriter;
+
+class TestMetrics final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testHistogram()
+	{
+		DurationHistogram h;
+		h.observe(50);
+		h.observe(100);
+		h.observe(700);
+		h.observe(1000000);
+
+		QCOMPARE(h.count(), qint64(4));
+		QCOMPARE(h.sumMs(), qint64(1000850));
+		QCOMPARE(h.cumulativeCount(0), qint64(2));
+		QCOMPARE(h.cumulativeCount(1), qint64(2));
+		QCOMPARE(h.cumulativeCount(3), qint64(3));
+		QCOMPARE(
+			h.cumulativeCount(DurationHistogram::BUCKET_COUNT - 1), qint64(3));
+	}
+
+	void testWriter()
+	{
+		MetricsWriter w;
+		w.family("test_users", MetricsWriter::Type::Gauge, "Users");
+		w.sample("test_users", {}, qint64(3));
+		w.sample("test_users", {{"session", "a\"b\\c\nd"}}, qint64(1));
+
+		QCOMPARE(
+			w.text(),
+			QByteArray(
+				"# HELP test_users Users\n"
+				"# TYPE test_users gauge\n"
+				"test_users 3\n"
+				"test_users{session=\"a\\\"b\\\\c\\nd\"} 1\n"));
+	}
+
+	void testWriterHistogram()
+	{
+		DurationHistogram h;
+		h.observe(200);
+		h.observe(3000);
+
+		MetricsWriter w;
+		w.histogram("test_duration_seconds", {{"session", "x"}}, h);
+		const QList<QByteArray> lines = w.text().split('\n');
+
+		QCOMPARE(
+			lines[0],
+			QByteArray("test_duration_seconds_bucket{session=\"x\",le=\"0.1\"} 0"));
+		QCOMPARE(
+			lines[1],
+			QByteArray(
+				"test_duration_seconds_bucket{session=\"x\",le=\"0.25\"} 1"));
+		QCOMPARE(
+			lines[DurationHistogram::BUCKET_COUNT],
+			QByteArray(
+				"test_duration_seconds_bucket{session=\"x\",le=\"+Inf\"} 2"));
+		QCOMPARE(
+			lines[DurationHistogram::BUCKET_COUNT + 1],
+			QByteArray("test_duration_seconds_sum{session=\"x\"} 3.2"));
+		QCOMPARE(
+			lines[DurationHistogram::BUCKET_COUNT + 2],
+			QByteArray("test_duration_seconds_count{session=\"x\"} 2"));
+	}
+};
+
+
+QTEST_MAIN(TestMetrics)
+#include "metrics.moc"
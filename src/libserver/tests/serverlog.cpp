@@ -67,6 +67,10 @@ private slots:
 
 		QCOMPARE(srvlog.query().get().size(), 3);
 		QCOMPARE(srvlog.query().session(session).get().size(), 2);
+
+		const QList<Log> all = srvlog.query().get();
+		QCOMPARE(srvlog.query().before(all[0].id()).get().size(), 2);
+		QCOMPARE(srvlog.query().before(all[1].id()).get().first().message(), all[2].message());
 	}
 };
 
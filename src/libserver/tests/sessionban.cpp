@@ -232,6 +232,44 @@ private slots:
 				banner.username, QHostAddress("192.168.0.2"), "ext:2", "def1"),
 			2);
 	}
+
+	void testMatchOrder()
+	{
+		SessionBanList bans;
+		QCOMPARE(
+			bans.addBan("Alice", QHostAddress(), QString(), QString(), "op", 10),
+			10);
+		QCOMPARE(
+			bans.addBan(
+				"bob", QHostAddress("192.168.0.1"), QString(), QString(), "op",
+				5),
+			5);
+		QCOMPARE(
+			bans.addBan(
+				QString(), QHostAddress("192.168.0.1"), "ext:1", QString(),
+				"op", 7),
+			7);
+
+		// When several bans match, the one that was added first wins.
+		QCOMPARE(
+			bans.isBanned("ALICE", QHostAddress("192.168.0.1"), "ext:1", "s"),
+			10);
+		QCOMPARE(
+			bans.isBanned(
+				QString(), QHostAddress("::ffff:192.168.0.1"), "ext:1",
+				QString()),
+			5);
+
+		QCOMPARE(bans.removeBan(5), QString("bob"));
+		QCOMPARE(
+			bans.isBanned(QString(), QHostAddress("192.168.0.1"), QString(), "s"),
+			7);
+		QCOMPARE(bans.removeBan(7), QString());
+		QCOMPARE(
+			bans.isBanned("bob", QHostAddress("192.168.0.1"), "ext:1", "s"), 0);
+		QCOMPARE(
+			bans.isBanned("alice", QHostAddress(), QString(), QString()), 10);
+	}
 };
 
 
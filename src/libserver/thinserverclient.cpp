@@ -9,6 +9,7 @@ ThinServerClient::ThinServerClient(
 	QTcpSocket *socket, ServerLog *logger, QObject *parent)
 	: Client(socket, logger, false, parent)
 	, m_historyPosition(-1)
+	, m_catchupTarget(-1)
 {
 	connectSendNextHistoryBatch();
 }
@@ -19,6 +20,7 @@ ThinServerClient::ThinServerClient(
 	QObject *parent)
 	: Client(socket, ip, logger, false, parent)
 	, m_historyPosition(-1)
+	, m_catchupTarget(-1)
 {
 	connectSendNextHistoryBatch();
 }
@@ -29,6 +31,12 @@ ThinServerClient::~ThinServerClient()
 	emit thinServerClientDestroyed(this);
 }
 
+void ThinServerClient::startCatchup(int targetIndex)
+{
+	m_catchupTarget = targetIndex;
+	m_catchupTimer.start();
+}
+
 void ThinServerClient::sendNextHistoryBatch()
 {
 	// Only enqueue messages for uploading when upload queue is empty
@@ -38,6 +46,11 @@ void ThinServerClient::sendNextHistoryBatch()
 	   session()->state() != Session::State::Running)
 		return;
 
+	if(m_catchupTarget != -1 && m_historyPosition >= m_catchupTarget) {
+		session()->addCatchupDuration(m_catchupTimer.elapsed());
+		m_catchupTarget = -1;
+	}
+
 	net::MessageList batch;
 	int batchLast;
 	std::tie(batch, batchLast) =
@@ -3,6 +3,7 @@
 #define THINSERVERCLIENT_H
 #include "libserver/client.h"
 #include "libserver/serverconfig.h"
+#include <QElapsedTimer>
 
 class QHostAddress;
 
@@ -29,6 +30,14 @@ public:
 
 	void setHistoryPosition(int pos) { m_historyPosition = pos; }
 
+	/**
+	 * @brief Start timing how long it takes to catch up to the session
+	 *
+	 * The catch-up is considered done once everything up to the given
+	 * history index has been sent to the client.
+	 */
+	void startCatchup(int targetIndex);
+
 signals:
 	void thinServerClientDestroyed(ThinServerClient *thisClient);
 
@@ -39,6 +48,8 @@ private:
 	void connectSendNextHistoryBatch();
 
 	int m_historyPosition;
+	int m_catchupTarget;
+	QElapsedTimer m_catchupTimer;
 };
 
 }
@@ -168,6 +168,8 @@ void ThinSession::onClientJoin(Client *client, bool host)
 		client->sendDirectMessage(net::ServerReply::makeCatchup(
 			history()->lastIndex() - history()->firstIndex(), catchupKey));
 		history()->addMessage(net::ServerReply::makeCaughtUp(catchupKey));
+		static_cast<ThinServerClient *>(client)->startCatchup(
+			history()->lastIndex());
 	}
 }
 
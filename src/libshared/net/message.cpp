@@ -279,6 +279,17 @@ bool Message::shouldSmoothe() const
 	}
 }
 
+bool Message::isEphemeral() const
+{
+	switch(type()) {
+	case DP_MSG_LASER_TRAIL:
+	case DP_MSG_MOVE_POINTER:
+		return true;
+	default:
+		return false;
+	}
+}
+
 void Message::setUchars(size_t size, unsigned char *out, void *user)
 {
 	if(size > 0) {
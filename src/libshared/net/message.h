@@ -79,6 +79,10 @@ public:
 
 	bool shouldSmoothe() const;
 
+	// Cursor movements and laser trails only convey the latest state of a
+	// user, so they can be coalesced or dropped when the connection lags.
+	bool isEphemeral() const;
+
 	static void setUchars(size_t size, unsigned char *out, void *user);
 	static void setUint8s(int count, uint8_t *out, void *user);
 	static void setUint16s(int count, uint16_t *out, void *user);
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libshared/net/messagecompression.h"
+#include <QByteArray>
+#include <cstring>
+#include <zlib.h>
+
+namespace net {
+
+static constexpr int CHUNK_SIZE = 16384;
+
+MessageDeflater::MessageDeflater()
+	: m_stream(new z_stream)
+{
+	memset(m_stream, 0, sizeof(*m_stream));
+	int ret = deflateInit(m_stream, Z_DEFAULT_COMPRESSION);
+	m_ok = ret == Z_OK;
+	if(!m_ok) {
+		qWarning("Error initializing deflate stream: %d", ret);
+	}
+}
+
+MessageDeflater::~MessageDeflater()
+{
+	deflateEnd(m_stream);
+	delete m_stream;
+}
+
+bool MessageDeflater::deflate(const char *data, int length, QByteArray &out)
+{
+	if(!m_ok) {
+		return false;
+	}
+
+	m_stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	m_stream->avail_in = uInt(length);
+	// With Z_SYNC_FLUSH, running out of output space is the only indication
+	// that there's more output pending.
+	do {
+		int offset = out.size();
+		out.resize(offset + CHUNK_SIZE);
+		m_stream->next_out = reinterpret_cast<Bytef *>(out.data() + offset);
+		m_stream->avail_out = CHUNK_SIZE;
+		int ret = ::deflate(m_stream, Z_SYNC_FLUSH);
+		out.resize(offset + CHUNK_SIZE - int(m_stream->avail_out));
+		if(ret != Z_OK && ret != Z_BUF_ERROR) {
+			qWarning("Error deflating messages: %d", ret);
+			m_ok = false;
+			return false;
+		}
+	} while(m_stream->avail_out == 0);
+
+	return true;
+}
+
+
+MessageInflater::MessageInflater()
+	: m_stream(new z_stream)
+{
+	memset(m_stream, 0, sizeof(*m_stream));
+	int ret = inflateInit(m_stream);
+	m_ok = ret == Z_OK;
+	if(!m_ok) {
+		qWarning("Error initializing inflate stream: %d", ret);
+	}
+}
+
+MessageInflater::~MessageInflater()
+{
+	inflateEnd(m_stream);
+	delete m_stream;
+}
+
+MessageInflater::Result MessageInflater::inflate(
+	const char *data, int length, int maxLength, QByteArray &out)
+{
+	if(!m_ok) {
+		return Result::Error;
+	}
+
+	m_stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	m_stream->avail_in = uInt(length);
+	int initialSize = out.size();
+	do {
+		int offset = out.size();
+		out.resize(offset + CHUNK_SIZE);
+		m_stream->next_out = reinterpret_cast<Bytef *>(out.data() + offset);
+		m_stream->avail_out = CHUNK_SIZE;
+		int ret = ::inflate(m_stream, Z_SYNC_FLUSH);
+		out.resize(offset + CHUNK_SIZE - int(m_stream->avail_out));
+		if(ret == Z_STREAM_END) {
+			// The remote end never ends the stream, so this is bogus.
+			qWarning("Unexpected end of inflate stream");
+			m_ok = false;
+			return Result::Error;
+		} else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+			qWarning("Error inflating messages: %d", ret);
+			m_ok = false;
+			return Result::Error;
+		} else if(out.size() - initialSize > maxLength) {
+			qWarning("Inflated messages exceed %d bytes", maxLength);
+			m_ok = false;
+			return Result::TooLarge;
+		}
+	} while(m_stream->avail_out == 0);
+
+	return Result::Ok;
+}
+
+}
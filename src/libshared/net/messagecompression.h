@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef LIBSHARED_NET_MESSAGECOMPRESSION_H
+#define LIBSHARED_NET_MESSAGECOMPRESSION_H
+#include <QtGlobal>
+
+class QByteArray;
+struct z_stream_s;
+
+namespace net {
+
+/**
+ * A persistent deflate stream for compressing batches of serialized messages.
+ *
+ * Each batch is flushed to a byte boundary, so that the remote end can inflate
+ * it without waiting for further data, while the compression still benefits
+ * from the history of previous batches on the same connection.
+ */
+class MessageDeflater final {
+public:
+	MessageDeflater();
+	~MessageDeflater();
+
+	MessageDeflater(const MessageDeflater &) = delete;
+	MessageDeflater(MessageDeflater &&) = delete;
+	MessageDeflater &operator=(const MessageDeflater &) = delete;
+	MessageDeflater &operator=(MessageDeflater &&) = delete;
+
+	/**
+	 * Compress the given data and append the result to out.
+	 * Returns false if the stream is in an error state.
+	 */
+	bool deflate(const char *data, int length, QByteArray &out);
+
+private:
+	z_stream_s *m_stream;
+	bool m_ok;
+};
+
+/**
+ * The counterpart to MessageDeflater.
+ */
+class MessageInflater final {
+public:
+	enum class Result { Ok, TooLarge, Error };
+
+	MessageInflater();
+	~MessageInflater();
+
+	MessageInflater(const MessageInflater &) = delete;
+	MessageInflater(MessageInflater &&) = delete;
+	MessageInflater &operator=(const MessageInflater &) = delete;
+	MessageInflater &operator=(MessageInflater &&) = delete;
+
+	/**
+	 * Decompress the given data and append the result to out. If it inflates
+	 * to more than maxLength bytes, it's considered a decompression bomb and
+	 * TooLarge is returned. Returns Error if the data is corrupted or the
+	 * stream ended. Either way, the stream can't be used after that.
+	 */
+	Result
+	inflate(const char *data, int length, int maxLength, QByteArray &out);
+
+private:
+	z_stream_s *m_stream;
+	bool m_ok;
+};
+
+}
+
+#endif
@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "libshared/net/messagequeue.h"
+#include "libshared/net/messagecompression.h"
 #include "libshared/util/qtcompat.h"
 #include <QDateTime>
 #include <QTcpSocket>
@@ -18,6 +19,13 @@ MessageQueue::MessageQueue(bool decodeOpaque, QObject *parent)
 	, m_smoothTimer(nullptr)
 	, m_smoothMessagesToDrain(INT_MAX)
 	, m_contextId(0)
+	, m_ephemeralDropThreshold(DEFAULT_EPHEMERAL_DROP_THRESHOLD)
+	, m_deflater(nullptr)
+	, m_inflater(nullptr)
+	, m_totalMessagesReceived(0)
+	, m_totalMessagesSent(0)
+	, m_totalBytesReceived(0)
+	, m_totalBytesSent(0)
 	, m_pingTimer(nullptr)
 	, m_idleTimeout(0)
 	, m_keepAliveTimeout(0)
@@ -34,6 +42,12 @@ MessageQueue::MessageQueue(bool decodeOpaque, QObject *parent)
 	resetKeepAliveTimer();
 }
 
+MessageQueue::~MessageQueue()
+{
+	delete m_deflater;
+	delete m_inflater;
+}
+
 void MessageQueue::setIdleTimeout(qint64 timeout)
 {
 	m_idleTimeout = timeout;
@@ -97,6 +111,29 @@ void MessageQueue::updateSmoothing()
 	}
 }
 
+void MessageQueue::setCompressionEnabled(bool compressionEnabled)
+{
+	// The deflate stream can't be restarted, since the remote end keeps its
+	// inflate stream around. So once enabled, compression stays on.
+	if(compressionEnabled && !m_deflater) {
+		m_deflater = new MessageDeflater;
+		setDecompressionEnabled(true);
+	} else if(!compressionEnabled && m_deflater) {
+		qWarning("setCompressionEnabled: can't disable compression again");
+	}
+}
+
+void MessageQueue::setDecompressionEnabled(bool decompressionEnabled)
+{
+	// Same deal as above, the remote end won't restart its deflate stream.
+	if(decompressionEnabled && !m_inflater) {
+		m_inflater = new MessageInflater;
+	} else if(!decompressionEnabled && m_inflater) {
+		qWarning(
+			"setDecompressionEnabled: can't disable decompression again");
+	}
+}
+
 void MessageQueue::setArtificialLagMs(int msecs)
 {
 	m_artificialLagMs = qMax(0, msecs);
@@ -194,6 +231,175 @@ void MessageQueue::receiveSmoothedMessages()
 	}
 }
 
+void MessageQueue::receiveMessage(
+	const char *buffer, int messageLength, ReceiveResult &result)
+{
+	int type = static_cast<unsigned char>(buffer[2]);
+	if(type == MSG_TYPE_PING) {
+		// Pings are handled internally
+		if(messageLength != DP_MESSAGE_HEADER_LENGTH + 1) {
+			// Not a valid Ping message!
+			emit badData(messageLength, MSG_TYPE_PING, 0);
+		} else {
+			handlePing(buffer[DP_MESSAGE_HEADER_LENGTH]);
+		}
+
+	} else if(type == MSG_TYPE_DISCONNECT) {
+		// Graceful disconnects are also handled internally
+		if(messageLength < DP_MESSAGE_HEADER_LENGTH + 1) {
+			// We expected at least a reason!
+			emit badData(messageLength, MSG_TYPE_DISCONNECT, 0);
+		} else {
+			result.smoothFlush = true;
+			result.disconnectReason = buffer[DP_MESSAGE_HEADER_LENGTH];
+			result.disconnectMessage = QString::fromUtf8(
+				buffer + DP_MESSAGE_HEADER_LENGTH + 1,
+				messageLength - DP_MESSAGE_HEADER_LENGTH - 1);
+		}
+
+	} else if(type == MSG_TYPE_KEEP_ALIVE) {
+		// Nothing to do, just keeps the connection alive if the client
+		// fails to send out a ping due upload queue saturation.
+
+	} else if(type == DP_MSG_COMPRESSED) {
+		receiveCompressed(
+			buffer + DP_MESSAGE_HEADER_LENGTH,
+			messageLength - DP_MESSAGE_HEADER_LENGTH, result);
+
+	} else {
+		// The rest are normal messages
+		net::Message msg = net::Message::deserialize(
+			reinterpret_cast<const unsigned char *>(buffer), messageLength,
+			m_decodeOpaque);
+		if(msg.isNull()) {
+			qWarning("Error deserializing message: %s", DP_error());
+			emit badData(
+				messageLength, type, static_cast<unsigned char>(buffer[3]));
+		} else {
+			if(m_smoothTimer) {
+				// Undos already have a delay because they require a
+				// round trip, we don't want to make them even slower.
+				bool ownUndoReceived = m_contextId != 0 &&
+									   msg.type() == DP_MSG_UNDO &&
+									   msg.contextId() == m_contextId;
+				if(ownUndoReceived) {
+					result.smoothFlush = true;
+				}
+				m_smoothBuffer.append(msg);
+			} else {
+				m_inbox.append(msg);
+			}
+			++result.gotMessages;
+		}
+	}
+}
+
+void MessageQueue::receiveCompressed(
+	const char *data, int length, ReceiveResult &result)
+{
+	if(!m_inflater) {
+		// Compression wasn't negotiated, the remote end has no business
+		// sending us this.
+		emit badData(length + DP_MESSAGE_HEADER_LENGTH, DP_MSG_COMPRESSED, 0);
+		return;
+	}
+
+	// Can't recover from a broken stream, everything after is garbage.
+	switch(m_inflater->inflate(
+		data, length, MAX_INFLATED_CHUNK, m_inflateBuffer)) {
+	case MessageInflater::Result::Ok:
+		break;
+	case MessageInflater::Result::TooLarge:
+		m_inflateBuffer.clear();
+		emit badData(length + DP_MESSAGE_HEADER_LENGTH, DP_MSG_COMPRESSED, 0);
+		return;
+	case MessageInflater::Result::Error:
+		m_inflateBuffer.clear();
+		emit readError();
+		return;
+	}
+
+	// Compressed chunks may split messages, so leave incomplete ones around
+	// until the rest of them arrives.
+	int offset = 0;
+	int size = compat::cast_6<int>(m_inflateBuffer.size());
+	while(size - offset >= DP_MESSAGE_HEADER_LENGTH) {
+		const char *buffer = m_inflateBuffer.constData() + offset;
+		int messageLength =
+			qFromBigEndian<quint16>(buffer) + DP_MESSAGE_HEADER_LENGTH;
+		if(size - offset < messageLength) {
+			break;
+		}
+
+		if(static_cast<unsigned char>(buffer[2]) == DP_MSG_COMPRESSED) {
+			// Compressing compressed data is nonsense.
+			emit badData(messageLength, DP_MSG_COMPRESSED, 0);
+		} else {
+			receiveMessage(buffer, messageLength, result);
+		}
+		offset += messageLength;
+	}
+	m_inflateBuffer.remove(0, offset);
+}
+
+void MessageQueue::finishReceive(const ReceiveResult &result)
+{
+	m_totalMessagesReceived += result.gotMessages;
+	if(result.gotMessages != 0) {
+		if(m_smoothTimer) {
+			if(result.smoothFlush) {
+				m_inbox.append(m_smoothBuffer);
+				m_smoothBuffer.clear();
+				emit messageAvailable();
+				m_smoothTimer->stop();
+			} else {
+				m_smoothMessagesToDrain =
+					m_smoothBuffer.size() / m_smoothDrainRate;
+				if(!m_smoothTimer->isActive()) {
+					receiveSmoothedMessages();
+				}
+			}
+		} else {
+			emit messageAvailable();
+		}
+	}
+
+	if(result.disconnectReason != -1) {
+		emit gracefulDisconnect(
+			GracefulDisconnect(result.disconnectReason),
+			result.disconnectMessage);
+	}
+}
+
+bool MessageQueue::compress(
+	const QByteArray &serialized, QByteArray &buffer, bool ws)
+{
+	Q_ASSERT(m_deflater);
+	QByteArray compressed;
+	if(!m_deflater->deflate(
+		   serialized.constData(), compat::cast_6<int>(serialized.size()),
+		   compressed)) {
+		return false;
+	}
+
+	// Message bodies are limited to 16 bit lengths, so chop up the chunk.
+	int offset = 0;
+	int size = compat::cast_6<int>(compressed.size());
+	while(offset < size) {
+		int length = qMin(size - offset, 0xffff);
+		if(!ws) {
+			char header[2];
+			qToBigEndian(quint16(length), header);
+			buffer.append(header, 2);
+		}
+		buffer.append(char(DP_MSG_COMPRESSED));
+		buffer.append(char(0));
+		buffer.append(compressed.constData() + offset, length);
+		offset += length;
+	}
+	return true;
+}
+
 void MessageQueue::checkIdleTimeout()
 {
 	if(getSocketState() == QAbstractSocket::ConnectedState &&
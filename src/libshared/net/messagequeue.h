@@ -12,6 +12,9 @@ class QTimer;
 
 namespace net {
 
+class MessageDeflater;
+class MessageInflater;
+
 /**
  * A wrapper for an IO device for sending and receiving messages.
  */
@@ -20,6 +23,7 @@ class MessageQueue : public QObject {
 public:
 	static constexpr int DEFAULT_SMOOTH_DRAIN_RATE = 20;
 	static constexpr int MAX_SMOOTH_DRAIN_RATE = 60;
+	static constexpr int DEFAULT_EPHEMERAL_DROP_THRESHOLD = 256 * 1024;
 
 	enum class GracefulDisconnect {
 		Error,	  // An error occurred
@@ -29,6 +33,7 @@ public:
 	};
 
 	MessageQueue(bool decodeOpaque, QObject *parent);
+	~MessageQueue() override;
 
 	/**
 	 * @brief Check if there are new messages available
@@ -77,6 +82,16 @@ public:
 	 */
 	virtual bool isUploading() const = 0;
 
+	/**
+	 * @brief Totals of messages and bytes that went through this queue
+	 *
+	 * Internal messages like pings are included in the counts.
+	 */
+	qint64 totalMessagesReceived() const { return m_totalMessagesReceived; }
+	qint64 totalMessagesSent() const { return m_totalMessagesSent; }
+	qint64 totalBytesReceived() const { return m_totalBytesReceived; }
+	qint64 totalBytesSent() const { return m_totalBytesSent; }
+
 	/**
 	 * @brief Set the maximum time the remote end can be quiet before timing out
 	 *
@@ -101,9 +116,43 @@ public:
 
 	void setKeepAliveTimeout(qint64 timeout);
 
+	/**
+	 * @brief Set the upload queue size at which ephemeral messages get dropped
+	 *
+	 * Ephemeral messages (see Message::isEphemeral) are sent with a lower
+	 * priority than everything else. When the upload queue grows beyond this
+	 * many bytes, they are discarded instead of being enqueued so that the
+	 * remote end can catch up on the actual canvas state sooner.
+	 *
+	 * @param bytes threshold in bytes, zero or less to never drop anything
+	 */
+	void setEphemeralDropThreshold(int bytes)
+	{
+		m_ephemeralDropThreshold = bytes;
+	}
+
 	void setSmoothEnabled(bool smoothingEnabled);
 	void setSmoothDrainRate(int smoothDrainRate);
 
+	/**
+	 * @brief Compress outgoing messages
+	 *
+	 * Only enable this if the remote end indicated support for it, since
+	 * older versions don't understand compressed messages. This implies
+	 * setDecompressionEnabled.
+	 */
+	void setCompressionEnabled(bool compressionEnabled);
+	bool isCompressionEnabled() const { return m_deflater != nullptr; }
+
+	/**
+	 * @brief Accept compressed incoming messages
+	 *
+	 * Enable this once we told the remote end that we support compression.
+	 * Compressed messages received before that are treated as bad data.
+	 */
+	void setDecompressionEnabled(bool decompressionEnabled);
+	bool isDecompressionEnabled() const { return m_inflater != nullptr; }
+
 	int artificalLagMs() { return m_artificialLagMs; }
 
 	void setArtificialLagMs(int msecs);
@@ -174,6 +223,23 @@ protected:
 	static constexpr int MSG_TYPE_DISCONNECT = 1;
 	static constexpr int MSG_TYPE_PING = 2;
 	static constexpr int MSG_TYPE_KEEP_ALIVE = 2;
+	// Batches smaller than this get sent uncompressed, since the overhead of
+	// flushing the stream and the chunk headers would outweigh any savings.
+	static constexpr int MIN_COMPRESS_BATCH = 256;
+	// Batches are cut off once they reach this size, so they're at most one
+	// message longer than this. Since the stream is flushed after each batch,
+	// that's also the most a single compressed chunk can inflate to.
+	static constexpr int MAX_COMPRESS_BATCH = 1024 * 64;
+	static constexpr int MAX_INFLATED_CHUNK = MAX_COMPRESS_BATCH +
+											  DP_MESSAGE_HEADER_LENGTH +
+											  DP_MESSAGE_MAX_PAYLOAD_LENGTH;
+
+	struct ReceiveResult {
+		int gotMessages = 0;
+		bool smoothFlush = false;
+		int disconnectReason = -1;
+		QString disconnectMessage;
+	};
 
 	virtual void enqueueMessages(int count, const net::Message *msgs) = 0;
 	virtual void enqueuePing(bool pong) = 0;
@@ -185,6 +251,22 @@ protected:
 
 	void handlePing(bool isPong);
 
+	// Handle a single received message in the regular (non-WebSocket) format.
+	void receiveMessage(
+		const char *buffer, int messageLength, ReceiveResult &result);
+	void receiveCompressed(const char *data, int length, ReceiveResult &result);
+	void finishReceive(const ReceiveResult &result);
+
+	// Compresses the given serialized messages into one or more chunks. The
+	// chunks are appended to the buffer in the regular or WebSocket format.
+	bool compress(const QByteArray &serialized, QByteArray &buffer, bool ws);
+
+	bool shouldDropEphemeral() const
+	{
+		return m_ephemeralDropThreshold > 0 &&
+			   uploadQueueBytes() > m_ephemeralDropThreshold;
+	}
+
 	bool m_decodeOpaque;
 	net::MessageList m_inbox; // received (complete) messages
 	bool m_gracefullyDisconnecting;
@@ -197,6 +279,14 @@ protected:
 	net::MessageList m_smoothBuffer;
 	int m_smoothMessagesToDrain;
 	unsigned int m_contextId;
+	int m_ephemeralDropThreshold;
+	MessageDeflater *m_deflater;
+	MessageInflater *m_inflater;
+	QByteArray m_inflateBuffer;
+	qint64 m_totalMessagesReceived;
+	qint64 m_totalMessagesSent;
+	qint64 m_totalBytesReceived;
+	qint64 m_totalBytesSent;
 
 private slots:
 	void checkIdleTimeout();
@@ -37,6 +37,9 @@ int TcpMessageQueue::uploadQueueBytes() const
 	for(const net::Message &msg : m_outbox) {
 		total += compat::castSize(msg.length());
 	}
+	for(const net::Message &msg : m_ephemeralOutbox) {
+		total += compat::castSize(msg.length());
+	}
 	total +=
 		m_pings.size() * (DP_MESSAGE_HEADER_LENGTH + DP_MSG_PING_STATIC_LENGTH);
 	return total;
@@ -50,13 +53,37 @@ bool TcpMessageQueue::isUploading() const
 void TcpMessageQueue::enqueueMessages(int count, const net::Message *msgs)
 {
 	for(int i = 0; i < count; ++i) {
-		m_outbox.enqueue(msgs[i]);
+		const net::Message &msg = msgs[i];
+		if(msg.isEphemeral()) {
+			enqueueEphemeral(msg);
+		} else {
+			m_outbox.enqueue(msg);
+		}
 	}
 	if(m_sendbuffer.isEmpty()) {
 		writeData();
 	}
 }
 
+void TcpMessageQueue::enqueueEphemeral(const net::Message &msg)
+{
+	if(shouldDropEphemeral()) {
+		// The connection can't keep up, don't make it worse by piling on
+		// cursor updates that will be outdated by the time they arrive.
+		m_ephemeralOrder.clear();
+		m_ephemeralOutbox.clear();
+	} else {
+		int key = ephemeralKey(msg);
+		QHash<int, net::Message>::iterator it = m_ephemeralOutbox.find(key);
+		if(it == m_ephemeralOutbox.end()) {
+			m_ephemeralOrder.enqueue(key);
+			m_ephemeralOutbox.insert(key, msg);
+		} else {
+			*it = msg;
+		}
+	}
+}
+
 void TcpMessageQueue::enqueuePing(bool pong)
 {
 	m_pings.enqueue(pong);
@@ -77,10 +104,8 @@ void TcpMessageQueue::abortSocket()
 
 void TcpMessageQueue::readData()
 {
-	int read, totalread = 0, gotmessages = 0;
-	bool smoothFlush = false;
-	int disconnectReason = -1;
-	QString disconnectMessage;
+	int read, totalread = 0;
+	ReceiveResult result;
 	do {
 		// Read as much as fits in to the message buffer
 		read = m_socket->read(
@@ -105,60 +130,7 @@ void TcpMessageQueue::readData()
 		int messageLength;
 		while((messageLength = haveWholeMessageToRead()) != 0) {
 			// Whole message received!
-			int type = static_cast<unsigned char>(m_recvbuffer[2]);
-			if(type == MSG_TYPE_PING) {
-				// Pings are handled internally
-				if(messageLength != DP_MESSAGE_HEADER_LENGTH + 1) {
-					// Not a valid Ping message!
-					emit badData(messageLength, MSG_TYPE_PING, 0);
-				} else {
-					handlePing(m_recvbuffer[DP_MESSAGE_HEADER_LENGTH]);
-				}
-
-			} else if(type == MSG_TYPE_DISCONNECT) {
-				// Graceful disconnects are also handled internally
-				if(messageLength < DP_MESSAGE_HEADER_LENGTH + 1) {
-					// We expected at least a reason!
-					emit badData(messageLength, MSG_TYPE_DISCONNECT, 0);
-				} else {
-					smoothFlush = true;
-					disconnectReason = m_recvbuffer[DP_MESSAGE_HEADER_LENGTH];
-					disconnectMessage = QString::fromUtf8(
-						m_recvbuffer + DP_MESSAGE_HEADER_LENGTH + 1,
-						messageLength - DP_MESSAGE_HEADER_LENGTH - 1);
-				}
-
-			} else if(type == MSG_TYPE_KEEP_ALIVE) {
-				// Nothing to do, just keeps the connection alive if the client
-				// fails to send out a ping due upload queue saturation.
-
-			} else {
-				// The rest are normal messages
-				net::Message msg = net::Message::deserialize(
-					reinterpret_cast<unsigned char *>(m_recvbuffer),
-					m_recvbytes, m_decodeOpaque);
-				if(msg.isNull()) {
-					qWarning("Error deserializing message: %s", DP_error());
-					emit badData(
-						messageLength, type,
-						static_cast<unsigned char>(m_recvbuffer[3]));
-				} else {
-					if(m_smoothTimer) {
-						// Undos already have a delay because they require a
-						// round trip, we don't want to make them even slower.
-						bool ownUndoReceived = m_contextId != 0 &&
-											   msg.type() == DP_MSG_UNDO &&
-											   msg.contextId() == m_contextId;
-						if(ownUndoReceived) {
-							smoothFlush = true;
-						}
-						m_smoothBuffer.append(msg);
-					} else {
-						m_inbox.append(msg);
-					}
-					++gotmessages;
-				}
-			}
+			receiveMessage(m_recvbuffer, messageLength, result);
 
 			if(messageLength < m_recvbytes) {
 				// Buffer contains more than one message
@@ -177,36 +149,16 @@ void TcpMessageQueue::readData()
 
 	if(totalread) {
 		resetLastRecvTimer();
+		m_totalBytesReceived += totalread;
 		emit bytesReceived(totalread);
 	}
 
-	if(gotmessages != 0) {
-		if(m_smoothTimer) {
-			if(smoothFlush) {
-				m_inbox.append(m_smoothBuffer);
-				m_smoothBuffer.clear();
-				emit messageAvailable();
-				m_smoothTimer->stop();
-			} else {
-				m_smoothMessagesToDrain =
-					m_smoothBuffer.size() / m_smoothDrainRate;
-				if(!m_smoothTimer->isActive()) {
-					receiveSmoothedMessages();
-				}
-			}
-		} else {
-			emit messageAvailable();
-		}
-	}
-
-	if(disconnectReason != -1) {
-		emit gracefulDisconnect(
-			GracefulDisconnect(disconnectReason), disconnectMessage);
-	}
+	finishReceive(result);
 }
 
 void TcpMessageQueue::dataWritten(qint64 bytes)
 {
+	m_totalBytesSent += bytes;
 	emit bytesSent(bytes);
 
 	// Write more once the buffer is empty
@@ -254,15 +206,23 @@ void TcpMessageQueue::writeData()
 {
 	bool sendMore = true;
 	int sentBatch = 0;
+	// Ephemeral messages only go out once the socket has caught up, until then
+	// they get coalesced in the outbox.
+	bool includeEphemeral = m_socket->bytesToWrite() == 0;
 
 	while(sendMore && sentBatch < 1024 * 64) {
 		sendMore = false;
-		if(m_sendbuffer.isEmpty() && messagesInOutbox()) {
+		if(m_sendbuffer.isEmpty() && haveMessagesToSend(includeEphemeral)) {
 			// Upload buffer is empty, but there are messages in the outbox
 			Q_ASSERT(m_sentbytes == 0);
-			if(!dequeueFromOutbox().serialize(m_sendbuffer)) {
+			if(m_deflater) {
+				if(!compressFromOutbox(includeEphemeral)) {
+					emit writeError();
+					return;
+				}
+			} else if(!dequeueFromOutbox().serialize(m_sendbuffer)) {
 				qWarning("Error serializing message: %s", DP_error());
-				sendMore = messagesInOutbox();
+				sendMore = haveMessagesToSend(includeEphemeral);
 				continue;
 			}
 		}
@@ -284,23 +244,54 @@ void TcpMessageQueue::writeData()
 				// Complete envelope sent
 				m_sendbuffer.clear();
 				m_sentbytes = 0;
-				sendMore = messagesInOutbox();
+				sendMore = haveMessagesToSend(includeEphemeral);
 			}
 		}
 	}
 }
 
+bool TcpMessageQueue::compressFromOutbox(bool includeEphemeral)
+{
+	// Compress a batch of messages at once, flushing the stream at the end of
+	// it. Bigger batches compress better, but they also have to be sent in
+	// their entirety before anything else can go out.
+	m_compressbuffer.clear();
+	while(m_compressbuffer.size() < MAX_COMPRESS_BATCH &&
+		  haveMessagesToSend(includeEphemeral)) {
+		if(dequeueFromOutbox().serialize(m_serializebuffer)) {
+			m_compressbuffer.append(m_serializebuffer);
+		} else {
+			qWarning("Error serializing message: %s", DP_error());
+		}
+	}
+	if(m_compressbuffer.size() < MIN_COMPRESS_BATCH) {
+		m_sendbuffer.swap(m_compressbuffer);
+		return true;
+	} else {
+		return compress(m_compressbuffer, m_sendbuffer, false);
+	}
+}
+
 bool TcpMessageQueue::messagesInOutbox() const
 {
-	return !m_outbox.isEmpty() || !m_pings.isEmpty();
+	return haveMessagesToSend(true);
+}
+
+bool TcpMessageQueue::haveMessagesToSend(bool includeEphemeral) const
+{
+	return !m_outbox.isEmpty() || !m_pings.isEmpty() ||
+		   (includeEphemeral && !m_ephemeralOrder.isEmpty());
 }
 
 net::Message TcpMessageQueue::dequeueFromOutbox()
 {
-	if(m_pings.isEmpty()) {
+	++m_totalMessagesSent;
+	if(!m_pings.isEmpty()) {
+		return net::makePingMessage(0, m_pings.dequeue());
+	} else if(!m_outbox.isEmpty()) {
 		return m_outbox.dequeue();
 	} else {
-		return net::makePingMessage(0, m_pings.dequeue());
+		return m_ephemeralOutbox.take(m_ephemeralOrder.dequeue());
 	}
 }
 
@@ -2,6 +2,7 @@
 #ifndef LIBSHARED_NET_TCPMESSSAGEQUEUE_H
 #define LIBSHARED_NET_TCPMESSSAGEQUEUE_H
 #include "libshared/net/messagequeue.h"
+#include <QHash>
 #include <QQueue>
 
 class QTcpSocket;
@@ -40,9 +41,18 @@ private:
 
 	void writeData();
 
+	void enqueueEphemeral(const net::Message &msg);
+	bool compressFromOutbox(bool includeEphemeral);
+
 	bool messagesInOutbox() const;
+	bool haveMessagesToSend(bool includeEphemeral) const;
 	net::Message dequeueFromOutbox();
 
+	static int ephemeralKey(const net::Message &msg)
+	{
+		return (int(msg.type()) << 8) | int(msg.contextId());
+	}
+
 	QTcpSocket *m_socket;
 	char *m_recvbuffer;		 // raw message reception buffer
 	QByteArray m_sendbuffer; // raw message upload buffer
@@ -50,6 +60,13 @@ private:
 	int m_sentbytes;		 // number of bytes in upload buffer already sent
 	QQueue<net::Message> m_outbox; // messages to be sent
 	QQueue<bool> m_pings;		   // pings and pongs to be sent
+	// Cursor and laser updates, sent only when the outbox is empty. Only the
+	// latest message per type and user is kept, the queue holds the order.
+	QQueue<int> m_ephemeralOrder;
+	QHash<int, net::Message> m_ephemeralOutbox;
+	// Batch of serialized messages to be compressed and a single one of them.
+	QByteArray m_compressbuffer;
+	QByteArray m_serializebuffer;
 };
 
 }
@@ -42,20 +42,101 @@ bool WebSocketMessageQueue::isUploading() const
 }
 
 void WebSocketMessageQueue::enqueueMessages(int count, const net::Message *msgs)
+{
+	if(m_deflater) {
+		enqueueCompressedMessages(count, msgs);
+	} else {
+		enqueueUncompressedMessages(count, msgs);
+	}
+}
+
+void WebSocketMessageQueue::enqueueUncompressedMessages(
+	int count, const net::Message *msgs)
 {
 	for(int i = 0; i < count; ++i) {
+		// There's no outbox to coalesce messages in, the socket buffers them.
+		// So when it's congested, all we can do is drop ephemeral messages.
+		if(msgs[i].isEphemeral() && shouldDropEphemeral()) {
+			continue;
+		}
 		if(msgs[i].serializeWs(m_serializationBuffer)) {
 			qint64 sent = m_socket->sendBinaryMessage(m_serializationBuffer);
 			if(sent != qint64(m_serializationBuffer.size())) {
 				emit writeError();
 				break;
 			}
+			++m_totalMessagesSent;
 		} else {
 			qWarning("Error serializing message: %s", DP_error());
 		}
 	}
 }
 
+void WebSocketMessageQueue::enqueueCompressedMessages(
+	int count, const net::Message *msgs)
+{
+	// Messages get compressed in batches. Inside of them, messages are in the
+	// regular format, since they need a length to be told apart.
+	m_compressionBuffer.clear();
+	int batchStart = 0;
+	int batchCount = 0;
+	bool dropEphemeral = shouldDropEphemeral();
+	for(int i = 0; i < count; ++i) {
+		if(!(dropEphemeral && msgs[i].isEphemeral())) {
+			if(msgs[i].serialize(m_serializationBuffer)) {
+				m_compressionBuffer.append(m_serializationBuffer);
+				++batchCount;
+			} else {
+				qWarning("Error serializing message: %s", DP_error());
+			}
+		}
+
+		// The remote end won't inflate arbitrarily large batches.
+		if(m_compressionBuffer.size() >= MAX_COMPRESS_BATCH) {
+			if(!sendCompressedBatch(batchCount)) {
+				return;
+			}
+			m_compressionBuffer.clear();
+			batchStart = i + 1;
+			batchCount = 0;
+		}
+	}
+
+	if(m_compressionBuffer.size() < MIN_COMPRESS_BATCH) {
+		if(!m_compressionBuffer.isEmpty()) {
+			enqueueUncompressedMessages(count - batchStart, msgs + batchStart);
+		}
+	} else {
+		sendCompressedBatch(batchCount);
+	}
+}
+
+bool WebSocketMessageQueue::sendCompressedBatch(int messageCount)
+{
+	QByteArray chunks;
+	if(!compress(m_compressionBuffer, chunks, true)) {
+		emit writeError();
+		return false;
+	}
+	m_totalMessagesSent += messageCount;
+
+	// Each chunk has a header consisting of the type and context id, so split
+	// them up again to send them as separate WebSocket messages.
+	int offset = 0;
+	int size = compat::cast_6<int>(chunks.size());
+	while(offset < size) {
+		int length =
+			qMin(size - offset, 0xffff + DP_MESSAGE_WS_HEADER_LENGTH);
+		qint64 sent = m_socket->sendBinaryMessage(chunks.mid(offset, length));
+		if(sent != qint64(length)) {
+			emit writeError();
+			return false;
+		}
+		offset += length;
+	}
+	return true;
+}
+
 void WebSocketMessageQueue::enqueuePing(bool pong)
 {
 	net::Message msg = net::makePingMessage(0, pong);
@@ -74,6 +155,7 @@ void WebSocketMessageQueue::abortSocket()
 
 void WebSocketMessageQueue::dataWritten(qint64 bytes)
 {
+	m_totalBytesSent += bytes;
 	emit bytesSent(bytes);
 	if(m_socket->bytesToWrite() == 0) {
 		emit allSent();
@@ -90,10 +172,7 @@ void WebSocketMessageQueue::receiveBinaryMessage(const QByteArray &bytes)
 {
 	// Ignore incoming messages while we're in the process of disconnecting.
 	if(!m_gracefullyDisconnecting) {
-		bool gotmessage = false;
-		bool smoothFlush = false;
-		int disconnectReason = -1;
-		QString disconnectMessage;
+		ReceiveResult result;
 
 		int type = static_cast<unsigned char>(bytes[0]);
 		size_t messageLength = compat::cast<size_t>(bytes.size());
@@ -116,13 +195,18 @@ void WebSocketMessageQueue::receiveBinaryMessage(const QByteArray &bytes)
 				// We expected at least a reason!
 				emit badData(int(messageLength), MSG_TYPE_DISCONNECT, 0);
 			} else {
-				smoothFlush = true;
-				disconnectReason = bytes[DP_MESSAGE_WS_HEADER_LENGTH];
-				disconnectMessage = QString::fromUtf8(
+				result.smoothFlush = true;
+				result.disconnectReason = bytes[DP_MESSAGE_WS_HEADER_LENGTH];
+				result.disconnectMessage = QString::fromUtf8(
 					bytes.constData() + DP_MESSAGE_WS_HEADER_LENGTH + 1,
 					int(messageLength) - DP_MESSAGE_WS_HEADER_LENGTH - 1);
 			}
 
+		} else if(type == DP_MSG_COMPRESSED) {
+			receiveCompressed(
+				bytes.constData() + DP_MESSAGE_WS_HEADER_LENGTH,
+				int(messageLength) - DP_MESSAGE_WS_HEADER_LENGTH, result);
+
 		} else {
 			// The rest are normal messages
 			net::Message msg = net::Message::deserializeWs(
@@ -142,42 +226,21 @@ void WebSocketMessageQueue::receiveBinaryMessage(const QByteArray &bytes)
 										   msg.type() == DP_MSG_UNDO &&
 										   msg.contextId() == m_contextId;
 					if(ownUndoReceived) {
-						smoothFlush = true;
+						result.smoothFlush = true;
 					}
 					m_smoothBuffer.append(msg);
 				} else {
 					m_inbox.append(msg);
 				}
-				gotmessage = true;
+				++result.gotMessages;
 			}
 		}
 
 		resetLastRecvTimer();
+		m_totalBytesReceived += bytes.size();
 		emit bytesReceived(compat::cast_6<int>(bytes.size()));
 
-		if(gotmessage) {
-			if(m_smoothTimer) {
-				if(smoothFlush) {
-					m_inbox.append(m_smoothBuffer);
-					m_smoothBuffer.clear();
-					emit messageAvailable();
-					m_smoothTimer->stop();
-				} else {
-					m_smoothMessagesToDrain =
-						m_smoothBuffer.size() / m_smoothDrainRate;
-					if(!m_smoothTimer->isActive()) {
-						receiveSmoothedMessages();
-					}
-				}
-			} else {
-				emit messageAvailable();
-			}
-		}
-
-		if(disconnectReason != -1) {
-			emit gracefulDisconnect(
-				GracefulDisconnect(disconnectReason), disconnectMessage);
-		}
+		finishReceive(result);
 	}
 }
 
@@ -31,8 +31,13 @@ private slots:
 private:
 	void afterDisconnectSent() override;
 
+	void enqueueUncompressedMessages(int count, const net::Message *msgs);
+	void enqueueCompressedMessages(int count, const net::Message *msgs);
+	bool sendCompressedBatch(int messageCount);
+
 	QWebSocket *m_socket;
     QByteArray m_serializationBuffer;
+	QByteArray m_compressionBuffer;
 };
 
 }
@@ -1,4 +1,5 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
+#include "libshared/net/messagecompression.h"
 #include "libshared/net/tcpmessagequeue.h"
 #include "libshared/util/qtcompat.h"
 #include <QDebug>
@@ -6,6 +7,7 @@
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QThread>
+#include <QtEndian>
 #include <QtTest/QtTest>
 #include <memory>
 
@@ -185,6 +187,135 @@ private slots:
 		loopUntil(allReceived);
 	}
 
+	void testCompressedSend()
+	{
+		auto mq = getMsgQueue();
+		mq->setCompressionEnabled(true);
+
+		const int sendCount = 1000;
+
+		int countReceived = 0;
+		bool allReceived = false;
+
+		// The echo server sends back the compressed chunks verbatim, which
+		// we should be able to take apart again.
+		connect(mq.get(), &net::MessageQueue::messageAvailable, [&]() {
+			net::MessageList got;
+			mq->receive(got);
+			for(const net::Message &msg : got) {
+				QCOMPARE(msg.type(), DP_MSG_CHAT);
+				size_t len;
+				const char *text = DP_msg_chat_message(msg.toChat(), &len);
+				QCOMPARE(
+					QString::fromUtf8(text, compat::castSize(len)),
+					makeCompressibleText(countReceived));
+				if(++countReceived == sendCount) {
+					allReceived = true;
+				}
+			}
+			QVERIFY(countReceived <= sendCount);
+		});
+
+		int totalSendLen = 0;
+		for(int i = 0; i < sendCount; ++i) {
+			net::Message msg =
+				net::makeChatMessage(0, 0, 0, makeCompressibleText(i));
+			totalSendLen += int(msg.length());
+			mq->send(msg);
+		}
+
+		QVERIFY(mq->uploadQueueBytes() < totalSendLen);
+
+		loopUntil(allReceived);
+	}
+
+	void testCompressedRejectedUnlessNegotiated()
+	{
+		auto s = getConnection();
+		net::TcpMessageQueue mq(s.get(), true, nullptr);
+
+		bool gotBadData = false;
+		connect(
+			&mq, &net::MessageQueue::badData,
+			[&gotBadData](int len, int type, int contextId) {
+				Q_UNUSED(len);
+				Q_UNUSED(contextId);
+				QCOMPARE(type, int(DP_MSG_COMPRESSED));
+				gotBadData = true;
+			});
+
+		// Written to the socket directly, since the message queue won't
+		// compress anything unless compression is enabled.
+		s->write(makeCompressedChunk(QByteArray(1024, 'x')));
+
+		loopUntil(gotBadData);
+		QVERIFY(!mq.isPending());
+	}
+
+	void testCompressedSizeLimit()
+	{
+		auto s = getConnection();
+		net::TcpMessageQueue mq(s.get(), true, nullptr);
+		mq.setDecompressionEnabled(true);
+
+		bool gotBadData = false;
+		connect(
+			&mq, &net::MessageQueue::badData,
+			[&gotBadData](int len, int type, int contextId) {
+				Q_UNUSED(len);
+				Q_UNUSED(contextId);
+				QCOMPARE(type, int(DP_MSG_COMPRESSED));
+				gotBadData = true;
+			});
+
+		// Megabytes of nothing compress down to a few kilobytes, which must
+		// not be inflated in their entirety.
+		s->write(makeCompressedChunk(QByteArray(4 * 1024 * 1024, '\0')));
+
+		loopUntil(gotBadData);
+		QVERIFY(!mq.isPending());
+	}
+
+	void testEphemeralCoalescing()
+	{
+		auto mq = getMsgQueue();
+
+		const int moveCount = 10;
+		net::MessageList got;
+		bool allReceived = false;
+
+		connect(mq.get(), &net::MessageQueue::messageAvailable, [&]() {
+			net::MessageList buffer;
+			mq->receive(buffer);
+			got.append(buffer);
+			allReceived = got.size() >= 2;
+		});
+
+		// The chat message occupies the socket, so the pointer movements
+		// should pile up behind it and get coalesced into the last one.
+		net::Message chat =
+			net::makeChatMessage(0, 0, 0, QStringLiteral("Hello world!"));
+		mq->send(chat);
+		int totalSendLen = int(chat.length());
+		for(int i = 0; i < moveCount; ++i) {
+			net::Message msg =
+				net::Message::noinc(DP_msg_move_pointer_new(1, i, i));
+			if(i == 0) {
+				totalSendLen += int(msg.length());
+			}
+			mq->send(msg);
+		}
+		QCOMPARE(mq->uploadQueueBytes(), totalSendLen);
+
+		loopUntil(allReceived);
+		QCOMPARE(got.size(), 2);
+		QVERIFY(got[0].equals(chat));
+		QCOMPARE(got[1].type(), DP_MSG_MOVE_POINTER);
+		DP_MsgMovePointer *mmp = DP_msg_move_pointer_cast(got[1].get());
+		QCOMPARE(DP_msg_move_pointer_x(mmp), moveCount - 1);
+		QCOMPARE(DP_msg_move_pointer_y(mmp), moveCount - 1);
+	}
+
 	void testSendDisconnect()
 	{
 		auto s = getConnection();
@@ -222,6 +353,31 @@ private:
 		return q;
 	}
 
+	static QByteArray makeCompressedChunk(const QByteArray &data)
+	{
+		net::MessageDeflater deflater;
+		QByteArray compressed;
+		bool ok = deflater.deflate(
+			data.constData(), compat::cast_6<int>(data.size()), compressed);
+		Q_ASSERT(ok);
+		Q_UNUSED(ok);
+		Q_ASSERT(compressed.size() <= 0xffff);
+
+		QByteArray chunk;
+		char header[2];
+		qToBigEndian(quint16(compressed.size()), header);
+		chunk.append(header, 2);
+		chunk.append(char(DP_MSG_COMPRESSED));
+		chunk.append(char(0));
+		chunk.append(compressed);
+		return chunk;
+	}
+
+	static QString makeCompressibleText(int i)
+	{
+		return QStringLiteral("Message number %1. ").arg(i).repeated(20);
+	}
+
 	void loopUntil(bool &condition)
 	{
 		const int timeout = 3000;
@@ -5,27 +5,202 @@
 #include <QSqlQuery>
 #include <QMetaEnum>
 #include <QSqlError>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
 
 namespace server {
 
+static bool insertLogEntries(QSqlDatabase &db, const QVector<Log> &entries)
+{
+	if(!db.transaction()) {
+		qWarning("Couldn't begin log transaction: %s", qPrintable(db.lastError().text()));
+		return false;
+	}
+
+	QSqlQuery q(db);
+	q.prepare("INSERT INTO serverlog (timestamp, level, topic, user, session, message) VALUES (?, ?, ?, ?, ?, ?)");
+	for(const Log &entry : entries) {
+		q.bindValue(0, entry.timestamp().toString(Qt::ISODate));
+		q.bindValue(1, int(entry.level()));
+		q.bindValue(2, QMetaEnum::fromType<Log::Topic>().valueToKey(int(entry.topic())));
+		q.bindValue(3, entry.user());
+		q.bindValue(4, entry.session());
+		q.bindValue(5, entry.message());
+		q.exec();
+	}
+
+	if(!db.commit()) {
+		qWarning("Couldn't commit log entries: %s", qPrintable(db.lastError().text()));
+		db.rollback();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Writes queued log entries on its own thread and database connection. Each
+ * time it wakes up, it takes everything that piled up and writes it in a single
+ * transaction, so bursts of log entries only cost a single commit.
+ */
+class DbLogWriter final : public QThread
+{
+public:
+	// If the writer can't keep up, further log entries get dropped instead of
+	// eating up all the memory.
+	static constexpr int MAX_QUEUED = 10000;
+
+	explicit DbLogWriter(const QString &databaseName)
+		: m_databaseName(databaseName)
+		, m_connectionName(QStringLiteral("dblog-writer-%1").arg(quintptr(this)))
+	{
+	}
+
+	~DbLogWriter() override
+	{
+		{
+			QMutexLocker locker(&m_mutex);
+			m_stopping = true;
+		}
+		m_queueCond.wakeOne();
+		wait();
+	}
+
+	void push(const Log &entry)
+	{
+		{
+			QMutexLocker locker(&m_mutex);
+			if(m_queue.size() >= MAX_QUEUED) {
+				++m_dropped;
+				return;
+			}
+			m_queue.append(entry);
+			++m_queued;
+		}
+		m_queueCond.wakeOne();
+	}
+
+	void flush()
+	{
+		QMutexLocker locker(&m_mutex);
+		const quint64 target = m_queued;
+		while(m_written < target && isRunning())
+			m_flushedCond.wait(&m_mutex);
+	}
+
+protected:
+	void run() override
+	{
+		{
+			QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+			db.setDatabaseName(m_databaseName);
+			const bool opened = db.open();
+			if(!opened)
+				qWarning("Couldn't open database log writer connection: %s", qPrintable(db.lastError().text()));
+
+			QVector<Log> batch;
+			while(takeBatch(batch)) {
+				// Entries are consumed even if they can't be written, so that
+				// anyone waiting on a flush doesn't get stuck forever.
+				if(opened)
+					insertLogEntries(db, batch);
+				finishBatch(batch.size());
+				batch.clear();
+			}
+			db.close();
+		}
+		QSqlDatabase::removeDatabase(m_connectionName);
+	}
+
+private:
+	bool takeBatch(QVector<Log> &batch)
+	{
+		int dropped;
+		{
+			QMutexLocker locker(&m_mutex);
+			while(m_queue.isEmpty() && !m_stopping)
+				m_queueCond.wait(&m_mutex);
+			batch.swap(m_queue);
+			dropped = m_dropped;
+			m_dropped = 0;
+		}
+		if(dropped > 0)
+			qWarning("Database log writer fell behind, dropped %d log entries", dropped);
+		return !batch.isEmpty();
+	}
+
+	void finishBatch(int count)
+	{
+		{
+			QMutexLocker locker(&m_mutex);
+			m_written += count;
+		}
+		m_flushedCond.wakeAll();
+	}
+
+	const QString m_databaseName;
+	const QString m_connectionName;
+	QMutex m_mutex;
+	QWaitCondition m_queueCond;
+	QWaitCondition m_flushedCond;
+	QVector<Log> m_queue;
+	quint64 m_queued = 0;
+	quint64 m_written = 0;
+	int m_dropped = 0;
+	bool m_stopping = false;
+};
+
 DbLog::DbLog(const QSqlDatabase &db)
 	: m_db(db)
+	, m_writer(nullptr)
 {
 }
 
+DbLog::~DbLog()
+{
+	// Stops the writer thread after it wrote out whatever is still queued.
+	delete m_writer;
+}
+
 bool DbLog::initDb()
 {
 	QSqlQuery q(m_db);
-	return q.exec(
+	bool ok = q.exec(
 		"CREATE TABLE IF NOT EXISTS serverlog ("
 			"timestamp, level, topic, user, session, message"
 		");"
 	);
+
+	// Queries are ordered by timestamp (and rowid, which every index includes
+	// implicitly), optionally filtered by session. Purging goes by timestamp.
+	// Older databases don't have these yet, so they get added here too.
+	ok = ok
+		&& q.exec("CREATE INDEX IF NOT EXISTS serverlog_timestamp_idx ON serverlog (timestamp);")
+		&& q.exec("CREATE INDEX IF NOT EXISTS serverlog_session_timestamp_idx ON serverlog (session, timestamp);");
+
+	// In-memory databases can't be shared with a second connection. Writing to
+	// them doesn't touch the disk though, so it's fine to do that directly.
+	const QString databaseName = m_db.databaseName();
+	if(ok && !m_writer && !databaseName.isEmpty() && databaseName != QStringLiteral(":memory:")) {
+		m_writer = new DbLogWriter(databaseName);
+		m_writer->start();
+	}
+
+	return ok;
 }
 
-QList<Log> DbLog::getLogEntries(const QString &session, const QDateTime &after, Log::Level atleast, bool omitSensitive, int offset, int limit) const
+void DbLog::flush() const
 {
-	QString sql = "SELECT timestamp, session, user, level, topic, message FROM serverlog WHERE 1=1";
+	if(m_writer)
+		m_writer->flush();
+}
+
+QList<Log> DbLog::getLogEntries(const QString &session, const QDateTime &after, qint64 before, Log::Level atleast, bool omitSensitive, int offset, int limit) const
+{
+	flush();
+
+	QString sql = "SELECT timestamp, session, user, level, topic, message, rowid FROM serverlog WHERE 1=1";
 	QVariantList params;
 	if(!session.isEmpty()) {
 		sql += " AND session=?";
@@ -36,6 +211,15 @@ QList<Log> DbLog::getLogEntries(const QString &session, const QDateTime &after,
 		params << after.addMSecs(1000).toString(Qt::ISODate);
 	}
 
+	// Keyset pagination: continue right after the given entry in the sort
+	// order, which lets the index skip straight there instead of walking
+	// through every entry before it like an OFFSET would.
+	if(before > 0) {
+		sql += " AND timestamp <= (SELECT timestamp FROM serverlog WHERE rowid=?)"
+			" AND (timestamp < (SELECT timestamp FROM serverlog WHERE rowid=?) OR rowid < ?)";
+		params << before << before << before;
+	}
+
 	if(atleast < Log::Level::Debug) {
 		sql += " AND level<=?";
 		params << int(atleast);
@@ -75,22 +259,17 @@ QList<Log> DbLog::getLogEntries(const QString &session, const QDateTime &after,
 			Log::Level(q.value(3).toInt()),
 			Log::Topic(QMetaEnum::fromType<Log::Topic>().keyToValue(q.value(4).toString().toLocal8Bit().constData())),
 			q.value(5).toString()
-		);
+		).id(q.value(6).toLongLong());
 	}
 	return results;
 }
 
 void DbLog::storeMessage(const Log &entry)
 {
-	QSqlQuery q(m_db);
-	q.prepare("INSERT INTO serverlog (timestamp, level, topic, user, session, message) VALUES (?, ?, ?, ?, ?, ?)");
-	q.bindValue(0, entry.timestamp().toString(Qt::ISODate));
-	q.bindValue(1, int(entry.level()));
-	q.bindValue(2, QMetaEnum::fromType<Log::Topic>().valueToKey(int(entry.topic())));
-	q.bindValue(3, entry.user());
-	q.bindValue(4, entry.session());
-	q.bindValue(5, entry.message());
-	q.exec();
+	if(m_writer)
+		m_writer->push(entry);
+	else
+		insertLogEntries(m_db, {entry});
 }
 
 int DbLog::purgeLogs(int olderThanDays)
@@ -98,6 +277,8 @@ int DbLog::purgeLogs(int olderThanDays)
 	if(olderThanDays<=0)
 		return 0;
 
+	flush();
+
 	QSqlQuery q(m_db);
 	q.prepare("DELETE FROM serverlog WHERE timestamp < DATE('now', ?)");
 	q.bindValue(0, QStringLiteral("-%1 days").arg(olderThanDays));
@@ -9,14 +9,25 @@
 
 namespace server {
 
+class DbLogWriter;
+
+/**
+ * @brief Server log stored in the configuration database
+ *
+ * When the database is backed by a file, log entries are queued and written
+ * in batched transactions by a dedicated writer thread with its own database
+ * connection, so logging doesn't block the server's event loop. Queries flush
+ * the queue first, destroying the log flushes whatever is left.
+ */
 class DbLog final : public ServerLog
 {
 public:
 	explicit DbLog(const QSqlDatabase &db);
+	~DbLog() override;
 
 	bool initDb();
 
-	QList<Log> getLogEntries(const QString &session, const QDateTime &after, Log::Level atleast, bool omitSensitive, int offset, int limit) const override;
+	QList<Log> getLogEntries(const QString &session, const QDateTime &after, qint64 before, Log::Level atleast, bool omitSensitive, int offset, int limit) const override;
 
 	/**
 	 * @brief Delete all log entries older than the given number of days
@@ -25,11 +36,17 @@ public:
 	 */
 	int purgeLogs(int olderThanDays);
 
+	/**
+	 * @brief Wait until all queued log entries have been written
+	 */
+	void flush() const;
+
 protected:
 	void storeMessage(const Log &entry) override;
 
 private:
 	QSqlDatabase m_db;
+	DbLogWriter *m_writer;
 };
 
 }
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "thinsrv/multiserver.h"
 #include "cmake-config/config.h"
+#include "libserver/client.h"
+#include "libserver/metrics.h"
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
 #include "libserver/session.h"
@@ -38,11 +40,21 @@ MultiServer::MultiServer(ServerConfig *config, QObject *parent)
 	m_extBans(new ExtBans(config, this)),
 	m_state(STOPPED),
 	m_autoStop(false),
-	m_port(0)
+	m_port(0),
+	m_eventLoopLagMs(0)
 {
 	m_sessions = new SessionServer(config, this);
 	m_started = QDateTime::currentDateTimeUtc();
 
+	// The lag is how much later than scheduled this timer fires, which
+	// tells us how long the event loop was kept busy by something else.
+	QTimer *lagTimer = new QTimer(this);
+	lagTimer->setTimerType(Qt::PreciseTimer);
+	lagTimer->setInterval(LAG_TIMER_INTERVAL_MS);
+	connect(lagTimer, &QTimer::timeout, this, &MultiServer::measureEventLoopLag);
+	lagTimer->start();
+	m_lagTimer.start();
+
 	Database *db = qobject_cast<Database*>(m_config);
 	if(db) {
 		db->loadExternalIpBans(m_extBans);
@@ -66,6 +78,121 @@ MultiServer::MultiServer(ServerConfig *config, QObject *parent)
 	});
 }
 
+void MultiServer::measureEventLoopLag()
+{
+	m_eventLoopLagMs = qMax(qint64(0), m_lagTimer.restart() - LAG_TIMER_INTERVAL_MS);
+}
+
+QByteArray MultiServer::metricsText() const
+{
+	using Type = MetricsWriter::Type;
+	const QList<Session *> &sessions = m_sessions->sessions();
+	MetricsWriter w;
+
+	w.family("drawpile_sessions", Type::Gauge, "Number of active sessions");
+	w.sample("drawpile_sessions", {}, qint64(m_sessions->sessionCount()));
+
+	w.family("drawpile_users", Type::Gauge, "Number of connected users");
+	w.sample("drawpile_users", {}, qint64(m_sessions->totalUsers()));
+
+	w.family(
+		"drawpile_event_loop_lag_seconds", Type::Gauge,
+		"How late the main event loop last ran a scheduled timer");
+	w.sample(
+		"drawpile_event_loop_lag_seconds", {}, m_eventLoopLagMs / 1000.0);
+
+	w.family(
+		"drawpile_session_users", Type::Gauge, "Number of users in a session");
+	for(const Session *s : sessions) {
+		w.sample(
+			"drawpile_session_users", {{"session", s->id()}},
+			qint64(s->userCount()));
+	}
+
+	QVector<TrafficMetrics> traffic;
+	traffic.reserve(sessions.size());
+	for(const Session *s : sessions) {
+		traffic.append(s->trafficMetrics());
+	}
+
+	w.family(
+		"drawpile_session_messages_received_total", Type::Counter,
+		"Messages received from the users of a session");
+	for(int i = 0; i < sessions.size(); ++i) {
+		w.sample(
+			"drawpile_session_messages_received_total",
+			{{"session", sessions[i]->id()}}, traffic[i].messagesReceived);
+	}
+
+	w.family(
+		"drawpile_session_messages_sent_total", Type::Counter,
+		"Messages sent to the users of a session");
+	for(int i = 0; i < sessions.size(); ++i) {
+		w.sample(
+			"drawpile_session_messages_sent_total",
+			{{"session", sessions[i]->id()}}, traffic[i].messagesSent);
+	}
+
+	w.family(
+		"drawpile_session_received_bytes_total", Type::Counter,
+		"Bytes received from the users of a session");
+	for(int i = 0; i < sessions.size(); ++i) {
+		w.sample(
+			"drawpile_session_received_bytes_total",
+			{{"session", sessions[i]->id()}}, traffic[i].bytesReceived);
+	}
+
+	w.family(
+		"drawpile_session_sent_bytes_total", Type::Counter,
+		"Bytes sent to the users of a session");
+	for(int i = 0; i < sessions.size(); ++i) {
+		w.sample(
+			"drawpile_session_sent_bytes_total",
+			{{"session", sessions[i]->id()}}, traffic[i].bytesSent);
+	}
+
+	w.family(
+		"drawpile_session_history_bytes", Type::Gauge,
+		"Size of a session's history");
+	for(const Session *s : sessions) {
+		w.sample(
+			"drawpile_session_history_bytes", {{"session", s->id()}},
+			qint64(s->history()->sizeInBytes()));
+	}
+
+	w.family(
+		"drawpile_session_history_resident_blocks", Type::Gauge,
+		"History blocks of a session currently cached in memory");
+	for(const Session *s : sessions) {
+		w.sample(
+			"drawpile_session_history_resident_blocks", {{"session", s->id()}},
+			qint64(s->history()->residentBlockCount()));
+	}
+
+	w.family(
+		"drawpile_session_catchup_duration_seconds", Type::Histogram,
+		"Time it took joining users to receive the session history");
+	for(const Session *s : sessions) {
+		w.histogram(
+			"drawpile_session_catchup_duration_seconds", {{"session", s->id()}},
+			s->catchupDurations());
+	}
+
+	w.family(
+		"drawpile_client_upload_queue_bytes", Type::Gauge,
+		"Bytes waiting to be sent to a user");
+	for(const Session *s : sessions) {
+		for(const Client *c : s->clients()) {
+			w.sample(
+				"drawpile_client_upload_queue_bytes",
+				{{"session", s->id()}, {"user", QString::number(c->id())}},
+				qint64(c->uploadQueueBytes()));
+		}
+	}
+
+	return w.text();
+}
+
 /**
  * @brief Automatically stop server when last session is closed
  *
@@ -543,6 +670,7 @@ JsonApiResult MultiServer::serverJsonApi(JsonApiMethod method, const QStringList
 #	endif
 #endif
 		config::SessionUserLimit,
+		config::EnableCompression,
 	};
 	const int settingCount = sizeof(settings) / sizeof(settings[0]);
 
@@ -908,7 +1036,17 @@ JsonApiResult MultiServer::logJsonApi(JsonApiMethod method, const QStringList &p
 		return JsonApiBadMethod();
 
 	auto q = m_config->logger()->query();
-	q.page(request.value("page").toInt(), 100);
+
+	// Query parameters come in as strings, so go through QVariant to convert.
+	if(request.contains("before")) {
+		bool ok;
+		qint64 before = request.value("before").toVariant().toLongLong(&ok);
+		if(!ok || before <= 0)
+			return JsonApiErrorResult(JsonApiResult::BadRequest, "Invalid cursor");
+		q.before(before).page(0, 100);
+	} else {
+		q.page(request.value("page").toVariant().toInt(), 100);
+	}
 
 	if(request.contains("session"))
 		q.session(request.value("session").toString());
@@ -922,7 +1060,7 @@ JsonApiResult MultiServer::logJsonApi(JsonApiMethod method, const QStringList &p
 
 	QJsonArray out;
 	for(const Log &log : q.omitSensitive(false).get()) {
-		out.append(log.toJson());
+		out.append(log.toJson(Log::WithId));
 	}
 
 	return JsonApiResult { JsonApiResult::Ok, QJsonDocument(out) };
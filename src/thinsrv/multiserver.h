@@ -6,6 +6,7 @@
 #include <QObject>
 #include <QHostAddress>
 #include <QDateTime>
+#include <QElapsedTimer>
 
 class QDir;
 class QTcpServer;
@@ -58,6 +59,13 @@ public:
 
 	ServerConfig *config() { return m_config; }
 
+	/**
+	 * @brief Get server metrics in the Prometheus text exposition format
+	 *
+	 * This is used by the HTTP admin's /metrics endpoint.
+	 */
+	Q_INVOKABLE QByteArray metricsText() const;
+
 public slots:
 	void setSessionDirectory(const QDir &dir);
 
@@ -95,6 +103,7 @@ private slots:
 	void printStatusUpdate();
 	void tryAutoStop();
 	void assignRecording(Session *session);
+	void measureEventLoopLag();
 
 signals:
 	void serverStartError(const QString &message);
@@ -123,6 +132,8 @@ private:
 
 	enum State {RUNNING, STOPPING, STOPPED};
 
+	static constexpr int LAG_TIMER_INTERVAL_MS = 1000;
+
 	ServerConfig *m_config;
 	QTcpServer *m_tcpServer;
 #ifdef HAVE_WEBSOCKETS
@@ -142,6 +153,9 @@ private:
 	QString m_recordingPath;
 
 	QDateTime m_started;
+
+	QElapsedTimer m_lagTimer;
+	qint64 m_eventLoopLagMs;
 };
 
 }
@@ -3,6 +3,7 @@
 #include "thinsrv/database.h"
 #include "thinsrv/dblog.h"
 
+#include <QTemporaryDir>
 #include <QtTest/QtTest>
 
 using server::Database;
@@ -47,10 +48,80 @@ private slots:
 		QCOMPARE(logEntryCount(), 1);
 	}
 
+	void testFileLogWriting()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const QString path = dir.filePath("test.db");
+		const QDateTime now = QDateTime::currentDateTimeUtc();
+
+		// File-backed logs are written on a separate thread, queries must
+		// still see everything logged before them.
+		m_db.reset(new Database);
+		QVERIFY(m_db->openFile(path));
+		logger = dynamic_cast<DbLog*>(m_db->logger());
+		QVERIFY(logger);
+		logger->setSilent(true);
+
+		for(int i = 0; i < 1000; ++i)
+			logger->logMessage(Log(now, QString(), "test", Log::Level::Info, Log::Topic::Status, QString::number(i)));
+		QCOMPARE(logEntryCount(), 1000);
+
+		// Entries still queued up on shutdown must not get lost.
+		for(int i = 0; i < 500; ++i)
+			logger->logMessage(Log(now, QString(), "test", Log::Level::Info, Log::Topic::Status, QString::number(i)));
+		m_db.reset();
+
+		m_db.reset(new Database);
+		QVERIFY(m_db->openFile(path));
+		logger = dynamic_cast<DbLog*>(m_db->logger());
+		QVERIFY(logger);
+		logger->setSilent(true);
+		QCOMPARE(logEntryCount(), 1500);
+		m_db.reset();
+	}
+
+	void testLogCursorPaging()
+	{
+		const QDateTime now = QDateTime::currentDateTimeUtc();
+
+		// Entries with the same timestamp are ordered by id, those must not
+		// get skipped or repeated across pages.
+		for(int i = 0; i < 95; ++i)
+			logger->logMessage(Log(now.addSecs(-(i / 10)), i % 2 ? QString("s") : QString(), "test", Log::Level::Info, Log::Topic::Status, QString::number(i)));
+
+		const QList<Log> all = logger->query().omitSensitive(false).get();
+		QCOMPARE(all.size(), 95);
+
+		QList<Log> paged;
+		qint64 before = 0;
+		while(true) {
+			const QList<Log> page = logger->query().before(before).page(0, 10).get();
+			if(page.isEmpty())
+				break;
+			QVERIFY(page.size() <= 10);
+			paged.append(page);
+			before = page.last().id();
+		}
+
+		QCOMPARE(paged.size(), all.size());
+		for(int i = 0; i < all.size(); ++i) {
+			QVERIFY(all[i].id() > 0);
+			QCOMPARE(paged[i].id(), all[i].id());
+			QCOMPARE(paged[i].message(), all[i].message());
+		}
+
+		const QList<Log> sessionAll = logger->query().session("s").get();
+		QCOMPARE(sessionAll.size(), 47);
+		const QList<Log> sessionPage = logger->query().session("s").before(sessionAll[19].id()).page(0, 10).get();
+		QCOMPARE(sessionPage.size(), 10);
+		QCOMPARE(sessionPage.first().id(), sessionAll[20].id());
+	}
+
 private:
 	int logEntryCount()
 	{
-		return logger->getLogEntries(QString(), QDateTime(), Log::Level::Debug, false, 0, 0).size();
+		return logger->getLogEntries(QString(), QDateTime(), 0, Log::Level::Debug, false, 0, 0).size();
 	}
 
 	QScopedPointer<Database> m_db;
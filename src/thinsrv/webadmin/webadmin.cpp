@@ -101,6 +101,21 @@ void Webadmin::setSessions(MultiServer *server)
 
 		return HttpResponse::JsonResponse(result.body, result.status);
 	});
+
+	m_server->addRequestHandler("^/metrics$", [server](const HttpRequest &req) {
+		if(req.method() != HttpRequest::HEAD && req.method() != HttpRequest::GET)
+			return HttpResponse::MethodNotAllowed(QStringList() << "HEAD" << "GET");
+
+		QByteArray text;
+		QMetaObject::invokeMethod(
+			server, "metricsText", Qt::BlockingQueuedConnection,
+			Q_RETURN_ARG(QByteArray, text)
+			);
+
+		HttpResponse r(200, req.method() == HttpRequest::HEAD ? QByteArray() : text);
+		r.setHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+		return r;
+	});
 }
 
 void Webadmin::setStaticFileRoot(const QDir &dir)
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "tools/drawpile-loadtest/inprocessserver.h"
+#include "libserver/inmemoryconfig.h"
+#include "thinsrv/multiserver.h"
+#include <QHostAddress>
+
+namespace loadtest {
+
+InProcessServer::InProcessServer()
+{
+	m_thread.setObjectName(QStringLiteral("loadtest-server"));
+}
+
+InProcessServer::~InProcessServer()
+{
+	stop();
+}
+
+bool InProcessServer::start(QString &outError)
+{
+	if(m_context) {
+		outError = QStringLiteral("Server already started");
+		return false;
+	}
+
+	m_context = new QObject;
+	m_context->moveToThread(&m_thread);
+	m_thread.start();
+
+	bool ok = false;
+	QMetaObject::invokeMethod(
+		m_context,
+		[&] {
+			server::InMemoryConfig *config = new server::InMemoryConfig;
+			// Nothing should cut the test short: no limit on the session size
+			// and no autoresets, the history just keeps on growing.
+			config->setConfigString(
+				server::config::SessionSizeLimit, QStringLiteral("0"));
+			config->setConfigString(
+				server::config::AutoresetThreshold, QStringLiteral("0"));
+
+			m_server = new server::MultiServer(config);
+			config->setParent(m_server);
+
+			QString error;
+			QMetaObject::Connection connection = QObject::connect(
+				m_server, &server::MultiServer::serverStartError, m_context,
+				[&error](const QString &message) {
+					error = message;
+				});
+			ok = m_server->start(0, QHostAddress::LocalHost);
+			QObject::disconnect(connection);
+
+			if(ok) {
+				m_port = quint16(m_server->port());
+			} else {
+				outError = error.isEmpty()
+							   ? QStringLiteral("Couldn't start server")
+							   : error;
+				delete m_server;
+				m_server = nullptr;
+			}
+		},
+		Qt::BlockingQueuedConnection);
+
+	if(!ok) {
+		stop();
+	}
+	return ok;
+}
+
+void InProcessServer::stop()
+{
+	if(m_context) {
+		if(m_server) {
+			QMetaObject::invokeMethod(
+				m_context,
+				[this] {
+					m_server->stop();
+					delete m_server;
+					m_server = nullptr;
+				},
+				Qt::BlockingQueuedConnection);
+		}
+		m_thread.quit();
+		m_thread.wait();
+		delete m_context;
+		m_context = nullptr;
+		m_port = 0;
+	}
+}
+
+ResourceUsage InProcessServer::usage()
+{
+	ResourceUsage result;
+	if(m_context) {
+		QMetaObject::invokeMethod(
+			m_context,
+			[&result] {
+				result = ResourceUsage::currentThread();
+			},
+			Qt::BlockingQueuedConnection);
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TOOLS_LOADTEST_INPROCESSSERVER_H
+#define TOOLS_LOADTEST_INPROCESSSERVER_H
+#include "tools/drawpile-loadtest/loadtest.h"
+#include <QString>
+#include <QThread>
+
+namespace server {
+class MultiServer;
+}
+
+namespace loadtest {
+
+/**
+ * @brief A session server running on its own thread, listening on localhost
+ *
+ * The thread is there so that the server's CPU time can be told apart from
+ * the one of the simulated clients and so that they don't get in each other's
+ * way on the event loop.
+ */
+class InProcessServer final {
+public:
+	InProcessServer();
+	~InProcessServer();
+
+	InProcessServer(const InProcessServer &) = delete;
+	InProcessServer &operator=(const InProcessServer &) = delete;
+
+	//! Start listening on a free port on localhost.
+	bool start(QString &outError);
+	void stop();
+
+	quint16 port() const { return m_port; }
+
+	//! CPU time spent on the server thread so far.
+	ResourceUsage usage();
+
+private:
+	QThread m_thread;
+	QObject *m_context = nullptr;
+	server::MultiServer *m_server = nullptr;
+	quint16 m_port = 0;
+};
+
+}
+
+#endif
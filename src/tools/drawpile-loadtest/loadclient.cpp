@@ -0,0 +1,429 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "tools/drawpile-loadtest/loadclient.h"
+#include "cmake-config/config.h"
+#include "libshared/net/protover.h"
+#include "libshared/net/servercmd.h"
+#include "libshared/net/tcpmessagequeue.h"
+#include "libshared/util/qtcompat.h"
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace loadtest {
+
+LoadClient::LoadClient(
+	int index, const ClientSettings &settings, const QElapsedTimer &clock,
+	QObject *parent)
+	: QObject(parent)
+	, m_index(index)
+	, m_settings(settings)
+	, m_clock(clock)
+	, m_socket(new QTcpSocket(this))
+	, m_queue(new net::TcpMessageQueue(m_socket, false, this))
+	, m_sendTimer(new QTimer(this))
+	, m_undoTimer(new QTimer(this))
+	, m_chatTimer(new QTimer(this))
+{
+	m_queue->setPingInterval(PING_INTERVAL_MS);
+
+	connect(m_socket, &QTcpSocket::connected, this, [this] {
+		if(m_state == State::Connecting) {
+			m_state = State::ExpectGreeting;
+		}
+	});
+	connect(
+		m_socket, compat::SocketError, this, &LoadClient::handleSocketError);
+	connect(
+		m_socket, &QTcpSocket::disconnected, this,
+		&LoadClient::handleDisconnected);
+
+	connect(
+		m_queue, &net::MessageQueue::messageAvailable, this,
+		&LoadClient::receiveMessages);
+	connect(
+		m_queue, &net::MessageQueue::gracefulDisconnect, this,
+		[this](
+			net::MessageQueue::GracefulDisconnect reason,
+			const QString &message) {
+			Q_UNUSED(reason);
+			fail(QStringLiteral("Disconnected by server: %1").arg(message));
+		});
+	connect(m_queue, &net::MessageQueue::timedOut, this, [this] {
+		fail(QStringLiteral("Connection timed out"));
+	});
+
+	m_sendTimer->setTimerType(Qt::PreciseTimer);
+	m_sendTimer->setInterval(SEND_INTERVAL_MS);
+	connect(m_sendTimer, &QTimer::timeout, this, &LoadClient::sendTraffic);
+	connect(m_undoTimer, &QTimer::timeout, this, &LoadClient::sendUndo);
+	connect(m_chatTimer, &QTimer::timeout, this, &LoadClient::sendChat);
+}
+
+void LoadClient::start()
+{
+	Q_ASSERT(m_state == State::Idle);
+	m_state = State::Connecting;
+	m_socket->connectToHost(m_settings.host, m_settings.port);
+}
+
+void LoadClient::stop()
+{
+	stopTimers();
+	if(m_state != State::Failed) {
+		m_state = State::Stopped;
+	}
+	m_socket->disconnectFromHost();
+}
+
+qint64 LoadClient::bytesSent() const
+{
+	return m_queue->totalBytesSent();
+}
+
+qint64 LoadClient::bytesReceived() const
+{
+	return m_queue->totalBytesReceived();
+}
+
+void LoadClient::receiveMessages()
+{
+	while(m_queue->isPending()) {
+		net::Message msg = m_queue->shiftPending();
+		++m_messagesReceived;
+		switch(m_state) {
+		case State::ExpectGreeting:
+		case State::ExpectIdentOk:
+		case State::ExpectJoinOk:
+			if(msg.type() == DP_MSG_SERVER_COMMAND) {
+				handleLoginReply(net::ServerReply::fromMessage(msg));
+			}
+			break;
+		case State::CatchingUp:
+		case State::Running:
+			handleSessionMessage(msg);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void LoadClient::handleLoginReply(const net::ServerReply &reply)
+{
+	if(reply.type == net::ServerReply::ReplyType::Error) {
+		fail(QStringLiteral("Login error: %1").arg(reply.message));
+		return;
+	}
+
+	// Session listings and title updates can arrive at any point during the
+	// login, they're of no interest to us.
+	switch(m_state) {
+	case State::ExpectGreeting:
+		handleGreeting(reply);
+		break;
+	case State::ExpectIdentOk:
+		if(reply.type == net::ServerReply::ReplyType::Result) {
+			QString state = reply.reply[QStringLiteral("state")].toString();
+			if(state == QStringLiteral("identOk")) {
+				handleIdentOk();
+			} else {
+				fail(QStringLiteral("Unexpected ident result '%1'").arg(state));
+			}
+		}
+		break;
+	case State::ExpectJoinOk:
+		if(reply.type == net::ServerReply::ReplyType::Result) {
+			handleJoinOk(reply);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void LoadClient::handleGreeting(const net::ServerReply &reply)
+{
+	if(reply.type != net::ServerReply::ReplyType::Login) {
+		fail(QStringLiteral("Server greeting is not a login message"));
+		return;
+	}
+
+	int serverVersion = reply.reply[QStringLiteral("version")].toInt();
+	int ourVersion = protocol::ProtocolVersion::current().serverVersion();
+	if(serverVersion != ourVersion) {
+		fail(QStringLiteral("Server protocol version %1, expected %2")
+				 .arg(serverVersion)
+				 .arg(ourVersion));
+		return;
+	}
+
+	QJsonArray flags = reply.reply[QStringLiteral("flags")].toArray();
+	if(flags.contains(QStringLiteral("TLS"))) {
+		fail(QStringLiteral("Server requires TLS, which isn't supported"));
+		return;
+	} else if(flags.contains(QStringLiteral("NOGUEST"))) {
+		fail(QStringLiteral("Server doesn't allow guest logins"));
+		return;
+	}
+	m_compress = flags.contains(QStringLiteral("DEFLATE"));
+
+	m_state = State::ExpectIdentOk;
+	sendCommand(
+		QStringLiteral("ident"), {QStringLiteral("load%1").arg(m_index + 1)},
+		{{QStringLiteral("intent"), QStringLiteral("guest")}});
+}
+
+void LoadClient::handleIdentOk()
+{
+	QJsonObject kwargs = {
+		{QStringLiteral("app_version"), cmake_config::version()},
+		{QStringLiteral("os"), QStringLiteral("loadtest")},
+		{QStringLiteral("s"), makeSid()},
+		{QStringLiteral("capabilities"), QStringLiteral("KEEPALIVE,DEFLATE")},
+	};
+
+	// The server may start compressing in the same read as its reply.
+	if(m_compress) {
+		m_queue->setDecompressionEnabled(true);
+	}
+
+	m_state = State::ExpectJoinOk;
+	m_joinSentUs = nowUs();
+	if(isHost()) {
+		kwargs[QStringLiteral("protocol")] =
+			protocol::ProtocolVersion::current().asString();
+		kwargs[QStringLiteral("user_id")] = 1;
+		sendCommand(QStringLiteral("host"), {}, kwargs);
+	} else {
+		sendCommand(QStringLiteral("join"), {m_settings.sessionId}, kwargs);
+	}
+}
+
+void LoadClient::handleJoinOk(const net::ServerReply &reply)
+{
+	QString state = reply.reply[QStringLiteral("state")].toString();
+	if(state != QStringLiteral("host") && state != QStringLiteral("join")) {
+		fail(QStringLiteral("Unexpected login result '%1'").arg(state));
+		return;
+	}
+
+	QJsonObject join = reply.reply[QStringLiteral("join")].toObject();
+	m_sessionId = join[QStringLiteral("id")].toString();
+	m_userId = join[QStringLiteral("user")].toInt();
+	if(m_userId < 1 || m_userId > 254) {
+		fail(QStringLiteral("User id %1 out of range").arg(m_userId));
+		return;
+	}
+
+	m_queue->setContextId(unsigned(m_userId));
+	// The server only starts compressing after the login is done, so that
+	// passwords don't end up in the compression state. We do the same.
+	if(m_compress) {
+		m_queue->setCompressionEnabled(true);
+	}
+
+	if(isHost()) {
+		sendInitialState();
+		startRunning();
+	} else {
+		// The server tells us how much history to expect and then puts a
+		// marker with the same key at the end of it.
+		m_state = State::CatchingUp;
+	}
+}
+
+void LoadClient::handleSessionMessage(const net::Message &msg)
+{
+	if(m_state == State::CatchingUp) {
+		++m_catchupMessages;
+	}
+
+	DP_MessageType type = msg.type();
+	if(type == DP_MSG_SERVER_COMMAND) {
+		handleSessionReply(net::ServerReply::fromMessage(msg));
+	} else if(
+		m_state == State::Running && int(msg.contextId()) == m_userId &&
+		(msg.isInCommandRange() || type == DP_MSG_CHAT)) {
+		handleEcho(msg);
+	}
+}
+
+void LoadClient::handleSessionReply(const net::ServerReply &reply)
+{
+	switch(reply.type) {
+	case net::ServerReply::ReplyType::Catchup:
+		if(m_state == State::CatchingUp && m_catchupKey == -1) {
+			m_catchupKey = reply.reply[QStringLiteral("key")].toInt();
+		}
+		break;
+	case net::ServerReply::ReplyType::CaughtUp:
+		if(m_state == State::CatchingUp &&
+		   reply.reply[QStringLiteral("key")].toInt() == m_catchupKey) {
+			m_catchupMs = (nowUs() - m_joinSentUs) / 1000;
+			startRunning();
+		}
+		break;
+	case net::ServerReply::ReplyType::Error:
+		qWarning(
+			"Client %d: server error: %s", m_index + 1,
+			qUtf8Printable(reply.message));
+		break;
+	default:
+		break;
+	}
+}
+
+void LoadClient::handleEcho(const net::Message &msg)
+{
+	// Our messages come back in the order we sent them, so this is normally
+	// the one at the front. Anything skipped over to get to it must have been
+	// dropped by the server. If nothing matches, this isn't something we're
+	// tracking and it mustn't throw off the ones we are.
+	DP_MessageType type = msg.type();
+	compat::sizetype count = m_pending.size();
+	for(compat::sizetype i = 0; i < count; ++i) {
+		const PendingEcho &pe = m_pending.at(i);
+		if(pe.type == type) {
+			m_latenciesUs.append(nowUs() - pe.sentUs);
+			m_messagesLost += i;
+			m_pending.erase(m_pending.begin(), m_pending.begin() + i + 1);
+			return;
+		}
+	}
+}
+
+void LoadClient::sendCommand(
+	const QString &cmd, const QJsonArray &args, const QJsonObject &kwargs)
+{
+	m_queue->send(net::ServerCommand::make(cmd, args, kwargs));
+	++m_messagesSent;
+}
+
+void LoadClient::sendInitialState()
+{
+	// The server doesn't look at what's being drawn, so this just needs to be
+	// something a real client could have sent.
+	unsigned int contextId = unsigned(m_userId);
+	char title[] = "Layer 1";
+	net::Message msgs[] = {
+		net::Message::noinc(DP_msg_canvas_resize_new(
+			contextId, 0, CANVAS_WIDTH, CANVAS_HEIGHT, 0)),
+		net::Message::noinc(DP_msg_layer_tree_create_new(
+			contextId, uint16_t((m_userId << 8) | 1), 0, 0, 0, 0, title,
+			sizeof(title) - 1)),
+	};
+	// These get tracked too, since their echoes arrive after the drawing
+	// commands have already started going out.
+	for(const net::Message &msg : msgs) {
+		sendTracked(msg);
+	}
+	sendCommand(QStringLiteral("init-complete"), {}, {});
+}
+
+void LoadClient::startRunning()
+{
+	m_state = State::Running;
+	m_runningSinceUs = nowUs();
+
+	if(m_settings.traffic && !m_settings.traffic->isEmpty() &&
+	   m_settings.messagesPerSecond > 0.0) {
+		m_sendTimer->start();
+	}
+
+	if(m_settings.undosPerMinute > 0.0) {
+		m_undoTimer->start(
+			qMax(1, qRound(60000.0 / m_settings.undosPerMinute)));
+	}
+
+	if(m_settings.chatsPerMinute > 0.0) {
+		m_chatTimer->start(
+			qMax(1, qRound(60000.0 / m_settings.chatsPerMinute)));
+	}
+
+	emit running(this);
+}
+
+void LoadClient::sendTraffic()
+{
+	// Send however many messages we're behind on, so that the rate holds even
+	// if the timer fires late because the event loop was busy.
+	double elapsedSecs = double(nowUs() - m_runningSinceUs) / 1000000.0;
+	qint64 due =
+		qint64(m_settings.messagesPerSecond * elapsedSecs) - m_trafficSent;
+	const net::MessageList &traffic = *m_settings.traffic;
+	qint64 size = traffic.size();
+	for(qint64 i = 0; i < due && i < MAX_SENDS_PER_TICK; ++i) {
+		qint64 index = (m_settings.trafficOffset + m_trafficSent) % size;
+		sendTracked(traffic[int(index)]);
+		++m_trafficSent;
+	}
+}
+
+void LoadClient::sendUndo()
+{
+	sendTracked(
+		net::Message::noinc(DP_msg_undo_new(unsigned(m_userId), 0, false)));
+}
+
+void LoadClient::sendChat()
+{
+	++m_chatsSent;
+	sendTracked(net::makeChatMessage(
+		uint8_t(m_userId), 0, 0,
+		QStringLiteral("Load test message %1").arg(m_chatsSent)));
+}
+
+void LoadClient::sendTracked(const net::Message &msg)
+{
+	// The server overwrites the context id with our own, so the same message
+	// can be shared between all clients.
+	m_pending.enqueue({msg.type(), nowUs()});
+	m_queue->send(msg);
+	++m_messagesSent;
+}
+
+void LoadClient::handleSocketError(QAbstractSocket::SocketError error)
+{
+	if(error != QAbstractSocket::RemoteHostClosedError) {
+		fail(m_socket->errorString());
+	}
+}
+
+void LoadClient::handleDisconnected()
+{
+	fail(QStringLiteral("Disconnected"));
+}
+
+void LoadClient::fail(const QString &error)
+{
+	if(m_state != State::Stopped && m_state != State::Failed) {
+		stopTimers();
+		m_state = State::Failed;
+		m_error = error;
+		m_socket->abort();
+		emit failed(this);
+	}
+}
+
+void LoadClient::stopTimers()
+{
+	m_sendTimer->stop();
+	m_undoTimer->stop();
+	m_chatTimer->stop();
+}
+
+QString LoadClient::makeSid() const
+{
+	// The server wants a 32 digit hex string, one per simulated system.
+	return QStringLiteral("%1").arg(
+		qulonglong(m_index + 1), 32, 16, QLatin1Char('0'));
+}
+
+qint64 LoadClient::nowUs() const
+{
+	return m_clock.nsecsElapsed() / 1000;
+}
+
+}
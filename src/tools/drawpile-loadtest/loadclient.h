@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TOOLS_LOADTEST_LOADCLIENT_H
+#define TOOLS_LOADTEST_LOADCLIENT_H
+#include "libshared/net/message.h"
+#include <QAbstractSocket>
+#include <QObject>
+#include <QQueue>
+#include <QString>
+#include <QVector>
+
+class QElapsedTimer;
+class QJsonArray;
+class QJsonObject;
+class QTcpSocket;
+class QTimer;
+
+namespace net {
+class MessageQueue;
+struct ServerReply;
+}
+
+namespace loadtest {
+
+struct ClientSettings {
+	QString host;
+	quint16 port = 0;
+	// Session to join, empty to host a new one.
+	QString sessionId;
+	// Recorded or generated drawing commands to replay, in a loop.
+	const net::MessageList *traffic = nullptr;
+	int trafficOffset = 0;
+	double messagesPerSecond = 0.0;
+	double undosPerMinute = 0.0;
+	double chatsPerMinute = 0.0;
+};
+
+/**
+ * @brief A simulated user that logs into a session and draws in it
+ *
+ * Everything the client sends that goes into the session history gets relayed
+ * back to it by the server in the same order. The time between sending and
+ * getting it back is recorded as the relay latency.
+ */
+class LoadClient final : public QObject {
+	Q_OBJECT
+public:
+	enum class State {
+		Idle,
+		Connecting,
+		ExpectGreeting,
+		ExpectIdentOk,
+		ExpectJoinOk,
+		CatchingUp,
+		Running,
+		Stopped,
+		Failed,
+	};
+
+	LoadClient(
+		int index, const ClientSettings &settings, const QElapsedTimer &clock,
+		QObject *parent = nullptr);
+
+	void start();
+	void stop();
+
+	int index() const { return m_index; }
+	bool isHost() const { return m_settings.sessionId.isEmpty(); }
+	bool isLateJoiner() const { return m_lateJoiner; }
+	void setLateJoiner(bool lateJoiner) { m_lateJoiner = lateJoiner; }
+
+	State state() const { return m_state; }
+	const QString &error() const { return m_error; }
+	int userId() const { return m_userId; }
+	const QString &sessionId() const { return m_sessionId; }
+
+	//! Relay latencies in microseconds, in the order they were measured.
+	const QVector<qint64> &latenciesUs() const { return m_latenciesUs; }
+
+	//! Time from sending the join command to being caught up, -1 if none.
+	qint64 catchupMs() const { return m_catchupMs; }
+	int catchupMessages() const { return m_catchupMessages; }
+
+	qint64 messagesSent() const { return m_messagesSent; }
+	qint64 messagesReceived() const { return m_messagesReceived; }
+	//! Own messages that never came back, the server must have dropped them.
+	qint64 messagesLost() const { return m_messagesLost; }
+	//! Own messages still on their way when the client was stopped.
+	qint64 messagesInFlight() const { return m_pending.size(); }
+	qint64 bytesSent() const;
+	qint64 bytesReceived() const;
+
+signals:
+	//! The client is now drawing in the session.
+	void running(LoadClient *client);
+	void failed(LoadClient *client);
+
+private:
+	static constexpr int CANVAS_WIDTH = 1920;
+	static constexpr int CANVAS_HEIGHT = 1080;
+	static constexpr int PING_INTERVAL_MS = 15 * 1000;
+	static constexpr int SEND_INTERVAL_MS = 10;
+	static constexpr int MAX_SENDS_PER_TICK = 1000;
+
+	struct PendingEcho {
+		DP_MessageType type;
+		qint64 sentUs;
+	};
+
+	void receiveMessages();
+	void handleLoginReply(const net::ServerReply &reply);
+	void handleGreeting(const net::ServerReply &reply);
+	void handleIdentOk();
+	void handleJoinOk(const net::ServerReply &reply);
+	void handleSessionMessage(const net::Message &msg);
+	void handleSessionReply(const net::ServerReply &reply);
+	void handleEcho(const net::Message &msg);
+
+	void sendCommand(
+		const QString &cmd, const QJsonArray &args, const QJsonObject &kwargs);
+	void sendInitialState();
+	void startRunning();
+	void sendTraffic();
+	void sendUndo();
+	void sendChat();
+	void sendTracked(const net::Message &msg);
+
+	void handleSocketError(QAbstractSocket::SocketError error);
+	void handleDisconnected();
+	void fail(const QString &error);
+	void stopTimers();
+
+	QString makeSid() const;
+	qint64 nowUs() const;
+
+	const int m_index;
+	const ClientSettings m_settings;
+	const QElapsedTimer &m_clock;
+	bool m_lateJoiner = false;
+	State m_state = State::Idle;
+	QString m_error;
+	QTcpSocket *m_socket = nullptr;
+	net::MessageQueue *m_queue = nullptr;
+	QTimer *m_sendTimer = nullptr;
+	QTimer *m_undoTimer = nullptr;
+	QTimer *m_chatTimer = nullptr;
+	bool m_compress = false;
+	int m_userId = 0;
+	QString m_sessionId;
+
+	qint64 m_joinSentUs = 0;
+	int m_catchupKey = -1;
+	qint64 m_catchupMs = -1;
+	int m_catchupMessages = 0;
+
+	qint64 m_runningSinceUs = 0;
+	qint64 m_trafficSent = 0;
+	int m_chatsSent = 0;
+	QQueue<PendingEcho> m_pending;
+	QVector<qint64> m_latenciesUs;
+	qint64 m_messagesSent = 0;
+	qint64 m_messagesReceived = 0;
+	qint64 m_messagesLost = 0;
+};
+
+}
+
+#endif
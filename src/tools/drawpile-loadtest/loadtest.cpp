@@ -0,0 +1,473 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include "dpcommon/common.h"
+#include "dpengine/load.h"
+#include "dpengine/player.h"
+#include "dpmsg/blend_mode.h"
+}
+#include "tools/drawpile-loadtest/loadtest.h"
+#include "tools/drawpile-loadtest/loadclient.h"
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace loadtest {
+
+namespace {
+
+#ifdef Q_OS_UNIX
+double timevalToSecs(const struct timeval &tv)
+{
+	return double(tv.tv_sec) + double(tv.tv_usec) / 1000000.0;
+}
+#endif
+
+void setGeneratedDabs(int count, DP_ClassicDab *cds, void *user)
+{
+	QRandomGenerator *rng = static_cast<QRandomGenerator *>(user);
+	for(int i = 0; i < count; ++i) {
+		DP_classic_dab_init(
+			cds, i, int8_t(rng->bounded(-16, 17)),
+			int8_t(rng->bounded(-16, 17)), uint16_t(rng->bounded(256, 4096)),
+			200, 128);
+	}
+}
+
+// Nearest rank method, the input must be sorted.
+qint64 percentile(const QVector<qint64> &sorted, double p)
+{
+	if(sorted.isEmpty()) {
+		return -1;
+	}
+	int rank = int(std::ceil(p * double(sorted.size())));
+	return sorted[qBound(0, rank - 1, sorted.size() - 1)];
+}
+
+QString formatUsAsMs(qint64 us)
+{
+	return us < 0 ? QStringLiteral("-")
+				  : QString::number(double(us) / 1000.0, 'f', 2);
+}
+
+QString stateName(const LoadClient *client)
+{
+	switch(client->state()) {
+	case LoadClient::State::Idle:
+		return QStringLiteral("idle");
+	case LoadClient::State::Connecting:
+	case LoadClient::State::ExpectGreeting:
+	case LoadClient::State::ExpectIdentOk:
+	case LoadClient::State::ExpectJoinOk:
+		return QStringLiteral("login");
+	case LoadClient::State::CatchingUp:
+		return QStringLiteral("catchup");
+	case LoadClient::State::Running:
+		return QStringLiteral("running");
+	case LoadClient::State::Stopped:
+		return QStringLiteral("ok");
+	case LoadClient::State::Failed:
+		return QStringLiteral("FAILED");
+	}
+	return QStringLiteral("?");
+}
+
+}
+
+ResourceUsage ResourceUsage::process()
+{
+	ResourceUsage usage;
+#ifdef Q_OS_UNIX
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) == 0) {
+		usage.userCpu = timevalToSecs(ru.ru_utime);
+		usage.systemCpu = timevalToSecs(ru.ru_stime);
+#ifdef Q_OS_MACOS
+		// macOS reports this in bytes rather than kilobytes.
+		usage.maxRssKb = qint64(ru.ru_maxrss) / 1024;
+#else
+		usage.maxRssKb = qint64(ru.ru_maxrss);
+#endif
+	}
+#endif
+#ifdef Q_OS_LINUX
+	// The second field is the resident set size in pages.
+	QFile statm(QStringLiteral("/proc/self/statm"));
+	if(statm.open(QIODevice::ReadOnly)) {
+		QList<QByteArray> fields = statm.readAll().split(' ');
+		long pageSize = sysconf(_SC_PAGESIZE);
+		bool ok = false;
+		qint64 pages = fields.size() > 1 ? fields[1].toLongLong(&ok) : -1;
+		if(ok && pages >= 0 && pageSize > 0) {
+			usage.rssKb = pages * qint64(pageSize) / 1024;
+		}
+	}
+#endif
+	return usage;
+}
+
+ResourceUsage ResourceUsage::currentThread()
+{
+	ResourceUsage usage;
+#ifdef Q_OS_LINUX
+	struct rusage ru;
+	if(getrusage(RUSAGE_THREAD, &ru) == 0) {
+		usage.userCpu = timevalToSecs(ru.ru_utime);
+		usage.systemCpu = timevalToSecs(ru.ru_stime);
+	}
+#endif
+	return usage;
+}
+
+LoadTest::LoadTest(const Settings &settings, QObject *parent)
+	: QObject(parent)
+	, m_settings(settings)
+{
+}
+
+bool LoadTest::loadTraffic(QString &outError)
+{
+	m_traffic.clear();
+	if(m_settings.recordingPath.isEmpty()) {
+		generateTraffic();
+		return true;
+	} else {
+		return loadRecording(outError);
+	}
+}
+
+bool LoadTest::loadRecording(QString &outError)
+{
+	QByteArray pathBytes = m_settings.recordingPath.toUtf8();
+	DP_LoadResult result;
+	DP_Player *player = DP_load_recording(pathBytes.constData(), &result);
+	if(!player) {
+		if(result == DP_LOAD_RESULT_RECORDING_INCOMPATIBLE) {
+			outError = QStringLiteral("Recording '%1' is incompatible")
+						   .arg(m_settings.recordingPath);
+		} else {
+			outError = QStringLiteral("Error loading recording '%1': %2")
+						   .arg(m_settings.recordingPath,
+								QString::fromUtf8(DP_error()));
+		}
+		return false;
+	}
+
+	// Only drawing commands get replayed. Meta messages like joins, leaves and
+	// session owner changes are the server's business and it won't accept them
+	// from a client anyway.
+	bool ok = true;
+	bool keepReading = true;
+	while(keepReading) {
+		DP_Message *msg;
+		DP_PlayerResult stepResult = DP_player_step(player, &msg);
+		switch(stepResult) {
+		case DP_PLAYER_SUCCESS: {
+			net::Message message = net::Message::noinc(msg);
+			if(message.isInCommandRange()) {
+				m_traffic.append(message);
+			}
+			break;
+		}
+		case DP_PLAYER_ERROR_PARSE:
+			qWarning("Skipping unparseable message: %s", DP_error());
+			break;
+		case DP_PLAYER_RECORDING_END:
+			keepReading = false;
+			break;
+		default:
+			outError = QStringLiteral("Error reading recording '%1': %2")
+						   .arg(m_settings.recordingPath,
+								QString::fromUtf8(DP_error()));
+			ok = false;
+			keepReading = false;
+			break;
+		}
+	}
+	DP_player_free(player);
+
+	if(ok && m_traffic.isEmpty()) {
+		outError = QStringLiteral("Recording '%1' contains no drawing commands")
+					   .arg(m_settings.recordingPath);
+		ok = false;
+	}
+	return ok;
+}
+
+void LoadTest::generateTraffic()
+{
+	// Brush strokes wandering around the canvas, which is what the bulk of
+	// traffic in a real session looks like. The layer is the one the host
+	// creates when setting up the session, the context ids get replaced by the
+	// server with the ones of the actual sender.
+	QRandomGenerator rng(m_settings.seed);
+	for(int i = 0; i < GENERATED_STROKE_COUNT; ++i) {
+		m_traffic.append(net::Message::noinc(DP_msg_undo_point_new(1)));
+		// Classic dab coordinates are in quarter pixels.
+		int x = rng.bounded(1920 * 4);
+		int y = rng.bounded(1080 * 4);
+		uint32_t color = 0xff000000u | (rng.generate() & 0xffffffu);
+		for(int j = 0; j < GENERATED_MESSAGES_PER_STROKE; ++j) {
+			m_traffic.append(net::Message::noinc(DP_msg_draw_dabs_classic_new(
+				1, 0x0101, x, y, color, DP_BLEND_MODE_NORMAL, setGeneratedDabs,
+				GENERATED_DABS_PER_MESSAGE, &rng)));
+			x = qBound(0, x + rng.bounded(-200, 201), 1920 * 4 - 1);
+			y = qBound(0, y + rng.bounded(-200, 201), 1080 * 4 - 1);
+		}
+		m_traffic.append(net::Message::noinc(DP_msg_pen_up_new(1)));
+	}
+}
+
+void LoadTest::start()
+{
+	m_clock.start();
+	makeClient(QString());
+}
+
+bool LoadTest::hasFailures() const
+{
+	if(m_runningMs < 0) {
+		return true;
+	}
+	for(const LoadClient *client : m_clients) {
+		if(client->state() == LoadClient::State::Failed ||
+		   client->messagesLost() != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+LoadClient *LoadTest::makeClient(const QString &sessionId)
+{
+	int index = m_clients.size();
+	int total = m_settings.clients + m_settings.lateJoiners;
+
+	ClientSettings clientSettings;
+	clientSettings.host = m_settings.host;
+	clientSettings.port = m_settings.port;
+	clientSettings.sessionId = sessionId;
+	clientSettings.traffic = &m_traffic;
+	// Start everyone at a different point in the traffic, otherwise they'd
+	// all be drawing the same strokes on top of each other.
+	clientSettings.trafficOffset =
+		int(qint64(m_traffic.size()) * index / qMax(1, total));
+	clientSettings.messagesPerSecond = m_settings.messagesPerSecond;
+	clientSettings.undosPerMinute = m_settings.undosPerMinute;
+	clientSettings.chatsPerMinute = m_settings.chatsPerMinute;
+
+	LoadClient *client = new LoadClient(index, clientSettings, m_clock, this);
+	connect(
+		client, &LoadClient::running, this, &LoadTest::handleClientRunning);
+	connect(client, &LoadClient::failed, this, &LoadTest::handleClientFailed);
+	m_clients.append(client);
+	client->start();
+	return client;
+}
+
+void LoadTest::handleClientRunning(LoadClient *client)
+{
+	if(!client->isHost() || !m_sessionId.isEmpty() || m_finished) {
+		return;
+	}
+
+	m_sessionId = client->sessionId();
+	m_runningMs = m_clock.elapsed();
+	qInfo(
+		"Session %s is up, starting %d more clients",
+		qUtf8Printable(m_sessionId), m_settings.clients - 1);
+	for(int i = 1; i < m_settings.clients; ++i) {
+		makeClient(m_sessionId);
+	}
+
+	// Late joiners are spread evenly over the test, so each one has to catch
+	// up on a longer history than the last.
+	qint64 durationMs = qint64(m_settings.durationSecs) * 1000;
+	int lateJoiners = m_settings.lateJoiners;
+	for(int i = 0; i < lateJoiners; ++i) {
+		QTimer::singleShot(
+			int(durationMs * (i + 1) / (lateJoiners + 1)), this,
+			&LoadTest::startLateJoiner);
+	}
+	QTimer::singleShot(int(durationMs), this, &LoadTest::finish);
+}
+
+void LoadTest::handleClientFailed(LoadClient *client)
+{
+	qWarning(
+		"Client %d failed: %s", client->index() + 1,
+		qUtf8Printable(client->error()));
+	// Without a session, there's nothing to test.
+	if(client->isHost() && m_sessionId.isEmpty()) {
+		finish();
+	}
+}
+
+void LoadTest::startLateJoiner()
+{
+	if(!m_finished) {
+		makeClient(m_sessionId)->setLateJoiner(true);
+	}
+}
+
+void LoadTest::finish()
+{
+	if(!m_finished) {
+		m_finished = true;
+		for(LoadClient *client : m_clients) {
+			client->stop();
+		}
+		emit finished();
+	}
+}
+
+void LoadTest::printReport(
+	QTextStream &out, const ResourceUsage &serverUsage) const
+{
+	double seconds = 0.0;
+	if(m_runningMs >= 0) {
+		seconds = double(m_clock.elapsed() - m_runningMs) / 1000.0;
+	}
+	out << QStringLiteral("Session %1, %2 client(s), %3 late joiner(s), "
+						  "%4 traffic messages, %5 seconds\n")
+			   .arg(m_sessionId.isEmpty() ? QStringLiteral("-") : m_sessionId)
+			   .arg(m_settings.clients)
+			   .arg(m_settings.lateJoiners)
+			   .arg(m_traffic.size())
+			   .arg(seconds, 0, 'f', 1);
+	out << "Latencies in milliseconds, from sending a message until the server "
+		   "relays it back\n\n";
+
+	out << QStringLiteral("%1 %2 %3 %4 %5 %6 %7 %8 %9 %10 %11 %12 %13 %14\n")
+			   .arg(QStringLiteral("client"), 6)
+			   .arg(QStringLiteral("role"), 5)
+			   .arg(QStringLiteral("state"), 7)
+			   .arg(QStringLiteral("sent"), 8)
+			   .arg(QStringLiteral("recvd"), 8)
+			   .arg(QStringLiteral("lost"), 5)
+			   .arg(QStringLiteral("pend"), 5)
+			   .arg(QStringLiteral("p50"), 8)
+			   .arg(QStringLiteral("p90"), 8)
+			   .arg(QStringLiteral("p99"), 8)
+			   .arg(QStringLiteral("max"), 8)
+			   .arg(QStringLiteral("catchup"), 8)
+			   .arg(QStringLiteral("kB out"), 8)
+			   .arg(QStringLiteral("kB in"), 8);
+
+	QVector<qint64> allLatencies;
+	QVector<qint64> catchupMs;
+	qint64 catchupMessages = 0;
+	qint64 totalSent = 0;
+	qint64 totalReceived = 0;
+	qint64 totalLost = 0;
+	qint64 totalBytesSent = 0;
+	qint64 totalBytesReceived = 0;
+	for(const LoadClient *client : m_clients) {
+		QVector<qint64> latencies = client->latenciesUs();
+		std::sort(latencies.begin(), latencies.end());
+		allLatencies += latencies;
+		qint64 maxLatency = latencies.isEmpty() ? -1 : latencies.last();
+
+		QString role;
+		if(client->isHost()) {
+			role = QStringLiteral("host");
+		} else if(client->isLateJoiner()) {
+			role = QStringLiteral("late");
+		} else {
+			role = QStringLiteral("join");
+		}
+		qint64 clientCatchupMs = client->catchupMs();
+		if(clientCatchupMs >= 0) {
+			catchupMs.append(clientCatchupMs);
+			catchupMessages += client->catchupMessages();
+		}
+
+		out << QStringLiteral(
+				   "%1 %2 %3 %4 %5 %6 %7 %8 %9 %10 %11 %12 %13 %14\n")
+				   .arg(client->index() + 1, 6)
+				   .arg(role, 5)
+				   .arg(stateName(client), 7)
+				   .arg(client->messagesSent(), 8)
+				   .arg(client->messagesReceived(), 8)
+				   .arg(client->messagesLost(), 5)
+				   .arg(client->messagesInFlight(), 5)
+				   .arg(formatUsAsMs(percentile(latencies, 0.5)), 8)
+				   .arg(formatUsAsMs(percentile(latencies, 0.9)), 8)
+				   .arg(formatUsAsMs(percentile(latencies, 0.99)), 8)
+				   .arg(formatUsAsMs(maxLatency), 8)
+				   .arg(
+					   clientCatchupMs < 0 ? QStringLiteral("-")
+										   : QString::number(clientCatchupMs),
+					   8)
+				   .arg(client->bytesSent() / 1024, 8)
+				   .arg(client->bytesReceived() / 1024, 8);
+
+		totalSent += client->messagesSent();
+		totalReceived += client->messagesReceived();
+		totalLost += client->messagesLost();
+		totalBytesSent += client->bytesSent();
+		totalBytesReceived += client->bytesReceived();
+	}
+
+	for(const LoadClient *client : m_clients) {
+		if(client->state() == LoadClient::State::Failed) {
+			out << QStringLiteral("Client %1: %2\n")
+					   .arg(client->index() + 1)
+					   .arg(client->error());
+		}
+	}
+
+	std::sort(allLatencies.begin(), allLatencies.end());
+	out << "\nRelay latency over " << allLatencies.size()
+		<< " messages: p50 " << formatUsAsMs(percentile(allLatencies, 0.5))
+		<< ", p90 " << formatUsAsMs(percentile(allLatencies, 0.9))
+		<< ", p99 " << formatUsAsMs(percentile(allLatencies, 0.99))
+		<< ", p99.9 " << formatUsAsMs(percentile(allLatencies, 0.999))
+		<< ", max "
+		<< formatUsAsMs(allLatencies.isEmpty() ? -1 : allLatencies.last())
+		<< "\n";
+	out << "Messages: " << totalSent << " sent, " << totalReceived
+		<< " received, " << totalLost << " lost";
+	if(seconds > 0.0) {
+		out << QStringLiteral(", %1 relayed per second")
+				   .arg(double(totalReceived) / seconds, 0, 'f', 0);
+	}
+	out << "\n";
+	out << "Traffic: " << totalBytesSent / 1024 << " kB sent, "
+		<< totalBytesReceived / 1024 << " kB received\n";
+
+	if(catchupMs.isEmpty()) {
+		out << "Catch-up: no clients joined an existing session\n";
+	} else {
+		std::sort(catchupMs.begin(), catchupMs.end());
+		out << "Catch-up over " << catchupMs.size() << " clients and "
+			<< catchupMessages << " messages: min " << catchupMs.first()
+			<< " ms, median " << percentile(catchupMs, 0.5) << " ms, max "
+			<< catchupMs.last() << " ms\n";
+	}
+
+	ResourceUsage processUsage = ResourceUsage::process();
+	if(serverUsage.userCpu >= 0.0) {
+		out << QStringLiteral("Server thread CPU: %1 s user, %2 s system\n")
+				   .arg(serverUsage.userCpu, 0, 'f', 2)
+				   .arg(serverUsage.systemCpu, 0, 'f', 2);
+	}
+	if(processUsage.userCpu >= 0.0) {
+		out << QStringLiteral("Process CPU: %1 s user, %2 s system\n")
+				   .arg(processUsage.userCpu, 0, 'f', 2)
+				   .arg(processUsage.systemCpu, 0, 'f', 2);
+	}
+	if(processUsage.rssKb >= 0 || processUsage.maxRssKb >= 0) {
+		out << "Process memory: " << processUsage.rssKb << " kB resident, "
+			<< processUsage.maxRssKb << " kB peak\n";
+	}
+}
+
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef TOOLS_LOADTEST_LOADTEST_H
+#define TOOLS_LOADTEST_LOADTEST_H
+#include "libshared/net/message.h"
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+class QTextStream;
+
+namespace loadtest {
+
+class LoadClient;
+
+struct Settings {
+	QString host;
+	quint16 port = 0;
+	// Clients that join right after the session has been hosted, including
+	// the host, and clients that trickle in while the session is going.
+	int clients = 10;
+	int lateJoiners = 0;
+	int durationSecs = 30;
+	double messagesPerSecond = 50.0;
+	double undosPerMinute = 6.0;
+	double chatsPerMinute = 2.0;
+	// Recording to take the drawing commands from, generated ones if empty.
+	QString recordingPath;
+	unsigned int seed = 1;
+};
+
+//! CPU time is in seconds, memory in kilobytes, -1 if unavailable.
+struct ResourceUsage {
+	double userCpu = -1.0;
+	double systemCpu = -1.0;
+	qint64 rssKb = -1;
+	qint64 maxRssKb = -1;
+
+	static ResourceUsage process();
+	//! Only the CPU time of the calling thread, memory is per process.
+	static ResourceUsage currentThread();
+};
+
+/**
+ * @brief Drives a bunch of simulated clients against a server
+ *
+ * The first client hosts a session, the others join it once it's up. Late
+ * joiners are spread out over the test duration, so they have to catch up on
+ * an increasingly large history. After the duration is up, all clients are
+ * stopped and finished is emitted.
+ */
+class LoadTest final : public QObject {
+	Q_OBJECT
+public:
+	explicit LoadTest(const Settings &settings, QObject *parent = nullptr);
+
+	bool loadTraffic(QString &outError);
+	int trafficSize() const { return m_traffic.size(); }
+
+	void start();
+
+	bool hasFailures() const;
+
+	//! The server usage is for an in-process server, if there is one.
+	void printReport(
+		QTextStream &out, const ResourceUsage &serverUsage) const;
+
+signals:
+	void finished();
+
+private:
+	static constexpr int GENERATED_STROKE_COUNT = 200;
+	static constexpr int GENERATED_DABS_PER_MESSAGE = 16;
+	static constexpr int GENERATED_MESSAGES_PER_STROKE = 30;
+
+	bool loadRecording(QString &outError);
+	void generateTraffic();
+
+	LoadClient *makeClient(const QString &sessionId);
+	void handleClientRunning(LoadClient *client);
+	void handleClientFailed(LoadClient *client);
+	void startLateJoiner();
+	void finish();
+
+	const Settings m_settings;
+	QElapsedTimer m_clock;
+	net::MessageList m_traffic;
+	QVector<LoadClient *> m_clients;
+	QString m_sessionId;
+	qint64 m_runningMs = -1;
+	bool m_finished = false;
+};
+
+}
+
+#endif
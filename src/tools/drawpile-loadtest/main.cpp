@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "cmake-config/config.h"
+#include "tools/drawpile-loadtest/inprocessserver.h"
+#include "tools/drawpile-loadtest/loadtest.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QTextStream>
+#include <QUrl>
+
+namespace {
+
+// User ids go from 1 to 254 and every client needs one.
+constexpr int MAX_CLIENTS = 254;
+
+bool parseInt(
+	const QCommandLineParser &parser, const QCommandLineOption &option,
+	int min, int max, int &outValue)
+{
+	bool ok;
+	int value = parser.value(option).toInt(&ok);
+	if(!ok || value < min || value > max) {
+		qCritical(
+			"Invalid %s: must be between %d and %d",
+			qUtf8Printable(option.names().last()), min, max);
+		return false;
+	}
+	outValue = value;
+	return true;
+}
+
+bool parseDouble(
+	const QCommandLineParser &parser, const QCommandLineOption &option,
+	double &outValue)
+{
+	bool ok;
+	double value = parser.value(option).toDouble(&ok);
+	if(!ok || value < 0.0) {
+		qCritical(
+			"Invalid %s: must be a non-negative number",
+			qUtf8Printable(option.names().last()));
+		return false;
+	}
+	outValue = value;
+	return true;
+}
+
+bool parseServer(const QString &input, QString &outHost, quint16 &outPort)
+{
+	QUrl url = QUrl::fromUserInput(QStringLiteral("drawpile://") + input);
+	if(!url.isValid() || url.host().isEmpty()) {
+		return false;
+	}
+	outHost = url.host();
+	outPort = quint16(url.port(cmake_config::proto::port()));
+	return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setOrganizationName("drawpile");
+	QCoreApplication::setOrganizationDomain("drawpile.net");
+	QCoreApplication::setApplicationName("drawpile-loadtest");
+	QCoreApplication::setApplicationVersion(cmake_config::version());
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Load test for the Drawpile server. Simulated clients host and join a "
+		"session and draw in it, then relay latency, catch-up times and "
+		"resource usage are reported. Without --server, a server is started "
+		"in-process on localhost.");
+	parser.addHelpOption();
+	parser.addVersionOption();
+
+	QCommandLineOption clientsOption(
+		{"c", "clients"}, "Clients joining at the start, including the host.",
+		"count", "10");
+	parser.addOption(clientsOption);
+
+	QCommandLineOption lateJoinersOption(
+		{"l", "late-joiners"},
+		"Clients joining over the course of the test, they have to catch up "
+		"on an increasingly long history.",
+		"count", "0");
+	parser.addOption(lateJoinersOption);
+
+	QCommandLineOption durationOption(
+		{"d", "duration"}, "Test duration in seconds.", "seconds", "30");
+	parser.addOption(durationOption);
+
+	QCommandLineOption rateOption(
+		{"r", "rate"}, "Drawing commands per second per client.", "rate",
+		"50");
+	parser.addOption(rateOption);
+
+	QCommandLineOption undoRateOption(
+		"undo-rate", "Undos per minute per client.", "rate", "6");
+	parser.addOption(undoRateOption);
+
+	QCommandLineOption chatRateOption(
+		"chat-rate", "Chat messages per minute per client.", "rate", "2");
+	parser.addOption(chatRateOption);
+
+	QCommandLineOption recordingOption(
+		"recording",
+		"Recording to take the drawing commands from, otherwise random "
+		"strokes are generated.",
+		"path");
+	parser.addOption(recordingOption);
+
+	QCommandLineOption seedOption(
+		"seed", "Random seed for generated strokes.", "seed", "1");
+	parser.addOption(seedOption);
+
+	QCommandLineOption serverOption(
+		{"s", "server"},
+		"Test an already running server instead of an in-process one. Must "
+		"allow guests to host and connect without TLS.",
+		"host[:port]");
+	parser.addOption(serverOption);
+
+	parser.process(app);
+
+	loadtest::Settings settings;
+	bool ok =
+		parseInt(parser, clientsOption, 1, MAX_CLIENTS, settings.clients) &&
+		parseInt(
+			parser, lateJoinersOption, 0, MAX_CLIENTS - 1,
+			settings.lateJoiners) &&
+		parseInt(
+			parser, durationOption, 1, 24 * 60 * 60, settings.durationSecs) &&
+		parseDouble(parser, rateOption, settings.messagesPerSecond) &&
+		parseDouble(parser, undoRateOption, settings.undosPerMinute) &&
+		parseDouble(parser, chatRateOption, settings.chatsPerMinute);
+	if(!ok) {
+		return 2;
+	}
+
+	if(settings.clients + settings.lateJoiners > MAX_CLIENTS) {
+		qCritical("At most %d clients can be in a session", MAX_CLIENTS);
+		return 2;
+	}
+
+	settings.recordingPath = parser.value(recordingOption);
+	settings.seed = parser.value(seedOption).toUInt(&ok);
+	if(!ok) {
+		qCritical("Invalid seed");
+		return 2;
+	}
+
+	loadtest::InProcessServer server;
+	bool inProcess = !parser.isSet(serverOption);
+	if(inProcess) {
+		QString error;
+		if(!server.start(error)) {
+			qCritical("Error starting server: %s", qUtf8Printable(error));
+			return 1;
+		}
+		settings.host = QStringLiteral("127.0.0.1");
+		settings.port = server.port();
+	} else if(!parseServer(
+				  parser.value(serverOption), settings.host, settings.port)) {
+		qCritical("Invalid server address");
+		return 2;
+	}
+
+	loadtest::LoadTest test(settings);
+	QString error;
+	if(!test.loadTraffic(error)) {
+		qCritical("%s", qUtf8Printable(error));
+		return 1;
+	}
+
+	qInfo(
+		"Testing %s:%d with %d client(s) for %d second(s)",
+		qUtf8Printable(settings.host), int(settings.port), settings.clients,
+		settings.durationSecs);
+	QObject::connect(
+		&test, &loadtest::LoadTest::finished, &app, &QCoreApplication::quit,
+		Qt::QueuedConnection);
+	test.start();
+	app.exec();
+
+	loadtest::ResourceUsage serverUsage;
+	if(inProcess) {
+		serverUsage = server.usage();
+		server.stop();
+	}
+
+	QTextStream out(stdout);
+	test.printReport(out, serverUsage);
+	out.flush();
+	return test.hasFailures() ? 1 : 0;
+}